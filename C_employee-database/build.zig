@@ -5,6 +5,55 @@ pub fn build(b: *std.Build) !void {
     const target = b.standardTargetOptions(.{});
     const optimize = b.standardOptimizeOption(.{});
 
+    // the storage engine, dbserver is a network front end over the same files
+    const engine_files = [_][]const u8{
+        "src/lib/employeedb.c",
+        "src/database/file.c",
+        "src/database/parse.c",
+        "src/database/database.c",
+        "src/database/crc32c.c",
+        "src/database/lz.c",
+        "src/database/index.c",
+        "src/database/search.c",
+        "src/database/request.c",
+        "src/database/ledger.c",
+        "src/database/strtab.c",
+    };
+
+    const engine_lib = b.addStaticLibrary(.{
+        .name = "employeedb",
+        .target = target,
+        .optimize = optimize
+    });
+
+    engine_lib.linkLibC();
+    engine_lib.root_module.addIncludePath(b.path("include"));
+    engine_lib.root_module.addIncludePath(b.path("../../../../../usr/include"));
+    engine_lib.addCSourceFiles(.{
+        .files = &engine_files,
+        .flags = &.{},
+    });
+    engine_lib.installHeader(b.path("include/employeedb.h"), "employeedb.h");
+
+    b.installArtifact(engine_lib);
+
+    const engine_shared = b.addSharedLibrary(.{
+        .name = "employeedb",
+        .target = target,
+        .optimize = optimize
+    });
+
+    engine_shared.linkLibC();
+    engine_shared.linkSystemLibrary("pthread");
+    engine_shared.root_module.addIncludePath(b.path("include"));
+    engine_shared.root_module.addIncludePath(b.path("../../../../../usr/include"));
+    engine_shared.addCSourceFiles(.{
+        .files = &engine_files,
+        .flags = &.{},
+    });
+
+    b.installArtifact(engine_shared);
+
     const server_exe = b.addExecutable(.{
         .name = "dbserver",
         .target = target,
@@ -12,6 +61,8 @@ pub fn build(b: *std.Build) !void {
     });
 
     server_exe.linkLibC();
+    server_exe.linkSystemLibrary("pthread");
+    server_exe.linkLibrary(engine_lib);
     server_exe.root_module.addIncludePath(b.path("include"));
     server_exe.root_module.addIncludePath(b.path("../../../../../usr/include"));
 
@@ -19,8 +70,14 @@ pub fn build(b: *std.Build) !void {
         .files = &.{
             "src/database/main.c",
             "src/database/db_poll.c",
-            "src/database/file.c",
-            "src/database/parse.c",
+            "src/database/feed.c",
+            "src/database/txn.c",
+            "src/database/maint.c",
+            "src/database/wheel.c",
+            "src/database/overload.c",
+            "src/database/shm.c",
+            "src/database/replication.c",
+            "src/database/capture.c",
         },
         .flags = &.{},
     });
@@ -55,6 +112,8 @@ pub fn build(b: *std.Build) !void {
     client_exe.addCSourceFiles(.{
         .files = &.{
             "src/client/client.c",
+            "src/database/request.c",
+            "src/database/lz.c",
         },
         .flags = &.{},
     });
@@ -76,4 +135,47 @@ pub fn build(b: *std.Build) !void {
 
     const client_run_step = b.step("runclient", "Run the client");
     client_run_step.dependOn(&run_client.step);
+
+    const bench_exe = b.addExecutable(.{
+        .name = "dbbench",
+        .target = target,
+        .optimize = optimize
+    });
+
+    bench_exe.linkLibC();
+    bench_exe.linkSystemLibrary("pthread");
+    bench_exe.linkLibrary(engine_lib);
+    bench_exe.root_module.addIncludePath(b.path("include"));
+    bench_exe.root_module.addIncludePath(b.path("../../../../../usr/include"));
+
+    bench_exe.addCSourceFiles(.{
+        .files = &.{
+            "src/bench/bench.c",
+            "src/database/shm.c",
+        },
+        .flags = &.{},
+    });
+
+    b.installArtifact(bench_exe);
+
+    const replay_exe = b.addExecutable(.{
+        .name = "dbreplay",
+        .target = target,
+        .optimize = optimize
+    });
+
+    replay_exe.linkLibC();
+    replay_exe.linkSystemLibrary("pthread");
+    replay_exe.root_module.addIncludePath(b.path("include"));
+    replay_exe.root_module.addIncludePath(b.path("../../../../../usr/include"));
+
+    replay_exe.addCSourceFiles(.{
+        .files = &.{
+            "src/replay/replay.c",
+            "src/database/lz.c",
+        },
+        .flags = &.{},
+    });
+
+    b.installArtifact(replay_exe);
 }
@@ -0,0 +1,51 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define CAPTURE_MAGIC 0x44425452
+#define CAPTURE_VERSION 1
+// records are gathered into blocks of this many bytes, each lz compressed on its own
+#define CAPTURE_BLOCK (64 * 1024)
+// a block that has not filled up is written this long after its first record
+#define CAPTURE_FLUSH_MS 1000
+
+// a trace file starts with this, start_us is the unix time of the first record's offset 0
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t protocol;
+    uint64_t start_us;
+} capture_file_header;
+
+// then blocks, each a db_protocol_frame and compressed_len bytes. raw they are a run of
+// these, each followed by the len bytes of the request exactly as the client sent it
+typedef struct {
+    uint64_t offset_us;
+    uint32_t conn;
+    uint32_t len;
+} capture_record;
+
+// fd is -1 when capture is off, every call is then a no-op
+struct capture_t {
+    int fd;
+    uint64_t start_us;
+    // the open block and when its first record came in
+    uint64_t opened_ms;
+    uint8_t *block;
+    size_t used;
+    uint64_t records;
+    uint64_t written;
+};
+
+int capture_open(struct capture_t *capture, char *path);
+void capture_record_frame(struct capture_t *capture, uint32_t conn, const void *frame, size_t len);
+int capture_timeout(struct capture_t *capture);
+void capture_tick(struct capture_t *capture);
+void capture_close(struct capture_t *capture);
+
+#endif
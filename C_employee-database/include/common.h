@@ -3,7 +3,7 @@
 
 #define STATUS_ERROR -1
 #define STATUS_SUCCESS 0
-#define PROTOCOL_VER 100
+#define PROTOCOL_VER 107
 
 #include <stdint.h>
 
@@ -22,31 +22,262 @@ typedef enum {
     MSG_EMPLOYEE_DEL_ID_RESP,
     MSG_EMPLOYEE_EDIT_REQ,
     MSG_EMPLOYEE_EDIT_RESP,
-    MSG_ERROR
+    MSG_ERROR,
+    MSG_REPL_SUBSCRIBE_REQ,
+    MSG_REPL_SNAPSHOT,
+    MSG_REPL_BATCH,
+    MSG_REPL_ACK,
+    MSG_REPL_PROMOTE_REQ,
+    MSG_REPL_PROMOTE_RESP,
+    MSG_STATUS_REQ,
+    MSG_STATUS_RESP,
+    MSG_EMPLOYEE_RANGE_REQ,
+    MSG_EMPLOYEE_RANGE_RESP,
+    MSG_EMPLOYEE_SEARCH_REQ,
+    MSG_EMPLOYEE_SEARCH_RESP,
+    MSG_SUBSCRIBE_REQ,
+    MSG_SUBSCRIBE_RESP,
+    MSG_CHANGE_EVENT,
+    MSG_CHANGE_RESYNC,
+    MSG_EMPLOYEE_PAGE_REQ,
+    MSG_EMPLOYEE_PAGE_RESP,
+    MSG_EMPLOYEE_EDIT_CAS_REQ,
+    MSG_EMPLOYEE_EDIT_CAS_RESP,
+    MSG_EMPLOYEE_ADD_HRS_CAS_REQ,
+    MSG_EMPLOYEE_ADD_HRS_CAS_RESP,
+    MSG_TXN_BEGIN_REQ,
+    MSG_TXN_BEGIN_RESP,
+    MSG_TXN_COMMIT_REQ,
+    MSG_TXN_COMMIT_RESP,
+    MSG_TXN_ABORT_REQ,
+    MSG_TXN_ABORT_RESP,
+    MSG_TXN_STAGED,
+    MSG_SHM_ATTACH_REQ,
+    MSG_SHM_ATTACH_RESP,
+    MSG_HOURS_SUM_REQ,
+    MSG_HOURS_SUM_RESP,
+    MSG_HOURS_TOP_REQ,
+    MSG_HOURS_TOP_RESP
 } db_protocol_type_enum;
 
+typedef enum {
+    RANGE_BY_ID,
+    RANGE_BY_HOURS
+} db_protocol_range_field_enum;
+
+typedef enum {
+    SEARCH_BY_NAME,
+    SEARCH_BY_ADDRESS
+} db_protocol_search_field_enum;
+
+// protocol 107 added exact matches, the only case sensitive ones
+typedef enum {
+    SEARCH_PREFIX,
+    SEARCH_CONTAINS,
+    SEARCH_EXACT
+} db_protocol_search_mode_enum;
+
+typedef enum {
+    CHANGE_ADD,
+    CHANGE_EDIT,
+    CHANGE_HOURS,
+    CHANGE_DELETE
+} db_protocol_change_enum;
+
+// bits of db_protocol_employee_req's fields
+typedef enum {
+    FIELD_NAME = 1,
+    FIELD_ADDRESS = 2,
+    FIELD_HOURS = 4
+} db_protocol_field_enum;
+
+typedef enum {
+    ERROR_FAILED,
+    ERROR_OVERLOADED
+} db_protocol_error_enum;
+
+// protocol 101 widened len from 16 to 32 bits
 typedef struct {
 	db_protocol_type_enum type;
-	uint16_t len;
+	uint32_t len;
 } db_protocol_header_t;
 
+// protocol 103, MSG_ERROR with a len of 1 is followed by this. the request was not
+// handled and can be sent again after retry_after_ms
+typedef struct {
+    uint32_t code;
+    uint32_t retry_after_ms;
+} db_protocol_error;
+
+// protocol 105, a client asks for features and the server replies with the ones it grants
+typedef enum {
+    FEATURE_COMPRESSION = 1
+} db_protocol_feature_enum;
+
+#define PROTOCOL_FEATURES FEATURE_COMPRESSION
+
 typedef struct {
 	uint16_t protocol;
+    uint16_t features;
 } db_protocol_hello;
 
+// with FEATURE_COMPRESSION, the records of LIST, PAGE, RANGE and SEARCH replies come as
+// frames of at most LIST_FRAME_RECORDS records, each one lz compressed on its own. a frame
+// whose compressed_len equals raw_len is stored as is
+#define LIST_FRAME_RECORDS 128
+
 typedef struct {
-	uint8_t data[1024];
-} db_protocol_data_req;
+    uint32_t raw_len;
+    uint32_t compressed_len;
+} db_protocol_frame;
 
+// protocol 104, names and addresses are length prefixed and not terminated
+#define PROTOCOL_TEXT_MAX 255
+
+// requests that name a record start with its id, so this is a prefix of each of them
 typedef struct {
 	uint32_t id;
 } db_protocol_id_req;
 
+// fields of an edit says which of name, address and hours change. adds set all of
+// them and leave id at 0
+typedef struct {
+    uint32_t id;
+    uint32_t hours;
+    uint16_t fields;
+    uint16_t name_len;
+    uint16_t address_len;
+    uint8_t name[PROTOCOL_TEXT_MAX];
+    uint8_t address[PROTOCOL_TEXT_MAX];
+} db_protocol_employee_req;
+
+typedef struct {
+    uint32_t id;
+    uint32_t hours;
+} db_protocol_hours_req;
+
+// removes every employee with exactly this name
+typedef struct {
+    uint16_t name_len;
+    uint8_t name[PROTOCOL_TEXT_MAX];
+} db_protocol_name_req;
+
+// protocol 102 added the record version
 typedef struct {
     uint32_t id;
 	uint8_t name[256];
     uint8_t address[256];
     uint32_t hours;
+    uint32_t version;
 } db_protocol_list_resp;
 
+// an edit or add hours request that only applies while the record is still at version,
+// followed by the db_protocol_employee_req or db_protocol_hours_req it makes conditional
+typedef struct {
+    uint32_t version;
+} db_protocol_cas_req;
+
+// version is the record's version after the request, or the one that did not match
+typedef struct {
+    uint32_t id;
+    uint32_t version;
+    uint16_t applied;
+} db_protocol_cas_resp;
+
+// low and high are inclusive, a limit of 0 returns every match
+typedef struct {
+    uint32_t field;
+    uint32_t low;
+    uint32_t high;
+    uint32_t limit;
+} db_protocol_range_req;
+
+// matching is case insensitive, a limit of 0 returns every match
+typedef struct {
+    uint32_t field;
+    uint32_t mode;
+    uint32_t limit;
+    uint8_t text[256];
+} db_protocol_search_req;
+
+// a seq of 0 or one from another epoch starts at the current position and asks for a resync
+typedef struct {
+    uint64_t epoch;
+    uint64_t seq;
+} db_protocol_subscribe_req;
+
+// also the payload of MSG_CHANGE_RESYNC, sent when a subscriber fell too far behind
+typedef struct {
+    uint64_t epoch;
+    uint64_t seq;
+    uint16_t resync;
+} db_protocol_subscribe_resp;
+
+// followed by a db_protocol_list_resp with the new record, except for deletes
+typedef struct {
+    uint64_t seq;
+    uint32_t change;
+    uint32_t id;
+} db_protocol_change_event;
+
+// snapshot and batch payloads are followed by compressed_len bytes of lz data
+typedef struct {
+    uint64_t seq;
+    uint64_t timestamp;
+    uint32_t count;
+    uint32_t id;
+    uint32_t raw_len;
+    uint32_t compressed_len;
+} db_protocol_repl_data;
+
+typedef struct {
+    uint64_t seq;
+} db_protocol_repl_ack;
+
+typedef struct {
+    uint16_t role;
+    uint16_t replicas;
+    uint64_t seq;
+    uint64_t lag_ms;
+    uint64_t replica_lag;
+    uint64_t list_hits;
+    uint64_t list_misses;
+    uint64_t loop_lag_us;
+    uint64_t shed;
+} db_protocol_status_resp;
+
+// a page of the same listing LIST returns, offset counts employees
+typedef struct {
+    uint32_t offset;
+    uint32_t limit;
+} db_protocol_page_req;
+
+// sent over a unix socket with the fd of the shared memory channel attached. requests and
+// replies go through its rings from then on, the socket only wakes a sleeping server
+typedef struct {
+    uint32_t size;
+} db_protocol_shm_resp;
+
+// protocol 106, hours logged in [from, to) in unix seconds. a SUM needs an id, a TOP with a
+// limit of 0 returns every employee with hours in the period
+typedef struct {
+    uint64_t from;
+    uint64_t to;
+    uint32_t id;
+    uint32_t limit;
+} db_protocol_hours_query_req;
+
+// SUM replies with a len of 1 and one of these, TOP with len of them, most hours first
+typedef struct {
+    uint64_t hours;
+    uint32_t id;
+} db_protocol_hours_total;
+
+// failed is the 1 based position of the request that made the commit roll back
+typedef struct {
+    uint32_t count;
+    uint32_t failed;
+    uint16_t committed;
+} db_protocol_txn_resp;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// crc32c (castagnoli), uses sse4.2 crc32 instructions when the cpu has them
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif
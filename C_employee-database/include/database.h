@@ -0,0 +1,119 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "index.h"
+#include "search.h"
+#include "ledger.h"
+#include "strtab.h"
+#include "common.h"
+
+#define SHARD_MANIFEST "shards.conf"
+#define SHARD_FILE_FORMAT "%s/shard-%03d.db"
+#define MAX_SHARDS 1024
+// uncompressed wire images of all shards together stay below this, shards beyond it are
+// serialized frame by frame on every listing
+#define WIRE_CACHE_BUDGET (64 * 1024 * 1024)
+
+typedef enum {
+    SHARD_SINGLE,
+    SHARD_BY_RANGE,
+    SHARD_BY_HASH
+} ShardMode_enum;
+
+struct shard_t {
+    char path[PATH_MAX];
+    struct dbheader_t *header;
+    struct employee_t *employees;
+    struct strtab_t strings;
+    struct hours_entry_t *hours;
+    uint64_t hours_capacity;
+    db_protocol_list_resp *wire;
+    uint8_t *packed;
+    size_t packed_len;
+    bool dirty;
+    bool indexed;
+    bool wire_cached;
+    bool packed_cached;
+};
+
+// a database is one file, or a directory of shard files partitioned by id
+struct database_t {
+    ShardMode_enum mode;
+    char *directory;
+    unsigned int range;
+    uint64_t next_id;
+    int count;
+    struct shard_t *shards;
+    struct search_index_t *search;
+
+    // every add hours with the time it was applied, for totals over a period
+    struct ledger_t *ledger;
+
+    // LIST requests served from the cached images, or that had to build or go without one
+    uint64_t list_hits;
+    uint64_t list_misses;
+
+    // optional, told about every record a write adds, changes or removes, in its wire form
+    void (*on_change)(void *context, db_protocol_change_enum change, db_protocol_list_resp *record);
+    void *change_context;
+};
+
+// a shard as it was before a transaction touched it
+struct shard_undo_t {
+    bool saved;
+    bool dirty;
+    struct dbheader_t header;
+    struct employee_t *employees;
+};
+
+// restores the shards a failed transaction changed, and drops the ones it created
+struct database_undo_t {
+    uint64_t next_id;
+    int count;
+    struct shard_undo_t *shards;
+    uint64_t ledger_mark;
+};
+
+int database_init(struct database_t *db, char *filepath, char *directory, char *spec, bool create);
+int database_load(struct database_t *db);
+int database_verify(struct database_t *db);
+void database_close(struct database_t *db);
+
+struct shard_t *database_route(struct database_t *db, unsigned int id, bool create);
+struct employee_t *database_find(struct database_t *db, unsigned int id);
+const char *database_name(struct database_t *db, struct employee_t *employee);
+const char *database_address(struct database_t *db, struct employee_t *employee);
+void database_wire_record(struct database_t *db, struct employee_t *employee, db_protocol_list_resp *record);
+uint64_t database_count(struct database_t *db);
+int database_persist(struct database_t *db);
+int database_replace(struct database_t *db, db_protocol_list_resp *records, uint64_t count, uint64_t next_id);
+void database_list(struct database_t *db);
+void database_wire_records(struct database_t *db, int shard, uint64_t first, uint64_t count, db_protocol_list_resp *records);
+db_protocol_list_resp *database_wire_image(struct database_t *db, int shard);
+uint8_t *database_packed_image(struct database_t *db, int shard, size_t *lenOut);
+int database_range(struct database_t *db, db_protocol_range_field_enum field, unsigned int low, unsigned int high, uint64_t limit, struct employee_t ***resultsOut, uint64_t *countOut);
+
+int database_hours(struct database_t *db, unsigned int id, uint64_t from, uint64_t to, uint64_t *hoursOut);
+int database_hours_top(struct database_t *db, uint64_t from, uint64_t to, uint32_t limit, struct ledger_sum_t **topOut, uint64_t *countOut);
+
+int database_search(struct database_t *db, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text, uint64_t limit, struct employee_t ***resultsOut, uint64_t *countOut);
+
+int database_undo_begin(struct database_t *db, struct database_undo_t *undo);
+int database_undo_save(struct database_t *db, struct database_undo_t *undo, int index);
+void database_undo_restore(struct database_t *db, struct database_undo_t *undo);
+void database_undo_free(struct database_undo_t *undo);
+
+int database_add(struct database_t *db, struct employee_fields_t *fields);
+int database_add_hours(struct database_t *db, unsigned int id, unsigned int hours);
+int database_edit(struct database_t *db, struct employee_fields_t *fields);
+int database_remove_name(struct database_t *db, char *name);
+int database_remove_id(struct database_t *db, unsigned int id);
+bool database_expired(struct employee_t *employee, unsigned int cutoff);
+int database_expire(struct database_t *db, int index, unsigned int cutoff, unsigned int **idsOut, uint64_t *countOut);
+
+#endif
@@ -1,30 +1,119 @@
 #ifndef DB_POLL_H
 #define DB_POLL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "parse.h"
 #include "common.h"
+#include "database.h"
+#include "wheel.h"
+#include "shm.h"
 
 #define BACKLOG 10
 #define MAX_CLIENTS 256
 #define BUFFER_SIZE 4096
 
+// requests handled per connection and loop iteration, the rest wait their turn
+#define FAIR_FRAMES 8
+// a new connection has this long to send its hello
+#define HANDSHAKE_TIMEOUT_MS 5000
+// a request that started arriving has to be complete within this
+#define REQUEST_TIMEOUT_MS 10000
+// an attached client that has not taken any reply for this long is checked for having gone
+#define SHM_STALL_MS 100
+// and one that is still there but has not taken any reply for this long is closed
+#define SHM_REPLY_TIMEOUT_MS 1000
+// connections without requests for this long are closed, subscribers and replicas excepted
+#define IDLE_TIMEOUT_MS 300000
+// a reply that has been queued for a client without any of it being taken for this long closes it
+#define SEND_TIMEOUT_MS 10000
+
+typedef enum {
+    TIMER_HANDSHAKE,
+    TIMER_REQUEST,
+    TIMER_IDLE,
+    TIMER_SEND
+} Timer_enum;
+
 typedef enum {
     STATE_NEW,
 	STATE_CONNECTED,
 	STATE_DISCONNECTED,
 	STATE_HELLO,
-	STATE_MSG
+	STATE_MSG,
+	STATE_REPLICA,
+	STATE_SUBSCRIBER
 } State_enum;
 
 typedef struct {
     int fd;
+    // numbered from 1 in accept order, names the connection in a capture
+    uint32_t conn_id;
     State_enum state;
     char buffer[BUFFER_SIZE];
+
+    // replicas, the last acknowledged sequence and the bytes of out still holding the snapshot
+    uint64_t repl_seq;
+    size_t repl_snapshot_len;
+
+    // bytes read but not yet handled, requests are copied to buffer one at a time
+    uint8_t in[BUFFER_SIZE];
+    size_t in_len;
+    struct wheel_timer_t timer;
+    Timer_enum timer_kind;
+
+    // connected over the unix socket, and the shared memory channel once attached with
+    // the server's ends of its request and reply rings
+    bool local;
+    void *shm;
+    struct shm_end_t shm_in;
+    struct shm_end_t shm_out;
+
+    // granted in the handshake
+    uint16_t features;
+
+    // replies, change feed events and replication messages, bytes from out_sent to out_len are not yet taken by the socket
+    uint64_t feed_seq;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+
+    // requests staged since MSG_TXN_BEGIN_REQ, NULL outside a transaction
+    uint8_t *txn;
+    size_t txn_len;
+    size_t txn_cap;
+    uint32_t txn_count;
 } ClientState_t;
 
+struct replication_t;
+struct feed_t;
+struct overload_t;
+
 void init_clients(ClientState_t *ClientStates);
 int find_free_slot(ClientState_t *ClientStates);
 int find_slot_by_fd(int fd, ClientState_t *ClientStates);
-int handle_client_fsm(struct dbheader_t *header, struct employee_t **employees, ClientState_t *client, char *filepath);
+int client_queue(ClientState_t *client, const void *data, size_t size);
+ssize_t client_flush(ClientState_t *client);
+void client_write(ClientState_t *client, const void *data, size_t size);
+void client_writev(ClientState_t *client, const struct iovec *iov, int iovcnt);
+bool client_blocked(ClientState_t *client);
+void client_shm_detach(ClientState_t *client);
+void client_shm_fill(ClientState_t *client);
+size_t request_payload_size(db_protocol_type_enum type);
+size_t client_frame_size(ClientState_t *client);
+size_t client_queued_frames(ClientState_t *client);
+void client_rearm(struct wheel_t *wheel, ClientState_t *client);
+bool is_write_request(db_protocol_type_enum type);
+bool is_cas_request(db_protocol_type_enum type);
+struct employee_t *cas_target(struct database_t *db, db_protocol_header_t *header);
+void cas_plain_request(db_protocol_header_t *header, db_protocol_header_t *plain);
+int apply_write_request(struct database_t *db, db_protocol_header_t *header);
+void fsm_reply_overloaded(ClientState_t *client, db_protocol_header_t *header, uint32_t retry_after_ms);
+int handle_client_fsm(struct database_t *db, ClientState_t *client, struct replication_t *repl, struct feed_t *feed, struct overload_t *overload);
 
 #endif
\ No newline at end of file
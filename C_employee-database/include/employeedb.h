@@ -0,0 +1,52 @@
+#ifndef EMPLOYEEDB_H
+#define EMPLOYEEDB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the storage engine of dbserver, in process. calls return 0 on success and -1 on
+// failure, like STATUS_SUCCESS and STATUS_ERROR, and may be made from any thread
+
+// which fields employeedb_edit changes
+#define EMPLOYEEDB_NAME 1
+#define EMPLOYEEDB_ADDRESS 2
+#define EMPLOYEEDB_HOURS 4
+
+struct employeedb_t;
+
+// a copy, it stays valid after the call that filled it
+struct employeedb_record_t {
+    unsigned int id;
+    char name[256];
+    char address[256];
+    unsigned int hours;
+    unsigned int version;
+    unsigned int updated;
+};
+
+// return non zero to stop the scan. record is only valid during the call, which runs
+// under the database lock and must not call back into the same database
+typedef int (*employeedb_scan_fn)(void *context, const struct employeedb_record_t *record);
+
+// a single file, or with directory a sharded database as dbserver -d opens it. spec is
+// only used when creating shards
+int employeedb_open(const char *filepath, const char *directory, const char *spec, bool create, struct employeedb_t **dbOut);
+// writes what is still unsaved first
+int employeedb_close(struct employeedb_t *db);
+// writes are kept in memory until this or close
+int employeedb_sync(struct employeedb_t *db);
+
+uint64_t employeedb_count(struct employeedb_t *db);
+int employeedb_get(struct employeedb_t *db, unsigned int id, struct employeedb_record_t *recordOut);
+int employeedb_scan(struct employeedb_t *db, employeedb_scan_fn callback, void *context);
+
+int employeedb_add(struct employeedb_t *db, const char *name, const char *address, unsigned int hours, unsigned int *idOut);
+int employeedb_edit(struct employeedb_t *db, unsigned int id, unsigned int fields, const char *name, const char *address, unsigned int hours);
+int employeedb_add_hours(struct employeedb_t *db, unsigned int id, unsigned int hours);
+int employeedb_delete(struct employeedb_t *db, unsigned int id);
+
+// hours added to id between two unix times, from inclusive and to exclusive
+int employeedb_hours(struct employeedb_t *db, unsigned int id, uint64_t from, uint64_t to, uint64_t *hoursOut);
+
+#endif
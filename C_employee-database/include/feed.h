@@ -0,0 +1,40 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "db_poll.h"
+#include "parse.h"
+
+// changes kept for subscribers that resume or fall behind
+#define FEED_HISTORY 8192
+// bytes buffered per subscriber before it stops pulling from the history
+#define FEED_CLIENT_BUFFER 65536
+#define FEED_EVENT_MAX (sizeof(db_protocol_header_t) + sizeof(db_protocol_change_event) + sizeof(db_protocol_list_resp))
+
+// the record is kept as it goes on the wire
+struct feed_event_t {
+    uint64_t seq;
+    db_protocol_change_enum change;
+    db_protocol_list_resp record;
+};
+
+// sequence numbers restart with the server, the epoch tells subscribers when that happened
+struct feed_t {
+    uint64_t epoch;
+    uint64_t seq;
+    uint64_t reset_seq;
+    struct feed_event_t *events;
+    ClientState_t *clients;
+};
+
+int feed_init(struct feed_t *feed, ClientState_t *clients);
+void feed_close(struct feed_t *feed);
+void feed_record(void *context, db_protocol_change_enum change, db_protocol_list_resp *record);
+int feed_subscribe(struct feed_t *feed, ClientState_t *client, db_protocol_header_t *header);
+void feed_flush(struct feed_t *feed);
+void feed_drop_client(ClientState_t *client);
+
+#endif
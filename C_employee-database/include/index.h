@@ -0,0 +1,23 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+
+#include "parse.h"
+
+// records are kept sorted by id, the hours index orders them by hours then id
+struct hours_entry_t {
+    unsigned int hours;
+    unsigned int position;
+};
+
+uint64_t lower_bound_id(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int id);
+struct employee_t *find_employee(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int id);
+int build_hours_index(struct dbheader_t *dbHeader, struct employee_t *employees, struct hours_entry_t **indexOut, uint64_t *capacityOut);
+uint64_t lower_bound_hours(struct hours_entry_t *index, uint64_t count, unsigned int hours);
+int hours_index_insert(struct hours_entry_t **index, uint64_t count, uint64_t *capacity, unsigned int hours, unsigned int position);
+void hours_index_move(struct hours_entry_t *index, uint64_t count, unsigned int oldHours, unsigned int hours, unsigned int position);
+void hours_index_remove(struct hours_entry_t *index, uint64_t count, unsigned int hours, unsigned int position);
+void hours_index_remap(struct hours_entry_t *index, uint64_t count, const unsigned int *remap);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LEDGER_MAGIC 0x6C656467
+#define LEDGER_DELTA_MAGIC 0x6C656464
+#define LEDGER_SUFFIX ".ledger"
+#define LEDGER_SHARDED_FILE "%s/hours.ledger"
+#define LEDGER_BLOCK_ENTRIES 1024
+#define LEDGER_DAY 86400
+
+// one add hours, at a unix time in seconds
+struct ledger_entry_t {
+    uint32_t time;
+    uint32_t id;
+    uint32_t hours;
+};
+
+// the file is a sequence of blocks, each this header and then three columns of varints:
+// time deltas from first, zigzag id deltas and hours. a block never spans two days.
+// sealed blocks carry LEDGER_MAGIC. each flush appends the entries it added to the open
+// block as a delta block, and the sealed block that closes it replaces all its deltas
+struct ledger_block_header_t {
+    uint32_t magic;
+    uint32_t day;
+    uint32_t count;
+    uint32_t first;
+    uint32_t size;
+    uint32_t crc;
+    uint64_t hours;
+};
+
+// where each sealed block is, to scan the raw entries of a day
+struct ledger_block_t {
+    uint64_t offset;
+    uint32_t day;
+    uint32_t count;
+};
+
+struct ledger_sum_t {
+    uint32_t id;
+    uint64_t hours;
+};
+
+// hours per employee over one day, or one week starting on monday, sorted by id
+struct ledger_rollup_t {
+    uint32_t period;
+    uint32_t count;
+    uint32_t capacity;
+    struct ledger_sum_t *sums;
+};
+
+struct ledger_t {
+    int fd;
+    uint32_t first;
+    uint32_t last;
+
+    struct ledger_block_t *blocks;
+    uint64_t block_count;
+    uint64_t block_capacity;
+
+    // rebuilt from the blocks on open, queries never scan whole days of entries
+    struct ledger_rollup_t *days;
+    uint32_t day_count;
+    uint32_t day_capacity;
+    struct ledger_rollup_t *weeks;
+    uint32_t week_count;
+    uint32_t week_capacity;
+
+    // the open block, of which the first tail_written entries are on disk as deltas.
+    // the file is only ever appended to at end
+    struct ledger_entry_t tail[LEDGER_BLOCK_ENTRIES];
+    uint32_t tail_count;
+    uint32_t tail_written;
+    uint64_t end;
+
+    // appended since the last flush, dropped when a transaction rolls back
+    struct ledger_entry_t *pending;
+    uint64_t pending_count;
+    uint64_t pending_capacity;
+};
+
+int ledger_open(struct ledger_t *ledger, const char *path);
+void ledger_close(struct ledger_t *ledger);
+int ledger_append(struct ledger_t *ledger, uint32_t time, uint32_t id, uint32_t hours);
+uint64_t ledger_mark(struct ledger_t *ledger);
+void ledger_rewind(struct ledger_t *ledger, uint64_t mark);
+int ledger_flush(struct ledger_t *ledger);
+
+int ledger_sum(struct ledger_t *ledger, uint32_t id, uint64_t from, uint64_t to, uint64_t *hoursOut);
+int ledger_top(struct ledger_t *ledger, uint64_t from, uint64_t to, uint32_t limit, struct ledger_sum_t **topOut, uint64_t *countOut);
+
+#endif
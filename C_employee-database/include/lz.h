@@ -0,0 +1,18 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// byte oriented lz77 in the style of lz4 blocks, favours speed over ratio
+size_t lz_compress_bound(size_t len);
+int lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap);
+int lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t cap);
+
+size_t lz_frames_bound(size_t len, size_t frame);
+int lz_compress_frames(const uint8_t *in, size_t len, size_t frame, uint8_t *out, size_t cap);
+int lz_decompress_frame(db_protocol_frame *frame, const uint8_t *in, uint8_t *out, size_t cap);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MAINT_H
+#define MAINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "database.h"
+
+// the expiry scan runs in slices on the event loop, each at most this long
+#define MAINT_SLICE_US 1000
+// pause between the slices of a pass, requests are served in between
+#define MAINT_SLICE_INTERVAL_MS 10
+// longest pause between passes, shorter when records expire sooner
+#define MAINT_PASS_INTERVAL_MS 60000
+// records scanned between clock checks
+#define MAINT_CLOCK_RECORDS 256
+
+struct replication_t;
+
+// the scan position is kept by id, so writes between slices do not invalidate it
+struct maint_t {
+    unsigned int expire_after;
+    unsigned int cutoff;
+    uint64_t next_ms;
+    bool scanning;
+    int shard;
+    unsigned int next_id;
+    uint64_t candidates;
+    uint64_t expired;
+};
+
+void maint_init(struct maint_t *maint, unsigned int expire_after);
+int maint_timeout(struct maint_t *maint);
+void maint_tick(struct maint_t *maint, struct database_t *db, struct replication_t *repl);
+
+#endif
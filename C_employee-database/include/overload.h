@@ -0,0 +1,44 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "db_poll.h"
+
+// loop lag above which requests without priority are rejected while others queue,
+// at twice this every request that can be retried is
+#define OVERLOAD_TARGET_MS 20
+// bounds of the retry-after hint sent with a rejection
+#define OVERLOAD_RETRY_MIN_MS 10
+#define OVERLOAD_RETRY_MAX_MS 5000
+
+typedef enum {
+    PRIORITY_NONE,
+    PRIORITY_READS,
+    PRIORITY_WRITES
+} Priority_enum;
+
+// lag is how long a loop iteration takes, the wait of a request that arrives as it starts.
+// queued is the number of complete requests still in client buffers
+struct overload_t {
+    uint64_t target_us;
+    Priority_enum priority;
+    uint64_t loop_start_us;
+    uint64_t request_start_us;
+    uint64_t lag_us;
+    uint64_t service_us;
+    uint64_t queued;
+    uint64_t admitted;
+    uint64_t shed;
+};
+
+int overload_init(struct overload_t *overload, char *spec);
+void overload_loop_start(struct overload_t *overload);
+void overload_loop_end(struct overload_t *overload);
+bool overload_admit(struct overload_t *overload, ClientState_t *client, db_protocol_type_enum type);
+void overload_served(struct overload_t *overload);
+uint32_t overload_retry_after(struct overload_t *overload);
+
+#endif
@@ -1,10 +1,43 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdint.h>
+
+#include "request.h"
+#include "strtab.h"
+
 #define HEADER_MAGIC 0x616C6973
-#define HEADER_VERSION 1
+#define HEADER_VERSION 6
+#define HEADER_VERSION_V1 1
+#define HEADER_VERSION_V2 2
+#define HEADER_VERSION_V3 3
+#define HEADER_VERSION_V4 4
+#define HEADER_VERSION_V5 5
+#define HEADER_VERSION_V6 6
+
+// longest name or address, with its terminator
+#define EMPLOYEE_TEXT_MAX 256
+
+// version 2 and later end with a crc32c per block of records and one for the header
+#define CHECKSUM_BLOCK_RECORDS 64
+// records are written and verified through buffers of this many blocks
+#define STREAM_CHUNK_BLOCKS 16
+
+// startup load splits the records into chunks of at least this many per thread
+#define LOAD_MIN_RECORDS 4096
+#define LOAD_MAX_THREADS 64
 
 struct dbheader_t {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short reserved;
+    uint64_t count;
+    uint64_t id;
+    uint64_t filesize;
+};
+
+// header layout of versions 1 and 2, upgraded on open
+struct dbheader_v1_t {
     unsigned int magic;
     unsigned short version;
     unsigned short count;
@@ -12,22 +45,65 @@ struct dbheader_t {
     unsigned int filesize;
 };
 
+// name and address refer to the shard's string table. version counts the changes to a record,
+// starting at 1 when it is added. updated is when it was added or last changed, in seconds since the epoch
 struct employee_t {
+    unsigned int id;
+    uint32_t name;
+    uint32_t address;
+    unsigned int hours;
+    unsigned int version;
+    unsigned int updated;
+};
+
+// version 6 files end with the text the records refer to: this header, the names arena,
+// the offset of each address and the address text. crc covers the rest of this header and the text
+struct dbstrings_t {
+    uint32_t names_len;
+    uint32_t address_count;
+    uint32_t address_len;
+    uint32_t crc;
+};
+
+// record layout of version 5, upgraded on open
+struct employee_v5_t {
+    unsigned int id;
+    char name[256];
+    char address[256];
+    unsigned int hours;
+    unsigned int version;
+    unsigned int updated;
+};
+
+// record layout of version 4, upgraded on open
+struct employee_v4_t {
+    unsigned int id;
+    char name[256];
+    char address[256];
+    unsigned int hours;
+    unsigned int version;
+};
+
+// record layout of versions 1 to 3, upgraded on open
+struct employee_v3_t {
     unsigned int id;
     char name[256];
     char address[256];
     unsigned int hours;
 };
 
-void output_file(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, char *filename);
-void list_employees(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList);
-int create_db_header(int fileDescriptor, struct dbheader_t **headerOut);
+void output_file(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, struct strtab_t *strings, char *filename);
+void list_employees(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, struct strtab_t *strings);
+int create_db_header(struct dbheader_t **headerOut);
 int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut);
-int read_employees(int fileDescriptor, struct dbheader_t *dbHeader, struct employee_t **employeesOut);
-int add_employee(struct dbheader_t *dbHeader, struct employee_t **employeesOut, char *addstring);
-int remove_employee(struct dbheader_t *dbHeader, struct employee_t **employees, char *removeString);
+int verify_db_file(int fileDescriptor, struct dbheader_t *dbHeader);
+uint64_t db_file_size(uint64_t count);
+int read_employees(int fileDescriptor, struct dbheader_t *dbHeader, struct employee_t **employeesOut, struct strtab_t *stringsOut);
+int add_employee(struct dbheader_t *dbHeader, struct employee_t **employeesOut, struct strtab_t *strings, struct employee_fields_t *fields);
+int remove_employee(struct dbheader_t *dbHeader, struct employee_t **employees, struct strtab_t *strings, char *removeString);
 int remove_employee_id(struct dbheader_t *dbHeader, struct employee_t **employees, unsigned int id);
-int add_hours(struct dbheader_t *dbHeader, struct employee_t *employees, char *addString);
-int edit_employee(struct dbheader_t *dbHeader, struct employee_t *employees, char *editstring);
+int add_hours(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int id, unsigned int hours);
+int edit_employee(struct dbheader_t *dbHeader, struct employee_t *employees, struct strtab_t *strings, struct employee_fields_t *fields);
+int compact_strings(struct employee_t *employees, uint64_t count, struct strtab_t *strings);
 
 #endif
\ No newline at end of file
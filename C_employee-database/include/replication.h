@@ -0,0 +1,58 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "db_poll.h"
+#include "parse.h"
+#include "database.h"
+
+#define REPL_RETRY_MS 1000
+// batches queued for a replica that stopped reading, past this it is dropped and resyncs from a snapshot
+#define REPL_CLIENT_BUFFER (16 * 1024 * 1024)
+
+typedef enum {
+    ROLE_PRIMARY,
+    ROLE_REPLICA
+} Role_enum;
+
+struct replication_t {
+    Role_enum role;
+    uint64_t seq;
+    int64_t lag_ms;
+
+    // replica side, connection to the primary
+    char *primary_host;
+    unsigned short primary_port;
+    int primary_fd;
+    uint64_t last_attempt;
+    // the connect has not finished, and the hello reply was not read yet
+    bool connecting;
+    bool handshaken;
+    // bytes of the primary's stream not yet framed into messages
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+
+    // primary side, applied requests waiting for the end of the loop iteration
+    ClientState_t *clients;
+    uint8_t *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    uint32_t pending_count;
+};
+
+int replication_init(struct replication_t *repl, ClientState_t *clients, char *primary);
+void replication_promote(struct replication_t *repl);
+int replication_connect(struct replication_t *repl);
+int replication_timeout(struct replication_t *repl);
+void replication_queue(struct replication_t *repl, db_protocol_header_t *request);
+void replication_flush(struct replication_t *repl);
+int replication_send_snapshot(struct replication_t *repl, ClientState_t *client, struct database_t *db);
+int replication_receive(struct replication_t *repl, struct database_t *db);
+void replication_status(struct replication_t *repl, db_protocol_status_resp *status);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+#define FIELD_ALL (FIELD_NAME | FIELD_ADDRESS | FIELD_HOURS)
+
+// an add or edit. name and address point into the text or request they came from
+// and are not terminated
+struct employee_fields_t {
+    unsigned int id;
+    unsigned int fields;
+    const char *name;
+    size_t name_len;
+    const char *address;
+    size_t address_len;
+    unsigned int hours;
+};
+
+int request_parse_employee(const char *text, bool edit, struct employee_fields_t *fieldsOut);
+int request_parse_hours(const char *text, unsigned int *idOut, unsigned int *hoursOut);
+int request_encode_employee(struct employee_fields_t *fields, db_protocol_employee_req *request);
+int request_decode_employee(db_protocol_employee_req *request, struct employee_fields_t *fieldsOut);
+int request_encode_name(const char *name, db_protocol_name_req *request);
+
+#endif
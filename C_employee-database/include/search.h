@@ -0,0 +1,39 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "strtab.h"
+#include "common.h"
+
+// trigrams are case folded and strings start with a boundary byte, so prefixes get their own trigrams
+#define SEARCH_BOUNDARY 0x01
+#define SEARCH_MIN_BUCKETS 4096
+
+// ids holding a trigram, kept sorted for intersection
+struct posting_t {
+    uint32_t key;
+    uint32_t count;
+    uint32_t capacity;
+    unsigned int *ids;
+};
+
+// open addressing table from field and trigram to posting list
+struct search_index_t {
+    struct posting_t *buckets;
+    uint64_t size;
+    uint64_t used;
+};
+
+int search_index_build(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employees, uint64_t count);
+int search_index_add(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employee);
+void search_index_remove(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employee);
+void search_index_sort(struct search_index_t *index);
+void search_index_free(struct search_index_t *index);
+bool search_indexable(db_protocol_search_mode_enum mode, char *text);
+int search_candidates(struct search_index_t *index, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text, unsigned int **idsOut, uint64_t *countOut);
+bool search_match(struct employee_t *employee, struct strtab_t *strings, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text);
+
+#endif
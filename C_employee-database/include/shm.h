@@ -0,0 +1,60 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+// requests are small, replies can be whole listings streamed through
+#define SHM_REQUEST_RING (64 * 1024)
+#define SHM_REPLY_RING (1024 * 1024)
+// how long a waiting side spins before it sleeps, when there is another cpu to wait for
+#define SHM_SPIN_US 50
+
+// a single producer, single consumer byte ring in memory shared by two processes.
+// head and tail count bytes and wrap around, each on its own cache line
+struct shm_ring_t {
+    _Atomic uint32_t head;
+    uint8_t pad0[60];
+    _Atomic uint32_t tail;
+    uint8_t pad1[60];
+    // set by a side sleeping on the futex, head for the consumer and tail for the producer
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint32_t producer_waiting;
+    uint8_t pad2[56];
+    uint8_t data[];
+};
+
+// one side's view of a ring. the size and the index this side moves are kept in its own
+// memory, only the other side's index is read from the mapping, which that side can write
+struct shm_end_t {
+    struct shm_ring_t *ring;
+    uint32_t size;
+    uint32_t index;
+    bool producer;
+};
+
+unsigned int shm_spin_us(void);
+size_t shm_channel_size(void);
+void *shm_create(int *fdOut);
+void *shm_map(int fd, size_t size);
+void shm_unmap(void *channel);
+struct shm_ring_t *shm_requests(void *channel);
+struct shm_ring_t *shm_replies(void *channel);
+
+void shm_end_init(struct shm_end_t *end, struct shm_ring_t *ring, uint32_t size, bool producer);
+size_t shm_ring_used(struct shm_end_t *end);
+ssize_t shm_ring_put(struct shm_end_t *end, const void *data, size_t size);
+ssize_t shm_ring_take(struct shm_end_t *end, void *out, size_t size);
+void shm_ring_notify(struct shm_end_t *end);
+int shm_ring_wait(struct shm_end_t *end, int timeout_ms);
+bool shm_ring_park(struct shm_end_t *end);
+void shm_ring_unpark(struct shm_end_t *end);
+bool shm_ring_consumer_parked(struct shm_end_t *end);
+
+int shm_send_fd(int socket, void *data, size_t size, int fd);
+int shm_recv_fd(int socket, void *data, size_t size, int *fdOut);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef STRTAB_H
+#define STRTAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STRTAB_MIN_SLOTS 64
+// text is compacted once it is this much larger than twice what was live at the last compaction
+#define STRTAB_COMPACT_MIN (1 << 20)
+
+// the text of one shard's records. names are copied into an arena and referenced by offset,
+// addresses are interned and referenced by their index in the dictionary. both are only
+// appended to until compacted, reference 0 is the empty string in either
+struct strtab_t {
+    char *names;
+    uint32_t names_len;
+    uint32_t names_cap;
+
+    // offset of each address in the address text, and a table of index + 1 for interning
+    uint32_t *addresses;
+    uint32_t address_count;
+    uint32_t address_cap;
+    char *address_text;
+    uint32_t address_len;
+    uint32_t address_text_cap;
+    uint32_t *slots;
+    uint32_t slot_count;
+
+    // bytes of text right after the last load or compaction
+    uint64_t live;
+};
+
+int strtab_init(struct strtab_t *strings);
+int strtab_load(struct strtab_t *strings, char *names, uint32_t namesLen, uint32_t *addresses, uint32_t addressCount, char *addressText, uint32_t addressLen);
+void strtab_free(struct strtab_t *strings);
+uint64_t strtab_size(struct strtab_t *strings);
+bool strtab_wasteful(struct strtab_t *strings);
+
+int strtab_add_name(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut);
+int strtab_intern_address(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut);
+bool strtab_find_address(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut);
+bool strtab_valid_name(struct strtab_t *strings, uint32_t ref);
+const char *strtab_name(struct strtab_t *strings, uint32_t ref);
+const char *strtab_address(struct strtab_t *strings, uint32_t ref);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef TXN_H
+#define TXN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "db_poll.h"
+#include "database.h"
+
+// requests one transaction may stage before it has to commit
+#define TXN_MAX_REQUESTS 1024
+
+struct replication_t;
+
+int txn_begin(ClientState_t *client);
+int txn_stage(ClientState_t *client, db_protocol_header_t *header);
+int txn_commit(struct database_t *db, struct replication_t *repl, ClientState_t *client, db_protocol_txn_resp *result);
+void txn_drop_client(ClientState_t *client);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+// hashed timing wheel, a timer lands in the slot of its tick and waits out the earlier rounds there
+#define WHEEL_TICK_MS 100
+#define WHEEL_SLOTS 1024
+
+struct wheel_timer_t {
+    uint64_t expires;
+    struct wheel_timer_t *next;
+    struct wheel_timer_t *prev;
+    int scheduled;
+};
+
+struct wheel_t {
+    struct wheel_timer_t *slots[WHEEL_SLOTS];
+    uint64_t tick;
+    uint64_t active;
+};
+
+uint64_t wheel_now_ms(void);
+void wheel_init(struct wheel_t *wheel);
+void wheel_schedule(struct wheel_t *wheel, struct wheel_timer_t *timer, uint64_t expires);
+void wheel_cancel(struct wheel_t *wheel, struct wheel_timer_t *timer);
+int wheel_timeout(struct wheel_t *wheel);
+void wheel_advance(struct wheel_t *wheel, void (*fire)(struct wheel_timer_t *timer, void *context), void *context);
+
+#endif
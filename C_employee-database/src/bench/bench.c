@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "db_poll.h"
+#include "shm.h"
+#include "employeedb.h"
+#include "lz.h"
+
+// a tcp or unix socket, with requests and replies going through the shared memory
+// rings once shm is attached
+struct conn_t {
+    int fd;
+    void *shm;
+    struct shm_end_t requests;
+    struct shm_end_t replies;
+    // granted in the handshake, and the reply bytes as they came over the wire
+    uint16_t features;
+    uint64_t received;
+};
+
+// a server that went away never moves the ring again, its socket closing tells
+static int conn_wait(struct conn_t *conn, struct shm_end_t *end) {
+    char byte;
+    while (shm_ring_wait(end, 1000) == STATUS_ERROR) {
+        if (recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+            printf("Server closed the connection\n");
+            return STATUS_ERROR;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+static int read_all(struct conn_t *conn, void *buffer, size_t size) {
+    conn->received += size;
+    size_t done = 0;
+    while (done < size) {
+        if (conn->shm != NULL) {
+            ssize_t taken = shm_ring_take(&conn->replies, (char*)buffer + done, size - done);
+            if (taken == STATUS_ERROR) {
+                printf("Broken reply ring\n");
+                return STATUS_ERROR;
+            }
+            done += taken;
+            if (done < size && conn_wait(conn, &conn->replies) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+            continue;
+        }
+
+        ssize_t bytes_read = read(conn->fd, (char*)buffer + done, size - done);
+        if (bytes_read <= 0) {
+            perror("read");
+            return STATUS_ERROR;
+        }
+        done += bytes_read;
+    }
+    return STATUS_SUCCESS;
+}
+
+// rings the socket only when the server is asleep in poll
+static int write_all(struct conn_t *conn, const void *data, size_t size) {
+    if (conn->shm == NULL) {
+        return write(conn->fd, data, size) == (ssize_t)size ? STATUS_SUCCESS : STATUS_ERROR;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t put = shm_ring_put(&conn->requests, (const char*)data + done, size - done);
+        if (put == STATUS_ERROR) {
+            printf("Broken request ring\n");
+            return STATUS_ERROR;
+        }
+        done += put;
+        if (shm_ring_consumer_parked(&conn->requests)) {
+            char doorbell = 0;
+            write(conn->fd, &doorbell, 1);
+        }
+        if (done < size && conn_wait(conn, &conn->requests) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int send_hello(struct conn_t *conn, uint16_t wanted) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_HELLO_REQ);
+    header->len = htonl(1);
+    db_protocol_hello *hello = (db_protocol_hello*)&header[1];
+    hello->protocol = htons(PROTOCOL_VER);
+    hello->features = htons(wanted);
+
+    write_all(conn, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_hello));
+    if (read_all(conn, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_hello)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    conn->features = ntohs(hello->features);
+
+    return ntohl(header->type) == MSG_HELLO_RESP ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+// an overloaded server answers with MSG_ERROR and when to try again, 0 for any other error
+static int recv_error(struct conn_t *conn, db_protocol_header_t *header, uint32_t *retryOut) {
+    *retryOut = 0;
+    if (ntohl(header->len) != 1) {
+        return STATUS_SUCCESS;
+    }
+
+    db_protocol_error error;
+    if (read_all(conn, &error, sizeof(error)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (ntohl(error.code) == ERROR_OVERLOADED) {
+        *retryOut = ntohl(error.retry_after_ms);
+    }
+    return STATUS_SUCCESS;
+}
+
+// decodes each frame as it arrives, into the records it carries
+static int recv_frames(struct conn_t *conn, uint8_t *records, size_t len) {
+
+    uint8_t compressed[LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp)];
+    size_t done = 0;
+    while (done < len) {
+        db_protocol_frame frame;
+        if (read_all(conn, &frame, sizeof(frame)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        frame.raw_len = ntohl(frame.raw_len);
+        frame.compressed_len = ntohl(frame.compressed_len);
+
+        if (frame.compressed_len > sizeof(compressed) || read_all(conn, compressed, frame.compressed_len) == STATUS_ERROR ||
+            lz_decompress_frame(&frame, compressed, records + done, len - done) == STATUS_ERROR) {
+            printf("Corrupted frame in reply\n");
+            return STATUS_ERROR;
+        }
+        done += frame.raw_len;
+    }
+    return STATUS_SUCCESS;
+}
+
+// one LIST, or one page when limit is set, returns the bytes decoded or 0 when it was rejected
+static ssize_t send_read(struct conn_t *conn, uint8_t **records, size_t *capacity, uint32_t limit, uint32_t *retryOut) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    size_t size = sizeof(db_protocol_header_t);
+    header->type = htonl(limit > 0 ? MSG_EMPLOYEE_PAGE_REQ : MSG_EMPLOYEE_LIST_REQ);
+    header->len = htonl(1);
+
+    if (limit > 0) {
+        db_protocol_page_req *page = (db_protocol_page_req*)&header[1];
+        page->offset = htonl(0);
+        page->limit = htonl(limit);
+        size += sizeof(db_protocol_page_req);
+    }
+
+    write_all(conn, message_buffer, size);
+    if (read_all(conn, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (ntohl(header->type) == MSG_ERROR) {
+        return recv_error(conn, header, retryOut) == STATUS_ERROR || *retryOut == 0 ? STATUS_ERROR : 0;
+    }
+
+    size_t len = (size_t)ntohl(header->len) * sizeof(db_protocol_list_resp);
+    if (len > *capacity) {
+        uint8_t *grown = realloc(*records, len);
+        if (grown == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        *records = grown;
+        *capacity = len;
+    }
+
+    if (conn->features & FEATURE_COMPRESSION) {
+        return recv_frames(conn, *records, len) == STATUS_ERROR ? STATUS_ERROR : (ssize_t)(sizeof(db_protocol_header_t) + len);
+    }
+
+    if (read_all(conn, *records, len) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    return sizeof(db_protocol_header_t) + len;
+}
+
+// adds no hours to employee 1, enough to invalidate its shard
+static int send_write(struct conn_t *conn, uint32_t *retryOut) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_EMPLOYEE_ADD_HRS_REQ);
+    header->len = htonl(1);
+    db_protocol_hours_req *request = (db_protocol_hours_req*)&header[1];
+    request->id = htonl(1);
+    request->hours = htonl(0);
+
+    write_all(conn, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_hours_req));
+    if (read_all(conn, message_buffer, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    *retryOut = 0;
+    return ntohl(header->type) == MSG_ERROR ? recv_error(conn, header, retryOut) : STATUS_SUCCESS;
+}
+
+// asks for the shared memory channel, requests and replies use its rings from then on
+static int send_attach(struct conn_t *conn) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_SHM_ATTACH_REQ);
+    header->len = htonl(0);
+    write_all(conn, message_buffer, sizeof(db_protocol_header_t));
+
+    // the fd comes with the first byte of the reply
+    int fd = -1;
+    if (shm_recv_fd(conn->fd, header, sizeof(db_protocol_header_t), &fd) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    db_protocol_shm_resp *resp = (db_protocol_shm_resp*)&header[1];
+    if (ntohl(header->type) != MSG_SHM_ATTACH_RESP || fd == -1 || read_all(conn, resp, sizeof(*resp)) == STATUS_ERROR) {
+        printf("Server refused shared memory\n");
+        if (fd != -1) {
+            close(fd);
+        }
+        return STATUS_ERROR;
+    }
+
+    conn->shm = shm_map(fd, ntohl(resp->size));
+    close(fd);
+    if (conn->shm == NULL) {
+        return STATUS_ERROR;
+    }
+
+    shm_end_init(&conn->requests, shm_requests(conn->shm), SHM_REQUEST_RING, true);
+    shm_end_init(&conn->replies, shm_replies(conn->shm), SHM_REPLY_RING, false);
+    return STATUS_SUCCESS;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right;
+}
+
+// one connection, run on its own thread when there are several
+struct worker_t {
+    pthread_t thread;
+    struct sockaddr_in server;
+    char *socket_path;
+    bool shm;
+    uint16_t features;
+    unsigned int requests;
+    unsigned int page_size;
+    unsigned int reads_per_write;
+
+    // latencies of the admitted reads, in us
+    double *latencies;
+    unsigned int admitted;
+    unsigned int shed;
+    unsigned int writes;
+    uint64_t bytes;
+    uint64_t wire;
+    ssize_t reply_size;
+    int status;
+};
+
+// a rejected request is not retried, the next one waits for the hint
+static void *run_worker(void *arg) {
+    struct worker_t *worker = arg;
+    worker->status = STATUS_ERROR;
+
+    struct sockaddr_un local = {0};
+    local.sun_family = AF_UNIX;
+    if (worker->socket_path != NULL) {
+        strncpy(local.sun_path, worker->socket_path, sizeof(local.sun_path) - 1);
+    }
+
+    struct conn_t connection = {.fd = -1, .shm = NULL, .features = 0, .received = 0};
+    struct conn_t *conn = &connection;
+    conn->fd = socket(worker->socket_path != NULL ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (conn->fd == STATUS_ERROR) {
+        perror("socket");
+        return NULL;
+    }
+
+    int connected = worker->socket_path != NULL ?
+        connect(conn->fd, (struct sockaddr*)&local, sizeof(local)) :
+        connect(conn->fd, (struct sockaddr*)&worker->server, sizeof(worker->server));
+    if (connected == STATUS_ERROR || send_hello(conn, worker->features) == STATUS_ERROR || (worker->shm && send_attach(conn) == STATUS_ERROR)) {
+        printf("Error establishing connection\n");
+        close(conn->fd);
+        return NULL;
+    }
+
+    // the first reply sizes the receive buffer and warms the cache
+    uint8_t *records = NULL;
+    size_t capacity = 0;
+    uint32_t retry = 0;
+    do {
+        usleep(retry * 1000);
+        worker->reply_size = send_read(conn, &records, &capacity, worker->page_size, &retry);
+    } while (worker->reply_size == 0);
+    uint64_t warmup = conn->received;
+
+    unsigned int i=0;
+    for (i=0;i<worker->requests && worker->reply_size != STATUS_ERROR;i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ssize_t received = send_read(conn, &records, &capacity, worker->page_size, &retry);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (received == STATUS_ERROR) {
+            break;
+        }
+        if (received == 0) {
+            worker->shed++;
+            usleep(retry * 1000);
+        } else {
+            worker->latencies[worker->admitted++] = elapsed_s(&start, &end) * 1e6;
+            worker->bytes += received;
+        }
+
+        if (worker->reads_per_write > 0 && (i + 1) % worker->reads_per_write == 0) {
+            if (send_write(conn, &retry) == STATUS_ERROR) {
+                break;
+            }
+            if (retry > 0) {
+                worker->shed++;
+                usleep(retry * 1000);
+            } else {
+                worker->writes++;
+            }
+        }
+    }
+
+    if (i == worker->requests && worker->reply_size != STATUS_ERROR) {
+        worker->status = STATUS_SUCCESS;
+    }
+    worker->wire = conn->received - warmup;
+
+    free(records);
+    if (conn->shm != NULL) {
+        shm_unmap(conn->shm);
+    }
+    close(conn->fd);
+    return NULL;
+}
+
+static int count_record(void *context, const struct employeedb_record_t *record) {
+    *(uint64_t*)context += record->hours > 0;
+    return 0;
+}
+
+// the same lookups with the engine in process, timed in batches since each one is
+// close to the cost of reading the clock
+static int run_embedded(char *filepath, unsigned int requests) {
+
+    struct employeedb_t *db = NULL;
+    if (employeedb_open(filepath, NULL, NULL, false, &db) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    uint64_t count = employeedb_count(db);
+    if (count == 0) {
+        printf("The database is empty\n");
+        employeedb_close(db);
+        return STATUS_ERROR;
+    }
+
+    struct employeedb_record_t record;
+    unsigned int found = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned int i=0;
+    for (i=0;i<requests;i++) {
+        found += employeedb_get(db, 1 + i % count, &record) == STATUS_SUCCESS;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double getSeconds = elapsed_s(&start, &end);
+
+    uint64_t withHours = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    employeedb_scan(db, count_record, &withHours);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double scanSeconds = elapsed_s(&start, &end);
+
+    printf("%u embedded gets, %u found in %.3f s, %.0f ns per get\n", requests, found, getSeconds, getSeconds * 1e9 / requests);
+    printf("scan of %lu employees, %lu with hours in %.3f ms, %.1f ns per record\n", count, withHours, scanSeconds * 1e3, scanSeconds * 1e9 / count);
+
+    employeedb_close(db);
+    return STATUS_SUCCESS;
+}
+
+void print_usage(char *argv[]) {
+	printf("Usage: %s -h HOST -p PORT | -U PATH [-m] | -f FILE [-n requests] [-g page size] [-w reads per write] [-c connections] [-z]\n", argv[0]);
+	printf("  -h  -  (required) host to connect to\n");
+	printf("  -p  -  (required) port to connect to\n");
+	printf("  -U  -  connect over the server's unix socket instead\n");
+	printf("  -m  -  with -U, send requests through shared memory\n");
+	printf("  -f  -  open this database file in process and time lookups by id instead\n");
+	printf("  -n  -  number of list requests per connection, default 1000\n");
+	printf("  -g  -  request pages of this many employees instead of the full list\n");
+	printf("  -w  -  send one add hours request after this many reads\n");
+	printf("  -c  -  concurrent connections, default 1\n");
+	printf("  -z  -  ask for compressed listings and report the compression ratio\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    char *hostarg = NULL;
+    unsigned short port = 0;
+    unsigned int requests = 1000;
+    unsigned int pageSize = 0;
+    unsigned int readsPerWrite = 0;
+    unsigned int connections = 1;
+    char *socketPath = NULL;
+    char *filepath = NULL;
+    bool shm = false;
+    uint16_t features = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:f:g:h:mn:p:U:w:z")) != -1) {
+        switch(c) {
+            case 'c':
+                connections = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                filepath = optarg;
+                break;
+            case 'g':
+                pageSize = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'h':
+                hostarg = optarg;
+                break;
+            case 'm':
+                shm = true;
+                break;
+            case 'n':
+                requests = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                port = (unsigned short)strtoul(optarg, NULL, 10);
+                break;
+            case 'U':
+                socketPath = optarg;
+                break;
+            case 'z':
+                features |= FEATURE_COMPRESSION;
+                break;
+            case 'w':
+                readsPerWrite = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                print_usage(argv);
+                return STATUS_ERROR;
+        }
+    }
+
+    if (filepath != NULL && requests > 0) {
+        return run_embedded(filepath, requests);
+    }
+
+    if ((socketPath == NULL && (hostarg == NULL || port == 0)) || (shm && socketPath == NULL) || requests == 0 || connections == 0) {
+        print_usage(argv);
+        return STATUS_ERROR;
+    }
+
+    struct sockaddr_in serverInfo = {0};
+    serverInfo.sin_family = AF_INET;
+    serverInfo.sin_addr.s_addr = inet_addr(hostarg != NULL ? hostarg : "127.0.0.1");
+    serverInfo.sin_port = htons(port);
+
+    struct worker_t *workers = calloc(connections, sizeof(struct worker_t));
+    double *latencies = calloc((size_t)connections * requests, sizeof(double));
+    if (workers == NULL || latencies == NULL) {
+        perror("calloc");
+        free(workers);
+        free(latencies);
+        return STATUS_ERROR;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned int i=0;
+    for (i=0;i<connections;i++) {
+        workers[i].server = serverInfo;
+        workers[i].socket_path = socketPath;
+        workers[i].shm = shm;
+        workers[i].features = features;
+        workers[i].requests = requests;
+        workers[i].page_size = pageSize;
+        workers[i].reads_per_write = readsPerWrite;
+        workers[i].latencies = &latencies[(size_t)i * requests];
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("pthread_create");
+            connections = i;
+            break;
+        }
+    }
+
+    uint64_t bytes = 0;
+    uint64_t wire = 0;
+    unsigned int writes = 0;
+    unsigned int admitted = 0;
+    unsigned int shed = 0;
+    int status = STATUS_SUCCESS;
+    for (i=0;i<connections;i++) {
+        pthread_join(workers[i].thread, NULL);
+        // latencies are gathered at the front for sorting
+        memmove(&latencies[admitted], workers[i].latencies, workers[i].admitted * sizeof(double));
+        bytes += workers[i].bytes;
+        wire += workers[i].wire;
+        writes += workers[i].writes;
+        admitted += workers[i].admitted;
+        shed += workers[i].shed;
+        if (workers[i].status == STATUS_ERROR) {
+            status = STATUS_ERROR;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = elapsed_s(&start, &end);
+
+    if (status == STATUS_ERROR || admitted == 0) {
+        printf("Benchmark failed\n");
+        free(workers);
+        free(latencies);
+        return STATUS_ERROR;
+    }
+
+    qsort(latencies, admitted, sizeof(double), compare_latency);
+
+    printf("%u %s requests on %u connections, %u writes in %.3f s\n", requests * connections, pageSize > 0 ? "page" : "list", connections, writes, seconds);
+    printf("%.0f requests/s, %.1f MB/s, %zd bytes per reply\n", admitted / seconds, bytes / seconds / 1e6, workers[0].reply_size);
+    printf("%.1f MB/s on the wire, compression ratio %.2f\n", wire / seconds / 1e6, (double)bytes / wire);
+    printf("%u admitted, %u rejected, latency p50 %.1f us, p99 %.1f us, max %.1f us\n", admitted, shed,
+        latencies[admitted / 2], latencies[(size_t)(admitted - 1) * 99 / 100], latencies[admitted - 1]);
+
+    free(workers);
+    free(latencies);
+    return STATUS_SUCCESS;
+}
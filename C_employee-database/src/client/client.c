@@ -3,14 +3,115 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <endian.h>
+#include <limits.h>
 
 #include "common.h"
 #include "db_poll.h"
+#include "request.h"
+#include "lz.h"
+
+// what the server granted in the handshake
+static uint16_t features = 0;
+
+// records can span several tcp reads
+int read_all(int socket, void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes_read = read(socket, (char*)buffer + done, size - done);
+        if (bytes_read <= 0) {
+            perror("read");
+            return STATUS_ERROR;
+        }
+        done += bytes_read;
+    }
+    return STATUS_SUCCESS;
+}
+
+// protocol 103, an overloaded server says when the request can be sent again
+void print_retry(db_protocol_header_t *header) {
+    db_protocol_error *error = (db_protocol_error*)&header[1];
+    if (header->len == 1 && ntohl(error->code) == ERROR_OVERLOADED) {
+        printf("Server overloaded, retry in %u ms\n", ntohl(error->retry_after_ms));
+    }
+}
+
+// the same, when only the header was read
+void recv_retry(int socket, db_protocol_header_t *header) {
+    if (header->len == 1 && read_all(socket, &header[1], sizeof(db_protocol_error)) == STATUS_SUCCESS) {
+        print_retry(header);
+    }
+}
+
+void print_employee(db_protocol_list_resp *employee) {
+    employee->name[sizeof(employee->name) - 1] = '\0';
+    employee->address[sizeof(employee->address) - 1] = '\0';
+    printf("%d:\t%s, %s, %d (v%u)\n", ntohl(employee->id), employee->name, employee->address, ntohl(employee->hours), ntohl(employee->version));
+}
+
+// protocol 105, records arrive as compressed frames and are printed one frame at a time
+int recv_frames(int socket, uint32_t count) {
+
+    size_t frameSize = LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp);
+    uint8_t *compressed = malloc(frameSize);
+    db_protocol_list_resp *records = malloc(frameSize);
+    int status = records != NULL && compressed != NULL ? STATUS_SUCCESS : STATUS_ERROR;
+
+    uint32_t received = 0;
+    while (received < count && status == STATUS_SUCCESS) {
+        db_protocol_frame frame;
+        if (read_all(socket, &frame, sizeof(frame)) == STATUS_ERROR) {
+            status = STATUS_ERROR;
+            break;
+        }
+        frame.raw_len = ntohl(frame.raw_len);
+        frame.compressed_len = ntohl(frame.compressed_len);
+
+        uint32_t inFrame = frame.raw_len / sizeof(db_protocol_list_resp);
+        if (frame.raw_len % sizeof(db_protocol_list_resp) != 0 || frame.compressed_len > frameSize || inFrame > count - received ||
+            read_all(socket, compressed, frame.compressed_len) == STATUS_ERROR ||
+            lz_decompress_frame(&frame, compressed, (uint8_t*)records, frameSize) == STATUS_ERROR) {
+            printf("Corrupted frame in reply\n");
+            status = STATUS_ERROR;
+            break;
+        }
+
+        uint32_t i=0;
+        for (i=0; i<inFrame; i++) {
+            print_employee(&records[i]);
+        }
+        received += inFrame;
+    }
+
+    free(compressed);
+    free(records);
+    return status;
+}
+
+int recv_employees(int socket, uint32_t count) {
 
-int send_hello(int socket) {
+    if (features & FEATURE_COMPRESSION) {
+        return recv_frames(socket, count);
+    }
+
+    db_protocol_list_resp employee;
+
+    uint32_t i=0;
+    for (i=0; i<count; i++) {
+        if (read_all(socket, &employee, sizeof(employee)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        print_employee(&employee);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int send_hello(int socket, uint16_t wanted) {
     char message_buffer[BUFFER_SIZE] = {0};
 
     db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
@@ -22,8 +123,9 @@ int send_hello(int socket) {
     hello->protocol = PROTOCOL_VER;
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
     hello->protocol = htons(hello->protocol);
+    hello->features = htons(wanted);
 
     // Send hello msg and read response
     write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_hello));
@@ -37,9 +139,13 @@ int send_hello(int socket) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        if (header->len == 1) {
+            print_retry(header);
+            return STATUS_ERROR;
+        }
         printf("Protocol mismatch\n");
         return STATUS_ERROR;
     }
@@ -47,12 +153,47 @@ int send_hello(int socket) {
     if (header->type == MSG_HELLO_RESP) {
         db_protocol_hello *hello_resp = (db_protocol_hello*)&header[1];
         hello_resp->protocol = ntohs(hello->protocol);
-        printf("Server connected, protocol v%d\n", hello_resp->protocol);
+        features = ntohs(hello_resp->features);
+        printf("Server connected, protocol v%d%s\n", hello_resp->protocol, features & FEATURE_COMPRESSION ? ", compressed" : "");
     }
 
     return STATUS_SUCCESS;
 }
 
+// the binary payload of a write given in its command line form, 0 if the text is malformed
+size_t encode_write(db_protocol_type_enum type, char *text, void *payload) {
+
+    struct employee_fields_t fields;
+    if (type == MSG_EMPLOYEE_ADD_REQ || type == MSG_EMPLOYEE_EDIT_REQ) {
+        if (request_parse_employee(text, type == MSG_EMPLOYEE_EDIT_REQ, &fields) == STATUS_ERROR ||
+            request_encode_employee(&fields, payload) == STATUS_ERROR) {
+            return 0;
+        }
+        return sizeof(db_protocol_employee_req);
+    }
+
+    if (type == MSG_EMPLOYEE_ADD_HRS_REQ) {
+        unsigned int id = 0;
+        unsigned int hours = 0;
+        if (request_parse_hours(text, &id, &hours) == STATUS_ERROR) {
+            return 0;
+        }
+        db_protocol_hours_req *request = (db_protocol_hours_req*)payload;
+        request->id = htonl(id);
+        request->hours = htonl(hours);
+        return sizeof(db_protocol_hours_req);
+    }
+
+    if (type == MSG_EMPLOYEE_DEL_REQ) {
+        if (request_encode_name(text, payload) == STATUS_ERROR) {
+            return 0;
+        }
+        return sizeof(db_protocol_name_req);
+    }
+
+    return 0;
+}
+
 int send_add_employee_req(int socket, char *employee_string) {
     char message_buffer[BUFFER_SIZE] = {0};
 
@@ -60,14 +201,16 @@ int send_add_employee_req(int socket, char *employee_string) {
     header->type = MSG_EMPLOYEE_ADD_REQ;
     header->len = 1;
 
-    db_protocol_data_req *employee = (db_protocol_data_req*)&header[1];
-    strncpy(&employee->data[0], employee_string, sizeof(employee->data));
+    size_t size = encode_write(MSG_EMPLOYEE_ADD_REQ, employee_string, &header[1]);
+    if (size == 0) {
+        return STATUS_ERROR;
+    }
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
 
     // Send add request and read response
-    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_data_req));
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + size);
     ssize_t bytes_read = read(socket, message_buffer, sizeof(message_buffer));
 
     // handle response
@@ -78,13 +221,18 @@ int send_add_employee_req(int socket, char *employee_string) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        print_retry(header);
         printf("Error received, add employee request failed.\n");
         return STATUS_ERROR;
     }
 
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction\n", header->len);
+    }
+
     if (header->type == MSG_EMPLOYEE_ADD_RESP) {
         printf("Employee was added succesfully!\n");
     }
@@ -99,14 +247,16 @@ int send_add_hrs_id_req(int socket, char *hrsstring) {
     header->type = MSG_EMPLOYEE_ADD_HRS_REQ;
     header->len = 1;
 
-    db_protocol_data_req *employee = (db_protocol_data_req*)&header[1];
-    strncpy(&employee->data[0], hrsstring, sizeof(employee->data));
+    size_t size = encode_write(MSG_EMPLOYEE_ADD_HRS_REQ, hrsstring, &header[1]);
+    if (size == 0) {
+        return STATUS_ERROR;
+    }
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
 
     // Send add request and read response
-    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_data_req));
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + size);
     ssize_t bytes_read = read(socket, message_buffer, sizeof(message_buffer));
 
     // handle response
@@ -117,13 +267,18 @@ int send_add_hrs_id_req(int socket, char *hrsstring) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        print_retry(header);
         printf("Error received, add hours request failed.\n");
         return STATUS_ERROR;
     }
 
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction\n", header->len);
+    }
+
     if (header->type == MSG_EMPLOYEE_ADD_HRS_RESP) {
         printf("Hours have been added succesfully:\n");
     }
@@ -139,7 +294,7 @@ int send_list_req(int socket) {
     header->len = 1;
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
 
     // Send add request and read response
     write(socket, message_buffer, sizeof(db_protocol_header_t));
@@ -153,25 +308,319 @@ int send_list_req(int socket) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        recv_retry(socket, header);
         printf("Error received, list request failed.\n");
         return STATUS_ERROR;
     }
 
     if (header->type == MSG_EMPLOYEE_LIST_RESP) {
         printf("Listing employees:\n");
-        db_protocol_list_resp *employee = (db_protocol_list_resp*)&header[1];
+        return recv_employees(socket, header->len);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// page is [offset]:[limit], offset counts employees in listing order
+int send_page_req(int socket, char *page) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_EMPLOYEE_PAGE_REQ);
+    header->len = htonl(1);
+
+    unsigned int offset = 0;
+    unsigned int limit = 0;
+    if (sscanf(page, "%u:%u", &offset, &limit) != 2) {
+        printf("Bad page, expected [offset]:[limit]\n");
+        return STATUS_ERROR;
+    }
+
+    db_protocol_page_req *request = (db_protocol_page_req*)&header[1];
+    request->offset = htonl(offset);
+    request->limit = htonl(limit);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_page_req));
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    header->len = ntohl(header->len);
+
+    if (header->type == MSG_ERROR) {
+        recv_retry(socket, header);
+        printf("Error received, page request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    if (header->type == MSG_EMPLOYEE_PAGE_RESP) {
+        printf("Listing employees %u to %u:\n", offset, offset + header->len);
+        return recv_employees(socket, header->len);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// spec is id:[low]-[high] or hours:[low]-[high], high may be left out, then an optional :[limit]
+int send_range_req(int socket, char *spec) {
+    char message_buffer[BUFFER_SIZE] = {0};
+    char field[16] = {0};
+    int consumed = 0;
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = MSG_EMPLOYEE_RANGE_REQ;
+    header->len = 1;
+
+    db_protocol_range_req *range = (db_protocol_range_req*)&header[1];
+    range->high = UINT_MAX;
+
+    if (sscanf(spec, "%15[a-z]:%u-%n", field, &range->low, &consumed) != 2 || consumed == 0) {
+        printf("Bad range, expected id:[low]-[high] or hours:[low]-[high]\n");
+        return STATUS_ERROR;
+    }
+
+    char *rest = spec + consumed;
+    if (*rest >= '0' && *rest <= '9') {
+        range->high = (uint32_t)strtoul(rest, &rest, 10);
+    }
+    if (*rest == ':') {
+        range->limit = (uint32_t)strtoul(rest + 1, NULL, 10);
+    }
+
+    if (strcmp(field, "id") == 0) {
+        range->field = RANGE_BY_ID;
+    } else if (strcmp(field, "hours") == 0) {
+        range->field = RANGE_BY_HOURS;
+    } else {
+        printf("Unknown range field: %s\n", field);
+        return STATUS_ERROR;
+    }
+
+    header->type = htonl(header->type);
+    header->len = htonl(header->len);
+    range->field = htonl(range->field);
+    range->low = htonl(range->low);
+    range->high = htonl(range->high);
+    range->limit = htonl(range->limit);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_range_req));
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    header->len = ntohl(header->len);
+
+    if (header->type == MSG_ERROR) {
+        recv_retry(socket, header);
+        printf("Error received, range request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    if (header->type == MSG_EMPLOYEE_RANGE_RESP) {
+        printf("Employees in range %s:\n", spec);
+        return recv_employees(socket, header->len);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// spec is [id]:[from]-[to] for one employee's hours or [limit]:[from]-[to] for the top ones,
+// times are unix seconds and a missing to means up to now
+int send_hours_req(int socket, db_protocol_type_enum type, char *spec) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = type;
+    header->len = 1;
+
+    db_protocol_hours_query_req *query = (db_protocol_hours_query_req*)&header[1];
+    query->to = UINT64_MAX;
+
+    char *rest = spec;
+    uint32_t number = (uint32_t)strtoul(rest, &rest, 10);
+    if (*rest != ':') {
+        printf("Bad hours query, expected [id]:[from]-[to] or [limit]:[from]-[to]\n");
+        return STATUS_ERROR;
+    }
+    query->from = strtoull(rest + 1, &rest, 10);
+    if (*rest == '-' && rest[1] >= '0' && rest[1] <= '9') {
+        query->to = strtoull(rest + 1, NULL, 10);
+    }
+
+    if (type == MSG_HOURS_SUM_REQ) {
+        query->id = number;
+    } else {
+        query->limit = number;
+    }
+
+    header->type = htonl(header->type);
+    header->len = htonl(header->len);
+    query->from = htobe64(query->from);
+    query->to = htobe64(query->to);
+    query->id = htonl(query->id);
+    query->limit = htonl(query->limit);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_hours_query_req));
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    header->len = ntohl(header->len);
+
+    if (header->type == MSG_ERROR) {
+        recv_retry(socket, header);
+        printf("Error received, hours query failed.\n");
+        return STATUS_ERROR;
+    }
+
+    if (header->type != MSG_HOURS_SUM_RESP && header->type != MSG_HOURS_TOP_RESP) {
+        return STATUS_SUCCESS;
+    }
+
+    if (header->type == MSG_HOURS_TOP_RESP) {
+        printf("Most hours in %s:\n", spec);
+    }
+
+    db_protocol_hours_total total;
+    uint32_t i=0;
+    for (i=0;i<header->len;i++) {
+        if (read_all(socket, &total, sizeof(total)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        printf("\tEmployee %u: %lu hours\n", ntohl(total.id), be64toh(total.hours));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// spec is name:[prefix] or address:[prefix] to match the start, name~[text] or address~[text] to match anywhere,
+// name=[text] or address=[text] to match the whole text
+int send_search_req(int socket, char *spec) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = MSG_EMPLOYEE_SEARCH_REQ;
+    header->len = 1;
+
+    db_protocol_search_req *search = (db_protocol_search_req*)&header[1];
+
+    size_t fieldLength = strcspn(spec, ":~=");
+    if (spec[fieldLength] == '\0') {
+        printf("Bad search, expected [name|address]:[prefix], [name|address]~[text] or [name|address]=[text]\n");
+        return STATUS_ERROR;
+    }
+
+    if (fieldLength == 4 && strncmp(spec, "name", 4) == 0) {
+        search->field = SEARCH_BY_NAME;
+    } else if (fieldLength == 7 && strncmp(spec, "address", 7) == 0) {
+        search->field = SEARCH_BY_ADDRESS;
+    } else {
+        printf("Unknown search field: %.*s\n", (int)fieldLength, spec);
+        return STATUS_ERROR;
+    }
+
+    if (spec[fieldLength] == '=') {
+        search->mode = SEARCH_EXACT;
+    } else {
+        search->mode = spec[fieldLength] == ':' ? SEARCH_PREFIX : SEARCH_CONTAINS;
+    }
+    strncpy((char*)search->text, &spec[fieldLength + 1], sizeof(search->text) - 1);
+
+    header->type = htonl(header->type);
+    header->len = htonl(header->len);
+    search->field = htonl(search->field);
+    search->mode = htonl(search->mode);
+    search->limit = htonl(search->limit);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_search_req));
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    header->len = ntohl(header->len);
+
+    if (header->type == MSG_ERROR) {
+        recv_retry(socket, header);
+        printf("Error received, search request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    if (header->type == MSG_EMPLOYEE_SEARCH_RESP) {
+        printf("Employees matching %s:\n", spec);
+        return recv_employees(socket, header->len);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// start is [epoch]:[seq] from an earlier subscription, or 0 to start from now. runs until the server goes away
+int send_subscribe_req(int socket, char *start) {
+    char message_buffer[BUFFER_SIZE] = {0};
+    const char *changes[] = {"add", "edit", "hours", "delete"};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_SUBSCRIBE_REQ);
+    header->len = htonl(1);
+
+    db_protocol_subscribe_req *request = (db_protocol_subscribe_req*)&header[1];
+    unsigned long long epoch = 0;
+    unsigned long long seq = 0;
+    sscanf(start, "%llu:%llu", &epoch, &seq);
+    request->epoch = htobe64(epoch);
+    request->seq = htobe64(seq);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_subscribe_req));
+
+    while (fflush(stdout) == 0 && read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_SUCCESS) {
+        header->type = ntohl(header->type);
+        header->len = ntohl(header->len);
+
+        if (header->type == MSG_ERROR) {
+            printf("Error received, subscribe request failed.\n");
+            return STATUS_ERROR;
+        }
+
+        if (header->type == MSG_SUBSCRIBE_RESP || header->type == MSG_CHANGE_RESYNC) {
+            db_protocol_subscribe_resp *position = (db_protocol_subscribe_resp*)&header[1];
+            if (read_all(socket, position, sizeof(*position)) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+
+            printf("%s at %lu:%lu\n", header->type == MSG_SUBSCRIBE_RESP ? "Subscribed" : "Fell behind", be64toh(position->epoch), be64toh(position->seq));
+            if (ntohs(position->resync)) {
+                printf("Missed changes, reload the employee list before applying events\n");
+            }
+            continue;
+        }
 
-        int i=0;
-        for (i=0; i<header->len; i++) {
-            read(socket, employee, sizeof(db_protocol_list_resp));
-            employee->id = ntohl(employee->id);
-            employee->hours = ntohl(employee->hours);
-            printf("%d:\t%s, %s, %d\n", employee->id, employee->name, employee->address, employee->hours);
+        if (header->type != MSG_CHANGE_EVENT) {
+            printf("Unexpected message %d on the change feed\n", header->type);
+            return STATUS_ERROR;
+        }
+
+        db_protocol_change_event *event = (db_protocol_change_event*)&header[1];
+        if (read_all(socket, event, sizeof(*event)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        event->change = ntohl(event->change);
+
+        if (event->change == CHANGE_DELETE) {
+            printf("%lu %s %d\n", be64toh(event->seq), changes[CHANGE_DELETE], ntohl(event->id));
+            continue;
         }
 
+        db_protocol_list_resp *employee = (db_protocol_list_resp*)&event[1];
+        if (event->change > CHANGE_DELETE || read_all(socket, employee, sizeof(*employee)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        printf("%lu %s %d:\t%s, %s, %d (v%u)\n", be64toh(event->seq), changes[event->change], ntohl(employee->id), employee->name, employee->address, ntohl(employee->hours), ntohl(employee->version));
     }
 
     return STATUS_SUCCESS;
@@ -184,14 +633,16 @@ int send_del_name_req(int socket, char *employee_name) {
     header->type = MSG_EMPLOYEE_DEL_REQ;
     header->len = 1;
 
-    db_protocol_data_req *employee = (db_protocol_data_req*)&header[1];
-    strncpy(&employee->data[0], employee_name, sizeof(employee->data));
+    size_t size = encode_write(MSG_EMPLOYEE_DEL_REQ, employee_name, &header[1]);
+    if (size == 0) {
+        return STATUS_ERROR;
+    }
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
 
     // Send add request and read response
-    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_data_req));
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + size);
     ssize_t bytes_read = read(socket, message_buffer, sizeof(message_buffer));
 
     // handle response
@@ -202,13 +653,18 @@ int send_del_name_req(int socket, char *employee_name) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        print_retry(header);
         printf("Error received, delete request failed.\n");
         return STATUS_ERROR;
     }
 
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction\n", header->len);
+    }
+
     if (header->type == MSG_EMPLOYEE_DEL_RESP) {
         printf("All employees with name %s have been deleted!\n", employee_name);
     }
@@ -228,7 +684,7 @@ int send_del_id_req(int socket, unsigned int id) {
     employee->id = id;
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
     employee->id = htonl(employee->id);
 
     // Send add request and read response
@@ -243,13 +699,18 @@ int send_del_id_req(int socket, unsigned int id) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        print_retry(header);
         printf("Error received, delete request failed.\n");
         return STATUS_ERROR;
     }
 
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction\n", header->len);
+    }
+
     if (header->type == MSG_EMPLOYEE_DEL_RESP) {
         printf("Employee with id %d has been deleted!\n", id);
     }
@@ -264,14 +725,16 @@ int send_edit_req(int socket, char *editString) {
     header->type = MSG_EMPLOYEE_EDIT_REQ;
     header->len = 1;
 
-    db_protocol_data_req *employee = (db_protocol_data_req*)&header[1];
-    strncpy(&employee->data[0], editString, sizeof(employee->data));
+    size_t size = encode_write(MSG_EMPLOYEE_EDIT_REQ, editString, &header[1]);
+    if (size == 0) {
+        return STATUS_ERROR;
+    }
 
     header->type = htonl(header->type);
-    header->len = htons(header->len);
+    header->len = htonl(header->len);
 
     // Send add request and read response
-    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_data_req));
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + size);
     ssize_t bytes_read = read(socket, message_buffer, sizeof(message_buffer));
 
     // handle response
@@ -282,13 +745,18 @@ int send_edit_req(int socket, char *editString) {
 
     header = (db_protocol_header_t*)message_buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (header->type == MSG_ERROR) {
+        print_retry(header);
         printf("Error received, edit request failed.\n");
         return STATUS_ERROR;
     }
 
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction\n", header->len);
+    }
+
     if (header->type == MSG_EMPLOYEE_DEL_RESP) {
         printf("Employee was updated!\n");
     }
@@ -296,16 +764,187 @@ int send_edit_req(int socket, char *editString) {
     return STATUS_SUCCESS;
 }
 
+// an edit or add hours request that only applies if the employee is still at version
+int send_cas_req(int socket, db_protocol_type_enum type, char *requestString, unsigned int version) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(type);
+    header->len = htonl(1);
+
+    db_protocol_cas_req *request = (db_protocol_cas_req*)&header[1];
+    request->version = htonl(version);
+    size_t size = encode_write(type == MSG_EMPLOYEE_EDIT_CAS_REQ ? MSG_EMPLOYEE_EDIT_REQ : MSG_EMPLOYEE_ADD_HRS_REQ, requestString, &request[1]);
+    if (size == 0) {
+        return STATUS_ERROR;
+    }
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_cas_req) + size);
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    if (header->type == MSG_TXN_STAGED) {
+        printf("Staged as request %d of the transaction, its version is checked on commit\n", ntohl(header->len));
+        return STATUS_SUCCESS;
+    }
+
+    if (header->type != type + 1) {
+        printf("Error received, conditional request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    db_protocol_cas_resp *response = (db_protocol_cas_resp*)&header[1];
+    if (read_all(socket, response, sizeof(*response)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (ntohs(response->applied) == 0) {
+        printf("Employee %d was changed by someone else, it is now at version %u\n", ntohl(response->id), ntohl(response->version));
+        return STATUS_ERROR;
+    }
+
+    printf("Employee %d was updated to version %u\n", ntohl(response->id), ntohl(response->version));
+    return STATUS_SUCCESS;
+}
+
+// begins or aborts a transaction, the requests sent in between are staged until the commit
+int send_txn_req(int socket, db_protocol_type_enum type) {
+    db_protocol_header_t header = {0};
+    header.type = htonl(type);
+    header.len = htonl(0);
+
+    write(socket, &header, sizeof(header));
+    if (read_all(socket, &header, sizeof(header)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (ntohl(header.type) != type + 1) {
+        printf("Error received, transaction request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int send_commit_req(int socket) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_TXN_COMMIT_REQ);
+    header->len = htonl(0);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t));
+    if (read_all(socket, header, sizeof(db_protocol_header_t)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (ntohl(header->type) != MSG_TXN_COMMIT_RESP) {
+        printf("Error received, commit request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    db_protocol_txn_resp *result = (db_protocol_txn_resp*)&header[1];
+    if (read_all(socket, result, sizeof(*result)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (ntohs(result->committed) == 0) {
+        printf("Transaction rolled back, request %d of %d failed\n", ntohl(result->failed), ntohl(result->count));
+        return STATUS_ERROR;
+    }
+
+    printf("Transaction of %d requests committed\n", ntohl(result->count));
+    return STATUS_SUCCESS;
+}
+
+int send_status_req(int socket) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_STATUS_REQ);
+    header->len = htonl(0);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t));
+    ssize_t bytes_read = read(socket, message_buffer, sizeof(db_protocol_header_t) + sizeof(db_protocol_status_resp));
+
+    if (bytes_read <= 0) {
+        perror("read");
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    if (header->type != MSG_STATUS_RESP) {
+        printf("Error received, status request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    db_protocol_status_resp *status = (db_protocol_status_resp*)&header[1];
+    printf("Role: %s\n", ntohs(status->role) == 0 ? "primary" : "replica");
+    printf("Sequence: %lu\n", be64toh(status->seq));
+    if (ntohs(status->role) == 0) {
+        printf("Replicas: %d\n", ntohs(status->replicas));
+        printf("Max replica lag: %lu mutations\n", be64toh(status->replica_lag));
+    } else {
+        printf("Replication lag: %ld ms\n", (int64_t)be64toh(status->lag_ms));
+    }
+
+    uint64_t hits = be64toh(status->list_hits);
+    uint64_t misses = be64toh(status->list_misses);
+    printf("List cache: %lu hits, %lu misses (%.1f%% hit rate)\n", hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+    printf("Loop lag: %.1f ms, %lu requests rejected under overload\n", be64toh(status->loop_lag_us) / 1000.0, be64toh(status->shed));
+
+    return STATUS_SUCCESS;
+}
+
+int send_promote_req(int socket) {
+    char message_buffer[BUFFER_SIZE] = {0};
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message_buffer;
+    header->type = htonl(MSG_REPL_PROMOTE_REQ);
+    header->len = htonl(0);
+
+    write(socket, message_buffer, sizeof(db_protocol_header_t));
+    ssize_t bytes_read = read(socket, message_buffer, sizeof(message_buffer));
+
+    if (bytes_read <= 0) {
+        perror("read");
+        return STATUS_ERROR;
+    }
+
+    header->type = ntohl(header->type);
+    if (header->type != MSG_REPL_PROMOTE_RESP) {
+        printf("Error received, promote request failed.\n");
+        return STATUS_ERROR;
+    }
+
+    printf("Server is now the primary\n");
+    return STATUS_SUCCESS;
+}
+
 void print_usage(char *argv[]) {
-	printf("Usage: %s [-h HOST] [-p PORT]\n", argv[0]);
+	printf("Usage: %s [-h HOST] [-p PORT] | [-U PATH]\n", argv[0]);
 	printf("  -h  -  (required) host to connect to\n");
 	printf("  -p  -  (required) port to connect to\n");
+	printf("  -U  -  connect to a server on this host over its unix socket instead\n");
 	printf("  -l  -  list employees\n");
+	printf("  -g [offset]:[limit] - list one page of employees\n");
+	printf("  -F [name|address]:[prefix] - find employees by name or address prefix, use ~ instead of : to match anywhere, = to match exactly\n");
+	printf("  -q [id|hours]:[low]-[high][:limit] - list employees in an id or hours range, ordered by it\n");
+	printf("  -k [id]:[from]-[to] - hours an employee logged between two unix times\n");
+	printf("  -K [limit]:[from]-[to] - employees who logged the most hours between two unix times\n");
+	printf("  -i  -  show server replication status\n");
+	printf("  -w [epoch]:[seq] - stream changes after seq, or 0 for changes from now on\n");
+	printf("  -P  -  promote a replica to primary\n");
 	printf("  -t [id] -  remove employee by id\n");
 	printf("  -r [name] -  remove employees by name\n");
 	printf("  -s [name],[hours] - add hours to employee by id\n");
 	printf("  -a [name],[address],[hours] -  add employee to the database\n");
 	printf("  -e [id],[name],[address],[hours] - edit employee by id. use '.' for any fields to be left unchanged\n");
+	printf("  -v [version] - only apply -e or -s if the employee is still at this version\n");
+	printf("  -T  -  apply the -a, -s, -r, -t and -e requests together or not at all\n");
+	printf("  -z  -  ask the server to compress listings\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -317,12 +956,24 @@ int main(int argc, char *argv[]) {
     char *portarg = NULL;
     char *hostarg = NULL;
     char *editString = NULL;
+    char *rangeString = NULL;
+    char *searchString = NULL;
+    char *hoursString = NULL;
+    char *topString = NULL;
+    char *subscribeString = NULL;
+    char *pageString = NULL;
+    char *versionString = NULL;
+    char *socketPath = NULL;
     int list = 0;
+    int status = 0;
+    int promote = 0;
+    int transaction = 0;
+    uint16_t wanted = 0;
     unsigned short port = 0;
     unsigned int id = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "a:e:h:lp:r:s:t:")) != -1) {
+    while ((c = getopt(argc, argv, "a:e:F:g:h:ik:K:lp:Pq:r:s:t:TU:v:w:z")) != -1) {
         switch(c) {
             case 'a':
                 addString = optarg;
@@ -330,26 +981,62 @@ int main(int argc, char *argv[]) {
             case 'e':
                 editString = optarg;
                 break;
+            case 'F':
+                searchString = optarg;
+                break;
+            case 'g':
+                pageString = optarg;
+                break;
             case 'h':
                 hostarg = optarg;
                 break;
+            case 'i':
+                status = 1;
+                break;
+            case 'k':
+                hoursString = optarg;
+                break;
+            case 'K':
+                topString = optarg;
+                break;
             case 'l':
                 list = 1;
                 break;
+            case 'P':
+                promote = 1;
+                break;
             case 'p':
                 portarg = optarg;
                 port = (unsigned short)strtoul(portarg, NULL, 10);
                 break;
+            case 'q':
+                rangeString = optarg;
+                break;
             case 'r':
                 removeNameString = optarg;
                 break;
             case 's':
                 hrsarg = optarg;
                 break;
+            case 'T':
+                transaction = 1;
+                break;
             case 't':
                 removeIdString = optarg;
                 id = (unsigned int)strtoul(removeIdString, NULL, 10);
                 break;
+            case 'U':
+                socketPath = optarg;
+                break;
+            case 'v':
+                versionString = optarg;
+                break;
+            case 'z':
+                wanted |= FEATURE_COMPRESSION;
+                break;
+            case 'w':
+                subscribeString = optarg;
+                break;
             case '?':
                 printf("Unknown option: -%c\n", c);
                 break;
@@ -358,39 +1045,52 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (port == 0) {
-        print_usage(argv);
-        return STATUS_ERROR;
-    }
-
-    if (hostarg == NULL) {
+    if (socketPath == NULL && (port == 0 || hostarg == NULL)) {
         print_usage(argv);
         return STATUS_ERROR;
     }
 
     struct sockaddr_in serverInfo = {0};
     serverInfo.sin_family = AF_INET;
-    serverInfo.sin_addr.s_addr = inet_addr(hostarg);
+    serverInfo.sin_addr.s_addr = inet_addr(hostarg != NULL ? hostarg : "127.0.0.1");
     serverInfo.sin_port = htons(port);
 
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    // a server on the same host can be reached without going through tcp
+    struct sockaddr_un localInfo = {0};
+    localInfo.sun_family = AF_UNIX;
+    if (socketPath != NULL) {
+        strncpy(localInfo.sun_path, socketPath, sizeof(localInfo.sun_path) - 1);
+    }
+
+    int server_socket = socket(socketPath != NULL ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (server_socket == STATUS_ERROR) {
         perror("socket");
         return STATUS_ERROR;
     }
 
-    if (connect(server_socket, (struct sockaddr*)&serverInfo, sizeof(serverInfo)) == STATUS_ERROR) {
+    int connected = socketPath != NULL ?
+        connect(server_socket, (struct sockaddr*)&localInfo, sizeof(localInfo)) :
+        connect(server_socket, (struct sockaddr*)&serverInfo, sizeof(serverInfo));
+    if (connected == STATUS_ERROR) {
         perror("connect");
         close(server_socket);
         return STATUS_ERROR;
     }
 
-    if (send_hello(server_socket) == STATUS_ERROR) {
+    if (send_hello(server_socket, wanted) == STATUS_ERROR) {
         printf("Error establishing connection\n");
         close(server_socket);
         return STATUS_ERROR;
     }
 
+    if (transaction > 0) {
+        if (send_txn_req(server_socket, MSG_TXN_BEGIN_REQ) == STATUS_ERROR) {
+            printf("Error with begin transaction request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
     if (addString != NULL) {
         if (send_add_employee_req(server_socket, addString) == STATUS_ERROR) {
             printf("Error with add new employee request!\n");
@@ -399,7 +1099,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (hrsarg != NULL) {
+    if (hrsarg != NULL && versionString != NULL) {
+        if (send_cas_req(server_socket, MSG_EMPLOYEE_ADD_HRS_CAS_REQ, hrsarg, (unsigned int)strtoul(versionString, NULL, 10)) == STATUS_ERROR) {
+            printf("Error with add hours request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    } else if (hrsarg != NULL) {
         if (send_add_hrs_id_req(server_socket, hrsarg) == STATUS_ERROR) {
             printf("Error with add hours request!\n");
             close(server_socket);
@@ -423,7 +1129,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (editString != NULL) {
+    if (editString != NULL && versionString != NULL) {
+        if (send_cas_req(server_socket, MSG_EMPLOYEE_EDIT_CAS_REQ, editString, (unsigned int)strtoul(versionString, NULL, 10)) == STATUS_ERROR) {
+            printf("Error with edit employee request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    } else if (editString != NULL) {
         if (send_edit_req(server_socket, editString) == STATUS_ERROR) {
             printf("Error with edit employee request!\n");
             close(server_socket);
@@ -431,6 +1143,14 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (transaction > 0) {
+        if (send_commit_req(server_socket) == STATUS_ERROR) {
+            printf("Error with commit request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
     if (list > 0) {
         if (send_list_req(server_socket) == STATUS_ERROR) {
             printf("Error with list employees request!\n");
@@ -439,5 +1159,69 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (pageString != NULL) {
+        if (send_page_req(server_socket, pageString) == STATUS_ERROR) {
+            printf("Error with page request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (rangeString != NULL) {
+        if (send_range_req(server_socket, rangeString) == STATUS_ERROR) {
+            printf("Error with range request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (searchString != NULL) {
+        if (send_search_req(server_socket, searchString) == STATUS_ERROR) {
+            printf("Error with search request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (hoursString != NULL) {
+        if (send_hours_req(server_socket, MSG_HOURS_SUM_REQ, hoursString) == STATUS_ERROR) {
+            printf("Error with hours request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (topString != NULL) {
+        if (send_hours_req(server_socket, MSG_HOURS_TOP_REQ, topString) == STATUS_ERROR) {
+            printf("Error with top hours request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (promote > 0) {
+        if (send_promote_req(server_socket) == STATUS_ERROR) {
+            printf("Error with promote request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (status > 0) {
+        if (send_status_req(server_socket) == STATUS_ERROR) {
+            printf("Error with status request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (subscribeString != NULL) {
+        if (send_subscribe_req(server_socket, subscribeString) == STATUS_ERROR) {
+            printf("Error with subscribe request!\n");
+            close(server_socket);
+            return STATUS_ERROR;
+        }
+    }
+
     return STATUS_SUCCESS;
 }
\ No newline at end of file
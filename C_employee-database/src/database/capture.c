@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+#include "common.h"
+#include "lz.h"
+
+static uint64_t clock_us(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// without a path capture stays off
+int capture_open(struct capture_t *capture, char *path) {
+
+    memset(capture, 0, sizeof(*capture));
+    capture->fd = -1;
+    if (path == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    capture->block = malloc(CAPTURE_BLOCK);
+    if (capture->block == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (capture->fd == -1) {
+        perror("open");
+        free(capture->block);
+        capture->block = NULL;
+        return STATUS_ERROR;
+    }
+
+    capture_file_header header = {0};
+    header.magic = htonl(CAPTURE_MAGIC);
+    header.version = htons(CAPTURE_VERSION);
+    header.protocol = htons(PROTOCOL_VER);
+    header.start_us = htobe64(clock_us(CLOCK_REALTIME));
+    if (write(capture->fd, &header, sizeof(header)) != sizeof(header)) {
+        perror("write");
+        capture_close(capture);
+        return STATUS_ERROR;
+    }
+
+    // offsets come from the monotonic clock, so a clock change does not reorder them
+    capture->start_us = clock_us(CLOCK_MONOTONIC);
+    printf("Capturing requests to %s\n", path);
+    return STATUS_SUCCESS;
+}
+
+static void capture_flush(struct capture_t *capture) {
+
+    if (capture->used == 0) {
+        return;
+    }
+
+    // the whole block as one frame, stored as is when it does not shrink
+    size_t cap = lz_frames_bound(capture->used, capture->used);
+    uint8_t *out = malloc(cap);
+    if (out == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    int size = lz_compress_frames(capture->block, capture->used, capture->used, out, cap);
+    if (size == STATUS_ERROR || write(capture->fd, out, size) != size) {
+        perror("write");
+    } else {
+        capture->written += size;
+    }
+
+    free(out);
+    capture->used = 0;
+}
+
+// frame is the complete request with its header still in network order
+void capture_record_frame(struct capture_t *capture, uint32_t conn, const void *frame, size_t len) {
+
+    if (capture->fd == -1) {
+        return;
+    }
+
+    if (capture->used + sizeof(capture_record) + len > CAPTURE_BLOCK) {
+        capture_flush(capture);
+    }
+
+    uint64_t now = clock_us(CLOCK_MONOTONIC);
+    if (capture->used == 0) {
+        capture->opened_ms = now / 1000;
+    }
+
+    // records follow each other at any offset of the block, so the header is copied in
+    capture_record record = {0};
+    record.offset_us = htobe64(now - capture->start_us);
+    record.conn = htonl(conn);
+    record.len = htonl(len);
+    memcpy(capture->block + capture->used, &record, sizeof(record));
+    memcpy(capture->block + capture->used + sizeof(record), frame, len);
+
+    capture->used += sizeof(capture_record) + len;
+    capture->records++;
+}
+
+// how long poll may wait before the open block is due, -1 when there is none
+int capture_timeout(struct capture_t *capture) {
+
+    if (capture->fd == -1 || capture->used == 0) {
+        return -1;
+    }
+
+    uint64_t now = clock_us(CLOCK_MONOTONIC) / 1000;
+    uint64_t due = capture->opened_ms + CAPTURE_FLUSH_MS;
+    return due > now ? (int)(due - now) : 0;
+}
+
+void capture_tick(struct capture_t *capture) {
+    if (capture_timeout(capture) == 0) {
+        capture_flush(capture);
+    }
+}
+
+void capture_close(struct capture_t *capture) {
+
+    if (capture->fd != -1) {
+        capture_flush(capture);
+        printf("Captured %lu requests in %lu bytes\n", capture->records, capture->written);
+        close(capture->fd);
+        capture->fd = -1;
+    }
+
+    free(capture->block);
+    capture->block = NULL;
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc_impl)(uint32_t crc, const uint8_t *data, size_t len);
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *data, size_t len) {
+    while (len--) {
+        crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len) {
+    uint64_t crc64 = crc;
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init(void) {
+    uint32_t i=0;
+    for (i=0;i<256;i++) {
+        uint32_t crc = i;
+        int j=0;
+        for (j=0;j<8;j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+
+    crc_impl = crc32c_table;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_impl = crc32c_sse42;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, crc32c_init);
+    return ~crc_impl(~crc, data, len);
+}
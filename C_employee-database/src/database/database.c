@@ -0,0 +1,1390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "database.h"
+#include "parse.h"
+#include "file.h"
+#include "common.h"
+#include "index.h"
+#include "search.h"
+#include "ledger.h"
+#include "lz.h"
+#include "strtab.h"
+
+struct shard_job_t {
+    struct shard_t *shard;
+    char *name;
+    int status;
+};
+
+// every change to a shard is written out and invalidates its cached images. the wire image
+// is freed so it stops counting against the budget. writes to single records keep the hours
+// index up to date themselves
+static void shard_written(struct shard_t *shard) {
+    shard->dirty = true;
+    free(shard->wire);
+    shard->wire = NULL;
+    shard->wire_cached = false;
+    shard->packed_cached = false;
+}
+
+// shards replaced or restored as a whole rebuild their hours index on the next hours range
+static void shard_modified(struct shard_t *shard) {
+    shard_written(shard);
+    shard->indexed = false;
+}
+
+static void search_drop(struct database_t *db) {
+    if (db->search != NULL) {
+        search_index_free(db->search);
+        free(db->search);
+        db->search = NULL;
+    }
+}
+
+// a built search index follows every write, if that fails it is dropped and rebuilt on the next search
+static void search_update(struct database_t *db, struct employee_t *employee, bool add) {
+
+    if (db->search == NULL || employee == NULL) {
+        return;
+    }
+
+    struct strtab_t *strings = &database_route(db, employee->id, false)->strings;
+    if (!add) {
+        search_index_remove(db->search, strings, employee);
+        return;
+    }
+
+    if (search_index_add(db->search, strings, employee) == STATUS_ERROR) {
+        search_drop(db);
+    }
+}
+
+static void notify_change(struct database_t *db, db_protocol_change_enum change, struct employee_t *employee) {
+
+    if (db->on_change == NULL) {
+        return;
+    }
+
+    if (employee == NULL) {
+        db->on_change(db->change_context, change, NULL);
+        return;
+    }
+
+    db_protocol_list_resp record;
+    database_wire_record(db, employee, &record);
+    db->on_change(db->change_context, change, &record);
+}
+
+static int shard_create(struct shard_t *shard) {
+
+    if (create_db_header(&shard->header) == STATUS_ERROR) {
+        printf("Error trying to create database header\n");
+        return STATUS_ERROR;
+    }
+
+    shard->employees = NULL;
+    if (strtab_init(&shard->strings) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    shard_modified(shard);
+    return STATUS_SUCCESS;
+}
+
+static int shard_load(struct shard_t *shard) {
+
+    int fileDescriptor = open_db_file(shard->path);
+    if (fileDescriptor == STATUS_ERROR) {
+        printf("Error trying to open database file %s\n", shard->path);
+        return STATUS_ERROR;
+    }
+
+    if (validate_db_header(fileDescriptor, &shard->header) == STATUS_ERROR) {
+        printf("Database header invalid in %s!\n", shard->path);
+        close(fileDescriptor);
+        return STATUS_ERROR;
+    }
+
+    // older versions are upgraded in place as soon as they are opened
+    unsigned short version = shard->header->version;
+
+    if (read_employees(fileDescriptor, shard->header, &shard->employees, &shard->strings) == STATUS_ERROR) {
+        printf("Error trying to read employees from %s\n", shard->path);
+        close(fileDescriptor);
+        return STATUS_ERROR;
+    }
+
+    //close until new output
+    close(fileDescriptor);
+
+    if (version != shard->header->version) {
+        output_file(shard->header, shard->employees, &shard->strings, shard->path);
+        printf("Upgraded %s from version %d to %d\n", shard->path, version, shard->header->version);
+    }
+
+    shard->dirty = false;
+    return STATUS_SUCCESS;
+}
+
+static int add_shards(struct database_t *db, int count) {
+
+    if (count > MAX_SHARDS) {
+        printf("Too many shards, the limit is %d\n", MAX_SHARDS);
+        return STATUS_ERROR;
+    }
+
+    struct shard_t *shards = realloc(db->shards, count * sizeof(struct shard_t));
+    if (shards == NULL) {
+        perror("realloc");
+        return STATUS_ERROR;
+    }
+
+    memset(&shards[db->count], 0, (count - db->count) * sizeof(struct shard_t));
+
+    int i=0;
+    for (i=db->count;i<count;i++) {
+        if (db->directory != NULL) {
+            snprintf(shards[i].path, sizeof(shards[i].path), SHARD_FILE_FORMAT, db->directory, i);
+        }
+    }
+
+    db->shards = shards;
+    db->count = count;
+    return STATUS_SUCCESS;
+}
+
+// spec is hash:[shards] or range:[ids per shard]
+static int parse_spec(struct database_t *db, char *spec) {
+
+    char mode[16] = {0};
+    unsigned int value = 0;
+
+    if (spec == NULL || sscanf(spec, "%15[a-z]:%u", mode, &value) != 2 || value == 0) {
+        printf("Bad shard spec, expected hash:[shards] or range:[ids per shard]\n");
+        return STATUS_ERROR;
+    }
+
+    if (strcmp(mode, "hash") == 0) {
+        db->mode = SHARD_BY_HASH;
+        return add_shards(db, value);
+    }
+
+    if (strcmp(mode, "range") == 0) {
+        db->mode = SHARD_BY_RANGE;
+        db->range = value;
+        return add_shards(db, 1);
+    }
+
+    printf("Bad shard spec: %s\n", spec);
+    return STATUS_ERROR;
+}
+
+static int read_manifest(struct database_t *db) {
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" SHARD_MANIFEST, db->directory);
+
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL) {
+        perror("fopen");
+        return STATUS_ERROR;
+    }
+
+    char spec[64] = {0};
+    char *line = fgets(spec, sizeof(spec), manifest);
+    fclose(manifest);
+
+    if (line == NULL) {
+        printf("Empty shard manifest %s\n", path);
+        return STATUS_ERROR;
+    }
+    spec[strcspn(spec, "\n")] = '\0';
+
+    if (parse_spec(db, spec) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    // range shards are created as ids grow, pick up every one that exists
+    if (db->mode == SHARD_BY_RANGE) {
+        int count = 1;
+        char shardPath[PATH_MAX];
+        snprintf(shardPath, sizeof(shardPath), SHARD_FILE_FORMAT, db->directory, count);
+        while (access(shardPath, F_OK) == 0) {
+            count++;
+            snprintf(shardPath, sizeof(shardPath), SHARD_FILE_FORMAT, db->directory, count);
+        }
+        return add_shards(db, count);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int write_manifest(struct database_t *db, char *spec) {
+
+    if (mkdir(db->directory, 0755) == STATUS_ERROR && errno != EEXIST) {
+        perror("mkdir");
+        return STATUS_ERROR;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" SHARD_MANIFEST, db->directory);
+
+    if (access(path, F_OK) == 0) {
+        printf("Shard directory already exists!\n");
+        return STATUS_ERROR;
+    }
+
+    FILE *manifest = fopen(path, "w");
+    if (manifest == NULL) {
+        perror("fopen");
+        return STATUS_ERROR;
+    }
+
+    fprintf(manifest, "%s\n", spec);
+    fclose(manifest);
+    return STATUS_SUCCESS;
+}
+
+// next to a single file, or inside the shard directory. path is PATH_MAX long
+static int ledger_path(struct database_t *db, char *path) {
+
+    int length = 0;
+    if (db->mode == SHARD_SINGLE) {
+        length = snprintf(path, PATH_MAX, "%s" LEDGER_SUFFIX, db->shards[0].path);
+    } else {
+        length = snprintf(path, PATH_MAX, LEDGER_SHARDED_FILE, db->directory);
+    }
+
+    // a truncated name would open some other file
+    if (length < 0 || length >= PATH_MAX) {
+        printf("Hours ledger path is too long\n");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// a new database starts without the hours of one that was there before
+static void ledger_remove(struct database_t *db) {
+    char path[PATH_MAX];
+    if (ledger_path(db, path) == STATUS_ERROR) {
+        return;
+    }
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror("unlink");
+    }
+}
+
+int database_init(struct database_t *db, char *filepath, char *directory, char *spec, bool create) {
+
+    memset(db, 0, sizeof(*db));
+
+    if (directory == NULL) {
+        db->mode = SHARD_SINGLE;
+        if (add_shards(db, 1) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        snprintf(db->shards[0].path, sizeof(db->shards[0].path), "%s", filepath);
+
+        if (create) {
+            int fileDescriptor = create_db_file(filepath);
+            if (fileDescriptor == STATUS_ERROR) {
+                printf("Error trying to create database file\n");
+                return STATUS_ERROR;
+            }
+            close(fileDescriptor);
+            ledger_remove(db);
+            return shard_create(&db->shards[0]);
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    db->directory = directory;
+
+    if (!create) {
+        return read_manifest(db);
+    }
+
+    if (parse_spec(db, spec) == STATUS_ERROR || write_manifest(db, spec) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    ledger_remove(db);
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        if (shard_create(&db->shards[i]) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int database_load(struct database_t *db) {
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+
+        if (shard->header == NULL && shard_load(shard) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        if (shard->header->id > db->next_id) {
+            db->next_id = shard->header->id;
+        }
+    }
+
+    if (db->ledger != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    db->ledger = malloc(sizeof(struct ledger_t));
+    if (db->ledger == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    char path[PATH_MAX];
+    if (ledger_path(db, path) == STATUS_ERROR || ledger_open(db->ledger, path) == STATUS_ERROR) {
+        printf("Error trying to open the hours ledger %s\n", path);
+        free(db->ledger);
+        db->ledger = NULL;
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int database_verify(struct database_t *db) {
+
+    int status = STATUS_SUCCESS;
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        struct dbheader_t *header = NULL;
+        int fileDescriptor = open_db_file(db->shards[i].path);
+
+        if (fileDescriptor == STATUS_ERROR || validate_db_header(fileDescriptor, &header) == STATUS_ERROR) {
+            printf("Database header invalid in %s!\n", db->shards[i].path);
+            status = STATUS_ERROR;
+        } else if (verify_db_file(fileDescriptor, header) == STATUS_ERROR) {
+            printf("Checksums failed in %s!\n", db->shards[i].path);
+            status = STATUS_ERROR;
+        }
+
+        if (fileDescriptor != STATUS_ERROR) {
+            close(fileDescriptor);
+        }
+        free(header);
+    }
+
+    return status;
+}
+
+void database_close(struct database_t *db) {
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        free(db->shards[i].header);
+        free(db->shards[i].employees);
+        strtab_free(&db->shards[i].strings);
+        free(db->shards[i].hours);
+        free(db->shards[i].wire);
+        free(db->shards[i].packed);
+    }
+
+    free(db->shards);
+    db->shards = NULL;
+    db->count = 0;
+    search_drop(db);
+
+    if (db->ledger != NULL) {
+        ledger_close(db->ledger);
+        free(db->ledger);
+        db->ledger = NULL;
+    }
+}
+
+struct shard_t *database_route(struct database_t *db, unsigned int id, bool create) {
+
+    if (id == 0) {
+        return NULL;
+    }
+
+    if (db->mode == SHARD_BY_HASH) {
+        return &db->shards[(id - 1) % db->count];
+    }
+
+    if (db->mode == SHARD_BY_RANGE) {
+        int index = (id - 1) / db->range;
+
+        if (index >= db->count) {
+            if (!create) {
+                return NULL;
+            }
+
+            int first = db->count;
+            if (add_shards(db, index + 1) == STATUS_ERROR) {
+                return NULL;
+            }
+
+            int i=0;
+            for (i=first;i<db->count;i++) {
+                if (shard_create(&db->shards[i]) == STATUS_ERROR) {
+                    return NULL;
+                }
+            }
+        }
+
+        return &db->shards[index];
+    }
+
+    return &db->shards[0];
+}
+
+uint64_t database_count(struct database_t *db) {
+
+    uint64_t count = 0;
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        count += db->shards[i].header->count;
+    }
+
+    return count;
+}
+
+// text left behind by edits and removals is dropped before the shard is written.
+// never runs inside a transaction, whose saved records still refer to the old text
+static void *persist_worker(void *arg) {
+    struct shard_t *shard = arg;
+    if (strtab_wasteful(&shard->strings) && compact_strings(shard->employees, shard->header->count, &shard->strings) == STATUS_SUCCESS) {
+        shard->packed_cached = false;
+    }
+    output_file(shard->header, shard->employees, &shard->strings, shard->path);
+    return NULL;
+}
+
+// writes every dirty shard, independent shards are written concurrently
+int database_persist(struct database_t *db) {
+
+    pthread_t threads[MAX_SHARDS];
+    bool started[MAX_SHARDS] = {0};
+    int dirty = 0;
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        dirty += db->shards[i].dirty;
+    }
+
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+        if (!shard->dirty) {
+            continue;
+        }
+
+        shard->dirty = false;
+        if (dirty > 1 && pthread_create(&threads[i], NULL, persist_worker, shard) == 0) {
+            started[i] = true;
+        } else {
+            persist_worker(shard);
+        }
+    }
+
+    for (i=0;i<db->count;i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    if (db->ledger != NULL) {
+        return ledger_flush(db->ledger);
+    }
+    return STATUS_SUCCESS;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    const struct employee_t *first = a;
+    const struct employee_t *second = b;
+    return (first->id > second->id) - (first->id < second->id);
+}
+
+// swaps the whole contents, used when a replica receives a snapshot
+int database_replace(struct database_t *db, db_protocol_list_resp *records, uint64_t count, uint64_t next_id) {
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        db->shards[i].header->count = 0;
+    }
+
+    uint64_t j=0;
+    for (j=0;j<count;j++) {
+        struct shard_t *shard = database_route(db, ntohl(records[j].id), true);
+        if (shard == NULL) {
+            return STATUS_ERROR;
+        }
+        shard->header->count++;
+    }
+
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+        free(shard->employees);
+        shard->employees = calloc(shard->header->count, sizeof(struct employee_t));
+        if (shard->employees == NULL && shard->header->count > 0) {
+            perror("calloc");
+            return STATUS_ERROR;
+        }
+        shard->header->count = 0;
+
+        strtab_free(&shard->strings);
+        if (strtab_init(&shard->strings) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    for (j=0;j<count;j++) {
+        struct shard_t *shard = database_route(db, ntohl(records[j].id), false);
+        struct employee_t *employee = &shard->employees[shard->header->count++];
+        const char *name = (const char*)records[j].name;
+        const char *address = (const char*)records[j].address;
+
+        employee->id = ntohl(records[j].id);
+        employee->hours = ntohl(records[j].hours);
+        employee->version = ntohl(records[j].version);
+        // ages are not replicated, a promoted replica counts them from the snapshot
+        employee->updated = time(NULL);
+
+        if (strtab_add_name(&shard->strings, name, strnlen(name, EMPLOYEE_TEXT_MAX - 1), &employee->name) == STATUS_ERROR ||
+            strtab_intern_address(&shard->strings, address, strnlen(address, EMPLOYEE_TEXT_MAX - 1), &employee->address) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    // records are kept in id order within a shard
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+        qsort(shard->employees, shard->header->count, sizeof(struct employee_t), compare_ids);
+        shard->header->id = next_id;
+        shard->header->filesize = db_file_size(shard->header->count);
+        shard_modified(shard);
+    }
+
+    db->next_id = next_id;
+    search_drop(db);
+    notify_change(db, CHANGE_DELETE, NULL);
+    return STATUS_SUCCESS;
+}
+
+void database_list(struct database_t *db) {
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        if (db->count > 1) {
+            printf("Shard %d:\n", i);
+        }
+        list_employees(db->shards[i].header, db->shards[i].employees, &db->shards[i].strings);
+    }
+}
+
+static int compare_result_ids(const void *a, const void *b) {
+    const struct employee_t *first = *(struct employee_t * const *)a;
+    const struct employee_t *second = *(struct employee_t * const *)b;
+    return (first->id > second->id) - (first->id < second->id);
+}
+
+static int compare_result_hours(const void *a, const void *b) {
+    const struct employee_t *first = *(struct employee_t * const *)a;
+    const struct employee_t *second = *(struct employee_t * const *)b;
+
+    if (first->hours != second->hours) {
+        return (first->hours > second->hours) - (first->hours < second->hours);
+    }
+    return compare_result_ids(a, b);
+}
+
+static int append_result(struct employee_t ***results, uint64_t *count, uint64_t *capacity, struct employee_t *employee) {
+
+    if (*count == *capacity) {
+        uint64_t grown = *capacity == 0 ? 64 : *capacity * 2;
+        struct employee_t **resized = realloc(*results, grown * sizeof(struct employee_t*));
+        if (resized == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        *results = resized;
+        *capacity = grown;
+    }
+
+    (*results)[(*count)++] = employee;
+    return STATUS_SUCCESS;
+}
+
+// names and addresses are padded with zeros, like the fixed size records they used to be
+static void wire_record(struct strtab_t *strings, struct employee_t *employee, db_protocol_list_resp *record) {
+    record->id = htonl(employee->id);
+    strncpy((char*)record->name, strtab_name(strings, employee->name), sizeof(record->name) - 1);
+    record->name[sizeof(record->name) - 1] = '\0';
+    strncpy((char*)record->address, strtab_address(strings, employee->address), sizeof(record->address) - 1);
+    record->address[sizeof(record->address) - 1] = '\0';
+    record->hours = htonl(employee->hours);
+    record->version = htonl(employee->version);
+}
+
+// text of a record from the string table of its shard
+const char *database_name(struct database_t *db, struct employee_t *employee) {
+    struct shard_t *shard = database_route(db, employee->id, false);
+    return shard == NULL ? "" : strtab_name(&shard->strings, employee->name);
+}
+
+const char *database_address(struct database_t *db, struct employee_t *employee) {
+    struct shard_t *shard = database_route(db, employee->id, false);
+    return shard == NULL ? "" : strtab_address(&shard->strings, employee->address);
+}
+
+void database_wire_record(struct database_t *db, struct employee_t *employee, db_protocol_list_resp *record) {
+
+    struct shard_t *shard = database_route(db, employee->id, false);
+    if (shard == NULL) {
+        memset(record, 0, sizeof(*record));
+        record->id = htonl(employee->id);
+        return;
+    }
+
+    wire_record(&shard->strings, employee, record);
+}
+
+// records [first, first + count) of a shard as LIST sends them, built from its string tables
+void database_wire_records(struct database_t *db, int index, uint64_t first, uint64_t count, db_protocol_list_resp *records) {
+
+    struct shard_t *shard = &db->shards[index];
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        wire_record(&shard->strings, &shard->employees[first + i], &records[i]);
+    }
+}
+
+// a shard's records as LIST sends them, built once and reused until the shard changes.
+// NULL when the image would take the cached images of all shards past WIRE_CACHE_BUDGET
+db_protocol_list_resp *database_wire_image(struct database_t *db, int index) {
+
+    struct shard_t *shard = &db->shards[index];
+    if (shard->wire_cached) {
+        return shard->wire;
+    }
+
+    size_t used = 0;
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        if (db->shards[i].wire_cached) {
+            used += db->shards[i].header->count * sizeof(db_protocol_list_resp);
+        }
+    }
+
+    uint64_t count = shard->header->count;
+    if (count == 0 || used + count * sizeof(db_protocol_list_resp) > WIRE_CACHE_BUDGET) {
+        return NULL;
+    }
+
+    db_protocol_list_resp *wire = malloc(count * sizeof(db_protocol_list_resp));
+    if (wire == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    database_wire_records(db, index, 0, count, wire);
+
+    shard->wire = wire;
+    shard->wire_cached = true;
+    return wire;
+}
+
+// the shard as compressed LIST frames, rebuilt only when the shard changes. without a cached
+// wire image records are serialized one frame at a time
+uint8_t *database_packed_image(struct database_t *db, int index, size_t *lenOut) {
+
+    struct shard_t *shard = &db->shards[index];
+    if (shard->packed_cached) {
+        *lenOut = shard->packed_len;
+        return shard->packed;
+    }
+
+    uint64_t count = shard->header->count;
+    size_t frame = LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp);
+    size_t bound = lz_frames_bound(count * sizeof(db_protocol_list_resp), frame);
+    uint8_t *packed = realloc(shard->packed, bound);
+    if (packed == NULL) {
+        perror("realloc");
+        return NULL;
+    }
+    shard->packed = packed;
+
+    db_protocol_list_resp *scratch = malloc(frame);
+    if (scratch == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    size_t len = 0;
+    uint64_t first = 0;
+    for (first=0; first<count; first+=LIST_FRAME_RECORDS) {
+        uint64_t frameCount = count - first < LIST_FRAME_RECORDS ? count - first : LIST_FRAME_RECORDS;
+        db_protocol_list_resp *records = scratch;
+        if (shard->wire_cached) {
+            records = shard->wire + first;
+        } else {
+            database_wire_records(db, index, first, frameCount, scratch);
+        }
+
+        int written = lz_compress_frames((uint8_t*)records, frameCount * sizeof(db_protocol_list_resp), frame, packed + len, bound - len);
+        if (written == STATUS_ERROR) {
+            free(scratch);
+            return NULL;
+        }
+        len += written;
+    }
+    free(scratch);
+
+    shard->packed_len = len;
+    shard->packed_cached = true;
+    *lenOut = shard->packed_len;
+    return packed;
+}
+
+// each shard yields at most limit matches in key order, shards are then merged by sorting.
+// the results point into the shards and are only valid until the next write
+int database_range(struct database_t *db, db_protocol_range_field_enum field, unsigned int low, unsigned int high, uint64_t limit, struct employee_t ***resultsOut, uint64_t *countOut) {
+
+    struct employee_t **results = NULL;
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+
+    if (field != RANGE_BY_ID && field != RANGE_BY_HOURS) {
+        printf("Unknown range field %d\n", field);
+        return STATUS_ERROR;
+    }
+
+    int i=0;
+    for (i=0;i<db->count && low <= high;i++) {
+        struct shard_t *shard = &db->shards[i];
+        struct dbheader_t *header = shard->header;
+        uint64_t matched = 0;
+
+        if (field == RANGE_BY_ID) {
+            uint64_t j = lower_bound_id(header, shard->employees, low);
+            for (;j<header->count && shard->employees[j].id <= high && (limit == 0 || matched < limit);j++, matched++) {
+                if (append_result(&results, &count, &capacity, &shard->employees[j]) == STATUS_ERROR) {
+                    free(results);
+                    return STATUS_ERROR;
+                }
+            }
+            continue;
+        }
+
+        if (!shard->indexed) {
+            if (build_hours_index(header, shard->employees, &shard->hours, &shard->hours_capacity) == STATUS_ERROR) {
+                free(results);
+                return STATUS_ERROR;
+            }
+            shard->indexed = true;
+        }
+
+        uint64_t j = lower_bound_hours(shard->hours, header->count, low);
+        for (;j<header->count && shard->hours[j].hours <= high && (limit == 0 || matched < limit);j++, matched++) {
+            if (append_result(&results, &count, &capacity, &shard->employees[shard->hours[j].position]) == STATUS_ERROR) {
+                free(results);
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    // range shards hold consecutive ids, so id results are already in order
+    if (db->count > 1 && (field == RANGE_BY_HOURS || db->mode != SHARD_BY_RANGE)) {
+        qsort(results, count, sizeof(struct employee_t*), field == RANGE_BY_ID ? compare_result_ids : compare_result_hours);
+    }
+
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+
+    *resultsOut = results;
+    *countOut = count;
+    return STATUS_SUCCESS;
+}
+
+static int search_build(struct database_t *db) {
+
+    db->search = calloc(1, sizeof(struct search_index_t));
+    if (db->search == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        if (search_index_build(db->search, &db->shards[i].strings, db->shards[i].employees, db->shards[i].header->count) == STATUS_ERROR) {
+            search_drop(db);
+            return STATUS_ERROR;
+        }
+    }
+
+    // hash shards interleave ids, posting lists are put back in id order once
+    search_index_sort(db->search);
+    return STATUS_SUCCESS;
+}
+
+// an address is in a shard's dictionary or in none of its records, which are then compared by reference
+static int search_address(struct database_t *db, char *text, uint64_t limit, struct employee_t ***resultsOut, uint64_t *countOut) {
+
+    struct employee_t **results = NULL;
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+        uint32_t address = 0;
+        if (!strtab_find_address(&shard->strings, text, strlen(text), &address)) {
+            continue;
+        }
+
+        uint64_t j=0;
+        for (j=0;j<shard->header->count;j++) {
+            if (shard->employees[j].address == address && append_result(&results, &count, &capacity, &shard->employees[j]) == STATUS_ERROR) {
+                free(results);
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    if (db->count > 1 && db->mode != SHARD_BY_RANGE) {
+        qsort(results, count, sizeof(struct employee_t*), compare_result_ids);
+    }
+
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+
+    *resultsOut = results;
+    *countOut = count;
+    return STATUS_SUCCESS;
+}
+
+// the trigram index is built by the first search, text too short for a trigram falls back to a scan
+int database_search(struct database_t *db, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text, uint64_t limit, struct employee_t ***resultsOut, uint64_t *countOut) {
+
+    struct employee_t **results = NULL;
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+
+    if ((field != SEARCH_BY_NAME && field != SEARCH_BY_ADDRESS) || (mode != SEARCH_PREFIX && mode != SEARCH_CONTAINS && mode != SEARCH_EXACT)) {
+        printf("Unknown search field %d or mode %d\n", field, mode);
+        return STATUS_ERROR;
+    }
+
+    if (field == SEARCH_BY_ADDRESS && mode == SEARCH_EXACT) {
+        return search_address(db, text, limit, resultsOut, countOut);
+    }
+
+    if (!search_indexable(mode, text)) {
+        int i=0;
+        for (i=0;i<db->count;i++) {
+            struct shard_t *shard = &db->shards[i];
+
+            uint64_t j=0;
+            for (j=0;j<shard->header->count;j++) {
+                if (search_match(&shard->employees[j], &shard->strings, field, mode, text) && append_result(&results, &count, &capacity, &shard->employees[j]) == STATUS_ERROR) {
+                    free(results);
+                    return STATUS_ERROR;
+                }
+            }
+        }
+
+        if (db->count > 1 && db->mode != SHARD_BY_RANGE) {
+            qsort(results, count, sizeof(struct employee_t*), compare_result_ids);
+        }
+    } else {
+        if (db->search == NULL && search_build(db) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        unsigned int *ids = NULL;
+        uint64_t candidates = 0;
+        if (search_candidates(db->search, field, mode, text, &ids, &candidates) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        uint64_t j=0;
+        for (j=0;j<candidates && (limit == 0 || count < limit);j++) {
+            struct shard_t *shard = database_route(db, ids[j], false);
+            struct employee_t *employee = shard == NULL ? NULL : find_employee(shard->header, shard->employees, ids[j]);
+
+            if (employee != NULL && search_match(employee, &shard->strings, field, mode, text) && append_result(&results, &count, &capacity, employee) == STATUS_ERROR) {
+                free(ids);
+                free(results);
+                return STATUS_ERROR;
+            }
+        }
+        free(ids);
+    }
+
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+
+    *resultsOut = results;
+    *countOut = count;
+    return STATUS_SUCCESS;
+}
+
+int database_undo_begin(struct database_t *db, struct database_undo_t *undo) {
+
+    undo->next_id = db->next_id;
+    undo->count = db->count;
+    undo->ledger_mark = db->ledger != NULL ? ledger_mark(db->ledger) : 0;
+    undo->shards = calloc(db->count, sizeof(struct shard_undo_t));
+    if (undo->shards == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// copies a shard the first time it is about to change, shards created since the start need no copy
+int database_undo_save(struct database_t *db, struct database_undo_t *undo, int index) {
+
+    if (index >= undo->count || undo->shards[index].saved) {
+        return STATUS_SUCCESS;
+    }
+
+    struct shard_t *shard = &db->shards[index];
+    struct shard_undo_t *saved = &undo->shards[index];
+    uint64_t count = shard->header->count;
+
+    saved->employees = malloc(count * sizeof(struct employee_t));
+    if (saved->employees == NULL && count > 0) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    memcpy(saved->employees, shard->employees, count * sizeof(struct employee_t));
+    saved->header = *shard->header;
+    saved->dirty = shard->dirty;
+    saved->saved = true;
+    return STATUS_SUCCESS;
+}
+
+void database_undo_restore(struct database_t *db, struct database_undo_t *undo) {
+
+    int i=0;
+    for (i=0;i<undo->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+        struct shard_undo_t *saved = &undo->shards[i];
+        if (!saved->saved) {
+            continue;
+        }
+
+        free(shard->employees);
+        shard->employees = saved->employees;
+        *shard->header = saved->header;
+        saved->employees = NULL;
+        saved->saved = false;
+
+        shard_modified(shard);
+        shard->dirty = saved->dirty;
+    }
+
+    // range shards added by the transaction were never written
+    for (i=undo->count;i<db->count;i++) {
+        free(db->shards[i].header);
+        free(db->shards[i].employees);
+        strtab_free(&db->shards[i].strings);
+        free(db->shards[i].hours);
+        free(db->shards[i].wire);
+        free(db->shards[i].packed);
+        memset(&db->shards[i], 0, sizeof(struct shard_t));
+    }
+
+    db->count = undo->count;
+    db->next_id = undo->next_id;
+    if (db->ledger != NULL) {
+        ledger_rewind(db->ledger, undo->ledger_mark);
+    }
+
+    // rebuilt on the next search rather than unwound record by record
+    search_drop(db);
+}
+
+void database_undo_free(struct database_undo_t *undo) {
+
+    int i=0;
+    for (i=0;i<undo->count;i++) {
+        free(undo->shards[i].employees);
+    }
+
+    free(undo->shards);
+    undo->shards = NULL;
+    undo->count = 0;
+}
+
+int database_add(struct database_t *db, struct employee_fields_t *fields) {
+
+    // ids are handed out across all shards, the target shard assigns the next one
+    if (db->next_id >= UINT_MAX) {
+        printf("Out of employee ids!\n");
+        return STATUS_ERROR;
+    }
+
+    unsigned int id = db->next_id + 1;
+    struct shard_t *shard = database_route(db, id, true);
+    if (shard == NULL) {
+        return STATUS_ERROR;
+    }
+
+    shard->header->id = id - 1;
+    if (add_employee(shard->header, &shard->employees, &shard->strings, fields) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    db->next_id = id;
+    shard_written(shard);
+    uint64_t position = shard->header->count - 1;
+    if (shard->indexed && hours_index_insert(&shard->hours, position, &shard->hours_capacity, shard->employees[position].hours, position) == STATUS_ERROR) {
+        shard->indexed = false;
+    }
+    search_update(db, &shard->employees[shard->header->count - 1], true);
+    notify_change(db, CHANGE_ADD, &shard->employees[shard->header->count - 1]);
+    return STATUS_SUCCESS;
+}
+
+// the record is only valid until the next write
+struct employee_t *database_find(struct database_t *db, unsigned int id) {
+
+    struct shard_t *shard = database_route(db, id, false);
+    if (shard == NULL) {
+        return NULL;
+    }
+
+    return find_employee(shard->header, shard->employees, id);
+}
+
+static struct shard_t *route_existing(struct database_t *db, unsigned int id) {
+
+    struct shard_t *shard = database_route(db, id, false);
+    if (shard == NULL) {
+        printf("Employee with id %d does not exist!\n", id);
+    }
+    return shard;
+}
+
+int database_add_hours(struct database_t *db, unsigned int id, unsigned int hours) {
+
+    struct shard_t *shard = route_existing(db, id);
+    if (shard == NULL) {
+        return STATUS_ERROR;
+    }
+
+    struct employee_t *employee = find_employee(shard->header, shard->employees, id);
+    unsigned int oldHours = employee != NULL ? employee->hours : 0;
+    if (add_hours(shard->header, shard->employees, id, hours) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    shard_written(shard);
+    if (shard->indexed) {
+        hours_index_move(shard->hours, shard->header->count, oldHours, employee->hours, employee - shard->employees);
+    }
+    notify_change(db, CHANGE_HOURS, employee);
+
+    // written with the shards on the next persist
+    if (db->ledger != NULL && ledger_append(db->ledger, (uint32_t)time(NULL), id, hours) == STATUS_ERROR) {
+        printf("Hours of employee %d were not added to the ledger\n", id);
+    }
+    return STATUS_SUCCESS;
+}
+
+int database_hours(struct database_t *db, unsigned int id, uint64_t from, uint64_t to, uint64_t *hoursOut) {
+    if (db->ledger == NULL) {
+        return STATUS_ERROR;
+    }
+    return ledger_sum(db->ledger, id, from, to, hoursOut);
+}
+
+int database_hours_top(struct database_t *db, uint64_t from, uint64_t to, uint32_t limit, struct ledger_sum_t **topOut, uint64_t *countOut) {
+    if (db->ledger == NULL) {
+        return STATUS_ERROR;
+    }
+    return ledger_top(db->ledger, from, to, limit, topOut, countOut);
+}
+
+int database_edit(struct database_t *db, struct employee_fields_t *fields) {
+
+    struct shard_t *shard = route_existing(db, fields->id);
+    if (shard == NULL) {
+        return STATUS_ERROR;
+    }
+
+    // the old text is unindexed before edit_employee overwrites it
+    struct employee_t *employee = find_employee(shard->header, shard->employees, fields->id);
+    search_update(db, employee, false);
+
+    unsigned int oldHours = employee != NULL ? employee->hours : 0;
+    int status = edit_employee(shard->header, shard->employees, &shard->strings, fields);
+    search_update(db, employee, true);
+    if (status == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    shard_written(shard);
+    if (employee != NULL) {
+        if (shard->indexed) {
+            hours_index_move(shard->hours, shard->header->count, oldHours, employee->hours, employee - shard->employees);
+        }
+        notify_change(db, CHANGE_EDIT, employee);
+    }
+    return STATUS_SUCCESS;
+}
+
+int database_remove_id(struct database_t *db, unsigned int id) {
+
+    struct shard_t *shard = database_route(db, id, false);
+    if (shard == NULL) {
+        return STATUS_ERROR;
+    }
+
+    struct employee_t *employee = find_employee(shard->header, shard->employees, id);
+    if (employee == NULL) {
+        printf("Employee with id %d does not exist!\n", id);
+        return STATUS_ERROR;
+    }
+
+    // the record is gone after the removal, keep what the feed reports
+    struct employee_t removed = *employee;
+    unsigned int position = employee - shard->employees;
+    search_update(db, employee, false);
+    if (remove_employee_id(shard->header, &shard->employees, id) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    shard_written(shard);
+    if (shard->indexed) {
+        hours_index_remove(shard->hours, shard->header->count + 1, removed.hours, position);
+    }
+    notify_change(db, CHANGE_DELETE, &removed);
+    return STATUS_SUCCESS;
+}
+
+// records without hours that have not changed since cutoff
+bool database_expired(struct employee_t *employee, unsigned int cutoff) {
+    return employee->hours == 0 && employee->updated <= cutoff;
+}
+
+// drops every expired record of a shard in one pass instead of one removal each
+int database_expire(struct database_t *db, int index, unsigned int cutoff, unsigned int **idsOut, uint64_t *countOut) {
+
+    struct shard_t *shard = &db->shards[index];
+    uint64_t count = shard->header->count;
+
+    *idsOut = NULL;
+    *countOut = 0;
+
+    unsigned int *ids = malloc((count + 1) * sizeof(unsigned int));
+    if (ids == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    // where each record ends up, to fix up the hours index without sorting it again
+    unsigned int *remap = NULL;
+    if (shard->indexed && (remap = malloc((count + 1) * sizeof(unsigned int))) == NULL) {
+        shard->indexed = false;
+    }
+
+    uint64_t removed = 0;
+    uint64_t kept = 0;
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        struct employee_t *employee = &shard->employees[i];
+
+        if (!database_expired(employee, cutoff)) {
+            if (kept != i) {
+                shard->employees[kept] = *employee;
+            }
+            if (remap != NULL) {
+                remap[i] = kept;
+            }
+            kept++;
+            continue;
+        }
+
+        // not yet overwritten, kept is behind i
+        if (remap != NULL) {
+            remap[i] = UINT_MAX;
+        }
+        ids[removed++] = employee->id;
+        search_update(db, employee, false);
+        notify_change(db, CHANGE_DELETE, employee);
+    }
+
+    if (removed > 0) {
+        struct employee_t *employees = realloc(shard->employees, kept * sizeof(struct employee_t));
+        if (employees != NULL || kept == 0) {
+            shard->employees = employees;
+        }
+
+        shard->header->count = kept;
+        shard->header->filesize = db_file_size(kept);
+        shard_written(shard);
+        if (remap != NULL) {
+            hours_index_remap(shard->hours, count, remap);
+        }
+    }
+    free(remap);
+
+    *idsOut = ids;
+    *countOut = removed;
+    return STATUS_SUCCESS;
+}
+
+// exact matches are a subset of the prefix matches a built index finds, without one every shard is scanned
+static int collect_name(struct database_t *db, char *name, struct employee_t ***matchesOut, uint64_t *countOut) {
+
+    struct employee_t **matches = NULL;
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+
+    if (db->search != NULL) {
+        if (database_search(db, SEARCH_BY_NAME, SEARCH_PREFIX, name, 0, &matches, &count) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        uint64_t kept = 0;
+        uint64_t j=0;
+        for (j=0;j<count;j++) {
+            if (strcmp(database_name(db, matches[j]), name) == 0) {
+                matches[kept++] = matches[j];
+            }
+        }
+
+        *matchesOut = matches;
+        *countOut = kept;
+        return STATUS_SUCCESS;
+    }
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        struct shard_t *shard = &db->shards[i];
+
+        uint64_t j=0;
+        for (j=0;j<shard->header->count;j++) {
+            if (strcmp(strtab_name(&shard->strings, shard->employees[j].name), name) == 0 && append_result(&matches, &count, &capacity, &shard->employees[j]) == STATUS_ERROR) {
+                free(matches);
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    *matchesOut = matches;
+    *countOut = count;
+    return STATUS_SUCCESS;
+}
+
+// records that go are found before remove_employee shifts the rest, so the hours index is only
+// fixed up rather than sorted again
+static void *remove_name_worker(void *arg) {
+    struct shard_job_t *job = arg;
+    struct shard_t *shard = job->shard;
+    uint64_t count = shard->header->count;
+
+    unsigned int *remap = NULL;
+    if (shard->indexed && (remap = malloc((count + 1) * sizeof(unsigned int))) == NULL) {
+        shard->indexed = false;
+    }
+
+    uint64_t kept = 0;
+    uint64_t i=0;
+    for (i=0;i<count && remap != NULL;i++) {
+        remap[i] = strcmp(strtab_name(&shard->strings, shard->employees[i].name), job->name) == 0 ? UINT_MAX : kept++;
+    }
+
+    job->status = remove_employee(shard->header, &shard->employees, &shard->strings, job->name);
+    if (job->status == STATUS_SUCCESS && remap != NULL) {
+        hours_index_remap(shard->hours, count, remap);
+    }
+    free(remap);
+    return NULL;
+}
+
+// names are not partitioned, every shard is scanned in parallel
+int database_remove_name(struct database_t *db, char *name) {
+
+    struct shard_job_t jobs[MAX_SHARDS];
+    pthread_t threads[MAX_SHARDS];
+    bool started[MAX_SHARDS] = {0};
+
+    // the records are gone after the removal, so the index and the feed are told about them first
+    struct employee_t **matches = NULL;
+    uint64_t count = 0;
+    if (db->search != NULL || db->on_change != NULL) {
+        if (collect_name(db, name, &matches, &count) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    unsigned int *removed = malloc((count + 1) * sizeof(unsigned int));
+    if (removed == NULL) {
+        perror("malloc");
+        free(matches);
+        return STATUS_ERROR;
+    }
+
+    uint64_t j=0;
+    for (j=0;j<count;j++) {
+        removed[j] = matches[j]->id;
+        search_update(db, matches[j], false);
+    }
+    free(matches);
+
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        jobs[i].shard = &db->shards[i];
+        jobs[i].name = name;
+        jobs[i].status = STATUS_ERROR;
+
+        if (db->count == 1 || pthread_create(&threads[i], NULL, remove_name_worker, &jobs[i]) != 0) {
+            remove_name_worker(&jobs[i]);
+        } else {
+            started[i] = true;
+        }
+    }
+
+    int status = STATUS_ERROR;
+    for (i=0;i<db->count;i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        if (jobs[i].status == STATUS_SUCCESS) {
+            shard_written(&db->shards[i]);
+            status = STATUS_SUCCESS;
+        }
+    }
+
+    struct employee_t employee = {0};
+    for (j=0;j<count;j++) {
+        employee.id = removed[j];
+        notify_change(db, CHANGE_DELETE, &employee);
+    }
+    free(removed);
+
+    return status;
+}
@@ -3,19 +3,45 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <endian.h>
 
 #include "db_poll.h"
 #include "common.h"
 #include "parse.h"
+#include "replication.h"
+#include "feed.h"
+#include "txn.h"
+#include "overload.h"
+#include "shm.h"
+#include "lz.h"
+#include "database.h"
 
 void init_clients(ClientState_t *clients) {
     int i=0;
     for (i = 0;i < MAX_CLIENTS; i++) {
         clients[i].fd = -1;
         clients[i].state = STATE_NEW;
+        clients[i].repl_seq = 0;
+        clients[i].repl_snapshot_len = 0;
+        clients[i].feed_seq = 0;
+        clients[i].out = NULL;
+        clients[i].out_len = 0;
+        clients[i].out_sent = 0;
+        clients[i].out_cap = 0;
+        clients[i].txn = NULL;
+        clients[i].txn_len = 0;
+        clients[i].txn_cap = 0;
+        clients[i].txn_count = 0;
+        clients[i].in_len = 0;
+        clients[i].local = false;
+        clients[i].features = 0;
+        clients[i].shm = NULL;
+        memset(&clients[i].timer, 0, sizeof(clients[i].timer));
         memset(&clients[i].buffer, '\0', BUFFER_SIZE);
     }
 }
@@ -40,54 +66,826 @@ int find_slot_by_fd(int fd, ClientState_t *ClientStates) {
     return STATUS_ERROR;
 }
 
+// a local client that stopped reading is only noticed by its socket closing
+static bool client_gone(ClientState_t *client) {
+    char byte;
+    return recv(client->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+// the channel is dropped and the socket shut, so the loop closes the client when it reads it
+static void client_shm_evict(ClientState_t *client, const char *reason) {
+    printf("Local client %s, closing the connection\n", reason);
+    client_shm_detach(client);
+    shutdown(client->fd, SHUT_RDWR);
+}
+
+// replies to an attached client wait for room in its ring, as a socket write waits for the peer,
+// but not longer than SHM_REPLY_TIMEOUT_MS without progress
+static void client_shm_write(ClientState_t *client, const void *data, size_t size) {
+
+    const uint8_t *in = data;
+    uint64_t deadline = wheel_now_ms() + SHM_REPLY_TIMEOUT_MS;
+
+    while (size > 0) {
+        ssize_t put = shm_ring_put(&client->shm_out, in, size);
+        if (put == STATUS_ERROR) {
+            client_shm_evict(client, "broke its reply ring");
+            return;
+        }
+        shm_ring_notify(&client->shm_out);
+        in += put;
+        size -= put;
+        if (put > 0) {
+            deadline = wheel_now_ms() + SHM_REPLY_TIMEOUT_MS;
+        }
+
+        if (size > 0 && shm_ring_wait(&client->shm_out, SHM_STALL_MS) == STATUS_ERROR) {
+            if (client_gone(client)) {
+                printf("Local client went away mid reply\n");
+                client_shm_detach(client);
+                return;
+            }
+            if (wheel_now_ms() >= deadline) {
+                client_shm_evict(client, "stopped taking its replies");
+                return;
+            }
+        }
+    }
+}
+
+// appends behind what the socket has not taken yet, the written part is reclaimed only when out has to grow
+int client_queue(ClientState_t *client, const void *data, size_t size) {
+
+    if (client->out_len + size > client->out_cap && client->out_sent > 0) {
+        memmove(client->out, client->out + client->out_sent, client->out_len - client->out_sent);
+        client->out_len -= client->out_sent;
+        client->out_sent = 0;
+    }
+
+    if (client->out_len + size > client->out_cap) {
+        size_t cap = client->out_cap == 0 ? BUFFER_SIZE : client->out_cap * 2;
+        while (cap < client->out_len + size) cap *= 2;
+
+        uint8_t *out = realloc(client->out, cap);
+        if (out == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        client->out = out;
+        client->out_cap = cap;
+    }
+
+    memcpy(client->out + client->out_len, data, size);
+    client->out_len += size;
+    return STATUS_SUCCESS;
+}
+
+// writes what the socket takes of out without blocking, returns the bytes written
+ssize_t client_flush(ClientState_t *client) {
+
+    if (client->out_len == 0) {
+        return 0;
+    }
+
+    ssize_t written = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent, MSG_DONTWAIT);
+    if (written < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : STATUS_ERROR;
+    }
+
+    client->out_sent += written;
+    if (client->out_sent == client->out_len) {
+        client->out_sent = 0;
+        client->out_len = 0;
+    }
+    return written;
+}
+
+// replies go straight to the socket while nothing is queued before them, the rest waits in out
+// for the loop to flush. a failed send is left to the loop, which sees the socket close
+void client_write(ClientState_t *client, const void *data, size_t size) {
+
+    if (client->shm != NULL) {
+        client_shm_write(client, data, size);
+        return;
+    }
+
+    const uint8_t *in = data;
+    if (client->out_len == 0) {
+        ssize_t written = send(client->fd, in, size, MSG_DONTWAIT);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return;
+            }
+            written = 0;
+        }
+        in += written;
+        size -= written;
+    }
+
+    if (size > 0) {
+        client_queue(client, in, size);
+    }
+}
+
+void client_writev(ClientState_t *client, const struct iovec *iov, int iovcnt) {
+
+    int i=0;
+    if (client->shm == NULL && client->out_len == 0) {
+        struct msghdr message = {0};
+        message.msg_iov = (struct iovec*)iov;
+        message.msg_iovlen = iovcnt;
+        ssize_t written = sendmsg(client->fd, &message, MSG_DONTWAIT);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return;
+            }
+            written = 0;
+        }
+
+        // whatever the socket did not take is queued in order
+        for (i=0;i<iovcnt;i++) {
+            if ((size_t)written >= iov[i].iov_len) {
+                written -= iov[i].iov_len;
+                continue;
+            }
+            client_queue(client, (uint8_t*)iov[i].iov_base + written, iov[i].iov_len - written);
+            written = 0;
+        }
+        return;
+    }
+
+    for (i=0;i<iovcnt;i++) {
+        client_write(client, iov[i].iov_base, iov[i].iov_len);
+    }
+}
+
+// a client is not served while a reply it has not read is still queued
+bool client_blocked(ClientState_t *client) {
+    return client->out_len > 0 && (client->state == STATE_HELLO || client->state == STATE_MSG);
+}
+
+void client_shm_detach(ClientState_t *client) {
+    if (client->shm != NULL) {
+        shm_unmap(client->shm);
+        client->shm = NULL;
+    }
+}
+
+// moves requests from the ring into the input buffer, where they are framed like socket input
+void client_shm_fill(ClientState_t *client) {
+    if (client->shm == NULL) {
+        return;
+    }
+
+    ssize_t taken = shm_ring_take(&client->shm_in, client->in + client->in_len, sizeof(client->in) - client->in_len);
+    if (taken == STATUS_ERROR) {
+        client_shm_evict(client, "broke its request ring");
+        return;
+    }
+    client->in_len += taken;
+}
+
 void fsm_reply_hello(ClientState_t *client, db_protocol_header_t *header) {
     header->type = htonl(MSG_HELLO_RESP);
-    header->len = htons(1);
+    header->len = htonl(1);
     db_protocol_hello *hello = (db_protocol_hello*)&header[1];
     hello->protocol = htons(PROTOCOL_VER);
+    hello->features = htons(client->features);
 
-    write(client->fd, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_hello));
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_hello));
 }
 
 void fsm_reply_err(ClientState_t *client, db_protocol_header_t *header) {
     header->type = htonl(MSG_ERROR);
-    header->len = htons(0);
+    header->len = htonl(0);
+
+    client_write(client, header, sizeof(db_protocol_header_t));
+}
+
+void fsm_reply_overloaded(ClientState_t *client, db_protocol_header_t *header, uint32_t retry_after_ms) {
+    header->type = htonl(MSG_ERROR);
+    header->len = htonl(1);
+    db_protocol_error *error = (db_protocol_error*)&header[1];
+    error->code = htonl(ERROR_OVERLOADED);
+    error->retry_after_ms = htonl(retry_after_ms);
 
-    write(client->fd, header, sizeof(db_protocol_header_t));
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_error));
 }
 
 void fsm_reply_success(ClientState_t *client, db_protocol_header_t *header, db_protocol_type_enum type) {
     header->type = htonl(type);
-    header->len = htons(1);
+    header->len = htonl(1);
 
-    write(client->fd, header, sizeof(db_protocol_header_t));
+    client_write(client, header, sizeof(db_protocol_header_t));
 }
 
-void fsm_reply_list(ClientState_t *client, db_protocol_header_t *header, struct dbheader_t *database_header, struct employee_t *employees) {
+// records for a client that negotiated compression, as frames compressed on the spot
+static int client_write_frames(ClientState_t *client, const void *records, uint64_t count) {
 
-    header->type = htonl(MSG_EMPLOYEE_LIST_RESP);
-    header->len = htons(database_header->count);
+    size_t raw_len = count * sizeof(db_protocol_list_resp);
+    size_t frame = LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp);
+    size_t bound = lz_frames_bound(raw_len, frame);
+    uint8_t *packed = malloc(bound);
+    if (packed == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    int len = lz_compress_frames(records, raw_len, frame, packed, bound);
+    if (len != STATUS_ERROR) {
+        client_write(client, packed, len);
+    }
+    free(packed);
+    return len == STATUS_ERROR ? STATUS_ERROR : STATUS_SUCCESS;
+}
+
+// records [first, first + count) of a shard, from its cached wire image or serialized a frame
+// at a time into scratch
+static void client_write_records(ClientState_t *client, struct database_t *db, int shard, uint64_t first, uint64_t count, db_protocol_list_resp *scratch) {
+
+    db_protocol_list_resp *image = db->shards[shard].wire_cached ? db->shards[shard].wire : NULL;
+    if (image != NULL && !(client->features & FEATURE_COMPRESSION)) {
+        client_write(client, image + first, count * sizeof(db_protocol_list_resp));
+        return;
+    }
+
+    while (count > 0) {
+        uint64_t frameCount = count < LIST_FRAME_RECORDS ? count : LIST_FRAME_RECORDS;
+        db_protocol_list_resp *records = scratch;
+        if (image != NULL) {
+            records = image + first;
+        } else {
+            database_wire_records(db, shard, first, frameCount, scratch);
+        }
+
+        if (client->features & FEATURE_COMPRESSION) {
+            client_write_frames(client, records, frameCount);
+        } else {
+            client_write(client, records, frameCount * sizeof(db_protocol_list_resp));
+        }
+
+        first += frameCount;
+        count -= frameCount;
+    }
+}
+
+// sends employees [offset, offset + limit) of the listing. compressed listings send whole shards
+// as their cached compressed image, everything else comes from the cached wire images, or is
+// built from the string tables frame by frame for shards the cache budget has no room for
+static int fsm_send_listing(ClientState_t *client, db_protocol_header_t *header, struct database_t *db, db_protocol_type_enum type, uint64_t offset, uint64_t limit) {
+
+    uint64_t total = database_count(db);
+    uint64_t count = offset < total ? total - offset : 0;
+    if (count > limit) {
+        count = limit;
+    }
+
+    db_protocol_list_resp *scratch = malloc(LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp));
+    if (scratch == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    // the cached images are built before anything is sent, so a failure can still be replied to
+    bool compressed = client->features & FEATURE_COMPRESSION;
+    bool hit = true;
+    int shard = 0;
+    uint64_t skip = offset;
+    uint64_t left = count;
+    for (shard=0; shard<db->count && left > 0; shard++) {
+        uint64_t records = db->shards[shard].header->count;
+        if (skip >= records) {
+            skip -= records;
+            continue;
+        }
+
+        uint64_t sending = records - skip < left ? records - skip : left;
+        size_t len = 0;
+        if (compressed && sending == records) {
+            hit = hit && db->shards[shard].packed_cached;
+            if (database_packed_image(db, shard, &len) == NULL) {
+                free(scratch);
+                return STATUS_ERROR;
+            }
+        } else {
+            // a shard past the budget is still listed, just not from an image
+            hit = hit && db->shards[shard].wire_cached;
+            database_wire_image(db, shard);
+        }
+        left -= sending;
+        skip = 0;
+    }
+
+    if (count > 0 && hit) {
+        db->list_hits++;
+    } else if (count > 0) {
+        db->list_misses++;
+    }
+
+    header->type = htonl(type);
+    header->len = htonl(count);
+    client_write(client, header, sizeof(db_protocol_header_t));
+
+    for (shard=0; shard<db->count && count > 0; shard++) {
+        uint64_t records = db->shards[shard].header->count;
+        if (offset >= records) {
+            offset -= records;
+            continue;
+        }
+
+        uint64_t sending = records - offset < count ? records - offset : count;
+        if (compressed && sending == records) {
+            client_write(client, db->shards[shard].packed, db->shards[shard].packed_len);
+        } else {
+            client_write_records(client, db, shard, offset, sending, scratch);
+        }
+
+        count -= sending;
+        offset = 0;
+    }
+
+    free(scratch);
+    return STATUS_SUCCESS;
+}
+
+void fsm_reply_list(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+    if (fsm_send_listing(client, header, db, MSG_EMPLOYEE_LIST_RESP, 0, UINT64_MAX) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+    }
+}
+
+void fsm_reply_page(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+    db_protocol_page_req *page = (db_protocol_page_req*)&header[1];
+    uint32_t offset = ntohl(page->offset);
+    uint32_t limit = ntohl(page->limit);
+
+    if (fsm_send_listing(client, header, db, MSG_EMPLOYEE_PAGE_RESP, offset, limit) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+    }
+}
+
+static void fsm_reply_results(ClientState_t *client, db_protocol_header_t *header, struct database_t *db, db_protocol_type_enum type, struct employee_t **results, uint64_t count) {
+
+    if (client->features & FEATURE_COMPRESSION) {
+        // whole frames are serialized and compressed together
+        db_protocol_list_resp *frame = malloc(LIST_FRAME_RECORDS * sizeof(db_protocol_list_resp));
+        if (frame == NULL) {
+            perror("malloc");
+            fsm_reply_err(client, header);
+            return;
+        }
+
+        header->type = htonl(type);
+        header->len = htonl(count);
+        client_write(client, header, sizeof(db_protocol_header_t));
+
+        uint64_t i = 0;
+        while (i < count) {
+            uint64_t j = 0;
+            for (j=0; j<LIST_FRAME_RECORDS && i<count; j++, i++) {
+                database_wire_record(db, results[i], &frame[j]);
+            }
+            client_write_frames(client, frame, j);
+        }
+        free(frame);
+        return;
+    }
+
+    header->type = htonl(type);
+    header->len = htonl(count);
+    client_write(client, header, sizeof(db_protocol_header_t));
 
-    write(client->fd, header, sizeof(db_protocol_header_t));
     db_protocol_list_resp *employee = (db_protocol_list_resp*)&header[1];
 
-    int i = 0;
-    for (i=0; i<database_header->count; i++) {
-        strncpy(employee->name, employees[i].name, sizeof(employees[0].name));
-        strncpy(employee->address, employees[i].address, sizeof(employees[0].address));
-        employee->id = htonl(employees[i].id);
-        employee->hours = htonl(employees[i].hours);
-        write(client->fd, &header[1], sizeof(db_protocol_list_resp));
+    uint64_t i = 0;
+    for (i=0; i<count; i++) {
+        database_wire_record(db, results[i], employee);
+        client_write(client, employee, sizeof(db_protocol_list_resp));
+    }
+}
+
+void fsm_reply_range(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+
+    db_protocol_range_req *range = (db_protocol_range_req*)&header[1];
+    db_protocol_range_field_enum field = ntohl(range->field);
+    unsigned int low = ntohl(range->low);
+    unsigned int high = ntohl(range->high);
+    unsigned int limit = ntohl(range->limit);
+
+    struct employee_t **results = NULL;
+    uint64_t count = 0;
+    if (database_range(db, field, low, high, limit, &results, &count) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    fsm_reply_results(client, header, db, MSG_EMPLOYEE_RANGE_RESP, results, count);
+    free(results);
+}
+
+void fsm_reply_search(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+
+    db_protocol_search_req *search = (db_protocol_search_req*)&header[1];
+    db_protocol_search_field_enum field = ntohl(search->field);
+    db_protocol_search_mode_enum mode = ntohl(search->mode);
+    unsigned int limit = ntohl(search->limit);
+    search->text[sizeof(search->text) - 1] = '\0';
+
+    struct employee_t **results = NULL;
+    uint64_t count = 0;
+    if (database_search(db, field, mode, (char*)search->text, limit, &results, &count) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+        return;
     }
+
+    fsm_reply_results(client, header, db, MSG_EMPLOYEE_SEARCH_RESP, results, count);
+    free(results);
+}
+
+void fsm_reply_hours_sum(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+
+    // the payload starts at an unaligned offset of the client buffer
+    db_protocol_hours_query_req query;
+    memcpy(&query, &header[1], sizeof(query));
+    unsigned int id = ntohl(query.id);
+
+    uint64_t hours = 0;
+    if (database_hours(db, id, be64toh(query.from), be64toh(query.to), &hours) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    header->type = htonl(MSG_HOURS_SUM_RESP);
+    header->len = htonl(1);
+    db_protocol_hours_total total = {0};
+    total.hours = htobe64(hours);
+    total.id = htonl(id);
+    memcpy(&header[1], &total, sizeof(total));
+
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_hours_total));
+}
+
+void fsm_reply_hours_top(ClientState_t *client, db_protocol_header_t *header, struct database_t *db) {
+
+    db_protocol_hours_query_req query;
+    memcpy(&query, &header[1], sizeof(query));
+
+    struct ledger_sum_t *top = NULL;
+    uint64_t count = 0;
+    if (database_hours_top(db, be64toh(query.from), be64toh(query.to), ntohl(query.limit), &top, &count) == STATUS_ERROR) {
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    db_protocol_hours_total *totals = malloc((count + 1) * sizeof(db_protocol_hours_total));
+    if (totals == NULL) {
+        perror("malloc");
+        free(top);
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    uint64_t i = 0;
+    for (i=0; i<count; i++) {
+        totals[i].hours = htobe64(top[i].hours);
+        totals[i].id = htonl(top[i].id);
+    }
+
+    header->type = htonl(MSG_HOURS_TOP_RESP);
+    header->len = htonl(count);
+    struct iovec iov[2] = {
+        {header, sizeof(db_protocol_header_t)},
+        {totals, count * sizeof(db_protocol_hours_total)}
+    };
+    client_writev(client, iov, 2);
+
+    free(totals);
+    free(top);
 }
 
-int handle_client_fsm(struct dbheader_t *database_header, struct employee_t **employees, ClientState_t *client, char* filepath) {
+size_t request_payload_size(db_protocol_type_enum type) {
+    switch (type) {
+        case MSG_HELLO_REQ:
+            return sizeof(db_protocol_hello);
+        case MSG_EMPLOYEE_ADD_REQ:
+        case MSG_EMPLOYEE_EDIT_REQ:
+            return sizeof(db_protocol_employee_req);
+        case MSG_EMPLOYEE_ADD_HRS_REQ:
+            return sizeof(db_protocol_hours_req);
+        case MSG_EMPLOYEE_DEL_REQ:
+            return sizeof(db_protocol_name_req);
+        case MSG_EMPLOYEE_DEL_ID_REQ:
+            return sizeof(db_protocol_id_req);
+        case MSG_REPL_ACK:
+            return sizeof(db_protocol_repl_ack);
+        case MSG_EMPLOYEE_RANGE_REQ:
+            return sizeof(db_protocol_range_req);
+        case MSG_EMPLOYEE_SEARCH_REQ:
+            return sizeof(db_protocol_search_req);
+        case MSG_SUBSCRIBE_REQ:
+            return sizeof(db_protocol_subscribe_req);
+        case MSG_EMPLOYEE_PAGE_REQ:
+            return sizeof(db_protocol_page_req);
+        case MSG_HOURS_SUM_REQ:
+        case MSG_HOURS_TOP_REQ:
+            return sizeof(db_protocol_hours_query_req);
+        case MSG_EMPLOYEE_EDIT_CAS_REQ:
+            return sizeof(db_protocol_cas_req) + sizeof(db_protocol_employee_req);
+        case MSG_EMPLOYEE_ADD_HRS_CAS_REQ:
+            return sizeof(db_protocol_cas_req) + sizeof(db_protocol_hours_req);
+        default:
+            return 0;
+    }
+}
+
+// size of the complete request at the start of the input, 0 while more bytes are needed
+size_t client_frame_size(ClientState_t *client) {
+
+    if (client->in_len < sizeof(db_protocol_header_t)) {
+        return 0;
+    }
+
+    db_protocol_header_t *header = (db_protocol_header_t*)client->in;
+    size_t size = sizeof(db_protocol_header_t) + request_payload_size(ntohl(header->type));
+    return client->in_len >= size ? size : 0;
+}
+
+// complete requests in the input, the queue the overload controller sees
+size_t client_queued_frames(ClientState_t *client) {
+
+    size_t count = 0;
+    size_t offset = 0;
+    while (client->in_len - offset >= sizeof(db_protocol_header_t)) {
+        db_protocol_header_t *header = (db_protocol_header_t*)(client->in + offset);
+        size_t size = sizeof(db_protocol_header_t) + request_payload_size(ntohl(header->type));
+        if (client->in_len - offset < size) {
+            break;
+        }
+        offset += size;
+        count++;
+    }
+    return count;
+}
+
+// picks the deadline that applies after a client was served. a partial request keeps the
+// deadline it started with, so trickling bytes does not extend it
+void client_rearm(struct wheel_t *wheel, ClientState_t *client) {
+
+    if (client->state == STATE_HELLO) {
+        return;
+    }
+
+    if (client->state == STATE_SUBSCRIBER || client->state == STATE_REPLICA) {
+        wheel_cancel(wheel, &client->timer);
+        return;
+    }
+
+    // a queued reply has to make progress, the deadline is pushed back by every flush that does
+    if (client->out_len > 0) {
+        if (client->timer_kind != TIMER_SEND || !client->timer.scheduled) {
+            client->timer_kind = TIMER_SEND;
+            wheel_schedule(wheel, &client->timer, wheel_now_ms() + SEND_TIMEOUT_MS);
+        }
+        return;
+    }
+
+    if (client->in_len > 0) {
+        if (client->timer_kind != TIMER_REQUEST || !client->timer.scheduled) {
+            client->timer_kind = TIMER_REQUEST;
+            wheel_schedule(wheel, &client->timer, wheel_now_ms() + REQUEST_TIMEOUT_MS);
+        }
+        return;
+    }
+
+    client->timer_kind = TIMER_IDLE;
+    wheel_schedule(wheel, &client->timer, wheel_now_ms() + IDLE_TIMEOUT_MS);
+}
+
+bool is_write_request(db_protocol_type_enum type) {
+    return type == MSG_EMPLOYEE_ADD_REQ || type == MSG_EMPLOYEE_ADD_HRS_REQ || type == MSG_EMPLOYEE_DEL_REQ ||
+        type == MSG_EMPLOYEE_DEL_ID_REQ || type == MSG_EMPLOYEE_EDIT_REQ;
+}
+
+bool is_cas_request(db_protocol_type_enum type) {
+    return type == MSG_EMPLOYEE_EDIT_CAS_REQ || type == MSG_EMPLOYEE_ADD_HRS_CAS_REQ;
+}
+
+// the record a cas request names, NULL if there is none
+struct employee_t *cas_target(struct database_t *db, db_protocol_header_t *header) {
+    db_protocol_id_req *request = (db_protocol_id_req*)((db_protocol_cas_req*)&header[1] + 1);
+    return database_find(db, ntohl(request->id));
+}
+
+// the unconditional request applied and replicated once the version matched
+void cas_plain_request(db_protocol_header_t *header, db_protocol_header_t *plain) {
+    db_protocol_cas_req *cas = (db_protocol_cas_req*)&header[1];
+    plain->type = header->type == MSG_EMPLOYEE_EDIT_CAS_REQ ? MSG_EMPLOYEE_EDIT_REQ : MSG_EMPLOYEE_ADD_HRS_REQ;
+    plain->len = 1;
+    memcpy(&plain[1], &cas[1], request_payload_size(plain->type));
+}
+
+// applies a mutation to the in memory database, shared by clients and replication
+int apply_write_request(struct database_t *db, db_protocol_header_t *header) {
+
+    if (header->type == MSG_EMPLOYEE_DEL_REQ) {
+        db_protocol_name_req* employee = (db_protocol_name_req*)&header[1];
+        size_t len = ntohs(employee->name_len);
+        if (len > PROTOCOL_TEXT_MAX) {
+            printf("Malformed remove request\n");
+            return STATUS_ERROR;
+        }
+
+        // stored names are terminated, the wire form is not
+        char name[PROTOCOL_TEXT_MAX + 1] = {0};
+        memcpy(name, employee->name, len);
+        printf("Removing employees with name: %s\n", name);
+        if (database_remove_name(db, name) == STATUS_ERROR) {
+            printf("Error removing employees!\n");
+            return STATUS_ERROR;
+        }
+
+        printf("Employees with name %s have been removed succesfully!\n", name);
+    }
+
+    if (header->type == MSG_EMPLOYEE_DEL_ID_REQ) {
+        db_protocol_id_req* employee = (db_protocol_id_req*)&header[1];
+        unsigned int id = ntohl(employee->id);
+        printf("Removing employees with id: %d\n", id);
+        if (database_remove_id(db, id) == STATUS_ERROR) {
+            printf("Error removing employees!\n");
+            return STATUS_ERROR;
+        }
+
+        printf("Employees with id %d has been removed succesfully!\n", id);
+    }
+
+    if (header->type == MSG_EMPLOYEE_EDIT_REQ) {
+        struct employee_fields_t fields;
+        if (request_decode_employee((db_protocol_employee_req*)&header[1], &fields) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        printf("Editing employee %u: %.*s\n", fields.id, (int)fields.name_len, fields.name);
+        if (database_edit(db, &fields) == STATUS_ERROR) {
+            printf("Error editing employee!\n");
+            return STATUS_ERROR;
+        }
+
+        printf("Employee has been edited succesfully!\n");
+    }
+
+    if (header->type == MSG_EMPLOYEE_ADD_REQ) {
+        struct employee_fields_t fields;
+        if (request_decode_employee((db_protocol_employee_req*)&header[1], &fields) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+
+        printf("Adding employee: %.*s\n", (int)fields.name_len, fields.name);
+        if (database_add(db, &fields) == STATUS_ERROR) {
+            printf("Error adding new employee!\n");
+            return STATUS_ERROR;
+        }
+
+        printf("Employee was added succesfully!\n");
+    }
+
+    if (header->type == MSG_EMPLOYEE_ADD_HRS_REQ) {
+        db_protocol_hours_req* employee = (db_protocol_hours_req*)&header[1];
+        unsigned int id = ntohl(employee->id);
+        unsigned int hours = ntohl(employee->hours);
+        printf("Adding %u hours to employee %u\n", hours, id);
+
+        if (database_add_hours(db, id, hours) == STATUS_ERROR) {
+            printf("Error adding hours!\n");
+            return STATUS_ERROR;
+        }
+
+        printf("Hours were added successfully!\n");
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void fsm_reply_status(ClientState_t *client, db_protocol_header_t *header, struct replication_t *repl, struct database_t *db, struct overload_t *overload) {
+    header->type = htonl(MSG_STATUS_RESP);
+    header->len = htonl(1);
+
+    // the payload starts at an unaligned offset of the client buffer
+    db_protocol_status_resp status;
+    replication_status(repl, &status);
+    status.list_hits = htobe64(db->list_hits);
+    status.list_misses = htobe64(db->list_misses);
+    status.loop_lag_us = htobe64(overload->lag_us);
+    status.shed = htobe64(overload->shed);
+    memcpy(&header[1], &status, sizeof(status));
+
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_status_resp));
+}
+
+// requests are handled one at a time, nothing can change the record between the version check and the write
+int fsm_reply_cas(ClientState_t *client, db_protocol_header_t *header, struct replication_t *repl, struct database_t *db) {
+
+    db_protocol_cas_req *cas = (db_protocol_cas_req*)&header[1];
+    unsigned int expected = ntohl(cas->version);
+
+    struct employee_t *employee = cas_target(db, header);
+    unsigned int id = ntohl(((db_protocol_id_req*)&cas[1])->id);
+    if (employee == NULL) {
+        printf("Employee with id %d does not exist!\n", id);
+        fsm_reply_err(client, header);
+        return STATUS_SUCCESS;
+    }
+
+    db_protocol_type_enum type = header->type;
+    bool applied = employee->version == expected;
+
+    if (applied) {
+        // replicas apply the plain request and count the same versions
+        char request[BUFFER_SIZE];
+        db_protocol_header_t *plain = (db_protocol_header_t*)request;
+        cas_plain_request(header, plain);
+
+        if (apply_write_request(db, plain) == STATUS_ERROR) {
+            fsm_reply_err(client, header);
+            return STATUS_ERROR;
+        }
+
+        replication_queue(repl, plain);
+        employee = database_find(db, id);
+    } else {
+        printf("Version mismatch for employee %d, expected %u but it is at %u\n", id, expected, employee->version);
+    }
+
+    header->type = htonl(type + 1);
+    header->len = htonl(1);
+    db_protocol_cas_resp *response = (db_protocol_cas_resp*)&header[1];
+    memset(response, 0, sizeof(*response));
+    response->id = htonl(id);
+    response->version = htonl(employee->version);
+    response->applied = htons(applied);
+
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_cas_resp));
+
+    if (applied) {
+        database_persist(db);
+    }
+    return STATUS_SUCCESS;
+}
+
+void fsm_reply_commit(ClientState_t *client, db_protocol_header_t *header, struct replication_t *repl, struct database_t *db) {
+
+    db_protocol_txn_resp result;
+    if (txn_commit(db, repl, client, &result) == STATUS_ERROR) {
+        txn_drop_client(client);
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    header->type = htonl(MSG_TXN_COMMIT_RESP);
+    header->len = htonl(1);
+    db_protocol_txn_resp *response = (db_protocol_txn_resp*)&header[1];
+    memset(response, 0, sizeof(*response));
+    response->count = htonl(result.count);
+    response->failed = htonl(result.failed);
+    response->committed = htons(result.committed);
+
+    client_write(client, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_txn_resp));
+}
+
+// only offered over the unix socket, the fd can not be passed any other way
+static void fsm_reply_shm_attach(ClientState_t *client, db_protocol_header_t *header) {
+
+    int fd = -1;
+    if (!client->local || client->shm != NULL || client->txn != NULL || (client->shm = shm_create(&fd)) == NULL) {
+        printf("Rejecting shared memory attach\n");
+        fsm_reply_err(client, header);
+        return;
+    }
+
+    shm_end_init(&client->shm_in, shm_requests(client->shm), SHM_REQUEST_RING, false);
+    shm_end_init(&client->shm_out, shm_replies(client->shm), SHM_REPLY_RING, true);
+
+    header->type = htonl(MSG_SHM_ATTACH_RESP);
+    header->len = htonl(1);
+    db_protocol_shm_resp *resp = (db_protocol_shm_resp*)&header[1];
+    resp->size = htonl(shm_channel_size());
+
+    // the reply itself still goes over the socket
+    if (shm_send_fd(client->fd, header, sizeof(db_protocol_header_t) + sizeof(db_protocol_shm_resp), fd) == STATUS_ERROR) {
+        client_shm_detach(client);
+        fsm_reply_err(client, header);
+    }
+    close(fd);
+}
+
+int handle_client_fsm(struct database_t *db, ClientState_t *client, struct replication_t *repl, struct feed_t *feed, struct overload_t *overload) {
     db_protocol_header_t *header = (db_protocol_header_t*)client->buffer;
     header->type = ntohl(header->type);
-    header->len = ntohs(header->len);
+    header->len = ntohl(header->len);
 
     if (client->state == STATE_HELLO) {
-        if (header->type != MSG_HELLO_REQ || header->len != 1) {
+        // len is not checked, its width depends on the protocol version being negotiated
+        if (header->type != MSG_HELLO_REQ) {
             printf("Didn't get MSG_HELLO in HELLO state\n");
             fsm_reply_err(client, header);
             return STATUS_ERROR;
@@ -101,92 +899,169 @@ int handle_client_fsm(struct dbheader_t *database_header, struct employee_t **em
             return STATUS_ERROR;
         }
 
+        client->features = ntohs(hello->features) & PROTOCOL_FEATURES;
         fsm_reply_hello(client, header);
         client->state = STATE_MSG;
     }
 
+    if (client->state == STATE_REPLICA) {
+        if (header->type != MSG_REPL_ACK) {
+            printf("Unexpected message from replica\n");
+            return STATUS_ERROR;
+        }
+
+        // the payload starts at an unaligned offset of the client buffer
+        db_protocol_repl_ack ack;
+        memcpy(&ack, &header[1], sizeof(ack));
+        client->repl_seq = be64toh(ack.seq);
+    }
+
+    // subscribers only receive, anything they send is ignored
+    if (client->state == STATE_SUBSCRIBER) {
+        return STATUS_SUCCESS;
+    }
+
     if (client->state == STATE_MSG) {
 
-        if (header->type == MSG_EMPLOYEE_DEL_REQ) {
-            db_protocol_data_req* employee = (db_protocol_data_req*)&header[1];
-            printf("Removing employees with name: %s\n", employee->data);
-            if (remove_employee(database_header, employees, (char*)employee->data) == STATUS_ERROR) {
-                printf("Error removing employees!\n");
+        // writes inside a transaction are only staged, the commit applies them
+        if (client->txn != NULL && (is_write_request(header->type) || is_cas_request(header->type))) {
+            if (txn_stage(client, header) == STATUS_ERROR) {
                 fsm_reply_err(client, header);
-                return STATUS_ERROR;
+                return STATUS_SUCCESS;
             }
 
-            printf("Employees with name %s have been removed succesfully!\n", employee->data);
-            fsm_reply_success(client, header, MSG_EMPLOYEE_DEL_RESP);
-            output_file(database_header, *employees, filepath);
+            // len tells the client how many requests are staged so far
+            header->type = htonl(MSG_TXN_STAGED);
+            header->len = htonl(client->txn_count);
+            client_write(client, header, sizeof(db_protocol_header_t));
+            return STATUS_SUCCESS;
         }
 
-        if (header->type == MSG_EMPLOYEE_DEL_ID_REQ) {
-            db_protocol_id_req* employee = (db_protocol_id_req*)&header[1];
-            employee->id = ntohl(employee->id);
-            printf("Removing employees with id: %d\n", employee->id);
-            if (remove_employee_id(database_header, employees, employee->id) == STATUS_ERROR) {
-                printf("Error removing employees!\n");
+        if (header->type == MSG_TXN_BEGIN_REQ) {
+            if (repl->role == ROLE_REPLICA || txn_begin(client) == STATUS_ERROR) {
+                printf("Rejecting transaction\n");
                 fsm_reply_err(client, header);
-                return STATUS_ERROR;
+                return STATUS_SUCCESS;
             }
-
-            printf("Employees with id %d has been removed succesfully!\n", employee->id);
-            fsm_reply_success(client, header, MSG_EMPLOYEE_DEL_ID_RESP);
-            output_file(database_header, *employees, filepath);
+            fsm_reply_success(client, header, MSG_TXN_BEGIN_RESP);
         }
 
-        if (header->type == MSG_EMPLOYEE_EDIT_REQ) {
-            db_protocol_data_req* employee = (db_protocol_data_req*)&header[1];
-            printf("Editing employee : %s\n", employee->data);
-            if (edit_employee(database_header, *employees, employee->data) == STATUS_ERROR) {
-                printf("Error removing employees!\n");
+        if (header->type == MSG_TXN_COMMIT_REQ || header->type == MSG_TXN_ABORT_REQ) {
+            if (client->txn == NULL) {
+                printf("No transaction in progress\n");
                 fsm_reply_err(client, header);
-                return STATUS_ERROR;
+                return STATUS_SUCCESS;
             }
 
-            printf("Employee has been edited succesfully!\n");
-            fsm_reply_success(client, header, MSG_EMPLOYEE_EDIT_RESP);
-            output_file(database_header, *employees, filepath);
+            if (header->type == MSG_TXN_COMMIT_REQ) {
+                fsm_reply_commit(client, header, repl, db);
+            } else {
+                printf("Aborted transaction of %u requests\n", client->txn_count);
+                txn_drop_client(client);
+                fsm_reply_success(client, header, MSG_TXN_ABORT_RESP);
+            }
         }
 
-        if (header->type == MSG_EMPLOYEE_ADD_REQ) {
-            db_protocol_data_req* employee = (db_protocol_data_req*)&header[1];
-            printf("Adding employee: %s\n", employee->data);
+        if (is_write_request(header->type)) {
+            if (repl->role == ROLE_REPLICA) {
+                printf("Rejecting write request on read-only replica\n");
+                fsm_reply_err(client, header);
+                return STATUS_SUCCESS;
+            }
 
-            if (add_employee(database_header, employees, (char*)employee->data) == STATUS_ERROR) {
-                printf("Error adding new employee!\n");
+            if (apply_write_request(db, header) == STATUS_ERROR) {
                 fsm_reply_err(client, header);
                 return STATUS_ERROR;
             }
 
-            printf("Employee was added succesfully!\n");
-            fsm_reply_success(client, header, MSG_EMPLOYEE_ADD_RESP);
-            output_file(database_header, *employees, filepath);
+            replication_queue(repl, header);
+            fsm_reply_success(client, header, header->type + 1);
+            database_persist(db);
+        }
+
+        if (header->type == MSG_EMPLOYEE_EDIT_CAS_REQ || header->type == MSG_EMPLOYEE_ADD_HRS_CAS_REQ) {
+            if (repl->role == ROLE_REPLICA) {
+                printf("Rejecting write request on read-only replica\n");
+                fsm_reply_err(client, header);
+                return STATUS_SUCCESS;
+            }
 
+            if (fsm_reply_cas(client, header, repl, db) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
         }
 
         if (header->type == MSG_EMPLOYEE_LIST_REQ) {
             printf("Sending employee list..\n");
-            fsm_reply_list(client, header, database_header, *employees);
+            fsm_reply_list(client, header, db);
+        }
+
+        if (header->type == MSG_EMPLOYEE_PAGE_REQ) {
+            fsm_reply_page(client, header, db);
         }
 
-        if (header->type == MSG_EMPLOYEE_ADD_HRS_REQ) {
-            db_protocol_data_req* employee = (db_protocol_data_req*)&header[1];
-            printf("Adding hours to employee: %s\n", employee->data);
+        if (header->type == MSG_EMPLOYEE_RANGE_REQ) {
+            printf("Sending employee range..\n");
+            fsm_reply_range(client, header, db);
+        }
+
+        if (header->type == MSG_EMPLOYEE_SEARCH_REQ) {
+            printf("Sending search results..\n");
+            fsm_reply_search(client, header, db);
+        }
+
+        if (header->type == MSG_HOURS_SUM_REQ) {
+            fsm_reply_hours_sum(client, header, db);
+        }
 
-            if (add_hours(database_header, *employees, (char*)employee->data) == STATUS_ERROR) {
-                printf("Error adding hours!\n");
+        if (header->type == MSG_HOURS_TOP_REQ) {
+            printf("Sending hours totals..\n");
+            fsm_reply_hours_top(client, header, db);
+        }
+
+        // feeds and replication write to the socket directly
+        if (client->shm != NULL && (header->type == MSG_SUBSCRIBE_REQ || header->type == MSG_REPL_SUBSCRIBE_REQ)) {
+            printf("Shared memory clients can not subscribe\n");
+            fsm_reply_err(client, header);
+            return STATUS_SUCCESS;
+        }
+
+        if (header->type == MSG_SHM_ATTACH_REQ) {
+            fsm_reply_shm_attach(client, header);
+        }
+
+        if (header->type == MSG_SUBSCRIBE_REQ) {
+            if (feed_subscribe(feed, client, header) == STATUS_ERROR) {
+                printf("Error subscribing to the change feed!\n");
+                return STATUS_ERROR;
+            }
+        }
+
+        if (header->type == MSG_STATUS_REQ) {
+            fsm_reply_status(client, header, repl, db, overload);
+        }
+
+        if (header->type == MSG_REPL_SUBSCRIBE_REQ) {
+            if (repl->role == ROLE_REPLICA) {
+                printf("Replicas can not be replicated from\n");
                 fsm_reply_err(client, header);
                 return STATUS_ERROR;
             }
 
-            printf("Hours were added successfully!\n");
-            fsm_reply_success(client, header, MSG_EMPLOYEE_ADD_HRS_RESP);
-            output_file(database_header, *employees, filepath);
+            if (replication_send_snapshot(repl, client, db) == STATUS_ERROR) {
+                printf("Error sending snapshot to replica!\n");
+                return STATUS_ERROR;
+            }
+        }
+
+        if (header->type == MSG_REPL_PROMOTE_REQ) {
+            if (repl->role == ROLE_REPLICA) {
+                replication_promote(repl);
+            }
+            fsm_reply_success(client, header, MSG_REPL_PROMOTE_RESP);
         }
     }
 
     return STATUS_SUCCESS;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "feed.h"
+#include "db_poll.h"
+#include "common.h"
+#include "parse.h"
+
+int feed_init(struct feed_t *feed, ClientState_t *clients) {
+
+    memset(feed, 0, sizeof(*feed));
+    feed->clients = clients;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    feed->epoch = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    feed->events = calloc(FEED_HISTORY, sizeof(struct feed_event_t));
+    if (feed->events == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void feed_close(struct feed_t *feed) {
+    free(feed->events);
+    feed->events = NULL;
+}
+
+// called by the database for every record a write touched, without a record when everything was replaced
+void feed_record(void *context, db_protocol_change_enum change, db_protocol_list_resp *record) {
+
+    struct feed_t *feed = context;
+    feed->seq++;
+
+    if (record == NULL) {
+        feed->reset_seq = feed->seq;
+        return;
+    }
+
+    struct feed_event_t *event = &feed->events[feed->seq % FEED_HISTORY];
+    event->seq = feed->seq;
+    event->change = change;
+    event->record = *record;
+}
+
+static bool in_history(struct feed_t *feed, uint64_t seq) {
+    return seq > feed->reset_seq && seq <= feed->seq && feed->seq - seq < FEED_HISTORY;
+}
+
+static void append_position(ClientState_t *client, db_protocol_type_enum type, struct feed_t *feed, bool resync) {
+
+    db_protocol_header_t *header = (db_protocol_header_t*)&client->out[client->out_len];
+    header->type = htonl(type);
+    header->len = htonl(1);
+
+    // events follow each other at any offset of out, so payloads are copied in
+    db_protocol_subscribe_resp position = {0};
+    position.epoch = htobe64(feed->epoch);
+    position.seq = htobe64(feed->seq);
+    position.resync = htons(resync);
+    memcpy(&header[1], &position, sizeof(position));
+
+    client->out_len += sizeof(db_protocol_header_t) + sizeof(db_protocol_subscribe_resp);
+}
+
+static void append_event(ClientState_t *client, struct feed_event_t *event) {
+
+    db_protocol_header_t *header = (db_protocol_header_t*)&client->out[client->out_len];
+    header->type = htonl(MSG_CHANGE_EVENT);
+    header->len = htonl(1);
+
+    db_protocol_change_event change = {0};
+    change.seq = htobe64(event->seq);
+    change.change = htonl(event->change);
+    change.id = event->record.id;
+    memcpy(&header[1], &change, sizeof(change));
+    client->out_len += sizeof(db_protocol_header_t) + sizeof(db_protocol_change_event);
+
+    if (event->change == CHANGE_DELETE) {
+        return;
+    }
+
+    memcpy(&client->out[client->out_len], &event->record, sizeof(db_protocol_list_resp));
+    client->out_len += sizeof(db_protocol_list_resp);
+}
+
+int feed_subscribe(struct feed_t *feed, ClientState_t *client, db_protocol_header_t *header) {
+
+    db_protocol_subscribe_req request;
+    memcpy(&request, &header[1], sizeof(request));
+    uint64_t epoch = be64toh(request.epoch);
+    uint64_t seq = be64toh(request.seq);
+
+    // replies before the subscription were all taken, their buffer is replaced by a fixed one
+    feed_drop_client(client);
+    client->out = malloc(FEED_CLIENT_BUFFER);
+    if (client->out == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+    client->out_cap = FEED_CLIENT_BUFFER;
+
+    // events after seq are still here, otherwise the subscriber has to reload first
+    bool resume = seq != 0 && epoch == feed->epoch && (seq == feed->seq ? seq >= feed->reset_seq : in_history(feed, seq + 1));
+    client->feed_seq = resume ? seq : feed->seq;
+    client->state = STATE_SUBSCRIBER;
+
+    append_position(client, MSG_SUBSCRIBE_RESP, feed, !resume);
+    printf("Subscriber %s at seq %lu\n", resume ? "resumed" : "started", client->feed_seq);
+    return STATUS_SUCCESS;
+}
+
+void feed_drop_client(ClientState_t *client) {
+    free(client->out);
+    client->out = NULL;
+    client->out_len = 0;
+    client->out_sent = 0;
+    client->out_cap = 0;
+    client->repl_snapshot_len = 0;
+}
+
+// fills each subscriber's buffer from the history and writes what the socket takes without blocking
+void feed_flush(struct feed_t *feed) {
+
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        ClientState_t *client = &feed->clients[i];
+        if (client->state != STATE_SUBSCRIBER) {
+            continue;
+        }
+
+        while (client->feed_seq < feed->seq && client->out_len + FEED_EVENT_MAX <= FEED_CLIENT_BUFFER) {
+            if (!in_history(feed, client->feed_seq + 1)) {
+                printf("Subscriber fell behind at seq %lu, asking it to resync\n", client->feed_seq);
+                client->feed_seq = feed->seq;
+                append_position(client, MSG_CHANGE_RESYNC, feed, true);
+                break;
+            }
+
+            client->feed_seq++;
+            append_event(client, &feed->events[client->feed_seq % FEED_HISTORY]);
+        }
+
+        if (client->out_len == 0) {
+            continue;
+        }
+
+        ssize_t written = send(client->fd, client->out, client->out_len, MSG_DONTWAIT);
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("Lost subscriber, closing the connection\n");
+            close(client->fd);
+            client->fd = -1;
+            client->state = STATE_DISCONNECTED;
+            feed_drop_client(client);
+            continue;
+        }
+
+        if (written > 0) {
+            memmove(client->out, client->out + written, client->out_len - written);
+            client->out_len -= written;
+        }
+    }
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "index.h"
+#include "parse.h"
+#include "common.h"
+
+// first position with an id >= id
+uint64_t lower_bound_id(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int id) {
+
+    uint64_t low = 0;
+    uint64_t high = dbHeader->count;
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (employees[middle].id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+struct employee_t *find_employee(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int id) {
+
+    uint64_t position = lower_bound_id(dbHeader, employees, id);
+    if (position == dbHeader->count || employees[position].id != id) {
+        return NULL;
+    }
+
+    return &employees[position];
+}
+
+static int compare_hours(const void *a, const void *b) {
+    const struct hours_entry_t *first = a;
+    const struct hours_entry_t *second = b;
+
+    if (first->hours != second->hours) {
+        return (first->hours > second->hours) - (first->hours < second->hours);
+    }
+    return (first->position > second->position) - (first->position < second->position);
+}
+
+// positions follow id order, so ties on hours come out ordered by id
+int build_hours_index(struct dbheader_t *dbHeader, struct employee_t *employees, struct hours_entry_t **indexOut, uint64_t *capacityOut) {
+
+    if (dbHeader->count == 0) {
+        free(*indexOut);
+        *indexOut = NULL;
+        *capacityOut = 0;
+        return STATUS_SUCCESS;
+    }
+
+    struct hours_entry_t *index = realloc(*indexOut, dbHeader->count * sizeof(struct hours_entry_t));
+    if (index == NULL) {
+        perror("realloc");
+        return STATUS_ERROR;
+    }
+
+    uint64_t i=0;
+    for (i=0;i<dbHeader->count;i++) {
+        index[i].hours = employees[i].hours;
+        index[i].position = i;
+    }
+
+    qsort(index, dbHeader->count, sizeof(struct hours_entry_t), compare_hours);
+
+    *indexOut = index;
+    *capacityOut = dbHeader->count;
+    return STATUS_SUCCESS;
+}
+
+// first entry with hours >= hours
+uint64_t lower_bound_hours(struct hours_entry_t *index, uint64_t count, unsigned int hours) {
+
+    uint64_t low = 0;
+    uint64_t high = count;
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (index[middle].hours < hours) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// first entry ordered at or after hours then position
+static uint64_t lower_bound_entry(struct hours_entry_t *index, uint64_t count, unsigned int hours, unsigned int position) {
+
+    uint64_t low = 0;
+    uint64_t high = count;
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (index[middle].hours < hours || (index[middle].hours == hours && index[middle].position < position)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// a record added at position of count indexed ones. records from position on move up one
+int hours_index_insert(struct hours_entry_t **index, uint64_t count, uint64_t *capacity, unsigned int hours, unsigned int position) {
+
+    if (count == *capacity) {
+        uint64_t grown = *capacity > 0 ? *capacity * 2 : 64;
+        struct hours_entry_t *resized = realloc(*index, grown * sizeof(struct hours_entry_t));
+        if (resized == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        *index = resized;
+        *capacity = grown;
+    }
+
+    struct hours_entry_t *entries = *index;
+    uint64_t i=0;
+    if (position < count) {
+        for (i=0;i<count;i++) {
+            if (entries[i].position >= position) {
+                entries[i].position++;
+            }
+        }
+    }
+
+    uint64_t at = lower_bound_entry(entries, count, hours, position);
+    memmove(&entries[at + 1], &entries[at], (count - at) * sizeof(struct hours_entry_t));
+    entries[at].hours = hours;
+    entries[at].position = position;
+    return STATUS_SUCCESS;
+}
+
+// the record at position changed its hours, only the entries between its old and new place move
+void hours_index_move(struct hours_entry_t *index, uint64_t count, unsigned int oldHours, unsigned int hours, unsigned int position) {
+
+    if (oldHours == hours) {
+        return;
+    }
+
+    uint64_t from = lower_bound_entry(index, count, oldHours, position);
+    if (from == count || index[from].position != position) {
+        return;
+    }
+
+    uint64_t to = lower_bound_entry(index, count, hours, position);
+    if (to > from) {
+        to--;
+        memmove(&index[from], &index[from + 1], (to - from) * sizeof(struct hours_entry_t));
+    } else {
+        memmove(&index[to + 1], &index[to], (from - to) * sizeof(struct hours_entry_t));
+    }
+    index[to].hours = hours;
+    index[to].position = position;
+}
+
+// the record at position of count indexed ones was removed, the ones after it move down one
+void hours_index_remove(struct hours_entry_t *index, uint64_t count, unsigned int hours, unsigned int position) {
+
+    uint64_t at = lower_bound_entry(index, count, hours, position);
+    if (at == count || index[at].position != position) {
+        return;
+    }
+
+    memmove(&index[at], &index[at + 1], (count - at - 1) * sizeof(struct hours_entry_t));
+    count--;
+
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        if (index[i].position > position) {
+            index[i].position--;
+        }
+    }
+}
+
+// after removing many records at once. remap holds the new position of each of the count
+// old ones, or UINT_MAX for the removed. surviving records keep their order, so no sort
+void hours_index_remap(struct hours_entry_t *index, uint64_t count, const unsigned int *remap) {
+
+    uint64_t kept = 0;
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        unsigned int position = remap[index[i].position];
+        if (position != UINT_MAX) {
+            index[kept].hours = index[i].hours;
+            index[kept++].position = position;
+        }
+    }
+}
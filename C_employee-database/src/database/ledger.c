@@ -0,0 +1,652 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "ledger.h"
+#include "crc32c.h"
+#include "common.h"
+
+#define LEDGER_VARINT_MAX 5
+#define LEDGER_COLUMNS_MAX (LEDGER_BLOCK_ENTRIES * 3 * LEDGER_VARINT_MAX)
+
+// sums for a query, open addressing on id. ids start at 1, so 0 marks a free slot
+struct ledger_totals_t {
+    struct ledger_sum_t *sums;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+// 1970-01-01 was a thursday, weeks start on monday
+static uint32_t week_of(uint64_t day) {
+    return (uint32_t)((day + 3) / 7);
+}
+
+static uint8_t *put_varint(uint8_t *out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, uint32_t *valueOut) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (in < end && shift < 7 * LEDGER_VARINT_MAX) {
+        uint8_t byte = *in++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *valueOut = value;
+            return in;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+// entries of one day, returns the size of the header and columns written to out
+static size_t encode_block(uint32_t magic, struct ledger_entry_t *entries, uint32_t count, uint8_t *out) {
+
+    struct ledger_block_header_t *header = (struct ledger_block_header_t*)out;
+    uint8_t *columns = out + sizeof(*header);
+    uint8_t *op = columns;
+    uint64_t hours = 0;
+
+    uint32_t previous = entries[0].time;
+    uint32_t i=0;
+    for (i=0;i<count;i++) {
+        op = put_varint(op, entries[i].time - previous);
+        previous = entries[i].time;
+    }
+
+    previous = 0;
+    for (i=0;i<count;i++) {
+        int32_t delta = (int32_t)(entries[i].id - previous);
+        op = put_varint(op, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        previous = entries[i].id;
+    }
+
+    for (i=0;i<count;i++) {
+        op = put_varint(op, entries[i].hours);
+        hours += entries[i].hours;
+    }
+
+    header->magic = htonl(magic);
+    header->day = htonl(entries[0].time / LEDGER_DAY);
+    header->count = htonl(count);
+    header->first = htonl(entries[0].time);
+    header->size = htonl(op - columns);
+    header->crc = htonl(crc32c(0, columns, op - columns));
+    header->hours = htobe64(hours);
+    return op - out;
+}
+
+static int decode_block(struct ledger_block_header_t *header, const uint8_t *columns, struct ledger_entry_t *entries) {
+
+    const uint8_t *ip = columns;
+    const uint8_t *end = columns + header->size;
+    uint32_t value = 0;
+
+    uint32_t time = header->first;
+    uint32_t i=0;
+    for (i=0;i<header->count;i++) {
+        if ((ip = get_varint(ip, end, &value)) == NULL) return STATUS_ERROR;
+        time += value;
+        entries[i].time = time;
+    }
+
+    uint32_t id = 0;
+    for (i=0;i<header->count;i++) {
+        if ((ip = get_varint(ip, end, &value)) == NULL) return STATUS_ERROR;
+        id += (value >> 1) ^ -(value & 1);
+        entries[i].id = id;
+    }
+
+    for (i=0;i<header->count;i++) {
+        if ((ip = get_varint(ip, end, &value)) == NULL) return STATUS_ERROR;
+        entries[i].hours = value;
+    }
+
+    return ip == end ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+// the sealed or delta block at offset, STATUS_ERROR when it is missing, torn or corrupted
+static int read_block(struct ledger_t *ledger, uint64_t offset, struct ledger_block_header_t *headerOut, struct ledger_entry_t *entries) {
+
+    struct ledger_block_header_t header;
+    if (pread(ledger->fd, &header, sizeof(header), offset) != sizeof(header)) {
+        return STATUS_ERROR;
+    }
+
+    header.magic = ntohl(header.magic);
+    header.day = ntohl(header.day);
+    header.count = ntohl(header.count);
+    header.first = ntohl(header.first);
+    header.size = ntohl(header.size);
+    header.crc = ntohl(header.crc);
+    header.hours = be64toh(header.hours);
+    if ((header.magic != LEDGER_MAGIC && header.magic != LEDGER_DELTA_MAGIC) || header.count == 0 || header.count > LEDGER_BLOCK_ENTRIES || header.size > LEDGER_COLUMNS_MAX) {
+        return STATUS_ERROR;
+    }
+
+    uint8_t columns[LEDGER_COLUMNS_MAX];
+    if (pread(ledger->fd, columns, header.size, offset + sizeof(header)) != (ssize_t)header.size ||
+        crc32c(0, columns, header.size) != header.crc ||
+        decode_block(&header, columns, entries) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    *headerOut = header;
+    return STATUS_SUCCESS;
+}
+
+static struct ledger_rollup_t *rollup_find(struct ledger_rollup_t *rollups, uint32_t count, uint32_t period) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (rollups[middle].period < period) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < count && rollups[low].period == period ? &rollups[low] : NULL;
+}
+
+static uint32_t lower_bound_sum(struct ledger_rollup_t *rollup, uint32_t id) {
+    uint32_t low = 0;
+    uint32_t high = rollup->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (rollup->sums[middle].id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// entries arrive in time order, so the period is the last one or a new one after it
+static int rollup_add(struct ledger_rollup_t **rollups, uint32_t *count, uint32_t *capacity, uint32_t period, uint32_t id, uint32_t hours) {
+
+    if (*count == 0 || (*rollups)[*count - 1].period != period) {
+        if (*count == *capacity) {
+            uint32_t grown = *capacity > 0 ? *capacity * 2 : 64;
+            struct ledger_rollup_t *resized = realloc(*rollups, grown * sizeof(struct ledger_rollup_t));
+            if (resized == NULL) {
+                perror("realloc");
+                return STATUS_ERROR;
+            }
+            *rollups = resized;
+            *capacity = grown;
+        }
+        memset(&(*rollups)[*count], 0, sizeof(struct ledger_rollup_t));
+        (*rollups)[(*count)++].period = period;
+    }
+
+    struct ledger_rollup_t *rollup = &(*rollups)[*count - 1];
+    uint32_t at = lower_bound_sum(rollup, id);
+    if (at < rollup->count && rollup->sums[at].id == id) {
+        rollup->sums[at].hours += hours;
+        return STATUS_SUCCESS;
+    }
+
+    if (rollup->count == rollup->capacity) {
+        uint32_t grown = rollup->capacity > 0 ? rollup->capacity * 2 : 16;
+        struct ledger_sum_t *resized = realloc(rollup->sums, grown * sizeof(struct ledger_sum_t));
+        if (resized == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        rollup->sums = resized;
+        rollup->capacity = grown;
+    }
+
+    memmove(&rollup->sums[at + 1], &rollup->sums[at], (rollup->count - at) * sizeof(struct ledger_sum_t));
+    rollup->sums[at].id = id;
+    rollup->sums[at].hours = hours;
+    rollup->count++;
+    return STATUS_SUCCESS;
+}
+
+static int ledger_index(struct ledger_t *ledger, struct ledger_entry_t *entry) {
+    uint32_t day = entry->time / LEDGER_DAY;
+    if (rollup_add(&ledger->days, &ledger->day_count, &ledger->day_capacity, day, entry->id, entry->hours) == STATUS_ERROR ||
+        rollup_add(&ledger->weeks, &ledger->week_count, &ledger->week_capacity, week_of(day), entry->id, entry->hours) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+static int add_block(struct ledger_t *ledger, uint64_t offset, uint32_t day, uint32_t count) {
+    if (ledger->block_count == ledger->block_capacity) {
+        uint64_t grown = ledger->block_capacity > 0 ? ledger->block_capacity * 2 : 64;
+        struct ledger_block_t *resized = realloc(ledger->blocks, grown * sizeof(struct ledger_block_t));
+        if (resized == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        ledger->blocks = resized;
+        ledger->block_capacity = grown;
+    }
+
+    ledger->blocks[ledger->block_count].offset = offset;
+    ledger->blocks[ledger->block_count].day = day;
+    ledger->blocks[ledger->block_count].count = count;
+    ledger->block_count++;
+    return STATUS_SUCCESS;
+}
+
+// reads every block once to rebuild the rollups, a torn block at the end is cut off.
+// deltas after the last sealed block are the open block, earlier ones were replaced
+int ledger_open(struct ledger_t *ledger, const char *path) {
+
+    memset(ledger, 0, sizeof(*ledger));
+    ledger->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (ledger->fd == -1) {
+        perror("open");
+        return STATUS_ERROR;
+    }
+
+    struct stat fileStat;
+    if (fstat(ledger->fd, &fileStat) == -1) {
+        perror("fstat");
+        close(ledger->fd);
+        return STATUS_ERROR;
+    }
+
+    struct ledger_entry_t *entries = malloc(LEDGER_BLOCK_ENTRIES * sizeof(struct ledger_entry_t));
+    if (entries == NULL) {
+        perror("malloc");
+        close(ledger->fd);
+        return STATUS_ERROR;
+    }
+
+    uint64_t offset = 0;
+    uint64_t total = 0;
+    struct ledger_block_header_t header;
+    while (offset < (uint64_t)fileStat.st_size && read_block(ledger, offset, &header, entries) == STATUS_SUCCESS) {
+        uint32_t i=0;
+        if (header.magic == LEDGER_DELTA_MAGIC) {
+            if (header.count > LEDGER_BLOCK_ENTRIES - ledger->tail_count) {
+                break;
+            }
+            memcpy(&ledger->tail[ledger->tail_count], entries, header.count * sizeof(struct ledger_entry_t));
+            ledger->tail_count += header.count;
+        } else {
+            if (add_block(ledger, offset, header.day, header.count) == STATUS_ERROR) {
+                free(entries);
+                ledger_close(ledger);
+                return STATUS_ERROR;
+            }
+
+            for (i=0;i<header.count;i++) {
+                if (ledger_index(ledger, &entries[i]) == STATUS_ERROR) {
+                    free(entries);
+                    ledger_close(ledger);
+                    return STATUS_ERROR;
+                }
+            }
+            total += header.count;
+            ledger->tail_count = 0;
+        }
+
+        if (ledger->first == 0) {
+            ledger->first = entries[0].time;
+        }
+        ledger->last = entries[header.count - 1].time;
+        offset += sizeof(header) + header.size;
+    }
+    free(entries);
+
+    // the open block is indexed once, no sealed copy of it follows
+    uint32_t i=0;
+    for (i=0;i<ledger->tail_count;i++) {
+        if (ledger_index(ledger, &ledger->tail[i]) == STATUS_ERROR) {
+            ledger_close(ledger);
+            return STATUS_ERROR;
+        }
+    }
+    ledger->tail_written = ledger->tail_count;
+    total += ledger->tail_count;
+
+    if (offset < (uint64_t)fileStat.st_size) {
+        printf("Dropping %lu bytes of a torn hours ledger block\n", (uint64_t)fileStat.st_size - offset);
+        if (ftruncate(ledger->fd, offset) == -1) {
+            perror("ftruncate");
+        }
+    }
+
+    ledger->end = offset;
+    printf("Hours ledger has %lu entries in %lu blocks\n", total, ledger->block_count);
+    return STATUS_SUCCESS;
+}
+
+void ledger_close(struct ledger_t *ledger) {
+
+    uint32_t i=0;
+    for (i=0;i<ledger->day_count;i++) {
+        free(ledger->days[i].sums);
+    }
+    for (i=0;i<ledger->week_count;i++) {
+        free(ledger->weeks[i].sums);
+    }
+
+    free(ledger->days);
+    free(ledger->weeks);
+    free(ledger->blocks);
+    free(ledger->pending);
+    if (ledger->fd != -1) {
+        close(ledger->fd);
+    }
+    memset(ledger, 0, sizeof(*ledger));
+    ledger->fd = -1;
+}
+
+// time never goes backwards in the ledger, an earlier clock reading is logged at the latest time
+int ledger_append(struct ledger_t *ledger, uint32_t time, uint32_t id, uint32_t hours) {
+
+    if (ledger->pending_count == ledger->pending_capacity) {
+        uint64_t grown = ledger->pending_capacity > 0 ? ledger->pending_capacity * 2 : 64;
+        struct ledger_entry_t *resized = realloc(ledger->pending, grown * sizeof(struct ledger_entry_t));
+        if (resized == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        ledger->pending = resized;
+        ledger->pending_capacity = grown;
+    }
+
+    if (time < ledger->last) {
+        time = ledger->last;
+    }
+    if (ledger->first == 0) {
+        ledger->first = time;
+    }
+    ledger->last = time;
+
+    struct ledger_entry_t *entry = &ledger->pending[ledger->pending_count++];
+    entry->time = time;
+    entry->id = id;
+    entry->hours = hours;
+    return STATUS_SUCCESS;
+}
+
+uint64_t ledger_mark(struct ledger_t *ledger) {
+    return ledger->pending_count;
+}
+
+void ledger_rewind(struct ledger_t *ledger, uint64_t mark) {
+    if (mark < ledger->pending_count) {
+        ledger->pending_count = mark;
+    }
+}
+
+// appends entries of the open block at the end of the file
+static int write_block(struct ledger_t *ledger, uint32_t magic, struct ledger_entry_t *entries, uint32_t count, uint8_t *buffer) {
+    size_t size = encode_block(magic, entries, count, buffer);
+    if (pwrite(ledger->fd, buffer, size, ledger->end) != (ssize_t)size) {
+        perror("pwrite");
+        return STATUS_ERROR;
+    }
+    ledger->end += size;
+    return STATUS_SUCCESS;
+}
+
+// moves pending entries into the open block, sealing it when it is full or the day changes.
+// nothing written before is ever overwritten, the entries still open go out as a delta
+int ledger_flush(struct ledger_t *ledger) {
+
+    if (ledger->pending_count == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    uint8_t *buffer = malloc(sizeof(struct ledger_block_header_t) + LEDGER_COLUMNS_MAX);
+    if (buffer == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    int status = STATUS_SUCCESS;
+    uint64_t i=0;
+    for (i=0;i<ledger->pending_count && status == STATUS_SUCCESS;i++) {
+        struct ledger_entry_t *entry = &ledger->pending[i];
+
+        if (ledger->tail_count == LEDGER_BLOCK_ENTRIES ||
+            (ledger->tail_count > 0 && entry->time / LEDGER_DAY != ledger->tail[0].time / LEDGER_DAY)) {
+            uint64_t offset = ledger->end;
+            if (write_block(ledger, LEDGER_MAGIC, ledger->tail, ledger->tail_count, buffer) == STATUS_ERROR ||
+                add_block(ledger, offset, ledger->tail[0].time / LEDGER_DAY, ledger->tail_count) == STATUS_ERROR) {
+                status = STATUS_ERROR;
+                break;
+            }
+            ledger->tail_count = 0;
+            ledger->tail_written = 0;
+        }
+
+        ledger->tail[ledger->tail_count++] = *entry;
+        status = ledger_index(ledger, entry);
+    }
+
+    if (status == STATUS_SUCCESS && ledger->tail_count > ledger->tail_written) {
+        status = write_block(ledger, LEDGER_DELTA_MAGIC, &ledger->tail[ledger->tail_written], ledger->tail_count - ledger->tail_written, buffer);
+        if (status == STATUS_SUCCESS) {
+            ledger->tail_written = ledger->tail_count;
+        }
+    }
+    if (status == STATUS_SUCCESS && fdatasync(ledger->fd) == -1) {
+        perror("fdatasync");
+        status = STATUS_ERROR;
+    }
+
+    free(buffer);
+    ledger->pending_count = 0;
+    return status;
+}
+
+static int totals_add(struct ledger_totals_t *totals, uint32_t id, uint64_t hours) {
+
+    if ((totals->count + 1) * 2 > totals->capacity) {
+        uint64_t grown = totals->capacity > 0 ? totals->capacity * 2 : 64;
+        struct ledger_sum_t *resized = calloc(grown, sizeof(struct ledger_sum_t));
+        if (resized == NULL) {
+            perror("calloc");
+            return STATUS_ERROR;
+        }
+
+        uint64_t i=0;
+        for (i=0;i<totals->capacity;i++) {
+            if (totals->sums[i].id == 0) {
+                continue;
+            }
+            uint64_t slot = (totals->sums[i].id * 2654435761U) & (grown - 1);
+            while (resized[slot].id != 0) {
+                slot = (slot + 1) & (grown - 1);
+            }
+            resized[slot] = totals->sums[i];
+        }
+
+        free(totals->sums);
+        totals->sums = resized;
+        totals->capacity = grown;
+    }
+
+    uint64_t slot = (id * 2654435761U) & (totals->capacity - 1);
+    while (totals->sums[slot].id != 0 && totals->sums[slot].id != id) {
+        slot = (slot + 1) & (totals->capacity - 1);
+    }
+
+    if (totals->sums[slot].id == 0) {
+        totals->sums[slot].id = id;
+        totals->count++;
+    }
+    totals->sums[slot].hours += hours;
+    return STATUS_SUCCESS;
+}
+
+// a whole day or week from its rollup, for one employee or all of them when id is 0
+static int add_rollup(struct ledger_rollup_t *rollups, uint32_t count, uint32_t period, uint32_t id, struct ledger_totals_t *totals) {
+
+    struct ledger_rollup_t *rollup = rollup_find(rollups, count, period);
+    if (rollup == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    if (id != 0) {
+        uint32_t at = lower_bound_sum(rollup, id);
+        return at < rollup->count && rollup->sums[at].id == id ? totals_add(totals, id, rollup->sums[at].hours) : STATUS_SUCCESS;
+    }
+
+    uint32_t i=0;
+    for (i=0;i<rollup->count;i++) {
+        if (totals_add(totals, rollup->sums[i].id, rollup->sums[i].hours) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+static int add_entries(struct ledger_entry_t *entries, uint64_t count, uint32_t id, uint64_t from, uint64_t to, struct ledger_totals_t *totals) {
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        if (entries[i].time >= from && entries[i].time < to && (id == 0 || entries[i].id == id) &&
+            totals_add(totals, entries[i].id, entries[i].hours) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+// the raw entries of a day only part of which is queried
+static int scan_day(struct ledger_t *ledger, uint32_t day, uint32_t id, uint64_t from, uint64_t to, struct ledger_totals_t *totals) {
+
+    uint64_t low = 0;
+    uint64_t high = ledger->block_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (ledger->blocks[middle].day < day) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    struct ledger_entry_t entries[LEDGER_BLOCK_ENTRIES];
+    struct ledger_block_header_t header;
+    for (;low<ledger->block_count && ledger->blocks[low].day == day;low++) {
+        if (read_block(ledger, ledger->blocks[low].offset, &header, entries) == STATUS_ERROR) {
+            printf("Hours ledger block at %lu is corrupted\n", ledger->blocks[low].offset);
+            return STATUS_ERROR;
+        }
+        if (add_entries(entries, header.count, id, from, to, totals) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (ledger->tail_count > 0 && ledger->tail[0].time / LEDGER_DAY == day) {
+        return add_entries(ledger->tail, ledger->tail_count, id, from, to, totals);
+    }
+    return STATUS_SUCCESS;
+}
+
+// whole weeks and days come from the rollups, only the partial days at either end are scanned
+static int accumulate(struct ledger_t *ledger, uint32_t id, uint64_t from, uint64_t to, struct ledger_totals_t *totals) {
+
+    // entries not flushed yet are in neither the blocks nor the rollups
+    if (add_entries(ledger->pending, ledger->pending_count, id, from, to, totals) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (to <= from || ledger->first == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    uint64_t firstDay = from / LEDGER_DAY;
+    uint64_t lastDay = (to - 1) / LEDGER_DAY;
+    if (firstDay < ledger->first / LEDGER_DAY) {
+        firstDay = ledger->first / LEDGER_DAY;
+    }
+    if (lastDay > ledger->last / LEDGER_DAY) {
+        lastDay = ledger->last / LEDGER_DAY;
+    }
+
+    uint64_t day = 0;
+    for (day=firstDay;day<=lastDay;day++) {
+        int status = STATUS_SUCCESS;
+        if (day * LEDGER_DAY < from || (day + 1) * LEDGER_DAY > to) {
+            status = scan_day(ledger, (uint32_t)day, id, from, to, totals);
+        } else if ((day + 3) % 7 == 0 && (day + 7) * LEDGER_DAY <= to) {
+            status = add_rollup(ledger->weeks, ledger->week_count, week_of(day), id, totals);
+            day += 6;
+        } else {
+            status = add_rollup(ledger->days, ledger->day_count, (uint32_t)day, id, totals);
+        }
+
+        if (status == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// hours id logged in [from, to)
+int ledger_sum(struct ledger_t *ledger, uint32_t id, uint64_t from, uint64_t to, uint64_t *hoursOut) {
+
+    struct ledger_totals_t totals = {0};
+    int status = id == 0 ? STATUS_ERROR : accumulate(ledger, id, from, to, &totals);
+
+    *hoursOut = 0;
+    uint64_t i=0;
+    for (i=0;i<totals.capacity;i++) {
+        *hoursOut += totals.sums[i].hours;
+    }
+
+    free(totals.sums);
+    return status;
+}
+
+static int compare_sums(const void *a, const void *b) {
+    const struct ledger_sum_t *first = a;
+    const struct ledger_sum_t *second = b;
+    if (first->hours != second->hours) {
+        return first->hours < second->hours ? 1 : -1;
+    }
+    return (first->id > second->id) - (first->id < second->id);
+}
+
+// the employees with the most hours in [from, to), most first. a limit of 0 returns all of them
+int ledger_top(struct ledger_t *ledger, uint64_t from, uint64_t to, uint32_t limit, struct ledger_sum_t **topOut, uint64_t *countOut) {
+
+    struct ledger_totals_t totals = {0};
+    if (accumulate(ledger, 0, from, to, &totals) == STATUS_ERROR) {
+        free(totals.sums);
+        return STATUS_ERROR;
+    }
+
+    // packed to the front of the table, which is then sorted in place
+    uint64_t count = 0;
+    uint64_t i=0;
+    for (i=0;i<totals.capacity;i++) {
+        if (totals.sums[i].id != 0 && totals.sums[i].hours > 0) {
+            totals.sums[count++] = totals.sums[i];
+        }
+    }
+
+    qsort(totals.sums, count, sizeof(struct ledger_sum_t), compare_sums);
+    if (limit > 0 && count > limit) {
+        count = limit;
+    }
+
+    *topOut = totals.sums;
+    *countOut = count;
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "lz.h"
+#include "common.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// a sequence is a token (4 bits literal length, 4 bits match length - LZ_MIN_MATCH),
+// extra length bytes, the literals, then a 2 byte little endian offset and extra match
+// length bytes. the last sequence has only literals and ends the block
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *op, uint8_t *end, size_t length) {
+    while (length >= 255) {
+        if (op >= end) return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= end) return NULL;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op, uint8_t *end, const uint8_t *literals, size_t literalLen, size_t offset, size_t matchLen) {
+
+    if (op >= end) return NULL;
+    uint8_t *token = op++;
+    size_t matchCode = matchLen > 0 ? matchLen - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)(((literalLen < 15 ? literalLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (literalLen >= 15 && (op = write_length(op, end, literalLen - 15)) == NULL) return NULL;
+    if ((size_t)(end - op) < literalLen) return NULL;
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+
+    if (matchLen == 0) return op;
+
+    if (end - op < 2) return NULL;
+    *op++ = offset & 0xFF;
+    *op++ = (offset >> 8) & 0xFF;
+
+    if (matchCode >= 15 && (op = write_length(op, end, matchCode - 15)) == NULL) return NULL;
+    return op;
+}
+
+size_t lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+int lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+    uint8_t *op = out;
+    uint8_t *end = out + cap;
+    size_t anchor = 0;
+    size_t ip = 1;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t sequence = read32(in + ip);
+        uint32_t h = lz_hash(sequence);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)ip;
+
+        if (ip - candidate > LZ_MAX_OFFSET || read32(in + candidate) != sequence) {
+            ip++;
+            continue;
+        }
+
+        size_t matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < len && in[candidate + matchLen] == in[ip + matchLen]) {
+            matchLen++;
+        }
+
+        op = write_sequence(op, end, in + anchor, ip - anchor, ip - candidate, matchLen);
+        if (op == NULL) return STATUS_ERROR;
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, end, in + anchor, len - anchor, 0, 0);
+    if (op == NULL) return STATUS_ERROR;
+
+    return (int)(op - out);
+}
+
+static const uint8_t *read_length(const uint8_t *ip, const uint8_t *end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (ip >= end) return NULL;
+        byte = *ip++;
+        *length += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+int lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+
+    const uint8_t *ip = in;
+    const uint8_t *inEnd = in + len;
+    uint8_t *op = out;
+    uint8_t *outEnd = out + cap;
+
+    while (ip < inEnd) {
+        uint8_t token = *ip++;
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && (ip = read_length(ip, inEnd, &literalLen)) == NULL) return STATUS_ERROR;
+        if ((size_t)(inEnd - ip) < literalLen || (size_t)(outEnd - op) < literalLen) return STATUS_ERROR;
+        memcpy(op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+
+        // last sequence carries literals only
+        if (ip == inEnd) break;
+
+        if (inEnd - ip < 2) return STATUS_ERROR;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t matchLen = token & 0x0F;
+        if (matchLen == 15 && (ip = read_length(ip, inEnd, &matchLen)) == NULL) return STATUS_ERROR;
+        matchLen += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - out) || (size_t)(outEnd - op) < matchLen) return STATUS_ERROR;
+
+        // matches may overlap their own output, copy forwards
+        const uint8_t *match = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, match, matchLen);
+            op += matchLen;
+        } else {
+            while (matchLen--) *op++ = *match++;
+        }
+    }
+
+    return (int)(op - out);
+}
+
+size_t lz_frames_bound(size_t len, size_t frame) {
+    size_t frames = len / frame + 1;
+    return lz_compress_bound(len) + frames * (sizeof(db_protocol_frame) + 16);
+}
+
+// in split into frames of at most frame bytes, each a db_protocol_frame and its data, so
+// a reader can decode them as they arrive. returns the bytes written to out
+int lz_compress_frames(const uint8_t *in, size_t len, size_t frame, uint8_t *out, size_t cap) {
+
+    size_t written = 0;
+    size_t offset = 0;
+    while (offset < len) {
+        size_t raw = len - offset < frame ? len - offset : frame;
+        if (cap - written < sizeof(db_protocol_frame) + raw) {
+            return STATUS_ERROR;
+        }
+
+        uint8_t *data = out + written + sizeof(db_protocol_frame);
+
+        // frames that would not shrink are stored
+        int compressed = lz_compress(in + offset, raw, data, raw);
+        if (compressed == STATUS_ERROR || (size_t)compressed >= raw) {
+            memcpy(data, in + offset, raw);
+            compressed = (int)raw;
+        }
+
+        // frames follow each other at any offset of out, so the header is copied in
+        db_protocol_frame header;
+        header.raw_len = htonl(raw);
+        header.compressed_len = htonl(compressed);
+        memcpy(out + written, &header, sizeof(header));
+        written += sizeof(db_protocol_frame) + compressed;
+        offset += raw;
+    }
+
+    return (int)written;
+}
+
+// frame already in host order, returns raw_len once in is decoded into out
+int lz_decompress_frame(db_protocol_frame *frame, const uint8_t *in, uint8_t *out, size_t cap) {
+
+    if (frame->raw_len > cap || frame->compressed_len > frame->raw_len) {
+        return STATUS_ERROR;
+    }
+
+    if (frame->compressed_len == frame->raw_len) {
+        memcpy(out, in, frame->raw_len);
+        return (int)frame->raw_len;
+    }
+
+    if (lz_decompress(in, frame->compressed_len, out, frame->raw_len) != (int)frame->raw_len) {
+        return STATUS_ERROR;
+    }
+    return (int)frame->raw_len;
+}
@@ -3,22 +3,45 @@
 #include <stdbool.h>
 #include <getopt.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "common.h"
 #include "file.h"
 #include "parse.h"
 #include "db_poll.h"
+#include "replication.h"
+#include "feed.h"
+#include "txn.h"
+#include "maint.h"
+#include "overload.h"
+#include "shm.h"
+#include "capture.h"
+#include "database.h"
 
 void print_usage(char *argv[]) {
-	printf("Usage: %s [-n] [-f FILE] [-p PORT]\n", argv[0]);
+	printf("Usage: %s [-n] [-f FILE | -d DIR] [-p PORT]\n", argv[0]);
 	printf("  -n  -  create new database file\n");
 	printf("  -f  -  (required) path to database file\n");
+	printf("  -d  -  use a directory of shard files instead of a single file\n");
+	printf("  -S [hash:shards | range:ids] - how a new shard directory partitions ids\n");
 	printf("  -p  -  port to listen to. if absent server will run commands and exit\n");
+	printf("  -U [path] - also listen on a unix socket at path, for local clients\n");
+	printf("  -R [host]:[port] - run as a read-only replica of the primary at host:port\n");
 	printf("  -l  -  list employees\n");
+	printf("  -c  -  verify database checksums and exit\n");
+	printf("  -x [days] - expire employees with no hours that have not changed for this many days\n");
+	printf("  -L [ms][:reads|writes] - loop lag before requests are rejected, 0 never rejects. default 20\n");
+	printf("  -C [path] - record every request with its time and connection to a trace file for dbreplay\n");
 	printf("  -t [id] -  remove employee by id\n");
 	printf("  -r [name] -  remove employees by name\n");
 	printf("  -h [name],[hours] - add hours to employee by id\n");
@@ -26,27 +49,229 @@ void print_usage(char *argv[]) {
 	printf("  -e [id],[name],[address],[hours] - edit employee by id. use '.' for any fields to be left unchanged\n");
 }
 
-void close_client(ClientState_t *client) {
+void close_client(ClientState_t *client, struct wheel_t *wheel) {
 
 	close(client->fd);
 	client->fd = -1;
     client->state = STATE_DISCONNECTED;
+    client->in_len = 0;
+    wheel_cancel(wheel, &client->timer);
+    client_shm_detach(client);
+    client->local = false;
+    client->features = 0;
+    feed_drop_client(client);
+    txn_drop_client(client);
     printf("Client disconnected!\n\n");
 
 }
 
-void poll_loop(unsigned short port, struct dbheader_t *database_header, struct employee_t *employees, char* filepath) {
-	int listen_fd, conn_fd, freeSlot;
-    struct sockaddr_in server_addr, client_addr;
+static void expire_client(struct wheel_timer_t *timer, void *context) {
+
+    ClientState_t *client = (ClientState_t*)((char*)timer - offsetof(ClientState_t, timer));
+    const char *reasons[] = {"sent no hello", "left a request unfinished", "was idle", "stopped reading its replies"};
+
+    printf("Closing connection that %s\n", reasons[client->timer_kind]);
+    close_client(client, context);
+}
+
+// handles up to FAIR_FRAMES complete requests, returns STATUS_ERROR once the client was closed.
+// under overload a request may be answered with a retry-after instead
+static int serve_client(struct database_t *db, ClientState_t *client, struct replication_t *repl, struct feed_t *feed, struct wheel_t *wheel, struct overload_t *overload, struct capture_t *capture) {
+
+    int served = 0;
+    size_t size = client_frame_size(client);
+
+    while (size > 0 && served < FAIR_FRAMES && !client_blocked(client)) {
+        memcpy(client->buffer, client->in, size);
+        memmove(client->in, client->in + size, client->in_len - size);
+        client->in_len -= size;
+        served++;
+        capture_record_frame(capture, client->conn_id, client->buffer, size);
+
+        db_protocol_header_t *header = (db_protocol_header_t*)client->buffer;
+        if (!overload_admit(overload, client, ntohl(header->type))) {
+            fsm_reply_overloaded(client, header, overload_retry_after(overload));
+            size = client_frame_size(client);
+            continue;
+        }
+
+        if (handle_client_fsm(db, client, repl, feed, overload) == STATUS_ERROR) {
+            printf("Error handling the message!\n");
+            close_client(client, wheel);
+            return STATUS_ERROR;
+        }
+        overload_served(overload);
+
+        size = client_frame_size(client);
+    }
+
+    client_rearm(wheel, client);
+    return STATUS_SUCCESS;
+}
+
+// a stale socket file from an earlier run is replaced
+static int listen_local(char *path) {
+
+    struct sockaddr_un local_addr = {0};
+    local_addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(local_addr.sun_path)) {
+        printf("Socket path too long: %s\n", path);
+        return STATUS_ERROR;
+    }
+    strcpy(local_addr.sun_path, path);
+
+    int local_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (local_fd == -1) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    unlink(path);
+    if (bind(local_fd, (struct sockaddr*)&local_addr, sizeof(local_addr)) == STATUS_ERROR || listen(local_fd, BACKLOG) == STATUS_ERROR) {
+        perror("bind");
+        close(local_fd);
+        return STATUS_ERROR;
+    }
+
+    printf("Server listening on %s\n", path);
+    return local_fd;
+}
+
+static void accept_client(int listen_fd, bool local, ClientState_t *ClientStates, struct wheel_t *wheel, struct overload_t *overload) {
+
+    static uint32_t connections = 0;
+    struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
+
+    int conn_fd = accept(listen_fd, (struct sockaddr*) &client_addr, &client_len);
+    if (conn_fd == -1) {
+        perror("accept");
+        return;
+    }
+
+    if (local) {
+        printf("New local connection\n");
+    } else {
+        printf("New connection from %s:%d\n",inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    }
+
+    int freeSlot = find_free_slot(&ClientStates[0]);
+    if (freeSlot == -1) {
+        // told when to come back instead of finding the connection closed
+        printf("Server full. Closing the connection\n");
+        char reply[sizeof(db_protocol_header_t) + sizeof(db_protocol_error)];
+        ClientState_t full = {.fd = conn_fd};
+        overload->shed++;
+        fsm_reply_overloaded(&full, (db_protocol_header_t*)reply, overload_retry_after(overload));
+        free(full.out);
+        close(conn_fd);
+        return;
+    }
+
+    // replies never block the loop, what the socket does not take is queued
+    fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+
+    if (!local) {
+        // replies go out as several small writes, which nagle would hold for the client's delayed ack
+        int noDelay = 1;
+        setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+
+    ClientStates[freeSlot].fd = conn_fd;
+    ClientStates[freeSlot].conn_id = ++connections;
+    ClientStates[freeSlot].state = STATE_HELLO;
+    ClientStates[freeSlot].in_len = 0;
+    ClientStates[freeSlot].local = local;
+    ClientStates[freeSlot].timer_kind = TIMER_HANDSHAKE;
+    wheel_schedule(wheel, &ClientStates[freeSlot].timer, wheel_now_ms() + HANDSHAKE_TIMEOUT_MS);
+}
+
+// true when an attached client has requests in its ring that fit the input buffer
+static bool shm_pending(ClientState_t *client) {
+    return client->shm != NULL && client->in_len < sizeof(client->in) && shm_ring_used(&client->shm_in) > 0;
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void shm_unpark(ClientState_t *ClientStates) {
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        if (ClientStates[i].fd != -1 && ClientStates[i].shm != NULL) {
+            shm_ring_unpark(&ClientStates[i].shm_in);
+        }
+    }
+}
+
+// before poll sleeps, attached clients get a short spin to send their next request, then are
+// told to ring the socket. false if a request came in
+static bool shm_park(ClientState_t *ClientStates) {
+
+    bool attached = false;
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        attached = attached || (ClientStates[i].fd != -1 && ClientStates[i].shm != NULL);
+    }
+    if (!attached) {
+        return true;
+    }
+
+    uint64_t start = now_us();
+    do {
+        for (i=0;i<MAX_CLIENTS;i++) {
+            if (ClientStates[i].fd != -1 && shm_pending(&ClientStates[i])) {
+                return false;
+            }
+        }
+    } while (now_us() - start < shm_spin_us());
+
+    for (i=0;i<MAX_CLIENTS;i++) {
+        if (ClientStates[i].fd != -1 && ClientStates[i].shm != NULL && !shm_ring_park(&ClientStates[i].shm_in)) {
+            shm_unpark(ClientStates);
+            return false;
+        }
+    }
+    return true;
+}
+
+void poll_loop(unsigned short port, struct database_t *db, char *primary, unsigned int expireAfter, struct overload_t *overload, char *socketPath, struct capture_t *capture) {
+	int listen_fd;
+    struct sockaddr_in server_addr;
 	ClientState_t ClientStates[MAX_CLIENTS] = {0};
 
-    struct pollfd fds[MAX_CLIENTS+1];
+    // the tcp and unix listeners, the clients and the primary a replica follows
+    struct pollfd fds[MAX_CLIENTS+3];
     int nfds = 1;
     int opt = 1;
 
     init_clients(&ClientStates[0]);
 
+    // a peer going away mid write is handled where the write fails
+    signal(SIGPIPE, SIG_IGN);
+
+    struct replication_t repl;
+    if (replication_init(&repl, &ClientStates[0], primary) == STATUS_ERROR) {
+        return;
+    }
+
+    struct feed_t feed;
+    if (feed_init(&feed, &ClientStates[0]) == STATUS_ERROR) {
+        return;
+    }
+    db->on_change = feed_record;
+    db->change_context = &feed;
+
+    struct maint_t maint;
+    maint_init(&maint, expireAfter);
+
+    struct wheel_t wheel;
+    wheel_init(&wheel);
+
+    int first = 0;
+
     listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd == -1) {
         perror("socket");
@@ -78,76 +303,188 @@ void poll_loop(unsigned short port, struct dbheader_t *database_header, struct e
 
     printf("Server listening on port %d\n", port);
 
+    int local_fd = -1;
+    if (socketPath != NULL && (local_fd = listen_local(socketPath)) == STATUS_ERROR) {
+        close(listen_fd);
+        return;
+    }
+
     memset(fds, 0, sizeof(fds));
     nfds = 1;
 
     while (1) {
 		fds[0].fd = listen_fd;
     	fds[0].events = POLLIN;
+        // poll skips a negative fd
+        fds[1].fd = local_fd;
+        fds[1].events = POLLIN;
 
-        int ii=1;
+        // clients with requests still waiting their turn are served again without waiting for input
+        bool waiting = false;
+
+        int ii=2;
         int i=0;
         for (i = 0;i < MAX_CLIENTS; i++) {
             if (ClientStates[i].fd != -1) {
                 fds[ii].fd = ClientStates[i].fd;
-                fds[ii].events = POLLIN;
+                // a full input buffer is not read from until its requests were handled.
+                // attached clients only ring their socket, or close it
+                fds[ii].events = ClientStates[i].in_len < sizeof(ClientStates[i].in) || ClientStates[i].shm != NULL ? POLLIN : 0;
+                waiting = waiting || (!client_blocked(&ClientStates[i]) && (client_frame_size(&ClientStates[i]) > 0 || shm_pending(&ClientStates[i])));
+                // subscribers with buffered events wake the loop once their socket drains
+                if (ClientStates[i].out_len > 0) {
+                    fds[ii].events |= POLLOUT;
+                }
                 ii++;
             }
         }
-        int n_events = poll(fds, nfds, -1); // -1 is no timeout
+
+        // replicas keep retrying the primary until it comes back, every REPL_RETRY_MS
+        if (repl.role == ROLE_REPLICA && repl.primary_fd == -1) {
+            replication_connect(&repl);
+        }
+        int timeout = replication_timeout(&repl); // -1 is no timeout
+        int maintTimeout = maint_timeout(&maint);
+        if (maintTimeout != -1 && (timeout == -1 || maintTimeout < timeout)) {
+            timeout = maintTimeout;
+        }
+        int wheelTimeout = wheel_timeout(&wheel);
+        if (wheelTimeout != -1 && (timeout == -1 || wheelTimeout < timeout)) {
+            timeout = wheelTimeout;
+        }
+        int captureTimeout = capture_timeout(capture);
+        if (captureTimeout != -1 && (timeout == -1 || captureTimeout < timeout)) {
+            timeout = captureTimeout;
+        }
+        if (waiting) {
+            timeout = 0;
+        }
+        if (repl.primary_fd != -1) {
+            fds[ii].fd = repl.primary_fd;
+            // writable once a connect in progress finished
+            fds[ii].events = repl.connecting ? POLLOUT : POLLIN;
+            ii++;
+        }
+        nfds = ii;
+
+        bool parked = timeout != 0 && shm_park(&ClientStates[0]);
+        if (timeout != 0 && !parked) {
+            timeout = 0;
+        }
+
+        int n_events = poll(fds, nfds, timeout);
+        if (parked) {
+            shm_unpark(&ClientStates[0]);
+        }
         if (n_events == -1) {
             perror("poll");
             close(listen_fd);
             return;
         }
+        overload_loop_start(overload);
 
         if (fds[0].revents & POLLIN) {
-            conn_fd = accept(listen_fd, (struct sockaddr*) &client_addr, &client_len);
-            if (conn_fd == -1) {
-                perror("accept");
-                continue;
-            }
-
-            printf("New connection from %s:%d\n",inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-
-            freeSlot = find_free_slot(&ClientStates[0]);
-            if (freeSlot == -1) {
-                printf("Server full. Closing the connection\n");
-                close(conn_fd);
-            } else {
-                ClientStates[freeSlot].fd = conn_fd;
-                ClientStates[freeSlot].state = STATE_HELLO;
-                nfds++;
-            }
-
+            accept_client(listen_fd, false, &ClientStates[0], &wheel, overload);
             n_events--;
+        }
 
+        if (fds[1].revents & POLLIN) {
+            accept_client(local_fd, true, &ClientStates[0], &wheel, overload);
+            n_events--;
         }
 
         int j = 0;
-        for (j = 0;j <= nfds && n_events > 0; j++) {
+        for (j = 2;j < nfds && n_events > 0; j++) {
+            // the primary's connection also reports a finished or failed connect
+            if (fds[j].fd == repl.primary_fd && fds[j].revents != 0) {
+                n_events--;
+                replication_receive(&repl, db);
+                continue;
+            }
+
             if (fds[j].revents & POLLIN) {
                 n_events--;
 
                 int fd = fds[j].fd;
+
                 int slot = find_slot_by_fd(fd, &ClientStates[0]);
-                ssize_t bytes_read = read(fd, &ClientStates[slot].buffer, sizeof(ClientStates[slot].buffer));
+                if (slot == STATUS_ERROR) {
+                    continue;
+                }
+
+                ClientState_t *client = &ClientStates[slot];
+                if (client->shm != NULL) {
+                    // doorbells carry nothing
+                    char doorbell[64];
+                    ssize_t rung = read(fd, doorbell, sizeof(doorbell));
+                    if (rung == 0 || (rung < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        printf("No new messages from client!\n");
+                        close_client(client, &wheel);
+                    }
+                    continue;
+                }
+
+                ssize_t bytes_read = read(fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+                if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    continue;
+                }
 
                 if (bytes_read <= 0) {
 					printf("No new messages from client!\n");
-					close_client(&ClientStates[slot]);
-					nfds--;
+					close_client(client, &wheel);
 					continue;
                 }
+                client->in_len += bytes_read;
+            }
+        }
 
-				if (handle_client_fsm(database_header, &employees, &ClientStates[slot], filepath) == STATUS_ERROR) {
-					printf("Error handling the message!\n");
-					close_client(&ClientStates[slot]);
-					nfds--;
-					continue;
-				}
+        // the queue depth every admission decision of this iteration starts from
+        overload->queued = 0;
+        for (i = 0;i < MAX_CLIENTS; i++) {
+            if (ClientStates[i].fd != -1) {
+                client_shm_fill(&ClientStates[i]);
+                overload->queued += client_queued_frames(&ClientStates[i]);
+            }
+        }
+
+        // the first client served moves on every iteration, so none is always last when the lag is highest
+        for (i = 0;i < MAX_CLIENTS; i++) {
+            ClientState_t *client = &ClientStates[(first + i) % MAX_CLIENTS];
+            if (client->fd != -1 && client->in_len > 0) {
+                serve_client(db, client, &repl, &feed, &wheel, overload, capture);
+            }
+        }
+        first = (first + 1) % MAX_CLIENTS;
+
+        // replies the sockets did not take at once
+        for (i = 0;i < MAX_CLIENTS; i++) {
+            ClientState_t *client = &ClientStates[i];
+            if (client->fd == -1 || !client_blocked(client)) {
+                continue;
+            }
+
+            ssize_t written = client_flush(client);
+            if (written == STATUS_ERROR) {
+                printf("Lost client mid reply\n");
+                close_client(client, &wheel);
+                continue;
+            }
+            if (written > 0) {
+                wheel_cancel(&wheel, &client->timer);
             }
+            client_rearm(&wheel, client);
         }
+
+        wheel_advance(&wheel, expire_client, &wheel);
+
+        maint_tick(&maint, db, &repl);
+
+        // everything applied during this iteration goes out as one batch
+        replication_flush(&repl);
+        feed_flush(&feed);
+        capture_tick(capture);
+
+        overload_loop_end(overload);
     }
 }
 
@@ -160,23 +497,34 @@ int main(int argc, char *argv[]) {
 	char *removeIdString = NULL;
 	char *addHours = NULL;
 	char *portarg = NULL;
+	char *primary = NULL;
+	char *shardDir = NULL;
+	char *shardSpec = NULL;
+	char *overloadSpec = NULL;
+	char *capturePath = NULL;
+	char *socketPath = NULL;
 	bool newfile = false;
 	bool listEmployees = false;
+	bool verifyFile = false;
 	int flag = 0;
 	unsigned short port = 0;
 	unsigned int id = 0;
+	unsigned int expireAfter = 0;
 
-	int dbFileDescriptor = -1;
-
-	struct dbheader_t *dbHeader = NULL;
-	struct employee_t *dbEmployeeList = NULL;
+	struct database_t db;
 
-	while ((flag = getopt(argc, argv, "a:e:f:h:lnp:r:t:")) != -1) {
+	while ((flag = getopt(argc, argv, "a:cC:d:e:f:h:lL:np:r:R:S:t:U:x:")) != -1) {
 
 		switch(flag) {
 			case 'a':
 				addString = optarg;
 				break;
+			case 'c':
+				verifyFile = true;
+				break;
+			case 'd':
+				shardDir = optarg;
+				break;
 			case 'e':
 				editString = optarg;
 				break;
@@ -189,6 +537,12 @@ int main(int argc, char *argv[]) {
 			case 'l':
 				listEmployees = true;
 				break;
+			case 'C':
+				capturePath = optarg;
+				break;
+			case 'L':
+				overloadSpec = optarg;
+				break;
 			case 'n':
 				newfile = true;
 				break;
@@ -202,10 +556,25 @@ int main(int argc, char *argv[]) {
 			case 'r':
 				removeString = optarg;
 				break;
+			case 'R':
+				primary = optarg;
+				break;
+			case 'S':
+				shardSpec = optarg;
+				break;
 			case 't':
 				removeIdString = optarg;
 				id = (unsigned int)strtoul(removeIdString, NULL, 10);
 				break;
+			case 'U':
+				socketPath = optarg;
+				break;
+			case 'x':
+				expireAfter = (unsigned int)(strtod(optarg, NULL) * 86400);
+				if (expireAfter == 0) {
+					printf("bad expiry: %s\n", optarg);
+				}
+				break;
 			case '?':
 				break;
             default:
@@ -214,105 +583,91 @@ int main(int argc, char *argv[]) {
     	}
 	}
 
-	if (filepath == NULL) {
+	if (filepath == NULL && shardDir == NULL) {
 		print_usage(argv);
 		return STATUS_ERROR;
 	}
 
-	if (newfile) {
-
-		dbFileDescriptor = create_db_file(filepath);
-
-		if (dbFileDescriptor == STATUS_ERROR) {
-			printf("Error trying to create database file\n");
-			return STATUS_ERROR;
-		}
-
-		if (create_db_header(dbFileDescriptor, &dbHeader) == STATUS_ERROR) {
-			printf("Error trying to create database header\n");
-			return STATUS_ERROR;
-		}
-
-	} else {
-
-		dbFileDescriptor = open_db_file(filepath);
-
-		if (dbFileDescriptor == STATUS_ERROR) {
-			printf("Error trying to open database file\n");
-			return STATUS_ERROR;
-		}
+	struct overload_t overload;
+	if (overload_init(&overload, overloadSpec) == STATUS_ERROR) {
+		return STATUS_ERROR;
+	}
 
-		if (validate_db_header(dbFileDescriptor, &dbHeader) == STATUS_ERROR) {
-			printf("Database header invalid!\n");
-			return STATUS_ERROR;
-		}
+	if (database_init(&db, filepath, shardDir, shardSpec, newfile) == STATUS_ERROR) {
+		printf("Error trying to open the database\n");
+		database_close(&db);
+		return STATUS_ERROR;
+	}
 
+	if (verifyFile) {
+		int status = database_verify(&db);
+		printf("%s\n", status == STATUS_SUCCESS ? "Database file OK" : "Database file corrupted!");
+		database_close(&db);
+		return status;
 	}
 
-	if (read_employees(dbFileDescriptor, dbHeader, &dbEmployeeList) == STATUS_ERROR) {
+	if (database_load(&db) == STATUS_ERROR) {
 		printf("Error trying to read employees\n");
+		database_close(&db);
 		return STATUS_ERROR;
 	}
 
-	//close until new output
-	close(dbFileDescriptor);
-
 	if (addString != NULL) {
-
-		if (dbEmployeeList == NULL) {
-			perror("realloc");
-			return STATUS_ERROR;
-		}
-
-		if (add_employee(dbHeader, &dbEmployeeList, addString) == STATUS_ERROR) {
+		struct employee_fields_t fields;
+		if (request_parse_employee(addString, false, &fields) == STATUS_ERROR || database_add(&db, &fields) == STATUS_ERROR) {
 			printf("Error trying to add employee\n");
 			return STATUS_ERROR;
 		}
-
 	}
 
 	if (removeString != NULL) {
-		if (remove_employee(dbHeader, &dbEmployeeList, removeString) == STATUS_ERROR) {
+		if (database_remove_name(&db, removeString) == STATUS_ERROR) {
 			printf("Error trying to remove employee\n");
 			return STATUS_ERROR;
 		}
 	}
 
 	if (removeIdString != NULL && id > 0) {
-		if (remove_employee_id(dbHeader, &dbEmployeeList, id) == STATUS_ERROR) {
+		if (database_remove_id(&db, id) == STATUS_ERROR) {
 			printf("Error trying to remove employee by id\n");
 			return STATUS_ERROR;
 		}
 	}
 
 	if (editString != NULL) {
-		if (edit_employee(dbHeader, dbEmployeeList, editString) == STATUS_ERROR) {
+		struct employee_fields_t fields;
+		if (request_parse_employee(editString, true, &fields) == STATUS_ERROR || database_edit(&db, &fields) == STATUS_ERROR) {
 			printf("Error trying to edit employee\n");
 			return STATUS_ERROR;
 		}
 	}
 
-	if (addHours > 0) {
-		if (add_hours(dbHeader, dbEmployeeList, addHours) == STATUS_ERROR) {
+	if (addHours != NULL) {
+		unsigned int hoursId = 0;
+		unsigned int hours = 0;
+		if (request_parse_hours(addHours, &hoursId, &hours) == STATUS_ERROR || database_add_hours(&db, hoursId, hours) == STATUS_ERROR) {
 			printf("Error trying to add hours\n");
 			return STATUS_ERROR;
 		}
 	}
 
-	output_file(dbHeader, dbEmployeeList, filepath);
+	database_persist(&db);
 
 	if (listEmployees) {
-		list_employees(dbHeader, dbEmployeeList);
+		database_list(&db);
 	}
 
 	if (port != 0) {
-		poll_loop(port, dbHeader, dbEmployeeList, filepath);
+		struct capture_t capture;
+		if (capture_open(&capture, capturePath) == STATUS_ERROR) {
+			database_close(&db);
+			return STATUS_ERROR;
+		}
+		poll_loop(port, &db, primary, expireAfter, &overload, socketPath, &capture);
+		capture_close(&capture);
 	}
 
-	free(dbHeader);
-	free(dbEmployeeList);
-	dbHeader = NULL;
-	dbEmployeeList = NULL;
+	database_close(&db);
 
 	return STATUS_SUCCESS;
 
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "maint.h"
+#include "replication.h"
+#include "database.h"
+#include "index.h"
+#include "common.h"
+
+static uint64_t monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void maint_init(struct maint_t *maint, unsigned int expire_after) {
+    memset(maint, 0, sizeof(*maint));
+    maint->expire_after = expire_after;
+    maint->next_ms = monotonic_us() / 1000;
+}
+
+// how long poll may wait before the next slice is due, -1 when expiry is off
+int maint_timeout(struct maint_t *maint) {
+
+    if (maint->expire_after == 0) {
+        return -1;
+    }
+
+    uint64_t now = monotonic_us() / 1000;
+    return maint->next_ms > now ? (int)(maint->next_ms - now) : 0;
+}
+
+// one pass over the shard, proportional to its size like any removal.
+// the removals are replicated as plain deletes by id
+static void maint_compact(struct maint_t *maint, struct database_t *db, struct replication_t *repl, int index) {
+
+    unsigned int *ids = NULL;
+    uint64_t count = 0;
+    if (database_expire(db, index, maint->cutoff, &ids, &count) == STATUS_ERROR) {
+        return;
+    }
+
+    char request[sizeof(db_protocol_header_t) + sizeof(db_protocol_id_req)];
+    db_protocol_header_t *header = (db_protocol_header_t*)request;
+    header->type = MSG_EMPLOYEE_DEL_ID_REQ;
+    header->len = 1;
+
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        ((db_protocol_id_req*)&header[1])->id = htonl(ids[i]);
+        replication_queue(repl, header);
+    }
+    free(ids);
+
+    if (count > 0) {
+        database_persist(db);
+        maint->expired += count;
+        printf("Expired %lu employees from shard %d, %lu since start\n", count, index, maint->expired);
+    }
+}
+
+void maint_tick(struct maint_t *maint, struct database_t *db, struct replication_t *repl) {
+
+    // replicas follow the deletes of their primary
+    if (maint->expire_after == 0 || repl->role != ROLE_PRIMARY) {
+        return;
+    }
+
+    uint64_t start = monotonic_us();
+    if (start / 1000 < maint->next_ms) {
+        return;
+    }
+
+    // the cutoff is fixed for a whole pass
+    if (!maint->scanning) {
+        maint->scanning = true;
+        maint->shard = 0;
+        maint->next_id = 0;
+        maint->candidates = 0;
+        maint->cutoff = time(NULL) - maint->expire_after;
+    }
+
+    uint64_t scanned = 0;
+    while (maint->shard < db->count) {
+        struct shard_t *shard = &db->shards[maint->shard];
+        uint64_t i = lower_bound_id(shard->header, shard->employees, maint->next_id);
+
+        for (;i<shard->header->count;i++) {
+            if (database_expired(&shard->employees[i], maint->cutoff)) {
+                maint->candidates++;
+            }
+
+            if (++scanned % MAINT_CLOCK_RECORDS == 0 && monotonic_us() - start >= MAINT_SLICE_US) {
+                maint->next_id = shard->employees[i].id + 1;
+                maint->next_ms = start / 1000 + MAINT_SLICE_INTERVAL_MS;
+                return;
+            }
+        }
+
+        if (maint->candidates > 0) {
+            maint_compact(maint, db, repl, maint->shard);
+        }
+
+        maint->shard++;
+        maint->next_id = 0;
+        maint->candidates = 0;
+    }
+
+    // a record expires at most half its time to live late
+    uint64_t interval = (uint64_t)maint->expire_after * 1000 / 2;
+    if (interval > MAINT_PASS_INTERVAL_MS) {
+        interval = MAINT_PASS_INTERVAL_MS;
+    }
+
+    maint->scanning = false;
+    maint->next_ms = monotonic_us() / 1000 + interval;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "overload.h"
+#include "db_poll.h"
+#include "common.h"
+
+static uint64_t monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// spec is [target ms] or [target ms]:reads or [target ms]:writes, a target of 0 admits everything
+int overload_init(struct overload_t *overload, char *spec) {
+    memset(overload, 0, sizeof(*overload));
+    overload->target_us = OVERLOAD_TARGET_MS * 1000;
+    overload->priority = PRIORITY_NONE;
+
+    if (spec == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    unsigned int target = 0;
+    char priority[16] = {0};
+    int fields = sscanf(spec, "%u:%15[a-z]", &target, priority);
+    if (fields < 1) {
+        printf("Bad overload spec, expected [ms] or [ms]:reads or [ms]:writes\n");
+        return STATUS_ERROR;
+    }
+
+    overload->target_us = (uint64_t)target * 1000;
+    if (fields == 2 && strcmp(priority, "reads") == 0) {
+        overload->priority = PRIORITY_READS;
+    } else if (fields == 2 && strcmp(priority, "writes") == 0) {
+        overload->priority = PRIORITY_WRITES;
+    } else if (fields == 2) {
+        printf("Bad overload priority: %s\n", priority);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void overload_loop_start(struct overload_t *overload) {
+    overload->loop_start_us = monotonic_us();
+}
+
+// lag is a moving average, one slow iteration alone does not start shedding
+void overload_loop_end(struct overload_t *overload) {
+    uint64_t elapsed = monotonic_us() - overload->loop_start_us;
+    overload->lag_us = (overload->lag_us * 3 + elapsed) / 4;
+}
+
+static bool is_bulk_read(db_protocol_type_enum type) {
+    return type == MSG_EMPLOYEE_LIST_REQ || type == MSG_EMPLOYEE_PAGE_REQ ||
+        type == MSG_EMPLOYEE_RANGE_REQ || type == MSG_EMPLOYEE_SEARCH_REQ || type == MSG_HOURS_TOP_REQ;
+}
+
+// staged writes are cheap and rejecting one would break its transaction, the commit can be retried
+static bool is_bulk_write(ClientState_t *client, db_protocol_type_enum type) {
+    if (type == MSG_TXN_COMMIT_REQ) {
+        return true;
+    }
+    return client->txn == NULL && (is_write_request(type) || is_cas_request(type));
+}
+
+// called for every request taken from a client buffer, before it is handled.
+// only reads and writes a client can retry are ever rejected, and only while others queue behind them
+bool overload_admit(struct overload_t *overload, ClientState_t *client, db_protocol_type_enum type) {
+
+    if (overload->queued > 0) {
+        overload->queued--;
+    }
+
+    uint64_t now = monotonic_us();
+    overload->request_start_us = now;
+
+    bool read = is_bulk_read(type);
+    bool write = is_bulk_write(client, type);
+    if (client->state != STATE_MSG || (!read && !write)) {
+        return true;
+    }
+
+    // this iteration may already be running longer than the average
+    uint64_t lag = now - overload->loop_start_us;
+    if (overload->lag_us > lag) {
+        lag = overload->lag_us;
+    }
+
+    bool shed = false;
+    if (overload->target_us > 0 && overload->queued > 0) {
+        if (lag > overload->target_us * 2) {
+            shed = true;
+        } else if (lag > overload->target_us) {
+            shed = !((overload->priority == PRIORITY_READS && read) || (overload->priority == PRIORITY_WRITES && write));
+        }
+    }
+
+    if (shed) {
+        overload->shed++;
+    } else {
+        overload->admitted++;
+    }
+    return !shed;
+}
+
+void overload_served(struct overload_t *overload) {
+    uint64_t elapsed = monotonic_us() - overload->request_start_us;
+    overload->service_us = (overload->service_us * 7 + elapsed) / 8;
+}
+
+// about the time the requests still queued need, or the current lag if that is longer
+uint32_t overload_retry_after(struct overload_t *overload) {
+    uint64_t wait_us = overload->queued * overload->service_us;
+    if (overload->lag_us > wait_us) {
+        wait_us = overload->lag_us;
+    }
+
+    uint64_t wait_ms = wait_us / 1000;
+    if (wait_ms < OVERLOAD_RETRY_MIN_MS) {
+        wait_ms = OVERLOAD_RETRY_MIN_MS;
+    }
+    if (wait_ms > OVERLOAD_RETRY_MAX_MS) {
+        wait_ms = OVERLOAD_RETRY_MAX_MS;
+    }
+    return (uint32_t)wait_ms;
+}
@@ -8,103 +8,272 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <endian.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
 
 #include "parse.h"
 #include "common.h"
+#include "crc32c.h"
+#include "index.h"
 
-#define TEMP_DB_FILE "TEMP_DB_FILE.db"
+#define TEMP_DB_SUFFIX ".tmp"
 
-void output_file(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, char* filename) {
-    // new file
-    int tempFileDescriptor = open(TEMP_DB_FILE, O_RDWR | O_CREAT, 0644);
+static int write_chunk(int fileDescriptor, const void *buffer, size_t size) {
 
-    unsigned short dbHeaderCount = dbHeader->count;
+    const char *in = buffer;
+    size_t done = 0;
 
-    //make copies
-    struct dbheader_t *db_header_copy = malloc(sizeof(struct dbheader_t));
-    memcpy(db_header_copy, dbHeader, sizeof(struct dbheader_t));
-    struct employee_t *employees_copy = malloc(sizeof(struct employee_t) * dbHeaderCount);
-    if (employees_copy == NULL) {
+    while (done < size) {
+        ssize_t written = write(fileDescriptor, in + done, size - done);
+        if (written == STATUS_ERROR) {
+            perror("write");
+            return STATUS_ERROR;
+        }
+        done += written;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static size_t db_header_size(unsigned short version) {
+    return version < HEADER_VERSION_V3 ? sizeof(struct dbheader_v1_t) : sizeof(struct dbheader_t);
+}
+
+// packs the header in the layout of the given version, returns its size
+static size_t pack_db_header(struct dbheader_t *dbHeader, unsigned short version, void *packed) {
+
+    if (version < HEADER_VERSION_V3) {
+        struct dbheader_v1_t *header = packed;
+        header->magic = htonl(dbHeader->magic);
+        header->version = htons(version);
+        header->count = htons(dbHeader->count);
+        header->id = htonl(dbHeader->id);
+        header->filesize = htonl(dbHeader->filesize);
+        return sizeof(struct dbheader_v1_t);
+    }
+
+    struct dbheader_t *header = packed;
+    memset(header, 0, sizeof(*header));
+    header->magic = htonl(dbHeader->magic);
+    header->version = htons(version);
+    header->count = htobe64(dbHeader->count);
+    header->id = htobe64(dbHeader->id);
+    header->filesize = htobe64(dbHeader->filesize);
+    return sizeof(struct dbheader_t);
+}
+
+static size_t record_size(unsigned short version) {
+    if (version < HEADER_VERSION_V4) {
+        return sizeof(struct employee_v3_t);
+    }
+    if (version == HEADER_VERSION_V4) {
+        return sizeof(struct employee_v4_t);
+    }
+    return version == HEADER_VERSION_V5 ? sizeof(struct employee_v5_t) : sizeof(struct employee_t);
+}
+
+static size_t checksum_blocks(uint64_t count) {
+    return (count + CHECKSUM_BLOCK_RECORDS - 1) / CHECKSUM_BLOCK_RECORDS;
+}
+
+static uint64_t file_size_for(unsigned short version, uint64_t count) {
+
+    uint64_t size = db_header_size(version) + count * record_size(version);
+
+    // one crc per block of records plus one for the header
+    if (version != HEADER_VERSION_V1) {
+        size += (checksum_blocks(count) + 1) * sizeof(uint32_t);
+    }
+
+    // the text that follows has its own size in this header
+    if (version >= HEADER_VERSION_V6) {
+        size += sizeof(struct dbstrings_t);
+    }
+
+    return size;
+}
+
+// without the text, output_file adds it when writing
+uint64_t db_file_size(uint64_t count) {
+    return file_size_for(HEADER_VERSION, count);
+}
+
+static int write_strings(int fileDescriptor, struct strtab_t *strings) {
+
+    uint32_t *offsets = malloc(sizeof(uint32_t) * strings->address_count);
+    if (offsets == NULL) {
         perror("malloc");
-        return;
+        return STATUS_ERROR;
     }
-    memcpy(employees_copy, dbEmployeeList, sizeof(struct employee_t) * dbHeaderCount);
 
+    uint32_t i=0;
+    for (i=0;i<strings->address_count;i++) {
+        offsets[i] = htonl(strings->addresses[i]);
+    }
 
+    struct dbstrings_t header = {0};
+    header.names_len = htonl(strings->names_len);
+    header.address_count = htonl(strings->address_count);
+    header.address_len = htonl(strings->address_len);
 
-    // pack header for writing into output file
-    db_header_copy->magic = htonl(db_header_copy->magic);
-    db_header_copy->version = htons(db_header_copy->version);
-    db_header_copy->count = htons(db_header_copy->count);
-    db_header_copy->id = htonl(db_header_copy->id);
-    db_header_copy->filesize = htonl(db_header_copy->filesize);
+    uint32_t crc = crc32c(0, &header, offsetof(struct dbstrings_t, crc));
+    crc = crc32c(crc, strings->names, strings->names_len);
+    crc = crc32c(crc, offsets, sizeof(uint32_t) * strings->address_count);
+    crc = crc32c(crc, strings->address_text, strings->address_len);
+    header.crc = htonl(crc);
 
-    if (lseek(tempFileDescriptor, 0, SEEK_SET) == STATUS_ERROR) {
-        perror("lseek");
-        return;
+    int status = write_chunk(fileDescriptor, &header, sizeof(header));
+    if (status == STATUS_SUCCESS) {
+        status = write_chunk(fileDescriptor, strings->names, strings->names_len);
+    }
+    if (status == STATUS_SUCCESS) {
+        status = write_chunk(fileDescriptor, offsets, sizeof(uint32_t) * strings->address_count);
+    }
+    if (status == STATUS_SUCCESS) {
+        status = write_chunk(fileDescriptor, strings->address_text, strings->address_len);
     }
 
-    if (write(tempFileDescriptor, db_header_copy, sizeof(struct dbheader_t)) == STATUS_ERROR) {
-        perror("write");
+    free(offsets);
+    return status;
+}
+
+void output_file(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, struct strtab_t *strings, char* filename) {
+    // new file next to the database, servers sharing a directory must not collide
+    char tempFile[PATH_MAX];
+    snprintf(tempFile, sizeof(tempFile), "%s" TEMP_DB_SUFFIX, filename);
+    int tempFileDescriptor = open(tempFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tempFileDescriptor == STATUS_ERROR) {
+        perror("open");
         return;
     }
 
-    if (lseek(tempFileDescriptor, sizeof(struct dbheader_t), SEEK_SET) == STATUS_ERROR) {
-        perror("lseek");
+    uint64_t dbHeaderCount = dbHeader->count;
+    size_t blocks = checksum_blocks(dbHeaderCount);
+    size_t chunk = CHECKSUM_BLOCK_RECORDS * STREAM_CHUNK_BLOCKS;
+
+    // records are packed through a bounded buffer rather than a copy of the whole list
+    uint8_t db_header_copy[sizeof(struct dbheader_t)];
+    struct employee_t *employees_copy = malloc(sizeof(struct employee_t) * chunk);
+    uint32_t *checksums = malloc(sizeof(uint32_t) * (blocks + 1));
+    if (employees_copy == NULL || checksums == NULL) {
+        perror("malloc");
+        free(employees_copy);
+        free(checksums);
+        close(tempFileDescriptor);
         return;
     }
 
-    // pack employee data
-    int i=0;
-    for (i=0;i<dbHeaderCount;i++) {
-        employees_copy[i].id = htonl(employees_copy[i].id);
-        employees_copy[i].hours = htonl(employees_copy[i].hours);
+    dbHeader->filesize = db_file_size(dbHeaderCount) + strtab_size(strings);
+    size_t headerSize = pack_db_header(dbHeader, HEADER_VERSION, db_header_copy);
+    checksums[blocks] = htonl(crc32c(0, db_header_copy, headerSize));
+
+    int status = write_chunk(tempFileDescriptor, db_header_copy, headerSize);
+
+    uint64_t done = 0;
+    while (status == STATUS_SUCCESS && done < dbHeaderCount) {
+        size_t records = dbHeaderCount - done < chunk ? dbHeaderCount - done : chunk;
+        memcpy(employees_copy, &dbEmployeeList[done], sizeof(struct employee_t) * records);
+
+        size_t i=0;
+        for (i=0;i<records;i++) {
+            employees_copy[i].id = htonl(employees_copy[i].id);
+            employees_copy[i].name = htonl(employees_copy[i].name);
+            employees_copy[i].address = htonl(employees_copy[i].address);
+            employees_copy[i].hours = htonl(employees_copy[i].hours);
+            employees_copy[i].version = htonl(employees_copy[i].version);
+            employees_copy[i].updated = htonl(employees_copy[i].updated);
+        }
 
-        lseek(tempFileDescriptor, sizeof(struct dbheader_t) + sizeof(struct employee_t) * i, SEEK_SET);
-        if (write(tempFileDescriptor, &employees_copy[i], sizeof(struct employee_t)) == STATUS_ERROR) {
-            perror("write");
-            return;
+        // checksum the packed bytes so they can be verified without decoding
+        for (i=0;i<records;i+=CHECKSUM_BLOCK_RECORDS) {
+            size_t blockRecords = records - i < CHECKSUM_BLOCK_RECORDS ? records - i : CHECKSUM_BLOCK_RECORDS;
+            checksums[(done + i) / CHECKSUM_BLOCK_RECORDS] = htonl(crc32c(0, &employees_copy[i], blockRecords * sizeof(struct employee_t)));
         }
+
+        status = write_chunk(tempFileDescriptor, employees_copy, sizeof(struct employee_t) * records);
+        done += records;
+    }
+
+    if (status == STATUS_SUCCESS) {
+        status = write_chunk(tempFileDescriptor, checksums, sizeof(uint32_t) * (blocks + 1));
+    }
+    if (status == STATUS_SUCCESS) {
+        status = write_strings(tempFileDescriptor, strings);
+    }
+    if (status == STATUS_SUCCESS && fsync(tempFileDescriptor) == STATUS_ERROR) {
+        perror("fsync");
+        status = STATUS_ERROR;
     }
 
-    free(db_header_copy);
     free(employees_copy);
+    free(checksums);
+    close(tempFileDescriptor);
+
+    if (status == STATUS_ERROR) {
+        remove(tempFile);
+        return;
+    }
 
     // replace current db file with newly outputted file
     // prevents leftover data at the end if the file decreases in size
-    close(tempFileDescriptor);
-    remove(filename);
-    rename(TEMP_DB_FILE, filename);
+    if (rename(tempFile, filename) == STATUS_ERROR) {
+        perror("rename");
+    }
 
 }
 
-void list_employees(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList) {
+void list_employees(struct dbheader_t *dbHeader, struct employee_t *dbEmployeeList, struct strtab_t *strings) {
 
-    int i=0;
+    uint64_t i=0;
     for (i=0;i<dbHeader->count;i++) {
-        printf("Employee %d:\n\tName: %s\n\tAddress: %s\n\tHours: %d\n\n", i+1, dbEmployeeList[i].name, dbEmployeeList[i].address, dbEmployeeList[i].hours);
+        printf("Employee %lu:\n\tName: %s\n\tAddress: %s\n\tHours: %d\n\n", i+1, strtab_name(strings, dbEmployeeList[i].name), strtab_address(strings, dbEmployeeList[i].address), dbEmployeeList[i].hours);
     }
 }
 
-int create_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
+int create_db_header(struct dbheader_t **headerOut) {
 
     struct dbheader_t *header = calloc(1, sizeof(struct dbheader_t));
 
     if (header == NULL) {
-
+        perror("calloc");
+        return STATUS_ERROR;
     }
 
     header->magic = HEADER_MAGIC;
     header->version = HEADER_VERSION;
     header->count = 0;
     header->id = 0;
-    header->filesize = sizeof(struct dbheader_t);
+    header->filesize = db_file_size(0);
 
     *headerOut = header;
 
     return STATUS_SUCCESS;
 }
 
+static int read_chunk(int fileDescriptor, void *buffer, size_t size, off_t offset);
+
+// the strings header sits right after the checksums, at the end of the fixed size part
+static int read_strings_header(int fileDescriptor, struct dbheader_t *dbHeader, struct dbstrings_t *stringsOut) {
+
+    off_t offset = file_size_for(dbHeader->version, dbHeader->count) - sizeof(struct dbstrings_t);
+    if (read_chunk(fileDescriptor, stringsOut, sizeof(*stringsOut), offset) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    stringsOut->names_len = ntohl(stringsOut->names_len);
+    stringsOut->address_count = ntohl(stringsOut->address_count);
+    stringsOut->address_len = ntohl(stringsOut->address_len);
+    stringsOut->crc = ntohl(stringsOut->crc);
+    return STATUS_SUCCESS;
+}
+
+static uint64_t strings_size(struct dbstrings_t *strings) {
+    return (uint64_t)strings->names_len + (uint64_t)strings->address_count * sizeof(uint32_t) + strings->address_len;
+}
+
 int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
 
     if (fileDescriptor == STATUS_ERROR) {
@@ -119,17 +288,27 @@ int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
         return STATUS_ERROR;
     }
 
-    if (read(fileDescriptor, header, sizeof(struct dbheader_t)) == STATUS_ERROR) {
+    // magic and version sit at the same offsets in every version
+    union {
+        struct dbheader_v1_t v1;
+        struct dbheader_t v3;
+    } packed = {0};
+
+    ssize_t bytes_read = read(fileDescriptor, &packed, sizeof(packed));
+    if (bytes_read == STATUS_ERROR) {
         perror("read");
         free(header);
         return STATUS_ERROR;
     }
 
-    header->magic = ntohl(header->magic);
-    header->version = ntohs(header->version);
-    header->count = ntohs(header->count);
-    header->id = ntohl(header->id);
-    header->filesize = ntohl(header->filesize);
+    header->magic = ntohl(packed.v1.magic);
+    header->version = ntohs(packed.v1.version);
+
+    if (bytes_read < (ssize_t)sizeof(struct dbheader_v1_t) || bytes_read < (ssize_t)db_header_size(header->version)) {
+        printf("Database file too small for header!\n");
+        free(header);
+        return STATUS_ERROR;
+    }
 
     if (header->magic != HEADER_MAGIC) {
         printf("Got invalid magic number!\n");
@@ -137,7 +316,15 @@ int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
         return STATUS_ERROR;
     }
 
-    if (header->version != HEADER_VERSION) {
+    if (header->version == HEADER_VERSION_V1 || header->version == HEADER_VERSION_V2) {
+        header->count = ntohs(packed.v1.count);
+        header->id = ntohl(packed.v1.id);
+        header->filesize = ntohl(packed.v1.filesize);
+    } else if (header->version >= HEADER_VERSION_V3 && header->version <= HEADER_VERSION) {
+        header->count = be64toh(packed.v3.count);
+        header->id = be64toh(packed.v3.id);
+        header->filesize = be64toh(packed.v3.filesize);
+    } else {
         printf("Got invalid version number!\n");
         free(header);
         return STATUS_ERROR;
@@ -146,9 +333,26 @@ int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
     struct stat dbstat = {0};
     fstat(fileDescriptor, &dbstat);
 
-    if (header->filesize != dbstat.st_size) {
+    if (header->filesize != (uint64_t)dbstat.st_size) {
         printf("Corrupted database!\n");
-        printf("Expected size: %d\nActual size: %d\n", header->filesize, dbstat.st_size);
+        printf("Expected size: %lu\nActual size: %ld\n", header->filesize, dbstat.st_size);
+        free(header);
+        return STATUS_ERROR;
+    }
+
+    uint64_t expected = file_size_for(header->version, header->count);
+    if (header->version >= HEADER_VERSION_V6 && expected <= header->filesize) {
+        struct dbstrings_t strings = {0};
+        if (read_strings_header(fileDescriptor, header, &strings) == STATUS_ERROR) {
+            free(header);
+            return STATUS_ERROR;
+        }
+        expected += strings_size(&strings);
+    }
+
+    if (header->filesize != expected) {
+        printf("Corrupted database!\n");
+        printf("Header count %lu does not match file size %lu\n", header->count, header->filesize);
         free(header);
         return STATUS_ERROR;
     }
@@ -157,14 +361,451 @@ int validate_db_header(int fileDescriptor, struct dbheader_t **headerOut) {
     return STATUS_SUCCESS;
 }
 
-int read_employees(int fileDescriptor, struct dbheader_t *dbHeader, struct employee_t **employeesOut) {
+// version 6 records load into employees, older ones into legacy to be interned afterwards
+struct load_job_t {
+    int fileDescriptor;
+    struct employee_t *employees;
+    struct employee_v5_t *legacy;
+    struct strtab_t *strings;
+    const uint32_t *checksums;
+    unsigned short version;
+    size_t headerSize;
+    size_t recordSize;
+    uint64_t start;
+    uint64_t count;
+    uint64_t maxId;
+    uint64_t badBlocks;
+    int status;
+    double readMs;
+    double decodeMs;
+};
+
+static double elapsed_ms(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// read one contiguous range of records, tolerating short reads
+static int read_chunk(int fileDescriptor, void *buffer, size_t size, off_t offset) {
+
+    char *out = buffer;
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t bytes_read = pread(fileDescriptor, out + done, size - done, offset + done);
+        if (bytes_read == STATUS_ERROR) {
+            perror("pread");
+            return STATUS_ERROR;
+        }
+        if (bytes_read == 0) {
+            printf("Unexpected end of database file!\n");
+            return STATUS_ERROR;
+        }
+        done += bytes_read;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// check the crc of every block in a range of still packed records, first is block aligned
+static uint64_t verify_blocks(const uint32_t *checksums, const uint8_t *packed, size_t recordSize, uint64_t first, uint64_t count) {
+
+    uint64_t bad = 0;
+    uint64_t i=0;
+    for (i=0;i<count;i+=CHECKSUM_BLOCK_RECORDS) {
+        uint64_t records = count - i < CHECKSUM_BLOCK_RECORDS ? count - i : CHECKSUM_BLOCK_RECORDS;
+        size_t block = (first + i) / CHECKSUM_BLOCK_RECORDS;
+
+        if (crc32c(0, &packed[i * recordSize], records * recordSize) != ntohl(checksums[block])) {
+            printf("Checksum mismatch in block %zu (records %lu-%lu)!\n", block, first + i, first + i + records - 1);
+            bad++;
+        }
+    }
+
+    return bad;
+}
+
+// verify only, streams the range through a small buffer instead of keeping the records
+static void verify_worker(struct load_job_t *job) {
+
+    uint64_t chunk = CHECKSUM_BLOCK_RECORDS * STREAM_CHUNK_BLOCKS;
+    uint8_t *buffer = malloc(chunk * job->recordSize);
+    if (buffer == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    uint64_t done = 0;
+    while (done < job->count) {
+        uint64_t records = job->count - done < chunk ? job->count - done : chunk;
+        off_t offset = job->headerSize + (off_t)(job->start + done) * job->recordSize;
+
+        if (read_chunk(job->fileDescriptor, buffer, (size_t)records * job->recordSize, offset) == STATUS_ERROR) {
+            free(buffer);
+            return;
+        }
+
+        job->badBlocks += verify_blocks(job->checksums, buffer, job->recordSize, job->start + done, records);
+        done += records;
+    }
+
+    free(buffer);
+    job->status = job->badBlocks == 0 ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+// ids must be non zero, increasing and within the header id
+static bool valid_id(struct load_job_t *job, unsigned int id, uint64_t lastId, uint64_t record) {
+    if (id == 0 || id <= lastId || id > job->maxId) {
+        printf("Invalid employee id %u in record %lu!\n", id, record);
+        return false;
+    }
+    return true;
+}
+
+static int decode_records(struct load_job_t *job) {
+
+    struct employee_t *employees = job->employees + job->start;
+    uint64_t lastId = 0;
+    uint64_t i=0;
+    for (i=0;i<job->count;i++) {
+        employees[i].id = ntohl(employees[i].id);
+        employees[i].name = ntohl(employees[i].name);
+        employees[i].address = ntohl(employees[i].address);
+        employees[i].hours = ntohl(employees[i].hours);
+        employees[i].version = ntohl(employees[i].version);
+        employees[i].updated = ntohl(employees[i].updated);
+
+        if (!valid_id(job, employees[i].id, lastId, job->start + i)) {
+            return STATUS_ERROR;
+        }
+
+        if (!strtab_valid_name(job->strings, employees[i].name) || employees[i].address >= job->strings->address_count) {
+            printf("Invalid string reference in record %lu!\n", job->start + i);
+            return STATUS_ERROR;
+        }
+
+        lastId = employees[i].id;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int decode_legacy(struct load_job_t *job) {
+
+    struct employee_v5_t *employees = job->legacy + job->start;
+
+    // older records are shorter, spread them out from the end so none is overwritten before it moved.
+    // their age is unknown, it counts from the upgrade
+    if (job->recordSize < sizeof(struct employee_v5_t)) {
+        unsigned int now = htonl(time(NULL));
+        uint64_t i = job->count;
+        while (i > 0) {
+            i--;
+            memmove(&employees[i], (uint8_t*)employees + i * job->recordSize, job->recordSize);
+            if (job->recordSize < sizeof(struct employee_v4_t)) {
+                employees[i].version = htonl(1);
+            }
+            employees[i].updated = now;
+        }
+    }
+
+    uint64_t lastId = 0;
+    uint64_t i=0;
+    for (i=0;i<job->count;i++) {
+        employees[i].id = ntohl(employees[i].id);
+        employees[i].hours = ntohl(employees[i].hours);
+        employees[i].version = ntohl(employees[i].version);
+        employees[i].updated = ntohl(employees[i].updated);
+
+        if (!valid_id(job, employees[i].id, lastId, job->start + i)) {
+            return STATUS_ERROR;
+        }
+
+        // version 1 writers filled the whole field, so text of full length has no terminator
+        if (job->version == HEADER_VERSION_V1) {
+            employees[i].name[sizeof(employees[i].name) - 1] = '\0';
+            employees[i].address[sizeof(employees[i].address) - 1] = '\0';
+        } else if (memchr(employees[i].name, '\0', sizeof(employees[i].name)) == NULL ||
+            memchr(employees[i].address, '\0', sizeof(employees[i].address)) == NULL) {
+            printf("Unterminated string in record %lu!\n", job->start + i);
+            return STATUS_ERROR;
+        }
+
+        lastId = employees[i].id;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void *load_worker(void *arg) {
+
+    struct load_job_t *job = arg;
+    struct timespec t0, t1, t2;
+
+    job->status = STATUS_ERROR;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if (job->employees == NULL && job->legacy == NULL) {
+        verify_worker(job);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        job->readMs = elapsed_ms(&t0, &t1);
+        return NULL;
+    }
+
+    uint8_t *records = job->employees != NULL ? (uint8_t*)(job->employees + job->start) : (uint8_t*)(job->legacy + job->start);
+    off_t offset = job->headerSize + (off_t)job->start * job->recordSize;
+    if (read_chunk(job->fileDescriptor, records, (size_t)job->count * job->recordSize, offset) == STATUS_ERROR) {
+        return NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (job->checksums != NULL) {
+        job->badBlocks = verify_blocks(job->checksums, records, job->recordSize, job->start, job->count);
+        if (job->badBlocks > 0) {
+            return NULL;
+        }
+    }
+
+    int status = job->employees != NULL ? decode_records(job) : decode_legacy(job);
+    if (status == STATUS_ERROR) {
+        return NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    job->readMs = elapsed_ms(&t0, &t1);
+    job->decodeMs = elapsed_ms(&t1, &t2);
+    job->status = STATUS_SUCCESS;
+    return NULL;
+}
+
+// split the records into block aligned ranges and run them on up to one thread per cpu
+static int run_load_jobs(struct load_job_t *jobs, int fileDescriptor, struct dbheader_t *dbHeader, struct employee_t *employees, struct employee_v5_t *legacy, struct strtab_t *strings, const uint32_t *checksums) {
+
+    uint64_t count = dbHeader->count;
+
+    // one thread per LOAD_MIN_RECORDS records, capped by the online cpus
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = count / LOAD_MIN_RECORDS;
+    if (nthreads > cpus) nthreads = cpus;
+    if (nthreads > LOAD_MAX_THREADS) nthreads = LOAD_MAX_THREADS;
+    if (nthreads < 1) nthreads = 1;
+
+    pthread_t threads[LOAD_MAX_THREADS];
+    uint64_t per_thread = count / nthreads;
+    per_thread -= per_thread % CHECKSUM_BLOCK_RECORDS;
+
+    int i=0;
+    for (i=0;i<nthreads;i++) {
+        jobs[i].fileDescriptor = fileDescriptor;
+        jobs[i].employees = employees;
+        jobs[i].legacy = legacy;
+        jobs[i].strings = strings;
+        jobs[i].checksums = checksums;
+        jobs[i].version = dbHeader->version;
+        jobs[i].headerSize = db_header_size(dbHeader->version);
+        jobs[i].recordSize = record_size(dbHeader->version);
+        jobs[i].start = i * per_thread;
+        jobs[i].count = (i == nthreads - 1) ? count - jobs[i].start : per_thread;
+        jobs[i].maxId = dbHeader->id;
+        jobs[i].status = STATUS_ERROR;
+    }
+
+    // run the first chunk on this thread, fall back to it for any thread that fails to start
+    int started = 1;
+    for (i=1;i<nthreads;i++) {
+        if (pthread_create(&threads[i], NULL, load_worker, &jobs[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    load_worker(&jobs[0]);
+    for (i=started;i<nthreads;i++) {
+        load_worker(&jobs[i]);
+    }
+
+    for (i=1;i<started;i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return nthreads;
+}
+
+// loads the per block checksum table and checks the header against it
+static uint32_t *read_checksums(int fileDescriptor, struct dbheader_t *dbHeader) {
+
+    size_t blocks = checksum_blocks(dbHeader->count);
+    uint32_t *checksums = malloc(sizeof(uint32_t) * (blocks + 1));
+    if (checksums == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    off_t offset = db_header_size(dbHeader->version) + (off_t)dbHeader->count * record_size(dbHeader->version);
+    if (read_chunk(fileDescriptor, checksums, sizeof(uint32_t) * (blocks + 1), offset) == STATUS_ERROR) {
+        free(checksums);
+        return NULL;
+    }
+
+    uint8_t packed[sizeof(struct dbheader_t)];
+    size_t headerSize = pack_db_header(dbHeader, dbHeader->version, packed);
+    if (crc32c(0, packed, headerSize) != ntohl(checksums[blocks])) {
+        printf("Checksum mismatch in database header!\n");
+        free(checksums);
+        return NULL;
+    }
+
+    return checksums;
+}
+
+// the string table of a version 6 file, checked against its crc
+static int read_strings(int fileDescriptor, struct dbheader_t *dbHeader, struct strtab_t *stringsOut) {
+
+    struct dbstrings_t header = {0};
+    if (read_strings_header(fileDescriptor, dbHeader, &header) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    if (header.names_len == 0 || header.address_count == 0 || header.address_len == 0) {
+        printf("Corrupt string table\n");
+        return STATUS_ERROR;
+    }
+
+    char *names = malloc(header.names_len);
+    uint32_t *addresses = malloc(sizeof(uint32_t) * header.address_count);
+    char *addressText = malloc(header.address_len);
+    if (names == NULL || addresses == NULL || addressText == NULL) {
+        perror("malloc");
+        free(names);
+        free(addresses);
+        free(addressText);
+        return STATUS_ERROR;
+    }
+
+    off_t offset = file_size_for(dbHeader->version, dbHeader->count);
+    int status = read_chunk(fileDescriptor, names, header.names_len, offset);
+    offset += header.names_len;
+    if (status == STATUS_SUCCESS) {
+        status = read_chunk(fileDescriptor, addresses, sizeof(uint32_t) * header.address_count, offset);
+    }
+    offset += sizeof(uint32_t) * header.address_count;
+    if (status == STATUS_SUCCESS) {
+        status = read_chunk(fileDescriptor, addressText, header.address_len, offset);
+    }
+
+    if (status == STATUS_SUCCESS) {
+        struct dbstrings_t packed = {htonl(header.names_len), htonl(header.address_count), htonl(header.address_len), 0};
+        uint32_t crc = crc32c(0, &packed, offsetof(struct dbstrings_t, crc));
+        crc = crc32c(crc, names, header.names_len);
+        crc = crc32c(crc, addresses, sizeof(uint32_t) * header.address_count);
+        crc = crc32c(crc, addressText, header.address_len);
+        if (crc != header.crc) {
+            printf("Checksum mismatch in string table!\n");
+            status = STATUS_ERROR;
+        }
+    }
+
+    if (status == STATUS_ERROR) {
+        free(names);
+        free(addresses);
+        free(addressText);
+        return STATUS_ERROR;
+    }
+
+    uint32_t i=0;
+    for (i=0;i<header.address_count;i++) {
+        addresses[i] = ntohl(addresses[i]);
+    }
+
+    return strtab_load(stringsOut, names, header.names_len, addresses, header.address_count, addressText, header.address_len);
+}
+
+// text of records from before version 6 goes into a new string table
+static int intern_legacy(struct employee_v5_t *legacy, uint64_t count, struct employee_t *employees, struct strtab_t *strings) {
+
+    if (strtab_init(strings) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        employees[i].id = legacy[i].id;
+        employees[i].hours = legacy[i].hours;
+        employees[i].version = legacy[i].version;
+        employees[i].updated = legacy[i].updated;
+
+        if (strtab_add_name(strings, legacy[i].name, strlen(legacy[i].name), &employees[i].name) == STATUS_ERROR ||
+            strtab_intern_address(strings, legacy[i].address, strlen(legacy[i].address), &employees[i].address) == STATUS_ERROR) {
+            strtab_free(strings);
+            return STATUS_ERROR;
+        }
+    }
+
+    strings->live = strtab_size(strings);
+    return STATUS_SUCCESS;
+}
+
+int verify_db_file(int fileDescriptor, struct dbheader_t *dbHeader) {
+
+    if (dbHeader->version == HEADER_VERSION_V1) {
+        printf("Database file version %d has no checksums to verify\n", dbHeader->version);
+        return STATUS_SUCCESS;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint32_t *checksums = read_checksums(fileDescriptor, dbHeader);
+    if (checksums == NULL) {
+        return STATUS_ERROR;
+    }
+
+    struct load_job_t jobs[LOAD_MAX_THREADS] = {0};
+    int nthreads = run_load_jobs(jobs, fileDescriptor, dbHeader, NULL, NULL, NULL, checksums);
+
+    int status = STATUS_SUCCESS;
+    uint64_t badBlocks = 0;
+    int i=0;
+    for (i=0;i<nthreads;i++) {
+        badBlocks += jobs[i].badBlocks;
+        if (jobs[i].status == STATUS_ERROR) {
+            status = STATUS_ERROR;
+        }
+    }
+    free(checksums);
+
+    if (dbHeader->version >= HEADER_VERSION_V6) {
+        struct strtab_t strings;
+        if (read_strings(fileDescriptor, dbHeader, &strings) == STATUS_ERROR) {
+            status = STATUS_ERROR;
+        } else {
+            strtab_free(&strings);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = elapsed_ms(&start, &end);
+    printf("Checked %zu blocks (%lu bytes) in %.2f ms, %.2f GB/s, %d threads\n",
+        checksum_blocks(dbHeader->count), dbHeader->filesize, ms, ms > 0 ? dbHeader->filesize / ms / 1000000.0 : 0, nthreads);
+
+    if (badBlocks > 0) {
+        printf("%lu corrupted blocks found!\n", badBlocks);
+    }
+
+    return status;
+}
+
+int read_employees(int fileDescriptor, struct dbheader_t *dbHeader, struct employee_t **employeesOut, struct strtab_t *stringsOut) {
 
     if (fileDescriptor == STATUS_ERROR) {
         printf("Got invalid file descriptor!\n");
         return STATUS_ERROR;
     }
 
-    int count = dbHeader->count;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t count = dbHeader->count;
     struct employee_t *employees = calloc(count, sizeof(struct employee_t));
 
     if (employees == NULL) {
@@ -172,44 +813,106 @@ int read_employees(int fileDescriptor, struct dbheader_t *dbHeader, struct emplo
         return STATUS_ERROR;
     }
 
-    if (lseek(fileDescriptor, sizeof(struct dbheader_t), SEEK_SET) == STATUS_ERROR) {
-        perror("lseek");
-        return STATUS_ERROR;
+    if (count == 0) {
+        // nothing to load, older files are still upgraded on the next write
+        if (strtab_init(stringsOut) == STATUS_ERROR) {
+            free(employees);
+            return STATUS_ERROR;
+        }
+        dbHeader->version = HEADER_VERSION;
+        dbHeader->filesize = db_file_size(0);
+        *employeesOut = employees;
+        return STATUS_SUCCESS;
     }
 
-    if (read(fileDescriptor, employees, sizeof(struct employee_t) * count) == STATUS_ERROR) {
-        perror("read");
-        return STATUS_ERROR;
+    uint32_t *checksums = NULL;
+    if (dbHeader->version != HEADER_VERSION_V1) {
+        checksums = read_checksums(fileDescriptor, dbHeader);
+        if (checksums == NULL) {
+            free(employees);
+            return STATUS_ERROR;
+        }
+    }
+
+    // older files keep their text in the records, it is interned once they are loaded
+    struct employee_v5_t *legacy = NULL;
+    if (dbHeader->version >= HEADER_VERSION_V6) {
+        if (read_strings(fileDescriptor, dbHeader, stringsOut) == STATUS_ERROR) {
+            free(checksums);
+            free(employees);
+            return STATUS_ERROR;
+        }
+    } else {
+        legacy = calloc(count, sizeof(struct employee_v5_t));
+        if (legacy == NULL) {
+            perror("calloc");
+            free(checksums);
+            free(employees);
+            return STATUS_ERROR;
+        }
     }
 
+    struct load_job_t jobs[LOAD_MAX_THREADS] = {0};
+    int nthreads = run_load_jobs(jobs, fileDescriptor, dbHeader, legacy == NULL ? employees : NULL, legacy, stringsOut, checksums);
+    free(checksums);
+
+    double readMs = 0, decodeMs = 0;
+    int status = STATUS_SUCCESS;
     int i=0;
-    for (i=0;i<count;i++) {
-        employees[i].id = ntohl(employees[i].id);
-        employees[i].hours = ntohl(employees[i].hours);
+    for (i=0;i<nthreads;i++) {
+        if (jobs[i].status == STATUS_ERROR) {
+            status = STATUS_ERROR;
+        }
+        if (jobs[i].readMs > readMs) readMs = jobs[i].readMs;
+        if (jobs[i].decodeMs > decodeMs) decodeMs = jobs[i].decodeMs;
+    }
+
+    // chunks are validated independently, check ordering across their boundaries
+    for (i=1;i<nthreads && status == STATUS_SUCCESS;i++) {
+        uint64_t first = jobs[i].start;
+        unsigned int id = legacy == NULL ? employees[first].id : legacy[first].id;
+        unsigned int previous = legacy == NULL ? employees[first - 1].id : legacy[first - 1].id;
+        if (id <= previous) {
+            printf("Invalid employee id %u in record %lu!\n", id, first);
+            status = STATUS_ERROR;
+        }
+    }
+
+    if (status == STATUS_SUCCESS && legacy != NULL) {
+        status = intern_legacy(legacy, count, employees, stringsOut);
+    } else if (status == STATUS_ERROR && legacy == NULL) {
+        strtab_free(stringsOut);
     }
+    free(legacy);
+
+    if (status == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Loaded %lu employees in %.2f ms (read %.2f ms, decode %.2f ms, %d threads)\n",
+        count, elapsed_ms(&start, &end), readMs, decodeMs, nthreads);
+
+    // older files are upgraded on the next write
+    dbHeader->version = HEADER_VERSION;
+    dbHeader->filesize = db_file_size(dbHeader->count) + strtab_size(stringsOut);
 
     *employeesOut = employees;
 
     return STATUS_SUCCESS;
 }
 
-int add_employee(struct dbheader_t *dbHeader, struct employee_t **employees_pointer, char *addstring) {
+int add_employee(struct dbheader_t *dbHeader, struct employee_t **employees_pointer, struct strtab_t *strings, struct employee_fields_t *fields) {
 
-    char *employeeName = strtok(addstring, ",");
-    if (employeeName == NULL) {
-        printf("Wrong string format!\n");
+    if (fields->name_len == 0 || fields->name_len >= EMPLOYEE_TEXT_MAX || fields->address_len >= EMPLOYEE_TEXT_MAX) {
+        printf("Wrong employee format!\n");
         return STATUS_ERROR;
     }
 
-    char *employeeAddress = strtok(NULL, ",");
-    if (employeeAddress == NULL) {
-        printf("Wrong string format!\n");
-        return STATUS_ERROR;
-    }
-
-    char *employeeHours = strtok(NULL, ",");
-    if (employeeHours == NULL) {
-        printf("Wrong string format!\n");
+    // record ids stay 32 bit on disk and on the wire
+    if (dbHeader->id >= UINT_MAX) {
+        printf("Out of employee ids!\n");
         return STATUS_ERROR;
     }
 
@@ -217,52 +920,64 @@ int add_employee(struct dbheader_t *dbHeader, struct employee_t **employees_poin
     dbHeader->id = dbHeader->id+1;
 
     dbHeader->count = dbHeader->count+1;
-	dbHeader->filesize = (dbHeader->filesize) + sizeof(struct employee_t);
+	dbHeader->filesize = db_file_size(dbHeader->count);
+
+    struct employee_t *employees = realloc(*employees_pointer, dbHeader->count * sizeof(struct employee_t));
+    if (employees == NULL) {
+        perror("realloc");
+        dbHeader->id--;
+        dbHeader->count--;
+        dbHeader->filesize = db_file_size(dbHeader->count);
+        return STATUS_ERROR;
+    }
+    memset(&employees[dbHeader->count-1], 0, sizeof(struct employee_t));
+    *employees_pointer = employees;
 
-    struct employee_t *employees = calloc(dbHeader->count, sizeof(struct employee_t));
-    memcpy(employees, *employees_pointer, (dbHeader->count-1) * sizeof(struct employee_t));
+    // text is only appended, a failed add leaves nothing referring to it
+    if (strtab_add_name(strings, fields->name, strnlen(fields->name, fields->name_len), &employees[dbHeader->count-1].name) == STATUS_ERROR ||
+        strtab_intern_address(strings, fields->address, strnlen(fields->address, fields->address_len), &employees[dbHeader->count-1].address) == STATUS_ERROR) {
+        dbHeader->id--;
+        dbHeader->count--;
+        dbHeader->filesize = db_file_size(dbHeader->count);
+        return STATUS_ERROR;
+    }
 
-    strncpy(employees[dbHeader->count-1].name, employeeName, sizeof(employees[dbHeader->count-1].name));
-    strncpy(employees[dbHeader->count-1].address, employeeAddress, sizeof(employees[dbHeader->count-1].address));
     employees[dbHeader->count-1].id = dbHeader->id;
-    employees[dbHeader->count-1].hours = (unsigned int)strtoul(employeeHours, NULL, 10);
-
-    *employees_pointer = employees;
+    employees[dbHeader->count-1].hours = fields->hours;
+    employees[dbHeader->count-1].version = 1;
+    employees[dbHeader->count-1].updated = time(NULL);
 
     return STATUS_SUCCESS;
 }
 
-int add_hours(struct dbheader_t *dbHeader, struct employee_t *employees, char *addString) {
+int add_hours(struct dbheader_t *dbHeader, struct employee_t *employees, unsigned int employeeId, unsigned int employeeHours) {
 
-    unsigned int employeeId = (unsigned int)strtoul(strtok(addString, ","), NULL, 10);
-    unsigned int employeeHours = (unsigned int)strtoul(strtok(NULL, ","), NULL, 10);
-
-    int i=0;
-    for (i=0;i<dbHeader->count;i++) {
-        if (employees[i].id == employeeId) {
-            employees[i].hours += employeeHours;
-            return STATUS_SUCCESS;
-        }
+    struct employee_t *employee = find_employee(dbHeader, employees, employeeId);
+    if (employee == NULL) {
+        return STATUS_ERROR;
     }
 
-    return STATUS_ERROR;
+    employee->hours += employeeHours;
+    employee->version++;
+    employee->updated = time(NULL);
+    return STATUS_SUCCESS;
 }
 
-int remove_employee(struct dbheader_t *dbHeader, struct employee_t **employees, char *employeeName) {
+int remove_employee(struct dbheader_t *dbHeader, struct employee_t **employees, struct strtab_t *strings, char *employeeName) {
 
-    unsigned short count = dbHeader->count;
+    uint64_t count = dbHeader->count;
     struct employee_t *employeeList = *employees;
     bool removed = false;
 
-    int i=0;
-    for (i=0;i<count;i++) {
-        if (strcmp(employeeList[i].name, employeeName) == 0) {
+    int64_t i=0;
+    for (i=0;i<(int64_t)count;i++) {
+        if (strcmp(strtab_name(strings, employeeList[i].name), employeeName) == 0) {
 
-            for (int j = i; j < count - 1; ++j) {
+            for (int64_t j = i; j < (int64_t)count - 1; ++j) {
                 employeeList[j] = employeeList[j + 1];  // Shift employees left
 
                 // repeat index in case of consecutive removals
-                if (j == count - 2) {
+                if (j == (int64_t)count - 2) {
                     i--;
                 }
             }
@@ -285,35 +1000,25 @@ int remove_employee(struct dbheader_t *dbHeader, struct employee_t **employees,
     *employees = newEmployeeList;
 
     dbHeader->count = count;
-    dbHeader->filesize = sizeof(struct dbheader_t) + count * sizeof(struct employee_t);
+    dbHeader->filesize = db_file_size(count);
     return STATUS_SUCCESS;
 }
 
 int remove_employee_id(struct dbheader_t *dbHeader, struct employee_t **employees, unsigned int id) {
 
-    unsigned short count = dbHeader->count;
+    uint64_t count = dbHeader->count;
     struct employee_t *employeeList = *employees;
-    bool removed = false;
-
-    int i=0;
-    for (i=0;i<count;i++) {
-        if (employeeList[i].id == id) {
 
-            for (int j = i; j < count - 1; ++j) {
-                employeeList[j] = employeeList[j + 1];  // Shift employees left
-            }
-
-            count--;
-            removed = true;
-            break;
-        }
-    }
-
-    if (!removed) {
+    uint64_t i = lower_bound_id(dbHeader, employeeList, id);
+    if (i == count || employeeList[i].id != id) {
         printf("Employee with id %d does not exist!\n", id);
         return STATUS_ERROR;
     }
 
+    // Shift employees left
+    memmove(&employeeList[i], &employeeList[i + 1], (count - i - 1) * sizeof(struct employee_t));
+    count--;
+
     struct employee_t *newEmployeeList = realloc(employeeList, count * sizeof(struct employee_t));
     if (newEmployeeList == NULL && count > 0) {
         return STATUS_ERROR;
@@ -322,53 +1027,75 @@ int remove_employee_id(struct dbheader_t *dbHeader, struct employee_t **employee
     *employees = newEmployeeList;
 
     dbHeader->count = count;
-    dbHeader->filesize = sizeof(struct dbheader_t) + count * sizeof(struct employee_t);
+    dbHeader->filesize = db_file_size(count);
     return STATUS_SUCCESS;
 }
 
-int edit_employee(struct dbheader_t *dbHeader, struct employee_t *employees, char *editstring) {
+int edit_employee(struct dbheader_t *dbHeader, struct employee_t *employees, struct strtab_t *strings, struct employee_fields_t *fields) {
 
-    char *idString = strtok(editstring, ",");
-    if (idString == NULL) {
-        printf("Error with edit string #1!\n");
+    if (fields->name_len >= EMPLOYEE_TEXT_MAX || fields->address_len >= EMPLOYEE_TEXT_MAX) {
+        printf("Wrong employee format!\n");
         return STATUS_ERROR;
     }
 
-    unsigned int employeeId = (unsigned int)strtoul(idString, NULL, 10);
-
-    char *employeeName = strtok(NULL, ",");
-    if (employeeName == NULL) {
-        printf("Error with edit string #2!\n");
-        return STATUS_ERROR;
+    struct employee_t *employee = find_employee(dbHeader, employees, fields->id);
+    if (employee != NULL) {
+        // the old name stays in the arena until the strings are compacted
+        uint32_t name = employee->name;
+        uint32_t address = employee->address;
+        if ((fields->fields & FIELD_NAME) && strtab_add_name(strings, fields->name, strnlen(fields->name, fields->name_len), &name) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        if ((fields->fields & FIELD_ADDRESS) && strtab_intern_address(strings, fields->address, strnlen(fields->address, fields->address_len), &address) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        employee->name = name;
+        employee->address = address;
+        if (fields->fields & FIELD_HOURS) {
+            employee->hours = fields->hours;
+        }
+        employee->version++;
+        employee->updated = time(NULL);
     }
 
-    char *employeeAddress = strtok(NULL, ",");
-    if (employeeAddress == NULL) {
-        printf("Error with edit string #3!\n");
+    return STATUS_SUCCESS;
+}
+
+// rebuilds the text from what the records still refer to, leaving both untouched on failure
+int compact_strings(struct employee_t *employees, uint64_t count, struct strtab_t *strings) {
+
+    struct strtab_t compacted;
+    if (strtab_init(&compacted) == STATUS_ERROR) {
         return STATUS_ERROR;
     }
 
-    char *employeeHours = strtok(NULL, ",");
-    if (employeeHours == NULL) {
-        printf("Error with edit string #4!\n");
+    uint32_t *refs = malloc(sizeof(uint32_t) * 2 * (count + 1));
+    if (refs == NULL) {
+        perror("malloc");
+        strtab_free(&compacted);
         return STATUS_ERROR;
     }
 
-    int i = 0;
-    for (i = 0; i<dbHeader->count; i++) {
-        if (employees[i].id == employeeId) {
-            if (strcmp(employeeName, ".") != 0) {
-                strncpy(employees[i].name, employeeName, sizeof(employees[i].name));
-            }
-            if (strcmp(employeeAddress, ".") != 0) {
-                strncpy(employees[i].address, employeeAddress, sizeof(employees[i].address));
-            }
-            if (strcmp(employeeHours, ".") != 0) {
-                employees[i].hours = (unsigned int)strtoul(employeeHours, NULL, 10);
-            }
-            break;
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        const char *name = strtab_name(strings, employees[i].name);
+        const char *address = strtab_address(strings, employees[i].address);
+        if (strtab_add_name(&compacted, name, strlen(name), &refs[i * 2]) == STATUS_ERROR ||
+            strtab_intern_address(&compacted, address, strlen(address), &refs[i * 2 + 1]) == STATUS_ERROR) {
+            free(refs);
+            strtab_free(&compacted);
+            return STATUS_ERROR;
         }
     }
 
+    for (i=0;i<count;i++) {
+        employees[i].name = refs[i * 2];
+        employees[i].address = refs[i * 2 + 1];
+    }
+    free(refs);
+
+    compacted.live = strtab_size(&compacted);
+    strtab_free(strings);
+    *strings = compacted;
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
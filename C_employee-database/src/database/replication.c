@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "replication.h"
+#include "db_poll.h"
+#include "common.h"
+#include "parse.h"
+#include "lz.h"
+#include "wheel.h"
+#include "feed.h"
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int replication_init(struct replication_t *repl, ClientState_t *clients, char *primary) {
+
+    memset(repl, 0, sizeof(*repl));
+    repl->role = ROLE_PRIMARY;
+    repl->primary_fd = -1;
+    repl->clients = clients;
+
+    if (primary == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    // primary is given as host:port
+    char *colon = strrchr(primary, ':');
+    if (colon == NULL) {
+        printf("Bad primary address: %s\n", primary);
+        return STATUS_ERROR;
+    }
+
+    *colon = '\0';
+    repl->primary_host = primary;
+    repl->primary_port = (unsigned short)strtoul(colon + 1, NULL, 10);
+    if (repl->primary_port == 0) {
+        printf("Bad primary port: %s\n", colon + 1);
+        return STATUS_ERROR;
+    }
+
+    repl->role = ROLE_REPLICA;
+    return STATUS_SUCCESS;
+}
+
+// starts a non-blocking connect, at most once every REPL_RETRY_MS. the hello and the
+// subscription go out from replication_receive once the socket is writable
+int replication_connect(struct replication_t *repl) {
+
+    uint64_t now = wheel_now_ms();
+    if (repl->last_attempt != 0 && now - repl->last_attempt < REPL_RETRY_MS) {
+        return STATUS_ERROR;
+    }
+    repl->last_attempt = now;
+
+    struct sockaddr_in primaryInfo = {0};
+    primaryInfo.sin_family = AF_INET;
+    primaryInfo.sin_addr.s_addr = inet_addr(repl->primary_host);
+    primaryInfo.sin_port = htons(repl->primary_port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == STATUS_ERROR) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    if (connect(fd, (struct sockaddr*)&primaryInfo, sizeof(primaryInfo)) == STATUS_ERROR && errno != EINPROGRESS) {
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    repl->primary_fd = fd;
+    repl->connecting = true;
+    repl->handshaken = false;
+    repl->in_len = 0;
+    return STATUS_SUCCESS;
+}
+
+int replication_timeout(struct replication_t *repl) {
+
+    if (repl->role != ROLE_REPLICA || repl->primary_fd != -1) {
+        return -1;
+    }
+
+    uint64_t elapsed = wheel_now_ms() - repl->last_attempt;
+    return elapsed >= REPL_RETRY_MS ? 0 : (int)(REPL_RETRY_MS - elapsed);
+}
+
+static void disconnect_primary(struct replication_t *repl) {
+    close(repl->primary_fd);
+    repl->primary_fd = -1;
+    repl->connecting = false;
+    repl->handshaken = false;
+    repl->in_len = 0;
+}
+
+void replication_promote(struct replication_t *repl) {
+
+    if (repl->primary_fd != -1) {
+        disconnect_primary(repl);
+    }
+    free(repl->in);
+    repl->in = NULL;
+    repl->in_cap = 0;
+
+    repl->role = ROLE_PRIMARY;
+    repl->lag_ms = 0;
+    printf("Promoted to primary at sequence %lu\n", repl->seq);
+}
+
+void replication_queue(struct replication_t *repl, db_protocol_header_t *request) {
+
+    if (repl->role != ROLE_PRIMARY) {
+        return;
+    }
+
+    size_t payload = request_payload_size(request->type);
+    size_t size = sizeof(db_protocol_header_t) + payload;
+
+    if (repl->pending_len + size > repl->pending_cap) {
+        size_t cap = repl->pending_cap == 0 ? BUFFER_SIZE : repl->pending_cap * 2;
+        while (cap < repl->pending_len + size) cap *= 2;
+
+        uint8_t *pending = realloc(repl->pending, cap);
+        if (pending == NULL) {
+            perror("realloc");
+            return;
+        }
+        repl->pending = pending;
+        repl->pending_cap = cap;
+    }
+
+    // frames are kept as they came off the wire
+    db_protocol_header_t *frame = (db_protocol_header_t*)(repl->pending + repl->pending_len);
+    frame->type = htonl(request->type);
+    frame->len = htonl(request->len);
+    memcpy(&frame[1], &request[1], payload);
+
+    repl->pending_len += size;
+    repl->pending_count++;
+    repl->seq++;
+}
+
+static void drop_replica(ClientState_t *client, const char *reason) {
+    printf("%s, closing the connection\n", reason);
+    close(client->fd);
+    client->fd = -1;
+    client->state = STATE_DISCONNECTED;
+    feed_drop_client(client);
+}
+
+static void queue_batch(struct replication_t *repl) {
+
+    bool has_replicas = false;
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        if (repl->clients[i].state == STATE_REPLICA) {
+            has_replicas = true;
+        }
+    }
+
+    if (!has_replicas) {
+        return;
+    }
+
+    size_t headers = sizeof(db_protocol_header_t) + sizeof(db_protocol_repl_data);
+    size_t bound = lz_compress_bound(repl->pending_len);
+    uint8_t *message = malloc(headers + bound);
+    if (message == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    int compressed = lz_compress(repl->pending, repl->pending_len, message + headers, bound);
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message;
+    db_protocol_repl_data *batch = (db_protocol_repl_data*)&header[1];
+    header->type = htonl(MSG_REPL_BATCH);
+    header->len = htonl(1);
+    memset(batch, 0, sizeof(*batch));
+    batch->seq = htobe64(repl->seq);
+    batch->timestamp = htobe64(now_ms());
+    batch->count = htonl(repl->pending_count);
+    batch->raw_len = htonl(repl->pending_len);
+    batch->compressed_len = htonl(compressed);
+
+    for (i=0;i<MAX_CLIENTS && compressed != STATUS_ERROR;i++) {
+        ClientState_t *client = &repl->clients[i];
+        if (client->state != STATE_REPLICA) {
+            continue;
+        }
+
+        // the snapshot is not held against the replica, only the batches queued behind it
+        size_t backlog = client->out_len - client->out_sent - client->repl_snapshot_len;
+        if (backlog + headers + compressed > REPL_CLIENT_BUFFER) {
+            drop_replica(client, "Replica fell behind, it resyncs from a snapshot");
+            continue;
+        }
+
+        if (client_queue(client, message, headers + compressed) == STATUS_ERROR) {
+            drop_replica(client, "Could not queue a batch for the replica");
+        }
+    }
+
+    free(message);
+}
+
+// queues everything applied since the last flush for each replica and writes what the sockets take
+void replication_flush(struct replication_t *repl) {
+
+    if (repl->pending_count > 0) {
+        queue_batch(repl);
+        repl->pending_len = 0;
+        repl->pending_count = 0;
+    }
+
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        ClientState_t *client = &repl->clients[i];
+        if (client->state != STATE_REPLICA) {
+            continue;
+        }
+
+        ssize_t written = client_flush(client);
+        if (written == STATUS_ERROR) {
+            drop_replica(client, "Lost replica");
+            continue;
+        }
+        client->repl_snapshot_len -= (size_t)written < client->repl_snapshot_len ? (size_t)written : client->repl_snapshot_len;
+    }
+}
+
+int replication_send_snapshot(struct replication_t *repl, ClientState_t *client, struct database_t *db) {
+
+    // writes applied earlier in this iteration are in the snapshot, so the other replicas get them first
+    replication_flush(repl);
+
+    unsigned int count = database_count(db);
+    size_t raw_len = count * sizeof(db_protocol_list_resp);
+    size_t headers = sizeof(db_protocol_header_t) + sizeof(db_protocol_repl_data);
+    size_t bound = lz_compress_bound(raw_len);
+
+    db_protocol_list_resp *raw = malloc(raw_len + 1);
+    uint8_t *message = malloc(headers + bound);
+    if (raw == NULL || message == NULL) {
+        perror("malloc");
+        free(raw);
+        free(message);
+        return STATUS_ERROR;
+    }
+
+    // the snapshot is every shard in its LIST wire form
+    uint64_t i=0;
+    int shard=0;
+    for (shard=0;shard<db->count;shard++) {
+        database_wire_records(db, shard, 0, db->shards[shard].header->count, &raw[i]);
+        i += db->shards[shard].header->count;
+    }
+
+    int compressed = lz_compress((uint8_t*)raw, raw_len, message + headers, bound);
+    free(raw);
+
+    if (compressed == STATUS_ERROR) {
+        free(message);
+        return STATUS_ERROR;
+    }
+
+    db_protocol_header_t *header = (db_protocol_header_t*)message;
+    db_protocol_repl_data *snapshot = (db_protocol_repl_data*)&header[1];
+    header->type = htonl(MSG_REPL_SNAPSHOT);
+    header->len = htonl(1);
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->seq = htobe64(repl->seq);
+    snapshot->timestamp = htobe64(now_ms());
+    snapshot->count = htonl(count);
+    snapshot->id = htonl(db->next_id);
+    snapshot->raw_len = htonl(raw_len);
+    snapshot->compressed_len = htonl(compressed);
+
+    // the message becomes the replica's output buffer and goes out with the batches from replication_flush
+    free(client->out);
+    client->out = message;
+    client->out_cap = headers + bound;
+    client->out_len = headers + compressed;
+    client->out_sent = 0;
+    client->repl_snapshot_len = client->out_len;
+
+    printf("Replica subscribed, queued snapshot of %u employees (%zu -> %d bytes)\n", count, raw_len, compressed);
+    client->state = STATE_REPLICA;
+    client->repl_seq = repl->seq;
+    return STATUS_SUCCESS;
+}
+
+static int apply_snapshot(struct database_t *db, db_protocol_repl_data *snapshot, uint8_t *raw) {
+
+    if (snapshot->raw_len != snapshot->count * sizeof(db_protocol_list_resp)) {
+        printf("Snapshot size does not match its count\n");
+        return STATUS_ERROR;
+    }
+
+    // the replica may be sharded differently, records are routed again
+    if (database_replace(db, (db_protocol_list_resp*)raw, snapshot->count, snapshot->id) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    printf("Loaded snapshot of %u employees\n", snapshot->count);
+    return STATUS_SUCCESS;
+}
+
+static int apply_batch(struct database_t *db, db_protocol_repl_data *batch, uint8_t *raw) {
+
+    char frame[BUFFER_SIZE];
+    size_t offset = 0;
+    uint32_t i=0;
+
+    for (i=0;i<batch->count;i++) {
+        if (offset + sizeof(db_protocol_header_t) > batch->raw_len) {
+            printf("Truncated replication batch\n");
+            return STATUS_ERROR;
+        }
+
+        db_protocol_header_t *header = (db_protocol_header_t*)frame;
+        memcpy(header, raw + offset, sizeof(db_protocol_header_t));
+        header->type = ntohl(header->type);
+        header->len = ntohl(header->len);
+
+        size_t payload = request_payload_size(header->type);
+        if (!is_write_request(header->type) || offset + sizeof(db_protocol_header_t) + payload > batch->raw_len) {
+            printf("Bad frame in replication batch\n");
+            return STATUS_ERROR;
+        }
+
+        memcpy(&header[1], raw + offset + sizeof(db_protocol_header_t), payload);
+        offset += sizeof(db_protocol_header_t) + payload;
+
+        // the replica no longer matches the primary, it reconnects and loads a fresh snapshot
+        if (apply_write_request(db, header) == STATUS_ERROR) {
+            printf("Replica failed to apply a replicated request, resubscribing\n");
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int finish_connect(struct replication_t *repl) {
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(repl->primary_fd, SOL_SOCKET, SO_ERROR, &error, &len) == STATUS_ERROR || error != 0) {
+        return STATUS_ERROR;
+    }
+
+    // the primary answers the hello first and the subscription with a snapshot
+    char request[2 * sizeof(db_protocol_header_t) + sizeof(db_protocol_hello)] = {0};
+    db_protocol_header_t *header = (db_protocol_header_t*)request;
+    db_protocol_hello *hello = (db_protocol_hello*)&header[1];
+    db_protocol_header_t *subscribe = (db_protocol_header_t*)&hello[1];
+
+    header->type = htonl(MSG_HELLO_REQ);
+    header->len = htonl(1);
+    hello->protocol = htons(PROTOCOL_VER);
+    subscribe->type = htonl(MSG_REPL_SUBSCRIBE_REQ);
+    subscribe->len = htonl(0);
+
+    // a fresh socket takes this much without blocking
+    if (send(repl->primary_fd, request, sizeof(request), MSG_DONTWAIT) != sizeof(request)) {
+        perror("send");
+        return STATUS_ERROR;
+    }
+
+    printf("Replicating from %s:%d\n", repl->primary_host, repl->primary_port);
+    repl->connecting = false;
+    return STATUS_SUCCESS;
+}
+
+static int apply_message(struct replication_t *repl, struct database_t *db, db_protocol_type_enum type, db_protocol_repl_data *data, const uint8_t *compressed) {
+
+    uint8_t *raw = malloc(data->raw_len + 1);
+    if (raw == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    if (lz_decompress(compressed, data->compressed_len, raw, data->raw_len) != (int)data->raw_len) {
+        printf("Corrupted replication payload\n");
+        free(raw);
+        return STATUS_ERROR;
+    }
+
+    int status = type == MSG_REPL_SNAPSHOT ? apply_snapshot(db, data, raw) : apply_batch(db, data, raw);
+    free(raw);
+    if (status == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    // the whole batch is persisted with a single write per shard
+    database_persist(db);
+    repl->seq = data->seq;
+    repl->lag_ms = (int64_t)(now_ms() - data->timestamp);
+
+    db_protocol_header_t ackHeader = {0};
+    db_protocol_repl_ack ack = {0};
+    ackHeader.type = htonl(MSG_REPL_ACK);
+    ackHeader.len = htonl(1);
+    ack.seq = htobe64(repl->seq);
+
+    char message[sizeof(db_protocol_header_t) + sizeof(db_protocol_repl_ack)];
+    memcpy(message, &ackHeader, sizeof(ackHeader));
+    memcpy(message + sizeof(ackHeader), &ack, sizeof(ack));
+
+    // acks are cumulative, one the socket has no room for is covered by the next
+    ssize_t written = send(repl->primary_fd, message, sizeof(message), MSG_DONTWAIT);
+    if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("send");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// handles every complete message in the input, and returns how large the buffer has to be for the next one
+static int frame_messages(struct replication_t *repl, struct database_t *db, size_t *want) {
+
+    size_t offset = 0;
+    int status = STATUS_SUCCESS;
+    *want = 0;
+
+    while (status == STATUS_SUCCESS && repl->in_len - offset >= sizeof(db_protocol_header_t)) {
+        const uint8_t *frame = repl->in + offset;
+        size_t available = repl->in_len - offset;
+
+        // messages follow each other at any offset, so headers are copied out
+        db_protocol_header_t header;
+        memcpy(&header, frame, sizeof(header));
+        header.type = ntohl(header.type);
+
+        if (!repl->handshaken) {
+            if (header.type != MSG_HELLO_RESP) {
+                printf("Primary rejected the replica handshake\n");
+                status = STATUS_ERROR;
+                break;
+            }
+            if (available < sizeof(db_protocol_header_t) + sizeof(db_protocol_hello)) {
+                break;
+            }
+            offset += sizeof(db_protocol_header_t) + sizeof(db_protocol_hello);
+            repl->handshaken = true;
+            continue;
+        }
+
+        if (header.type != MSG_REPL_SNAPSHOT && header.type != MSG_REPL_BATCH) {
+            printf("Unexpected message %d from the primary\n", header.type);
+            status = STATUS_ERROR;
+            break;
+        }
+
+        size_t headers = sizeof(db_protocol_header_t) + sizeof(db_protocol_repl_data);
+        if (available < headers) {
+            break;
+        }
+
+        db_protocol_repl_data data;
+        memcpy(&data, frame + sizeof(db_protocol_header_t), sizeof(data));
+        data.seq = be64toh(data.seq);
+        data.timestamp = be64toh(data.timestamp);
+        data.count = ntohl(data.count);
+        data.id = ntohl(data.id);
+        data.raw_len = ntohl(data.raw_len);
+        data.compressed_len = ntohl(data.compressed_len);
+
+        if (available < headers + data.compressed_len) {
+            *want = headers + data.compressed_len;
+            break;
+        }
+
+        status = apply_message(repl, db, header.type, &data, frame + headers);
+        offset += headers + data.compressed_len;
+    }
+
+    memmove(repl->in, repl->in + offset, repl->in_len - offset);
+    repl->in_len -= offset;
+    return status;
+}
+
+static int reserve_input(struct replication_t *repl, size_t size) {
+
+    if (size <= repl->in_cap) {
+        return STATUS_SUCCESS;
+    }
+
+    uint8_t *in = realloc(repl->in, size);
+    if (in == NULL) {
+        perror("realloc");
+        return STATUS_ERROR;
+    }
+    repl->in = in;
+    repl->in_cap = size;
+    return STATUS_SUCCESS;
+}
+
+// the primary's connection is ready, either the connect finished or its stream has more bytes
+int replication_receive(struct replication_t *repl, struct database_t *db) {
+
+    int status = STATUS_ERROR;
+
+    if (repl->connecting) {
+        status = finish_connect(repl);
+        goto done;
+    }
+
+    // room for at least BUFFER_SIZE more bytes, messages larger than that were reserved for below
+    if (reserve_input(repl, repl->in_len + BUFFER_SIZE) == STATUS_ERROR) {
+        goto done;
+    }
+
+    ssize_t bytes_read = read(repl->primary_fd, repl->in + repl->in_len, repl->in_cap - repl->in_len);
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return STATUS_SUCCESS;
+    }
+    if (bytes_read <= 0) {
+        if (bytes_read == STATUS_ERROR) perror("read");
+        printf("Lost connection to the primary\n");
+        goto done;
+    }
+    repl->in_len += bytes_read;
+
+    size_t want = 0;
+    if (frame_messages(repl, db, &want) == STATUS_ERROR) {
+        goto done;
+    }
+
+    // a snapshot is read in one piece once its size is known
+    status = reserve_input(repl, want);
+
+done:
+    if (status == STATUS_ERROR) {
+        disconnect_primary(repl);
+    }
+
+    return status;
+}
+
+void replication_status(struct replication_t *repl, db_protocol_status_resp *status) {
+
+    uint16_t replicas = 0;
+    uint64_t replica_lag = 0;
+
+    int i=0;
+    for (i=0;i<MAX_CLIENTS;i++) {
+        if (repl->clients[i].state == STATE_REPLICA) {
+            replicas++;
+            if (repl->seq - repl->clients[i].repl_seq > replica_lag) {
+                replica_lag = repl->seq - repl->clients[i].repl_seq;
+            }
+        }
+    }
+
+    // status may sit at any offset of a client buffer, so it is filled in one copy
+    db_protocol_status_resp reply = {0};
+    reply.role = htons(repl->role);
+    reply.replicas = htons(replicas);
+    reply.seq = htobe64(repl->seq);
+    reply.lag_ms = htobe64(repl->lag_ms);
+    reply.replica_lag = htobe64(replica_lag);
+    memcpy(status, &reply, sizeof(reply));
+}
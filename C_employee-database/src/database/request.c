@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "request.h"
+#include "common.h"
+
+// the next comma separated field, text moves past it and is NULL after the last one
+static const char *next_field(const char **text, size_t *lenOut) {
+
+    if (*text == NULL) {
+        return NULL;
+    }
+
+    const char *start = *text;
+    const char *comma = strchr(start, ',');
+    *lenOut = comma != NULL ? (size_t)(comma - start) : strlen(start);
+    *text = comma != NULL ? comma + 1 : NULL;
+    return start;
+}
+
+static int parse_number(const char *text, size_t len, unsigned int *valueOut) {
+
+    if (len == 0 || len > 10) {
+        return STATUS_ERROR;
+    }
+
+    unsigned long value = 0;
+    size_t i=0;
+    for (i=0;i<len;i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return STATUS_ERROR;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+
+    if (value > UINT32_MAX) {
+        return STATUS_ERROR;
+    }
+    *valueOut = (unsigned int)value;
+    return STATUS_SUCCESS;
+}
+
+static bool unchanged(const char *field, size_t len) {
+    return len == 1 && field[0] == '.';
+}
+
+// the command line form, [name],[address],[hours] or for an edit [id],[name],[address],[hours]
+// with '.' for fields left unchanged. text is not modified
+int request_parse_employee(const char *text, bool edit, struct employee_fields_t *fieldsOut) {
+
+    memset(fieldsOut, 0, sizeof(*fieldsOut));
+    fieldsOut->fields = FIELD_ALL;
+
+    size_t len = 0;
+    const char *field = NULL;
+    if (edit) {
+        field = next_field(&text, &len);
+        if (field == NULL || parse_number(field, len, &fieldsOut->id) == STATUS_ERROR) {
+            printf("Bad employee id in: %s\n", field != NULL ? field : "");
+            return STATUS_ERROR;
+        }
+    }
+
+    fieldsOut->name = next_field(&text, &fieldsOut->name_len);
+    fieldsOut->address = next_field(&text, &fieldsOut->address_len);
+    field = next_field(&text, &len);
+    if (fieldsOut->name == NULL || fieldsOut->address == NULL || field == NULL || text != NULL) {
+        printf("Wrong string format, expected %s[name],[address],[hours]\n", edit ? "[id]," : "");
+        return STATUS_ERROR;
+    }
+
+    if (edit && unchanged(fieldsOut->name, fieldsOut->name_len)) {
+        fieldsOut->fields &= ~FIELD_NAME;
+    }
+    if (edit && unchanged(fieldsOut->address, fieldsOut->address_len)) {
+        fieldsOut->fields &= ~FIELD_ADDRESS;
+    }
+    if (edit && unchanged(field, len)) {
+        fieldsOut->fields &= ~FIELD_HOURS;
+    } else if (parse_number(field, len, &fieldsOut->hours) == STATUS_ERROR) {
+        printf("Bad hours: %.*s\n", (int)len, field);
+        return STATUS_ERROR;
+    }
+
+    if (fieldsOut->name_len > PROTOCOL_TEXT_MAX || fieldsOut->address_len > PROTOCOL_TEXT_MAX) {
+        printf("Names and addresses are at most %d bytes\n", PROTOCOL_TEXT_MAX);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// [id],[hours]
+int request_parse_hours(const char *text, unsigned int *idOut, unsigned int *hoursOut) {
+
+    size_t idLen = 0;
+    size_t hoursLen = 0;
+    const char *id = next_field(&text, &idLen);
+    const char *hours = next_field(&text, &hoursLen);
+
+    if (id == NULL || hours == NULL || text != NULL ||
+        parse_number(id, idLen, idOut) == STATUS_ERROR || parse_number(hours, hoursLen, hoursOut) == STATUS_ERROR) {
+        printf("Wrong string format, expected [id],[hours]\n");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int request_encode_employee(struct employee_fields_t *fields, db_protocol_employee_req *request) {
+
+    if (fields->name_len > PROTOCOL_TEXT_MAX || fields->address_len > PROTOCOL_TEXT_MAX) {
+        printf("Names and addresses are at most %d bytes\n", PROTOCOL_TEXT_MAX);
+        return STATUS_ERROR;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->id = htonl(fields->id);
+    request->hours = htonl(fields->hours);
+    request->fields = htons(fields->fields);
+    request->name_len = htons(fields->name_len);
+    request->address_len = htons(fields->address_len);
+    memcpy(request->name, fields->name, fields->name_len);
+    memcpy(request->address, fields->address, fields->address_len);
+    return STATUS_SUCCESS;
+}
+
+// name and address are left pointing into the request
+int request_decode_employee(db_protocol_employee_req *request, struct employee_fields_t *fieldsOut) {
+
+    fieldsOut->id = ntohl(request->id);
+    fieldsOut->hours = ntohl(request->hours);
+    fieldsOut->fields = ntohs(request->fields);
+    fieldsOut->name = (const char*)request->name;
+    fieldsOut->name_len = ntohs(request->name_len);
+    fieldsOut->address = (const char*)request->address;
+    fieldsOut->address_len = ntohs(request->address_len);
+
+    if (fieldsOut->name_len > PROTOCOL_TEXT_MAX || fieldsOut->address_len > PROTOCOL_TEXT_MAX || (fieldsOut->fields & ~FIELD_ALL) != 0) {
+        printf("Malformed employee request\n");
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+int request_encode_name(const char *name, db_protocol_name_req *request) {
+
+    size_t len = strlen(name);
+    if (len > PROTOCOL_TEXT_MAX) {
+        printf("Names are at most %d bytes\n", PROTOCOL_TEXT_MAX);
+        return STATUS_ERROR;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->name_len = htons(len);
+    memcpy(request->name, name, len);
+    return STATUS_SUCCESS;
+}
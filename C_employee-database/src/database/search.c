@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "search.h"
+#include "parse.h"
+#include "common.h"
+
+#define FOLDED_MAX 258
+
+static const char *field_text(struct employee_t *employee, struct strtab_t *strings, db_protocol_search_field_enum field) {
+    return field == SEARCH_BY_ADDRESS ? strtab_address(strings, employee->address) : strtab_name(strings, employee->name);
+}
+
+// boundary byte followed by the lower cased text, returns the folded length
+static size_t fold_text(const char *text, unsigned char *folded) {
+    size_t length = 0;
+    folded[length++] = SEARCH_BOUNDARY;
+
+    while (length < FOLDED_MAX && text[length - 1] != '\0') {
+        folded[length] = (unsigned char)tolower((unsigned char)text[length - 1]);
+        length++;
+    }
+
+    return length;
+}
+
+static uint32_t trigram_key(db_protocol_search_field_enum field, const unsigned char *trigram) {
+    return (uint32_t)field << 24 | (uint32_t)trigram[0] << 16 | (uint32_t)trigram[1] << 8 | trigram[2];
+}
+
+static uint64_t bucket_slot(struct search_index_t *index, uint32_t key) {
+    return ((uint64_t)key * 0x9E3779B97F4A7C15ull >> 32) & (index->size - 1);
+}
+
+static int grow_buckets(struct search_index_t *index) {
+
+    uint64_t size = index->size == 0 ? SEARCH_MIN_BUCKETS : index->size * 2;
+    struct posting_t *buckets = calloc(size, sizeof(struct posting_t));
+    if (buckets == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    struct posting_t *old = index->buckets;
+    uint64_t oldSize = index->size;
+    index->buckets = buckets;
+    index->size = size;
+
+    uint64_t i=0;
+    for (i=0;i<oldSize;i++) {
+        if (old[i].key != 0) {
+            uint64_t slot = bucket_slot(index, old[i].key);
+            while (buckets[slot].key != 0) {
+                slot = (slot + 1) & (size - 1);
+            }
+            buckets[slot] = old[i];
+        }
+    }
+
+    free(old);
+    return STATUS_SUCCESS;
+}
+
+// keys are never 0, every trigram holds at least one non zero byte
+static struct posting_t *find_posting(struct search_index_t *index, uint32_t key, bool create) {
+
+    if (create && (index->used + 1) * 4 > index->size * 3 && grow_buckets(index) == STATUS_ERROR) {
+        return NULL;
+    }
+
+    if (index->size == 0) {
+        return NULL;
+    }
+
+    uint64_t slot = bucket_slot(index, key);
+    while (index->buckets[slot].key != 0) {
+        if (index->buckets[slot].key == key) {
+            return &index->buckets[slot];
+        }
+        slot = (slot + 1) & (index->size - 1);
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    index->buckets[slot].key = key;
+    index->used++;
+    return &index->buckets[slot];
+}
+
+static uint32_t lower_bound(const unsigned int *ids, uint32_t count, unsigned int id) {
+
+    uint32_t low = 0;
+    uint32_t high = count;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (ids[middle] < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// new ids are the largest so far and almost always append
+static int posting_insert(struct posting_t *posting, unsigned int id, bool sorted) {
+
+    uint32_t position = posting->count;
+    if (position > 0 && posting->ids[position - 1] >= id) {
+        if (posting->ids[position - 1] == id) {
+            return STATUS_SUCCESS;
+        }
+        if (sorted) {
+            position = lower_bound(posting->ids, posting->count, id);
+            if (posting->ids[position] == id) {
+                return STATUS_SUCCESS;
+            }
+        }
+    }
+
+    if (posting->count == posting->capacity) {
+        uint32_t capacity = posting->capacity == 0 ? 4 : posting->capacity * 2;
+        unsigned int *ids = realloc(posting->ids, capacity * sizeof(unsigned int));
+        if (ids == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        posting->ids = ids;
+        posting->capacity = capacity;
+    }
+
+    memmove(&posting->ids[position + 1], &posting->ids[position], (posting->count - position) * sizeof(unsigned int));
+    posting->ids[position] = id;
+    posting->count++;
+    return STATUS_SUCCESS;
+}
+
+static int index_record(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employee, bool sorted) {
+
+    unsigned char folded[FOLDED_MAX];
+
+    int field=0;
+    for (field=SEARCH_BY_NAME;field<=SEARCH_BY_ADDRESS;field++) {
+        size_t length = fold_text(field_text(employee, strings, field), folded);
+
+        size_t i=0;
+        for (i=0;i+3<=length;i++) {
+            struct posting_t *posting = find_posting(index, trigram_key(field, &folded[i]), true);
+            if (posting == NULL || posting_insert(posting, employee->id, sorted) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// bulk load, posting lists may come out of order until search_index_sort
+int search_index_build(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employees, uint64_t count) {
+
+    uint64_t i=0;
+    for (i=0;i<count;i++) {
+        if (index_record(index, strings, &employees[i], false) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int search_index_add(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employee) {
+    return index_record(index, strings, employee, true);
+}
+
+void search_index_remove(struct search_index_t *index, struct strtab_t *strings, struct employee_t *employee) {
+
+    unsigned char folded[FOLDED_MAX];
+
+    int field=0;
+    for (field=SEARCH_BY_NAME;field<=SEARCH_BY_ADDRESS;field++) {
+        size_t length = fold_text(field_text(employee, strings, field), folded);
+
+        size_t i=0;
+        for (i=0;i+3<=length;i++) {
+            struct posting_t *posting = find_posting(index, trigram_key(field, &folded[i]), false);
+            if (posting == NULL) {
+                continue;
+            }
+
+            uint32_t position = lower_bound(posting->ids, posting->count, employee->id);
+            if (position < posting->count && posting->ids[position] == employee->id) {
+                memmove(&posting->ids[position], &posting->ids[position + 1], (posting->count - position - 1) * sizeof(unsigned int));
+                posting->count--;
+            }
+        }
+    }
+}
+
+static int compare_ids(const void *a, const void *b) {
+    unsigned int first = *(const unsigned int *)a;
+    unsigned int second = *(const unsigned int *)b;
+    return (first > second) - (first < second);
+}
+
+void search_index_sort(struct search_index_t *index) {
+
+    uint64_t i=0;
+    for (i=0;i<index->size;i++) {
+        struct posting_t *posting = &index->buckets[i];
+
+        uint32_t j=1;
+        while (j < posting->count && posting->ids[j - 1] < posting->ids[j]) {
+            j++;
+        }
+
+        if (j < posting->count) {
+            qsort(posting->ids, posting->count, sizeof(unsigned int), compare_ids);
+        }
+    }
+}
+
+void search_index_free(struct search_index_t *index) {
+
+    uint64_t i=0;
+    for (i=0;i<index->size;i++) {
+        free(index->buckets[i].ids);
+    }
+
+    free(index->buckets);
+    index->buckets = NULL;
+    index->size = 0;
+    index->used = 0;
+}
+
+// prefixes include the boundary byte, so two characters are already enough. an exact match is also a prefix
+bool search_indexable(db_protocol_search_mode_enum mode, char *text) {
+    return strlen(text) >= (mode == SEARCH_CONTAINS ? 3 : 2);
+}
+
+// intersects the posting lists of every trigram in the text, shortest list first.
+// candidates still have to be checked with search_match
+int search_candidates(struct search_index_t *index, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text, unsigned int **idsOut, uint64_t *countOut) {
+
+    unsigned char folded[FOLDED_MAX];
+    struct posting_t *postings[FOLDED_MAX];
+    int count = 0;
+    int shortest = 0;
+
+    *idsOut = NULL;
+    *countOut = 0;
+
+    size_t length = fold_text(text, folded);
+    size_t i = mode == SEARCH_CONTAINS ? 1 : 0;
+    for (;i+3<=length;i++) {
+        struct posting_t *posting = find_posting(index, trigram_key(field, &folded[i]), false);
+        if (posting == NULL || posting->count == 0) {
+            return STATUS_SUCCESS;
+        }
+
+        if (count == 0 || posting->count < postings[shortest]->count) {
+            shortest = count;
+        }
+        postings[count++] = posting;
+    }
+
+    if (count == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    unsigned int *ids = malloc(postings[shortest]->count * sizeof(unsigned int));
+    if (ids == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+    memcpy(ids, postings[shortest]->ids, postings[shortest]->count * sizeof(unsigned int));
+    uint32_t matched = postings[shortest]->count;
+
+    int j=0;
+    for (j=0;j<count && matched > 0;j++) {
+        if (j == shortest) {
+            continue;
+        }
+
+        uint32_t kept = 0;
+        uint32_t k=0;
+        for (k=0;k<matched;k++) {
+            uint32_t position = lower_bound(postings[j]->ids, postings[j]->count, ids[k]);
+            if (position < postings[j]->count && postings[j]->ids[position] == ids[k]) {
+                ids[kept++] = ids[k];
+            }
+        }
+        matched = kept;
+    }
+
+    *idsOut = ids;
+    *countOut = matched;
+    return STATUS_SUCCESS;
+}
+
+// exact matches are the only ones that are case sensitive
+bool search_match(struct employee_t *employee, struct strtab_t *strings, db_protocol_search_field_enum field, db_protocol_search_mode_enum mode, char *text) {
+
+    const char *value = field_text(employee, strings, field);
+    size_t length = strlen(text);
+
+    if (mode == SEARCH_EXACT) {
+        return strcmp(value, text) == 0;
+    }
+
+    if (mode == SEARCH_PREFIX) {
+        return strncasecmp(value, text, length) == 0;
+    }
+
+    for (;*value != '\0';value++) {
+        if (strncasecmp(value, text, length) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
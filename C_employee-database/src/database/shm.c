@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "shm.h"
+#include "common.h"
+
+static uint64_t monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// the mapping is shared between processes, so the futexes are not private
+static long futex(_Atomic uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+// on a single cpu the side being waited for can not run while the other spins
+unsigned int shm_spin_us(void) {
+    static long cpus = 0;
+    if (cpus == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return cpus > 1 ? SHM_SPIN_US : 0;
+}
+
+size_t shm_channel_size(void) {
+    return 2 * sizeof(struct shm_ring_t) + SHM_REQUEST_RING + SHM_REPLY_RING;
+}
+
+struct shm_ring_t *shm_requests(void *channel) {
+    return (struct shm_ring_t*)channel;
+}
+
+struct shm_ring_t *shm_replies(void *channel) {
+    return (struct shm_ring_t*)((uint8_t*)channel + sizeof(struct shm_ring_t) + SHM_REQUEST_RING);
+}
+
+// an anonymous file holding both rings, its fd is handed to the client
+void *shm_create(int *fdOut) {
+
+    int fd = memfd_create("dbserver-shm", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return NULL;
+    }
+
+    if (ftruncate(fd, shm_channel_size()) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    void *channel = shm_map(fd, shm_channel_size());
+    if (channel == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    // a new file reads as zeros, both rings start empty
+    *fdOut = fd;
+    return channel;
+}
+
+void *shm_map(int fd, size_t size) {
+
+    if (size != shm_channel_size()) {
+        printf("Shared memory channel of %zu bytes, expected %zu\n", size, shm_channel_size());
+        return NULL;
+    }
+
+    void *channel = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (channel == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return channel;
+}
+
+void shm_unmap(void *channel) {
+    munmap(channel, shm_channel_size());
+}
+
+// both indices of a new channel start at zero
+void shm_end_init(struct shm_end_t *end, struct shm_ring_t *ring, uint32_t size, bool producer) {
+    end->ring = ring;
+    end->size = size;
+    end->index = 0;
+    end->producer = producer;
+}
+
+// bytes in the ring as this side sees them, more than size only when the other side broke it
+size_t shm_ring_used(struct shm_end_t *end) {
+    if (end->producer) {
+        return end->index - atomic_load_explicit(&end->ring->tail, memory_order_acquire);
+    }
+    return atomic_load_explicit(&end->ring->head, memory_order_acquire) - end->index;
+}
+
+// copies as much as fits, returns the bytes taken or STATUS_ERROR for a broken ring
+ssize_t shm_ring_put(struct shm_end_t *end, const void *data, size_t size) {
+
+    size_t used = shm_ring_used(end);
+    if (used > end->size) {
+        return STATUS_ERROR;
+    }
+    if (size > end->size - used) {
+        size = end->size - used;
+    }
+
+    size_t at = end->index & (end->size - 1);
+    size_t first = size < end->size - at ? size : end->size - at;
+    memcpy(end->ring->data + at, data, first);
+    memcpy(end->ring->data, (const uint8_t*)data + first, size - first);
+
+    end->index += (uint32_t)size;
+    atomic_store_explicit(&end->ring->head, end->index, memory_order_release);
+    return (ssize_t)size;
+}
+
+// copies out as much as is there up to size, and wakes a producer waiting for room.
+// STATUS_ERROR for a broken ring
+ssize_t shm_ring_take(struct shm_end_t *end, void *out, size_t size) {
+
+    size_t used = shm_ring_used(end);
+    if (used > end->size) {
+        return STATUS_ERROR;
+    }
+    if (size > used) {
+        size = used;
+    }
+
+    size_t at = end->index & (end->size - 1);
+    size_t first = size < end->size - at ? size : end->size - at;
+    memcpy(out, end->ring->data + at, first);
+    memcpy((uint8_t*)out + first, end->ring->data, size - first);
+
+    end->index += (uint32_t)size;
+    atomic_store_explicit(&end->ring->tail, end->index, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (size > 0 && atomic_load_explicit(&end->ring->producer_waiting, memory_order_relaxed)) {
+        futex(&end->ring->tail, FUTEX_WAKE, INT_MAX, NULL);
+    }
+    return (ssize_t)size;
+}
+
+// wakes a consumer sleeping on the futex, a spinning one sees head move by itself
+void shm_ring_notify(struct shm_end_t *end) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&end->ring->consumer_waiting, memory_order_relaxed)) {
+        futex(&end->ring->head, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+static bool ring_ready(struct shm_end_t *end) {
+    size_t used = shm_ring_used(end);
+    return end->producer ? used < end->size : used > 0;
+}
+
+// a producer waits for room, a consumer for data. spins first, then sleeps on the futex of
+// the index the other side moves. STATUS_ERROR once timeout_ms passed
+int shm_ring_wait(struct shm_end_t *end, int timeout_ms) {
+
+    _Atomic uint32_t *word = end->producer ? &end->ring->tail : &end->ring->head;
+    _Atomic uint32_t *waiting = end->producer ? &end->ring->producer_waiting : &end->ring->consumer_waiting;
+    uint64_t start = monotonic_us();
+
+    while (!ring_ready(end)) {
+        uint64_t elapsed = monotonic_us() - start;
+        if (elapsed < shm_spin_us()) {
+            continue;
+        }
+        if (elapsed >= (uint64_t)timeout_ms * 1000) {
+            return STATUS_ERROR;
+        }
+
+        // the other side checks waiting after moving its index, one of the two sees the other
+        uint32_t seen = atomic_load_explicit(word, memory_order_relaxed);
+        atomic_store_explicit(waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!ring_ready(end)) {
+            uint64_t left = (uint64_t)timeout_ms * 1000 - elapsed;
+            struct timespec timeout = {.tv_sec = left / 1000000, .tv_nsec = (left % 1000000) * 1000};
+            futex(word, FUTEX_WAIT, seen, &timeout);
+        }
+        atomic_store_explicit(waiting, 0, memory_order_relaxed);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// for a consumer that sleeps somewhere else, in poll. false if data arrived meanwhile
+bool shm_ring_park(struct shm_end_t *end) {
+    atomic_store_explicit(&end->ring->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (shm_ring_used(end) > 0) {
+        atomic_store_explicit(&end->ring->consumer_waiting, 0, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void shm_ring_unpark(struct shm_end_t *end) {
+    atomic_store_explicit(&end->ring->consumer_waiting, 0, memory_order_relaxed);
+}
+
+// the producer's side of park, true when the consumer has to be woken some other way
+bool shm_ring_consumer_parked(struct shm_end_t *end) {
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&end->ring->consumer_waiting, memory_order_relaxed);
+}
+
+// data goes out with the fd attached, over a unix socket
+int shm_send_fd(int socket, void *data, size_t size, int fd) {
+
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {.iov_base = data, .iov_len = size};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (sendmsg(socket, &message, 0) != (ssize_t)size) {
+        perror("sendmsg");
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+// fdOut is -1 when the message carried none
+int shm_recv_fd(int socket, void *data, size_t size, int *fdOut) {
+
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {.iov_base = data, .iov_len = size};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    *fdOut = -1;
+    if (recvmsg(socket, &message, MSG_WAITALL) != (ssize_t)size) {
+        perror("recvmsg");
+        return STATUS_ERROR;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fdOut, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strtab.h"
+#include "common.h"
+#include "crc32c.h"
+
+static int grow(void **buffer, uint32_t *cap, uint64_t need, size_t size) {
+
+    if (need <= *cap) {
+        return STATUS_SUCCESS;
+    }
+    if (need > UINT32_MAX) {
+        printf("String table full\n");
+        return STATUS_ERROR;
+    }
+
+    uint64_t newCap = *cap ? *cap : 64;
+    while (newCap < need) {
+        newCap *= 2;
+    }
+    if (newCap > UINT32_MAX) {
+        newCap = UINT32_MAX;
+    }
+
+    void *grown = realloc(*buffer, newCap * size);
+    if (grown == NULL) {
+        perror("realloc");
+        return STATUS_ERROR;
+    }
+    *buffer = grown;
+    *cap = newCap;
+    return STATUS_SUCCESS;
+}
+
+static uint32_t slot_for(struct strtab_t *strings, const char *text, size_t len) {
+    return crc32c(0, text, len) & (strings->slot_count - 1);
+}
+
+// table of address index + 1, 0 is an empty slot, kept under half full
+static int rehash(struct strtab_t *strings, uint32_t slotCount) {
+
+    uint32_t *slots = calloc(slotCount, sizeof(uint32_t));
+    if (slots == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+    free(strings->slots);
+    strings->slots = slots;
+    strings->slot_count = slotCount;
+
+    uint32_t i = 0;
+    for (i = 1; i < strings->address_count; i++) {
+        const char *text = strings->address_text + strings->addresses[i];
+        uint32_t slot = slot_for(strings, text, strlen(text));
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        slots[slot] = i + 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+int strtab_init(struct strtab_t *strings) {
+
+    memset(strings, 0, sizeof(*strings));
+
+    // the empty string is reference 0 of both
+    if (grow((void**)&strings->names, &strings->names_cap, 1, 1) == STATUS_ERROR ||
+        grow((void**)&strings->addresses, &strings->address_cap, 1, sizeof(uint32_t)) == STATUS_ERROR ||
+        grow((void**)&strings->address_text, &strings->address_text_cap, 1, 1) == STATUS_ERROR ||
+        rehash(strings, STRTAB_MIN_SLOTS) == STATUS_ERROR) {
+        strtab_free(strings);
+        return STATUS_ERROR;
+    }
+
+    strings->names[0] = '\0';
+    strings->names_len = 1;
+    strings->addresses[0] = 0;
+    strings->address_count = 1;
+    strings->address_text[0] = '\0';
+    strings->address_len = 1;
+    strings->live = strtab_size(strings);
+    return STATUS_SUCCESS;
+}
+
+// takes over buffers read from a file, checking every string is terminated
+int strtab_load(struct strtab_t *strings, char *names, uint32_t namesLen, uint32_t *addresses, uint32_t addressCount, char *addressText, uint32_t addressLen) {
+
+    memset(strings, 0, sizeof(*strings));
+    strings->names = names;
+    strings->names_len = strings->names_cap = namesLen;
+    strings->addresses = addresses;
+    strings->address_count = strings->address_cap = addressCount;
+    strings->address_text = addressText;
+    strings->address_len = strings->address_text_cap = addressLen;
+
+    if (namesLen == 0 || names[0] != '\0' || names[namesLen - 1] != '\0' ||
+        addressCount == 0 || addresses[0] != 0 ||
+        addressLen == 0 || addressText[0] != '\0' || addressText[addressLen - 1] != '\0') {
+        printf("Corrupt string table\n");
+        strtab_free(strings);
+        return STATUS_ERROR;
+    }
+
+    // addresses are appended, so offsets only grow, and each one follows a terminator
+    uint32_t i = 0;
+    for (i = 1; i < addressCount; i++) {
+        if (addresses[i] <= addresses[i - 1] || addresses[i] >= addressLen || addressText[addresses[i] - 1] != '\0') {
+            printf("Corrupt string table\n");
+            strtab_free(strings);
+            return STATUS_ERROR;
+        }
+    }
+
+    uint32_t slotCount = STRTAB_MIN_SLOTS;
+    while (slotCount < (uint64_t)addressCount * 2) {
+        slotCount *= 2;
+    }
+    if (rehash(strings, slotCount) == STATUS_ERROR) {
+        strtab_free(strings);
+        return STATUS_ERROR;
+    }
+
+    strings->live = strtab_size(strings);
+    return STATUS_SUCCESS;
+}
+
+void strtab_free(struct strtab_t *strings) {
+    free(strings->names);
+    free(strings->addresses);
+    free(strings->address_text);
+    free(strings->slots);
+    memset(strings, 0, sizeof(*strings));
+}
+
+uint64_t strtab_size(struct strtab_t *strings) {
+    return (uint64_t)strings->names_len + (uint64_t)strings->address_count * sizeof(uint32_t) + strings->address_len;
+}
+
+// edits and removals leave their old names behind until the text is rebuilt
+bool strtab_wasteful(struct strtab_t *strings) {
+    return strtab_size(strings) > strings->live * 2 + STRTAB_COMPACT_MIN;
+}
+
+int strtab_add_name(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut) {
+
+    if (len == 0) {
+        *refOut = 0;
+        return STATUS_SUCCESS;
+    }
+
+    if (grow((void**)&strings->names, &strings->names_cap, (uint64_t)strings->names_len + len + 1, 1) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    *refOut = strings->names_len;
+    memcpy(strings->names + strings->names_len, text, len);
+    strings->names[strings->names_len + len] = '\0';
+    strings->names_len += len + 1;
+    return STATUS_SUCCESS;
+}
+
+bool strtab_find_address(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut) {
+
+    if (len == 0) {
+        *refOut = 0;
+        return true;
+    }
+
+    uint32_t slot = slot_for(strings, text, len);
+    while (strings->slots[slot] != 0) {
+        uint32_t ref = strings->slots[slot] - 1;
+        const char *candidate = strings->address_text + strings->addresses[ref];
+        if (strncmp(candidate, text, len) == 0 && candidate[len] == '\0') {
+            *refOut = ref;
+            return true;
+        }
+        slot = (slot + 1) & (strings->slot_count - 1);
+    }
+
+    return false;
+}
+
+int strtab_intern_address(struct strtab_t *strings, const char *text, size_t len, uint32_t *refOut) {
+
+    if (strtab_find_address(strings, text, len, refOut)) {
+        return STATUS_SUCCESS;
+    }
+
+    if ((uint64_t)(strings->address_count + 1) * 2 > strings->slot_count) {
+        if (strings->slot_count > UINT32_MAX / 2 || rehash(strings, strings->slot_count * 2) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (grow((void**)&strings->addresses, &strings->address_cap, (uint64_t)strings->address_count + 1, sizeof(uint32_t)) == STATUS_ERROR ||
+        grow((void**)&strings->address_text, &strings->address_text_cap, (uint64_t)strings->address_len + len + 1, 1) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    uint32_t ref = strings->address_count++;
+    strings->addresses[ref] = strings->address_len;
+    memcpy(strings->address_text + strings->address_len, text, len);
+    strings->address_text[strings->address_len + len] = '\0';
+    strings->address_len += len + 1;
+
+    uint32_t slot = slot_for(strings, text, len);
+    while (strings->slots[slot] != 0) {
+        slot = (slot + 1) & (strings->slot_count - 1);
+    }
+    strings->slots[slot] = ref + 1;
+
+    *refOut = ref;
+    return STATUS_SUCCESS;
+}
+
+// a name reference has to point at the start of a string in the arena
+bool strtab_valid_name(struct strtab_t *strings, uint32_t ref) {
+    return ref < strings->names_len && (ref == 0 || strings->names[ref - 1] == '\0');
+}
+
+const char *strtab_name(struct strtab_t *strings, uint32_t ref) {
+    return strings->names + ref;
+}
+
+const char *strtab_address(struct strtab_t *strings, uint32_t ref) {
+    return strings->address_text + strings->addresses[ref];
+}
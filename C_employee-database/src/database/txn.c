@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "txn.h"
+#include "db_poll.h"
+#include "replication.h"
+#include "database.h"
+#include "common.h"
+#include "parse.h"
+
+struct txn_event_t {
+    db_protocol_change_enum change;
+    db_protocol_list_resp record;
+    bool reset;
+};
+
+// change events of a commit in progress, only passed on once it succeeded
+struct txn_events_t {
+    struct txn_event_t *events;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+int txn_begin(ClientState_t *client) {
+
+    if (client->txn != NULL) {
+        printf("Transaction already in progress\n");
+        return STATUS_ERROR;
+    }
+
+    client->txn_cap = BUFFER_SIZE;
+    client->txn = malloc(client->txn_cap);
+    if (client->txn == NULL) {
+        perror("malloc");
+        return STATUS_ERROR;
+    }
+
+    client->txn_len = 0;
+    client->txn_count = 0;
+    return STATUS_SUCCESS;
+}
+
+// frames are kept with the header in host order, as handle_client_fsm decoded it
+int txn_stage(ClientState_t *client, db_protocol_header_t *header) {
+
+    if (client->txn_count >= TXN_MAX_REQUESTS) {
+        printf("Transaction is limited to %d requests\n", TXN_MAX_REQUESTS);
+        return STATUS_ERROR;
+    }
+
+    size_t size = sizeof(db_protocol_header_t) + request_payload_size(header->type);
+    if (client->txn_len + size > client->txn_cap) {
+        size_t cap = client->txn_cap * 2;
+        while (cap < client->txn_len + size) cap *= 2;
+
+        uint8_t *txn = realloc(client->txn, cap);
+        if (txn == NULL) {
+            perror("realloc");
+            return STATUS_ERROR;
+        }
+        client->txn = txn;
+        client->txn_cap = cap;
+    }
+
+    memcpy(client->txn + client->txn_len, header, size);
+    client->txn_len += size;
+    client->txn_count++;
+    return STATUS_SUCCESS;
+}
+
+void txn_drop_client(ClientState_t *client) {
+    free(client->txn);
+    client->txn = NULL;
+    client->txn_len = 0;
+    client->txn_cap = 0;
+    client->txn_count = 0;
+}
+
+static void collect_event(void *context, db_protocol_change_enum change, db_protocol_list_resp *record) {
+
+    struct txn_events_t *events = context;
+
+    if (events->count == events->capacity) {
+        uint64_t capacity = events->capacity == 0 ? 16 : events->capacity * 2;
+        struct txn_event_t *grown = realloc(events->events, capacity * sizeof(struct txn_event_t));
+        if (grown == NULL) {
+            perror("realloc");
+            return;
+        }
+        events->events = grown;
+        events->capacity = capacity;
+    }
+
+    struct txn_event_t *event = &events->events[events->count++];
+    event->change = change;
+    event->reset = record == NULL;
+    if (record != NULL) {
+        event->record = *record;
+    }
+}
+
+static int save_shard(struct database_t *db, struct database_undo_t *undo, struct shard_t *shard) {
+    if (shard == NULL) {
+        return STATUS_SUCCESS;
+    }
+    return database_undo_save(db, undo, shard - db->shards);
+}
+
+// copies every shard the request can change before it is applied
+static int save_touched(struct database_t *db, struct database_undo_t *undo, db_protocol_header_t *request) {
+
+    unsigned int id = ntohl(((db_protocol_id_req*)&request[1])->id);
+
+    switch (request->type) {
+        case MSG_EMPLOYEE_ADD_REQ:
+            return save_shard(db, undo, database_route(db, db->next_id + 1, false));
+        case MSG_EMPLOYEE_ADD_HRS_REQ:
+        case MSG_EMPLOYEE_EDIT_REQ:
+        case MSG_EMPLOYEE_DEL_ID_REQ:
+            return save_shard(db, undo, database_route(db, id, false));
+        default:
+            break;
+    }
+
+    // removals by name can reach any shard
+    int i=0;
+    for (i=0;i<db->count;i++) {
+        if (database_undo_save(db, undo, i) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// applies the staged requests in order. the first one that fails, or a cas request whose version
+// no longer matches, rolls all of them back. nothing else runs until the commit returns
+int txn_commit(struct database_t *db, struct replication_t *repl, ClientState_t *client, db_protocol_txn_resp *result) {
+
+    memset(result, 0, sizeof(*result));
+    result->count = client->txn_count;
+
+    struct database_undo_t undo;
+    if (database_undo_begin(db, &undo) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    // replicas get the plain form of each request, cas ones without their version check
+    uint8_t *replicated = malloc(client->txn_len + 1);
+    if (replicated == NULL) {
+        perror("malloc");
+        database_undo_free(&undo);
+        return STATUS_ERROR;
+    }
+    size_t replicated_len = 0;
+
+    struct txn_events_t events = {0};
+    void (*on_change)(void *context, db_protocol_change_enum change, db_protocol_list_resp *record) = db->on_change;
+    void *change_context = db->change_context;
+    db->on_change = collect_event;
+    db->change_context = &events;
+
+    int status = STATUS_SUCCESS;
+    size_t offset = 0;
+    uint32_t i=0;
+    for (i=0;i<client->txn_count && status == STATUS_SUCCESS;i++) {
+        db_protocol_header_t *frame = (db_protocol_header_t*)(client->txn + offset);
+        offset += sizeof(db_protocol_header_t) + request_payload_size(frame->type);
+
+        char request[BUFFER_SIZE];
+        db_protocol_header_t *plain = (db_protocol_header_t*)request;
+
+        if (is_cas_request(frame->type)) {
+            struct employee_t *employee = cas_target(db, frame);
+            if (employee == NULL || employee->version != ntohl(((db_protocol_cas_req*)&frame[1])->version)) {
+                printf("Transaction request %u no longer matches its version\n", i + 1);
+                status = STATUS_ERROR;
+            } else {
+                cas_plain_request(frame, plain);
+            }
+        } else {
+            memcpy(request, frame, sizeof(db_protocol_header_t) + request_payload_size(frame->type));
+        }
+
+        if (status == STATUS_SUCCESS) {
+            size_t size = sizeof(db_protocol_header_t) + request_payload_size(plain->type);
+            memcpy(replicated + replicated_len, plain, size);
+            replicated_len += size;
+            status = save_touched(db, &undo, plain);
+        }
+        if (status == STATUS_SUCCESS) {
+            status = apply_write_request(db, plain);
+        }
+
+        if (status == STATUS_ERROR) {
+            result->failed = i + 1;
+        }
+    }
+
+    db->on_change = on_change;
+    db->change_context = change_context;
+
+    if (status == STATUS_ERROR) {
+        printf("Rolling back transaction of %u requests\n", client->txn_count);
+        database_undo_restore(db, &undo);
+    } else {
+        uint64_t j=0;
+        for (j=0;j<events.count && on_change != NULL;j++) {
+            on_change(change_context, events.events[j].change, events.events[j].reset ? NULL : &events.events[j].record);
+        }
+
+        for (offset=0;offset<replicated_len;) {
+            db_protocol_header_t *frame = (db_protocol_header_t*)(replicated + offset);
+            replication_queue(repl, frame);
+            offset += sizeof(db_protocol_header_t) + request_payload_size(frame->type);
+        }
+
+        // every shard the transaction touched is written once
+        database_persist(db);
+        result->committed = 1;
+        printf("Committed transaction of %u requests\n", client->txn_count);
+    }
+
+    free(events.events);
+    free(replicated);
+    database_undo_free(&undo);
+    txn_drop_client(client);
+    return STATUS_SUCCESS;
+}
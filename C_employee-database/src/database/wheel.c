@@ -0,0 +1,101 @@
+#include <string.h>
+#include <time.h>
+
+#include "wheel.h"
+
+uint64_t wheel_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void wheel_init(struct wheel_t *wheel) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick = wheel_now_ms() / WHEEL_TICK_MS;
+}
+
+void wheel_cancel(struct wheel_t *wheel, struct wheel_timer_t *timer) {
+
+    if (!timer->scheduled) {
+        return;
+    }
+
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[(timer->expires / WHEEL_TICK_MS) % WHEEL_SLOTS] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->scheduled = 0;
+    wheel->active--;
+}
+
+// rescheduling moves the timer, a deadline already past fires on the next advance
+void wheel_schedule(struct wheel_t *wheel, struct wheel_timer_t *timer, uint64_t expires) {
+
+    wheel_cancel(wheel, timer);
+
+    if (expires / WHEEL_TICK_MS < wheel->tick) {
+        expires = wheel->tick * WHEEL_TICK_MS;
+    }
+
+    struct wheel_timer_t **slot = &wheel->slots[(expires / WHEEL_TICK_MS) % WHEEL_SLOTS];
+    timer->expires = expires;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->scheduled = 1;
+    wheel->active++;
+}
+
+// how long poll may wait for the next tick, -1 with nothing scheduled
+int wheel_timeout(struct wheel_t *wheel) {
+
+    if (wheel->active == 0) {
+        return -1;
+    }
+
+    uint64_t now = wheel_now_ms();
+    uint64_t next = (wheel->tick + 1) * WHEEL_TICK_MS;
+    return next > now ? (int)(next - now) : 0;
+}
+
+static void fire_slot(struct wheel_t *wheel, uint64_t tick, uint64_t now, void (*fire)(struct wheel_timer_t *timer, void *context), void *context) {
+
+    struct wheel_timer_t *timer = wheel->slots[tick % WHEEL_SLOTS];
+    while (timer != NULL) {
+        struct wheel_timer_t *next = timer->next;
+        if (timer->expires <= now) {
+            wheel_cancel(wheel, timer);
+            fire(timer, context);
+        }
+        timer = next;
+    }
+}
+
+// fires every timer that is due. the current tick's slot is checked again on the next call,
+// it can still receive timers for later in the tick
+void wheel_advance(struct wheel_t *wheel, void (*fire)(struct wheel_timer_t *timer, void *context), void *context) {
+
+    uint64_t now = wheel_now_ms();
+    uint64_t target = now / WHEEL_TICK_MS;
+
+    // after a long stall every slot is visited once
+    if (target - wheel->tick > WHEEL_SLOTS) {
+        wheel->tick = target - WHEEL_SLOTS;
+    }
+
+    while (wheel->tick < target) {
+        fire_slot(wheel, wheel->tick, now, fire, context);
+        wheel->tick++;
+    }
+    fire_slot(wheel, target, now, fire, context);
+}
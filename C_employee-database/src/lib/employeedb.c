@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "employeedb.h"
+#include "database.h"
+#include "common.h"
+
+_Static_assert(sizeof(((struct employeedb_record_t*)0)->name) == EMPLOYEE_TEXT_MAX, "names fit the record");
+_Static_assert(EMPLOYEEDB_NAME == FIELD_NAME && EMPLOYEEDB_ADDRESS == FIELD_ADDRESS && EMPLOYEEDB_HOURS == FIELD_HOURS, "edit fields match the protocol");
+
+// reads can build indexes and caches, so every call takes the one lock
+struct employeedb_t {
+    struct database_t db;
+    pthread_mutex_t lock;
+    char *directory;
+};
+
+int employeedb_open(const char *filepath, const char *directory, const char *spec, bool create, struct employeedb_t **dbOut) {
+
+    if (filepath == NULL && directory == NULL) {
+        printf("A database file or shard directory is required\n");
+        return STATUS_ERROR;
+    }
+
+    struct employeedb_t *db = calloc(1, sizeof(struct employeedb_t));
+    if (db == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    // the database keeps the directory for the shard paths it adds later
+    if (directory != NULL) {
+        db->directory = strdup(directory);
+        if (db->directory == NULL) {
+            perror("strdup");
+            free(db);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (database_init(&db->db, (char*)filepath, db->directory, (char*)spec, create) == STATUS_ERROR ||
+        database_load(&db->db) == STATUS_ERROR) {
+        printf("Error trying to open the database\n");
+        database_close(&db->db);
+        free(db->directory);
+        free(db);
+        return STATUS_ERROR;
+    }
+
+    pthread_mutex_init(&db->lock, NULL);
+    *dbOut = db;
+    return STATUS_SUCCESS;
+}
+
+int employeedb_close(struct employeedb_t *db) {
+
+    if (db == NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    int status = employeedb_sync(db);
+    database_close(&db->db);
+    pthread_mutex_destroy(&db->lock);
+    free(db->directory);
+    free(db);
+    return status;
+}
+
+int employeedb_sync(struct employeedb_t *db) {
+    pthread_mutex_lock(&db->lock);
+    int status = database_persist(&db->db);
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
+
+uint64_t employeedb_count(struct employeedb_t *db) {
+    pthread_mutex_lock(&db->lock);
+    uint64_t count = database_count(&db->db);
+    pthread_mutex_unlock(&db->lock);
+    return count;
+}
+
+// stored records refer to their text, callers get it copied in
+static void copy_record(struct strtab_t *strings, struct employee_t *employee, struct employeedb_record_t *record) {
+    record->id = employee->id;
+    strncpy(record->name, strtab_name(strings, employee->name), sizeof(record->name) - 1);
+    record->name[sizeof(record->name) - 1] = '\0';
+    strncpy(record->address, strtab_address(strings, employee->address), sizeof(record->address) - 1);
+    record->address[sizeof(record->address) - 1] = '\0';
+    record->hours = employee->hours;
+    record->version = employee->version;
+    record->updated = employee->updated;
+}
+
+int employeedb_get(struct employeedb_t *db, unsigned int id, struct employeedb_record_t *recordOut) {
+
+    pthread_mutex_lock(&db->lock);
+    struct employee_t *employee = database_find(&db->db, id);
+    if (employee != NULL) {
+        copy_record(&database_route(&db->db, id, false)->strings, employee, recordOut);
+    }
+    pthread_mutex_unlock(&db->lock);
+
+    return employee != NULL ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+// shard by shard, in the order records are stored
+int employeedb_scan(struct employeedb_t *db, employeedb_scan_fn callback, void *context) {
+
+    pthread_mutex_lock(&db->lock);
+
+    struct employeedb_record_t record;
+    int stop = 0;
+    int i=0;
+    for (i=0;i<db->db.count && stop == 0;i++) {
+        struct shard_t *shard = &db->db.shards[i];
+        uint64_t j=0;
+        for (j=0;j<shard->header->count && stop == 0;j++) {
+            copy_record(&shard->strings, &shard->employees[j], &record);
+            stop = callback(context, &record);
+        }
+    }
+
+    pthread_mutex_unlock(&db->lock);
+    return STATUS_SUCCESS;
+}
+
+static void text_fields(struct employee_fields_t *fields, const char *name, const char *address) {
+    if (name != NULL) {
+        fields->name = name;
+        fields->name_len = strlen(name);
+    }
+    if (address != NULL) {
+        fields->address = address;
+        fields->address_len = strlen(address);
+    }
+}
+
+int employeedb_add(struct employeedb_t *db, const char *name, const char *address, unsigned int hours, unsigned int *idOut) {
+
+    if (name == NULL || address == NULL) {
+        printf("Employees need a name and an address\n");
+        return STATUS_ERROR;
+    }
+
+    struct employee_fields_t fields = {0};
+    fields.fields = FIELD_ALL;
+    fields.hours = hours;
+    text_fields(&fields, name, address);
+
+    pthread_mutex_lock(&db->lock);
+    int status = database_add(&db->db, &fields);
+    if (status == STATUS_SUCCESS && idOut != NULL) {
+        *idOut = (unsigned int)db->db.next_id;
+    }
+    pthread_mutex_unlock(&db->lock);
+
+    return status;
+}
+
+int employeedb_edit(struct employeedb_t *db, unsigned int id, unsigned int fields, const char *name, const char *address, unsigned int hours) {
+
+    if ((fields & ~FIELD_ALL) != 0 || ((fields & FIELD_NAME) && name == NULL) || ((fields & FIELD_ADDRESS) && address == NULL)) {
+        printf("Bad employee edit\n");
+        return STATUS_ERROR;
+    }
+
+    struct employee_fields_t edit = {0};
+    edit.id = id;
+    edit.fields = fields;
+    edit.hours = hours;
+    text_fields(&edit, fields & FIELD_NAME ? name : NULL, fields & FIELD_ADDRESS ? address : NULL);
+
+    pthread_mutex_lock(&db->lock);
+    // database_edit quietly succeeds for an id that is not there
+    int status = database_find(&db->db, id) != NULL ? database_edit(&db->db, &edit) : STATUS_ERROR;
+    pthread_mutex_unlock(&db->lock);
+
+    return status;
+}
+
+int employeedb_add_hours(struct employeedb_t *db, unsigned int id, unsigned int hours) {
+    pthread_mutex_lock(&db->lock);
+    int status = database_add_hours(&db->db, id, hours);
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
+
+int employeedb_delete(struct employeedb_t *db, unsigned int id) {
+    pthread_mutex_lock(&db->lock);
+    int status = database_remove_id(&db->db, id);
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
+
+int employeedb_hours(struct employeedb_t *db, unsigned int id, uint64_t from, uint64_t to, uint64_t *hoursOut) {
+    pthread_mutex_lock(&db->lock);
+    int status = database_hours(&db->db, id, from, to, hoursOut);
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
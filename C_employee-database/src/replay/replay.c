@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "common.h"
+#include "db_poll.h"
+#include "capture.h"
+#include "lz.h"
+
+// one captured request, replayed once by the worker that owns its connection
+struct request_t {
+    uint64_t offset_us;
+    uint32_t conn;
+    uint32_t len;
+    db_protocol_type_enum type;
+    uint8_t *frame;
+    // filled in by the replay, latency is -1 for requests that were not sent
+    double latency_us;
+    bool failed;
+};
+
+struct trace_t {
+    uint16_t protocol;
+    uint8_t *raw;
+    struct request_t *requests;
+    uint64_t count;
+    // connection ids run from 1 to conns
+    uint32_t conns;
+    uint64_t *last;
+    bool *skipped;
+};
+
+static uint64_t monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int read_all(int fd, void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t bytes_read = read(fd, (char*)buffer + done, size - done);
+        if (bytes_read <= 0) {
+            return STATUS_ERROR;
+        }
+        done += bytes_read;
+    }
+    return STATUS_SUCCESS;
+}
+
+static int skip_all(int fd, size_t size) {
+    char scratch[BUFFER_SIZE];
+    while (size > 0) {
+        size_t chunk = size < sizeof(scratch) ? size : sizeof(scratch);
+        if (read_all(fd, scratch, chunk) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        size -= chunk;
+    }
+    return STATUS_SUCCESS;
+}
+
+// feeds, replicas and shared memory need more than a request and its reply
+static bool subscribes(db_protocol_type_enum type) {
+    return type == MSG_SUBSCRIBE_REQ || type == MSG_REPL_SUBSCRIBE_REQ;
+}
+
+static const char *request_name(db_protocol_type_enum type) {
+    switch (type) {
+        case MSG_HELLO_REQ: return "hello";
+        case MSG_EMPLOYEE_LIST_REQ: return "list";
+        case MSG_EMPLOYEE_ADD_REQ: return "add";
+        case MSG_EMPLOYEE_ADD_HRS_REQ: return "add hours";
+        case MSG_EMPLOYEE_DEL_REQ: return "remove name";
+        case MSG_EMPLOYEE_DEL_ID_REQ: return "remove id";
+        case MSG_EMPLOYEE_EDIT_REQ: return "edit";
+        case MSG_REPL_PROMOTE_REQ: return "promote";
+        case MSG_STATUS_REQ: return "status";
+        case MSG_EMPLOYEE_RANGE_REQ: return "range";
+        case MSG_EMPLOYEE_SEARCH_REQ: return "search";
+        case MSG_EMPLOYEE_PAGE_REQ: return "page";
+        case MSG_EMPLOYEE_EDIT_CAS_REQ: return "edit cas";
+        case MSG_EMPLOYEE_ADD_HRS_CAS_REQ: return "add hours cas";
+        case MSG_TXN_BEGIN_REQ: return "begin";
+        case MSG_TXN_COMMIT_REQ: return "commit";
+        case MSG_TXN_ABORT_REQ: return "abort";
+        case MSG_HOURS_SUM_REQ: return "hours sum";
+        case MSG_HOURS_TOP_REQ: return "hours top";
+        default: return "other";
+    }
+}
+
+// decodes every block into one buffer, the requests point into it
+static int load_trace(char *path, struct trace_t *trace) {
+
+    memset(trace, 0, sizeof(*trace));
+
+    int fd = open(path, O_RDONLY);
+    struct stat fileStat;
+    if (fd == -1 || fstat(fd, &fileStat) == -1) {
+        perror("open");
+        if (fd != -1) {
+            close(fd);
+        }
+        return STATUS_ERROR;
+    }
+
+    size_t size = fileStat.st_size;
+    uint8_t *file = malloc(size + 1);
+    if (file == NULL || read_all(fd, file, size) == STATUS_ERROR) {
+        printf("Error reading the trace\n");
+        free(file);
+        close(fd);
+        return STATUS_ERROR;
+    }
+    close(fd);
+
+    capture_file_header *header = (capture_file_header*)file;
+    if (size < sizeof(*header) || ntohl(header->magic) != CAPTURE_MAGIC || ntohs(header->version) != CAPTURE_VERSION) {
+        printf("Not a dbserver trace: %s\n", path);
+        free(file);
+        return STATUS_ERROR;
+    }
+    trace->protocol = ntohs(header->protocol);
+
+    // the first pass sizes the decoded trace, a torn block at the end is left out
+    size_t end = sizeof(*header);
+    size_t rawSize = 0;
+    while (end + sizeof(db_protocol_frame) <= size) {
+        // blocks follow each other at any offset, so headers are copied out
+        db_protocol_frame frame;
+        memcpy(&frame, file + end, sizeof(frame));
+        size_t next = end + sizeof(db_protocol_frame) + ntohl(frame.compressed_len);
+        if (next > size) {
+            break;
+        }
+        rawSize += ntohl(frame.raw_len);
+        end = next;
+    }
+
+    trace->raw = malloc(rawSize + 1);
+    if (trace->raw == NULL) {
+        perror("malloc");
+        free(file);
+        return STATUS_ERROR;
+    }
+
+    size_t in = sizeof(*header);
+    size_t out = 0;
+    while (in < end) {
+        db_protocol_frame frame;
+        memcpy(&frame, file + in, sizeof(frame));
+        frame.raw_len = ntohl(frame.raw_len);
+        frame.compressed_len = ntohl(frame.compressed_len);
+        if (lz_decompress_frame(&frame, file + in + sizeof(db_protocol_frame), trace->raw + out, rawSize - out) == STATUS_ERROR) {
+            printf("Corrupted block in the trace\n");
+            free(file);
+            return STATUS_ERROR;
+        }
+        in += sizeof(db_protocol_frame) + frame.compressed_len;
+        out += frame.raw_len;
+    }
+    free(file);
+
+    uint64_t capacity = 0;
+    size_t offset = 0;
+    while (offset + sizeof(capture_record) <= rawSize) {
+        capture_record record;
+        memcpy(&record, trace->raw + offset, sizeof(record));
+        uint32_t len = ntohl(record.len);
+        if (len < sizeof(db_protocol_header_t) || offset + sizeof(capture_record) + len > rawSize) {
+            printf("Corrupted record in the trace\n");
+            return STATUS_ERROR;
+        }
+
+        if (trace->count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 1024;
+            struct request_t *grown = realloc(trace->requests, capacity * sizeof(struct request_t));
+            if (grown == NULL) {
+                perror("realloc");
+                return STATUS_ERROR;
+            }
+            trace->requests = grown;
+        }
+
+        struct request_t *request = &trace->requests[trace->count++];
+        request->offset_us = be64toh(record.offset_us);
+        request->conn = ntohl(record.conn);
+        request->len = len;
+        request->frame = trace->raw + offset + sizeof(capture_record);
+        db_protocol_header_t frameHeader;
+        memcpy(&frameHeader, request->frame, sizeof(frameHeader));
+        request->type = ntohl(frameHeader.type);
+        request->latency_us = -1;
+        request->failed = false;
+
+        if (request->conn > trace->conns) {
+            trace->conns = request->conn;
+        }
+        offset += sizeof(capture_record) + len;
+    }
+
+    trace->last = calloc(trace->conns + 1, sizeof(uint64_t));
+    trace->skipped = calloc(trace->conns + 1, sizeof(bool));
+    if (trace->last == NULL || trace->skipped == NULL) {
+        perror("calloc");
+        return STATUS_ERROR;
+    }
+
+    uint64_t i=0;
+    for (i=0;i<trace->count;i++) {
+        trace->last[trace->requests[i].conn] = i;
+        if (subscribes(trace->requests[i].type)) {
+            trace->skipped[trace->requests[i].conn] = true;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void free_trace(struct trace_t *trace) {
+    free(trace->raw);
+    free(trace->requests);
+    free(trace->last);
+    free(trace->skipped);
+}
+
+// reads a whole reply, whatever its type. failed is set for MSG_ERROR
+static int recv_reply(int fd, uint16_t *features, bool *failed) {
+
+    db_protocol_header_t header;
+    if (read_all(fd, &header, sizeof(header)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    header.type = ntohl(header.type);
+    header.len = ntohl(header.len);
+    *failed = header.type == MSG_ERROR;
+
+    switch (header.type) {
+        case MSG_HELLO_RESP: {
+            db_protocol_hello hello;
+            if (read_all(fd, &hello, sizeof(hello)) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+            *features = ntohs(hello.features);
+            return STATUS_SUCCESS;
+        }
+        case MSG_ERROR:
+            return header.len == 1 ? skip_all(fd, sizeof(db_protocol_error)) : STATUS_SUCCESS;
+        case MSG_EMPLOYEE_LIST_RESP:
+        case MSG_EMPLOYEE_PAGE_RESP:
+        case MSG_EMPLOYEE_RANGE_RESP:
+        case MSG_EMPLOYEE_SEARCH_RESP:
+            break;
+        case MSG_STATUS_RESP:
+            return skip_all(fd, sizeof(db_protocol_status_resp));
+        case MSG_EMPLOYEE_EDIT_CAS_RESP:
+        case MSG_EMPLOYEE_ADD_HRS_CAS_RESP:
+            return skip_all(fd, sizeof(db_protocol_cas_resp));
+        case MSG_TXN_COMMIT_RESP:
+            return skip_all(fd, sizeof(db_protocol_txn_resp));
+        case MSG_HOURS_SUM_RESP:
+        case MSG_HOURS_TOP_RESP:
+            return skip_all(fd, (size_t)header.len * sizeof(db_protocol_hours_total));
+        default:
+            return STATUS_SUCCESS;
+    }
+
+    size_t len = (size_t)header.len * sizeof(db_protocol_list_resp);
+    if (!(*features & FEATURE_COMPRESSION)) {
+        return skip_all(fd, len);
+    }
+
+    // frames are passed over, the replay only times them
+    size_t done = 0;
+    while (done < len) {
+        db_protocol_frame frame;
+        if (read_all(fd, &frame, sizeof(frame)) == STATUS_ERROR || skip_all(fd, ntohl(frame.compressed_len)) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        done += ntohl(frame.raw_len);
+    }
+    return STATUS_SUCCESS;
+}
+
+// connections are spread over the workers by id, each one replays its requests in trace order
+struct worker_t {
+    pthread_t thread;
+    struct trace_t *trace;
+    unsigned int index;
+    unsigned int workers;
+    struct sockaddr_in server;
+    char *socket_path;
+    bool timed;
+    uint64_t start_us;
+
+    uint64_t replayed;
+    uint64_t lost;
+};
+
+static int replay_connect(struct worker_t *worker) {
+
+    struct sockaddr_un local = {0};
+    local.sun_family = AF_UNIX;
+    if (worker->socket_path != NULL) {
+        strncpy(local.sun_path, worker->socket_path, sizeof(local.sun_path) - 1);
+    }
+
+    int fd = socket(worker->socket_path != NULL ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    int connected = worker->socket_path != NULL ?
+        connect(fd, (struct sockaddr*)&local, sizeof(local)) :
+        connect(fd, (struct sockaddr*)&worker->server, sizeof(worker->server));
+    if (connected == STATUS_ERROR) {
+        perror("connect");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    if (worker->socket_path == NULL) {
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return fd;
+}
+
+// a connection is opened at its first request and closed after its last. one the server
+// closed early has the rest of its requests dropped
+static void *run_worker(void *arg) {
+    struct worker_t *worker = arg;
+    struct trace_t *trace = worker->trace;
+
+    int *fds = malloc((trace->conns + 1) * sizeof(int));
+    uint16_t *features = calloc(trace->conns + 1, sizeof(uint16_t));
+    if (fds == NULL || features == NULL) {
+        perror("malloc");
+        free(fds);
+        free(features);
+        return NULL;
+    }
+
+    uint32_t c=0;
+    for (c=0;c<=trace->conns;c++) {
+        fds[c] = -1;
+    }
+
+    uint64_t i=0;
+    for (i=0;i<trace->count;i++) {
+        struct request_t *request = &trace->requests[i];
+        uint32_t conn = request->conn;
+        if (conn % worker->workers != worker->index || trace->skipped[conn] || fds[conn] == -2 || request->type == MSG_SHM_ATTACH_REQ) {
+            continue;
+        }
+
+        if (fds[conn] == -1 && (fds[conn] = replay_connect(worker)) == STATUS_ERROR) {
+            fds[conn] = -2;
+            worker->lost++;
+            continue;
+        }
+
+        if (worker->timed) {
+            uint64_t now = monotonic_us();
+            if (worker->start_us + request->offset_us > now) {
+                usleep(worker->start_us + request->offset_us - now);
+            }
+        }
+
+        uint64_t start = monotonic_us();
+        if (write(fds[conn], request->frame, request->len) != (ssize_t)request->len ||
+            recv_reply(fds[conn], &features[conn], &request->failed) == STATUS_ERROR) {
+            printf("Server closed connection %u\n", conn);
+            close(fds[conn]);
+            fds[conn] = -2;
+            worker->lost++;
+            continue;
+        }
+        request->latency_us = (double)(monotonic_us() - start);
+        worker->replayed++;
+
+        if (i == trace->last[conn]) {
+            close(fds[conn]);
+            fds[conn] = -2;
+        }
+    }
+
+    for (c=0;c<=trace->conns;c++) {
+        if (fds[c] >= 0) {
+            close(fds[c]);
+        }
+    }
+    free(fds);
+    free(features);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right;
+}
+
+// latencies of the replayed requests of one type, or of all of them for type -1
+static void print_latencies(struct trace_t *trace, int type, double *latencies) {
+
+    uint64_t count = 0;
+    uint64_t failed = 0;
+    uint64_t i=0;
+    for (i=0;i<trace->count;i++) {
+        struct request_t *request = &trace->requests[i];
+        if (request->latency_us >= 0 && (type == -1 || (int)request->type == type)) {
+            latencies[count++] = request->latency_us;
+            failed += request->failed;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+
+    qsort(latencies, count, sizeof(double), compare_latency);
+    printf("%-14s %9lu %7lu %10.1f %10.1f %10.1f\n", type == -1 ? "all" : request_name(type), count, failed,
+        latencies[count / 2], latencies[(size_t)(count * 0.99)], latencies[count - 1]);
+}
+
+void print_usage(char *argv[]) {
+	printf("Usage: %s -h HOST -p PORT | -U PATH -f TRACE [-c connections] [-r]\n", argv[0]);
+	printf("  -h  -  (required) host to connect to\n");
+	printf("  -p  -  (required) port to connect to\n");
+	printf("  -U  -  connect over the server's unix socket instead\n");
+	printf("  -f  -  (required) trace recorded with dbserver -C\n");
+	printf("  -c  -  threads the traced connections are spread over, default 1 replays them in trace order\n");
+	printf("  -r  -  send each request at its original time instead of as fast as possible\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    char *hostarg = NULL;
+    char *socketPath = NULL;
+    char *tracePath = NULL;
+    unsigned short port = 0;
+    unsigned int workerCount = 1;
+    bool timed = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:f:h:p:rU:")) != -1) {
+        switch(c) {
+            case 'c':
+                workerCount = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                tracePath = optarg;
+                break;
+            case 'h':
+                hostarg = optarg;
+                break;
+            case 'p':
+                port = (unsigned short)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                timed = true;
+                break;
+            case 'U':
+                socketPath = optarg;
+                break;
+            default:
+                print_usage(argv);
+                return STATUS_ERROR;
+        }
+    }
+
+    if (tracePath == NULL || (socketPath == NULL && (hostarg == NULL || port == 0)) || workerCount == 0) {
+        print_usage(argv);
+        return STATUS_ERROR;
+    }
+
+    struct trace_t trace;
+    if (load_trace(tracePath, &trace) == STATUS_ERROR) {
+        free_trace(&trace);
+        return STATUS_ERROR;
+    }
+
+    // the requests are replayed byte for byte, so both ends have to speak the same protocol
+    if (trace.protocol != PROTOCOL_VER) {
+        printf("Trace was captured with protocol %u, this replay speaks %u\n", trace.protocol, PROTOCOL_VER);
+        free_trace(&trace);
+        return STATUS_ERROR;
+    }
+
+    uint32_t skipped = 0;
+    uint32_t conn = 0;
+    for (conn=1;conn<=trace.conns;conn++) {
+        skipped += trace.skipped[conn];
+    }
+    printf("Replaying %lu requests on %u connections, %u subscriber connections skipped\n", trace.count, trace.conns, skipped);
+
+    struct sockaddr_in serverInfo = {0};
+    serverInfo.sin_family = AF_INET;
+    serverInfo.sin_addr.s_addr = inet_addr(hostarg != NULL ? hostarg : "127.0.0.1");
+    serverInfo.sin_port = htons(port);
+
+    struct worker_t *workers = calloc(workerCount, sizeof(struct worker_t));
+    double *latencies = malloc((trace.count + 1) * sizeof(double));
+    if (workers == NULL || latencies == NULL) {
+        perror("calloc");
+        free(workers);
+        free(latencies);
+        free_trace(&trace);
+        return STATUS_ERROR;
+    }
+
+    uint64_t start = monotonic_us();
+    unsigned int i=0;
+    for (i=0;i<workerCount;i++) {
+        workers[i].trace = &trace;
+        workers[i].index = i;
+        workers[i].workers = workerCount;
+        workers[i].server = serverInfo;
+        workers[i].socket_path = socketPath;
+        workers[i].timed = timed;
+        workers[i].start_us = start;
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("pthread_create");
+            workerCount = i;
+            break;
+        }
+    }
+
+    uint64_t replayed = 0;
+    uint64_t lost = 0;
+    for (i=0;i<workerCount;i++) {
+        pthread_join(workers[i].thread, NULL);
+        replayed += workers[i].replayed;
+        lost += workers[i].lost;
+    }
+    double seconds = (monotonic_us() - start) / 1e6;
+
+    uint64_t captured = trace.count > 0 ? trace.requests[trace.count - 1].offset_us : 0;
+    printf("%lu requests in %.3f s, %.0f requests/s. captured over %.3f s\n", replayed, seconds, replayed / seconds, captured / 1e6);
+    if (lost > 0) {
+        printf("%lu connections could not be replayed to the end\n", lost);
+    }
+
+    printf("%-14s %9s %7s %10s %10s %10s\n", "request", "count", "errors", "p50 us", "p99 us", "max us");
+    int type = 0;
+    for (type=MSG_HELLO_REQ;type<=MSG_HOURS_TOP_RESP;type++) {
+        print_latencies(&trace, type, latencies);
+    }
+    print_latencies(&trace, -1, latencies);
+
+    free(latencies);
+    free(workers);
+    free_trace(&trace);
+    return lost > 0 ? STATUS_ERROR : STATUS_SUCCESS;
+}
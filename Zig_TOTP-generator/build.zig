@@ -28,6 +28,8 @@ pub fn build(b: *std.Build) void {
         .root_module = exe_mod,
     });
 
+    vault_mod.addImport("totp", totp_mod);
+
     exe.root_module.addImport("vault", vault_mod);
     exe.root_module.addImport("totp", totp_mod);
     b.installArtifact(exe);
@@ -46,7 +48,37 @@ pub fn build(b: *std.Build) void {
         .root_module = exe_mod,
     });
 
+    const totp_unit_tests = b.addTest(.{
+        .root_module = totp_mod,
+    });
+
     const run_exe_unit_tests = b.addRunArtifact(exe_unit_tests);
+    const run_totp_unit_tests = b.addRunArtifact(totp_unit_tests);
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(&run_exe_unit_tests.step);
+    test_step.dependOn(&run_totp_unit_tests.step);
+
+    // numbers from a debug build mean nothing, so the benchmark is always built for speed
+    const bench_totp_mod = b.createModule(.{
+        .root_source_file = b.path("src/totp.zig"),
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    const bench_mod = b.createModule(.{
+        .root_source_file = b.path("src/bench.zig"),
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    const bench = b.addExecutable(.{
+        .name = "bench",
+        .root_module = bench_mod,
+    });
+
+    bench.root_module.addImport("totp", bench_totp_mod);
+
+    const run_bench = b.addRunArtifact(bench);
+    const bench_step = b.step("bench", "Measure list codes per second with and without cached keys");
+    bench_step.dependOn(&run_bench.step);
 }
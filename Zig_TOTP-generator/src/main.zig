@@ -10,6 +10,9 @@ const Action = enum {
     Unknown,
 };
 
+const PERIOD: i64 = 30;
+const DIGITS: u32 = 6;
+
 const Error = error {
     UnknownAction,
     MissingArguments,
@@ -61,20 +64,22 @@ pub fn main() !void {
             const name = name_arg orelse exitError(Error.MissingArguments, cmd, true);
             const secret = vlt.get(name).?;
 
-            const period: i64 = 30;
-            const digits: u32 = 6;
-            const otp = totp.generateTOTP(secret, period, digits) catch |err| {exitError(err, cmd, false);};
+            const otp = totp.generateTOTP(secret, PERIOD, DIGITS) catch |err| {exitError(err, cmd, false);};
             try stdout.print("{s}: {d}\n", .{name, otp});
         },
         Action.List => {
-            var iter = vlt.keyIterator();
-            while (iter.next()) |key| {
-                const value = vlt.get(key.*).?;
-                const period: i64 = 30;
-                const digits: u32 = 6;
-                const otp = totp.generateTOTP(value, period, digits) catch |err| {exitError(err, cmd, false);};
-                try stdout.print("{s}: {d}\n", .{key.*, otp});
+            const accounts = vault.readKeys(vlt, allocator) catch |err| {exitError(err, cmd, false);};
+            defer vault.cleanKeys(accounts, allocator);
+
+            // one counter for the whole list, every code comes from the same period
+            const counter = totp.counterAt(std.time.timestamp(), PERIOD);
+
+            var buffered = std.io.bufferedWriter(stdout);
+            const writer = buffered.writer();
+            for (accounts) |account| {
+                try writer.print("{s}: {d}\n", .{account.name, account.key.code(counter, DIGITS)});
             }
+            try buffered.flush();
         },
         Action.Unknown => {
             exitError(Error.UnknownAction, cmd, true);
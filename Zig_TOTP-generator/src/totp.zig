@@ -1,5 +1,5 @@
 const std = @import("std");
-const hmac = std.crypto.auth.hmac;
+const Sha1 = std.crypto.hash.Sha1;
 
 const BASE32 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
 
@@ -7,6 +7,19 @@ pub const decode_error = error {
     NotBase32Character,
 };
 
+// value of every byte as a base32 character in either case, PAD for = and INVALID for anything else
+const PAD = 0xFE;
+const INVALID = 0xFF;
+const BASE32_TABLE: [256]u8 = blk: {
+    var table = [_]u8{INVALID} ** 256;
+    for (BASE32, 0..) |char, i| {
+        table[char] = i;
+        table[std.ascii.toLower(char)] = i;
+    }
+    table['='] = PAD;
+    break :blk table;
+};
+
 pub fn validate(secret: []const u8) bool {
 
     // if any char that is not found on BASE32 or is not =
@@ -33,94 +46,95 @@ pub fn validate(secret: []const u8) bool {
     return true;
 }
 
-fn upper(text: []const u8, allocator: std.mem.Allocator) ![]u8 {
-    var buffer: []u8 = try allocator.alloc(u8, text.len);
-    for (0..text.len) |i| {
-        var uppercase_char: u8 = text[i];
-
-        if (text[i] >= 'a' and text[i] <= 'z') {
-            uppercase_char -= 32;
+// a secret decoded once, as the SHA1 states HMAC reaches after hashing the key xor ipad and
+// xor opad. a code then only needs one compression for the inner hash and one for the outer
+pub const Key = struct {
+    inner: Sha1,
+    outer: Sha1,
+
+    pub fn init(secret: []const u8) decode_error!Key {
+
+        // the decoded secret is the HMAC key: zero padded to a block, or hashed first when longer
+        var block = [_]u8{0} ** Sha1.block_length;
+        var long_key = Sha1.init(.{});
+        var key_len: usize = 0;
+        defer std.crypto.secureZero(u8, &block);
+        defer std.crypto.secureZero(u8, std.mem.asBytes(&long_key));
+
+        // every character adds 5 bits, a byte comes out whenever 8 are waiting
+        var bits: u32 = 0;
+        var bit_count: u8 = 0;
+        for (secret) |char| {
+            const value = BASE32_TABLE[char];
+            if (value == PAD) break;
+            if (value == INVALID) return decode_error.NotBase32Character;
+
+            bits = (bits << 5) | value;
+            bit_count += 5;
+            if (bit_count < 8) continue;
+
+            bit_count -= 8;
+            const byte: u8 = @truncate(bits >> @intCast(bit_count));
+            if (key_len < block.len) block[key_len] = byte;
+            long_key.update(&[_]u8{byte});
+            key_len += 1;
         }
 
-        buffer[i] = uppercase_char;
-    }
-    return buffer;
-}
+        if (key_len > block.len) {
+            long_key.final(block[0..Sha1.digest_length]);
+            @memset(block[Sha1.digest_length..], 0);
+        }
 
-fn base32Index(char: u8) !u8 {
-    if (char == '=') return 0;
+        var pad: [Sha1.block_length]u8 = undefined;
+        defer std.crypto.secureZero(u8, &pad);
 
-    for (0..31) |i| {
-        if (char == BASE32[i]) return @intCast(i);
-    }
+        var key: Key = undefined;
+        for (&pad, block) |*out, byte| out.* = byte ^ 0x36;
+        key.inner = Sha1.init(.{});
+        key.inner.update(&pad);
 
-    return decode_error.NotBase32Character;
-}
+        for (&pad, block) |*out, byte| out.* = byte ^ 0x5c;
+        key.outer = Sha1.init(.{});
+        key.outer.update(&pad);
 
-fn decode(secret: []const u8, allocator: std.mem.Allocator) ![]u8 {
-    const uppercase_secret = try upper(secret, allocator);
-    defer allocator.free(uppercase_secret);
-
-    const decoded_len = (secret.len*5)/8;
-    var buffer: []u8 = try allocator.alloc(u8, decoded_len);
-    @memset(buffer, 32);
-
-    var in_idx: usize = 0;
-    var out_idx: usize = 0;
-
-    while (in_idx < uppercase_secret.len) : (in_idx += 8) {
-
-        const in_byte1 = try base32Index(uppercase_secret[in_idx]);
-        const in_byte2 = try base32Index(uppercase_secret[in_idx+1]);
-        const in_byte3 = try base32Index(uppercase_secret[in_idx+2]);
-        const in_byte4 = try base32Index(uppercase_secret[in_idx+3]);
-        const in_byte5 = try base32Index(uppercase_secret[in_idx+4]);
-        const in_byte6 = try base32Index(uppercase_secret[in_idx+5]);
-        const in_byte7 = try base32Index(uppercase_secret[in_idx+6]);
-        const in_byte8 = try base32Index(uppercase_secret[in_idx+7]);
-
-        const out_byte1 = (in_byte1 << 3) | (in_byte2 >> 2);
-        const out_byte2 = (in_byte2 << 6) | (in_byte3 << 1) | (in_byte4 >> 4);
-        const out_byte3 = (in_byte4 << 4) | (in_byte5 >> 1);
-        const out_byte4 = (in_byte5 << 7) | (in_byte6 << 2) | (in_byte7 >> 3);
-        const out_byte5 = (in_byte7 << 5) | (in_byte8);
-
-        buffer[out_idx]   = out_byte1;
-        buffer[out_idx+1] = out_byte2;
-        buffer[out_idx+2] = out_byte3;
-        buffer[out_idx+3] = out_byte4;
-        buffer[out_idx+4] = out_byte5;
-
-        out_idx += 5;
+        return key;
     }
 
-    return buffer;
+    pub fn code(self: *const Key, counter: u64, digits: u32) u32 {
 
-}
+        var msg: [8]u8 = undefined;
+        std.mem.writeInt(u64, &msg, counter, std.builtin.Endian.big);
 
-pub fn generateTOTP(secret: []const u8, period: i64, digits: u32) !u32 {
-    var gpa = std.heap.GeneralPurposeAllocator(.{}){}; 
-    const allocator = gpa.allocator();
+        var digest: [Sha1.digest_length]u8 = undefined;
+
+        var inner = self.inner;
+        inner.update(&msg);
+        inner.final(&digest);
 
-    const unix_time = std.time.timestamp();
-    const sequence_value = @divFloor(unix_time, period);
+        var outer = self.outer;
+        outer.update(&digest);
+        outer.final(&digest);
 
-    var msg: [8]u8 = undefined;
-    std.mem.writeInt(u64, &msg, @intCast(sequence_value), std.builtin.Endian.big);
+        const truncated_result = dynamicTruncate(&digest);
+        return truncated_result % std.math.pow(u32, 10, digits);
+    }
 
-    const decoded_secret = try decode(secret, allocator);
-    defer allocator.free(decoded_secret);
+    pub fn wipe(self: *Key) void {
+        std.crypto.secureZero(u8, std.mem.asBytes(self));
+    }
+};
 
-    var hmac_sha1 = hmac.HmacSha1.init(decoded_secret);
-    hmac_sha1.update(&msg);
+// the time step a moment falls in, the counter every code for that moment uses
+pub fn counterAt(unix_time: i64, period: i64) u64 {
+    return @intCast(@divFloor(unix_time, period));
+}
 
-    var result: [hmac.HmacSha1.mac_length]u8 = undefined;
-    hmac_sha1.final(&result);
+pub fn generateTOTP(secret: []const u8, period: i64, digits: u32) !u32 {
 
-    const truncated_result = dynamicTruncate(&result);
-    const output_digits = truncated_result % std.math.pow(u32, 10, digits);
+    var key = try Key.init(secret);
+    defer key.wipe();
 
-    return output_digits;
+    return key.code(counterAt(std.time.timestamp(), period), digits);
 }
 
 fn dynamicTruncate(string: []const u8) u32 {
@@ -135,3 +149,40 @@ fn dynamicTruncate(string: []const u8) u32 {
     const result_masked = bytes & 0x7FFFFFFF;
     return result_masked;
 }
+
+test "RFC 6238 SHA1 vectors" {
+
+    // "12345678901234567890" in base32
+    const key = try Key.init("GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ");
+    const lower_key = try Key.init("gezdgnbvgy3tqojqgezdgnbvgy3tqojq");
+
+    const times = [_]i64{ 59, 1111111109, 1111111111, 1234567890, 2000000000, 20000000000 };
+    const codes = [_]u32{ 94287082, 7081804, 14050471, 89005924, 69279037, 65353130 };
+
+    for (times, codes) |time, expected| {
+        try std.testing.expectEqual(expected, key.code(counterAt(time, 30), 8));
+        try std.testing.expectEqual(expected, lower_key.code(counterAt(time, 30), 8));
+    }
+}
+
+test "key matches std HMAC for short, padded and long secrets" {
+
+    const HmacSha1 = std.crypto.auth.hmac.HmacSha1;
+
+    const secrets = [_][]const u8{ "MFRGG===", "JBSWY3DPEHPK3PXP", "7777777777777777", "GEZDGNBVGY3TQOJQ" ** 8 };
+    const decoded = [_][]const u8{ "abc", "Hello!\xde\xad\xbe\xef", "\xff" ** 10, "1234567890" ** 8 };
+
+    for (secrets, decoded) |secret, raw| {
+        const key = try Key.init(secret);
+        for ([_]u64{ 0, 1, 0xdeadbeef }) |counter| {
+            var msg: [8]u8 = undefined;
+            std.mem.writeInt(u64, &msg, counter, std.builtin.Endian.big);
+
+            var mac: [HmacSha1.mac_length]u8 = undefined;
+            HmacSha1.create(&mac, &msg, raw);
+            try std.testing.expectEqual(dynamicTruncate(&mac) % 1000000, key.code(counter, 6));
+        }
+    }
+
+    try std.testing.expectError(decode_error.NotBase32Character, Key.init("JBSWY3DPEHPK3PX1"));
+}
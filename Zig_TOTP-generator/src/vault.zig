@@ -1,4 +1,10 @@
 const std = @import("std");
+const totp = @import("totp");
+
+pub const Account = struct {
+    name: []const u8,
+    key: totp.Key,
+};
 
 pub fn checkVault(dir: std.fs.Dir, filename: []const u8) !void {
     dir.access(filename, .{}) catch |err| {
@@ -101,6 +107,29 @@ pub fn cleanVault(vlt: std.StringHashMap([]const u8), name: ?[]const u8, allocat
     }
 }
 
+// decodes every secret once, codes for the whole vault then only cost the hashing
+pub fn readKeys(hmap: std.StringHashMap([]const u8), allocator: std.mem.Allocator) ![]Account {
+
+    const accounts = try allocator.alloc(Account, hmap.count());
+    var idx: usize = 0;
+    errdefer {
+        for (accounts[0..idx]) |*account| account.key.wipe();
+        allocator.free(accounts);
+    }
+
+    var iter = hmap.iterator();
+    while (iter.next()) |entry| : (idx += 1) {
+        accounts[idx] = .{ .name = entry.key_ptr.*, .key = try totp.Key.init(entry.value_ptr.*) };
+    }
+
+    return accounts;
+}
+
+pub fn cleanKeys(accounts: []Account, allocator: std.mem.Allocator) void {
+    for (accounts) |*account| account.key.wipe();
+    allocator.free(accounts);
+}
+
 test "write test" {
 
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
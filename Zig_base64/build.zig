@@ -0,0 +1,70 @@
+const std = @import("std");
+
+pub fn build(b: *std.Build) void {
+
+    const target = b.standardTargetOptions(.{});
+    const optimize = b.standardOptimizeOption(.{});
+
+    // the encoder itself, for other packages to import
+    const base64_mod = b.addModule("base64", .{
+        .root_source_file = b.path("src/base64.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+
+    const exe_mod = b.createModule(.{
+        .root_source_file = b.path("src/main.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+
+    const exe = b.addExecutable(.{
+        .name = "base64",
+        .root_module = exe_mod,
+    });
+
+    exe.root_module.addImport("base64", base64_mod);
+    b.installArtifact(exe);
+
+    const run_cmd = b.addRunArtifact(exe);
+    run_cmd.step.dependOn(b.getInstallStep());
+
+    if (b.args) |args| {
+        run_cmd.addArgs(args);
+    }
+
+    const run_step = b.step("run", "Run the app");
+    run_step.dependOn(&run_cmd.step);
+
+    const base64_unit_tests = b.addTest(.{
+        .root_module = base64_mod,
+    });
+
+    const run_base64_unit_tests = b.addRunArtifact(base64_unit_tests);
+    const test_step = b.step("test", "Run unit tests");
+    test_step.dependOn(&run_base64_unit_tests.step);
+
+    // numbers from a debug build mean nothing, so the benchmark is always built for speed
+    const bench_base64_mod = b.createModule(.{
+        .root_source_file = b.path("src/base64.zig"),
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    const bench_mod = b.createModule(.{
+        .root_source_file = b.path("src/bench.zig"),
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    const bench = b.addExecutable(.{
+        .name = "bench",
+        .root_module = bench_mod,
+    });
+
+    bench.root_module.addImport("base64", bench_base64_mod);
+
+    const run_bench = b.addRunArtifact(bench);
+    const bench_step = b.step("bench", "Measure throughput across input sizes and thread counts");
+    bench_step.dependOn(&run_bench.step);
+}
@@ -0,0 +1,428 @@
+const std = @import("std");
+
+// encoding and decoding into buffers owned by the caller, nothing here allocates.
+// the parallel versions split the work over a thread pool the caller also owns
+
+pub const Error = error {
+    DecodeError,
+    NotBase64Character
+};
+
+pub const ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// value of every byte as a base64 character, 64 for the = padding and INVALID for anything else
+const INVALID = 0xFF;
+const DECODE_TABLE: [256]u8 = blk: {
+    var table = [_]u8{INVALID} ** 256;
+    for (ALPHABET, 0..) |char, i| table[char] = i;
+    table['='] = 64;
+    break :blk table;
+};
+
+// the vector paths work on 16 groups at once, 48 bytes to 64 characters and back
+const SIMD_GROUPS = 16;
+const ENCODE_BLOCK = SIMD_GROUPS * 3;
+const DECODE_BLOCK = SIMD_GROUPS * 4;
+
+const ByteVector = @Vector(ENCODE_BLOCK, u8);
+const CharVector = @Vector(DECODE_BLOCK, u8);
+const WideVector = @Vector(DECODE_BLOCK, u16);
+
+// each character takes its bits from one byte, or straddles two. joining the byte that holds
+// its high bits with the one that holds its low bits into a u16 makes every lane one shift
+const ENCODE_HIGH = groupMask(DECODE_BLOCK, 4, 3, .{ 0, 0, 1, 2 });
+const ENCODE_LOW = groupMask(DECODE_BLOCK, 4, 3, .{ 0, 1, 2, 2 });
+const ENCODE_SHIFTS = groupShifts(u4, DECODE_BLOCK, 4, .{ 10, 4, 6, 0 });
+
+// and back: every byte is the high bits of one character followed by the low bits of the next
+const DECODE_HIGH = groupMask(ENCODE_BLOCK, 3, 4, .{ 0, 1, 2 });
+const DECODE_LOW = groupMask(ENCODE_BLOCK, 3, 4, .{ 1, 2, 3 });
+const DECODE_HIGH_SHIFTS = groupShifts(u3, ENCODE_BLOCK, 3, .{ 2, 4, 6 });
+const DECODE_LOW_SHIFTS = groupShifts(u3, ENCODE_BLOCK, 3, .{ 4, 2, 0 });
+
+// the parallel versions give every thread at least this much input, in at most MAX_PARTS pieces
+pub const MIN_PART = 64 * 1024;
+pub const MAX_PARTS = 64;
+
+// characters needed for len bytes, padding included
+pub fn encodedLen(len: usize) usize {
+    return (len + 2) / 3 * 4;
+}
+
+// bytes len characters decode to at most
+pub fn maxDecodedLen(len: usize) usize {
+    return (len + 3) / 4 * 3;
+}
+
+// encodes text into out, which needs encodedLen(text.len) bytes. a partial group at the end is padded with =
+pub fn encode(text: []const u8, out: []u8) usize {
+
+    var idx: usize = 0;
+    var out_idx: usize = 0;
+    while (idx + ENCODE_BLOCK <= text.len) : (idx += ENCODE_BLOCK) {
+        encodeBlock(text[idx..][0..ENCODE_BLOCK], out[out_idx..][0..DECODE_BLOCK]);
+        out_idx += DECODE_BLOCK;
+    }
+
+    return out_idx + encodeScalar(text[idx..], out[out_idx..]);
+}
+
+// one group at a time, for the tail the vector path leaves and as the bench baseline
+pub fn encodeScalar(text: []const u8, out: []u8) usize {
+
+    var idx: usize = 0;
+    var out_idx: usize = 0;
+    while (idx + 3 <= text.len) : (idx += 3) {
+        encodeGroup(text[idx], text[idx+1], text[idx+2], out[out_idx..][0..4]);
+        out_idx += 4;
+    }
+
+    // missing bytes are encoded as 0 and then overwritten with =
+    const rest = text.len - idx;
+    if (rest > 0) {
+        const byte2: u8 = if (rest > 1) text[idx+1] else 0;
+        encodeGroup(text[idx], byte2, 0, out[out_idx..][0..4]);
+        @memset(out[out_idx+rest+1 .. out_idx+4], '=');
+        out_idx += 4;
+    }
+
+    return out_idx;
+}
+
+fn encodeGroup(byte1: u8, byte2: u8, byte3: u8, out: *[4]u8) void {
+
+    // 0bXXXXXXYY 0bYYYYZZZZ 0bZZAAAAAA
+    // keep 6 XXXXXX
+    const outbyte1: u8 = byte1 >> 2;
+
+    // keep 2 YY from byte1, YYYY from byte 2. shift them into position and sum
+    var outbyte2: u8 = byte1 & 0b00000011;
+    outbyte2 = outbyte2 << 4;
+    outbyte2 = outbyte2 + ((byte2 & 0b11110000) >> 4);
+
+    // similar to outbyte2, ZZZZ from byte2, ZZ from byte3
+    var outbyte3: u8 = byte2 & 0b00001111;
+    outbyte3 = outbyte3 << 2;
+    outbyte3 =  outbyte3 + ((byte3 & 0b11000000) >> 6);
+
+    // siilar to outbyte1 but no shift needed
+    const outbyte4: u8 = byte3 & 0b00111111;
+
+    out[0] = ALPHABET[outbyte1];
+    out[1] = ALPHABET[outbyte2];
+    out[2] = ALPHABET[outbyte3];
+    out[3] = ALPHABET[outbyte4];
+}
+
+// 48 bytes to 64 characters, with no table lookups
+fn encodeBlock(text: *const [ENCODE_BLOCK]u8, out: *[DECODE_BLOCK]u8) void {
+
+    const bytes: ByteVector = text.*;
+
+    // 0bXXXXXXYY 0bYYYYZZZZ 0bZZAAAAAA, each character lands in the low 6 bits of (high << 8 | low) >> shift
+    const high: WideVector = @intCast(@shuffle(u8, bytes, undefined, ENCODE_HIGH));
+    const low: WideVector = @intCast(@shuffle(u8, bytes, undefined, ENCODE_LOW));
+    const joined = (high << @as(@Vector(DECODE_BLOCK, u4), @splat(8))) | low;
+    const values: CharVector = @truncate((joined >> ENCODE_SHIFTS) & @as(WideVector, @splat(0b00111111)));
+
+    // the alphabet is 5 ranges, each a fixed distance from its values
+    var offsets = @select(u8, values == splatChars(62), splatChars(@as(u8, '+') -% 62), splatChars(@as(u8, '/') -% 63));
+    offsets = @select(u8, values < splatChars(62), splatChars(@as(u8, '0') -% 52), offsets);
+    offsets = @select(u8, values < splatChars(52), splatChars('a' - 26), offsets);
+    offsets = @select(u8, values < splatChars(26), splatChars('A'), offsets);
+
+    out.* = values +% offsets;
+}
+
+// decodes groups of 4 characters into out, which needs maxDecodedLen(text.len) bytes. a group cut short
+// is read as if padded. once a padded group was seen nothing may follow it, padded carries that across calls
+pub fn decode(text: []const u8, out: []u8, padded: *bool) Error!usize {
+
+    var idx: usize = 0;
+    var out_idx: usize = 0;
+
+    // padding and bad characters stop the vector path, the scalar one then reports them
+    if (!padded.*) {
+        while (idx + DECODE_BLOCK <= text.len) : (idx += DECODE_BLOCK) {
+            if (!decodeBlock(text[idx..][0..DECODE_BLOCK], out[out_idx..][0..ENCODE_BLOCK])) break;
+            out_idx += ENCODE_BLOCK;
+        }
+    }
+
+    return out_idx + try decodeScalar(text[idx..], out[out_idx..], padded);
+}
+
+pub fn decodeScalar(text: []const u8, out: []u8, padded: *bool) Error!usize {
+
+    var idx: usize = 0;
+    var out_idx: usize = 0;
+    while (idx < text.len) : (idx += 4) {
+
+        if (padded.* or idx+1 >= text.len) return Error.DecodeError;
+
+        const aux2 = if (idx+2 >= text.len) '=' else text[idx+2];
+        const aux3 = if (idx+3 >= text.len) '=' else text[idx+3];
+
+        const byte1: u8 = try base64Index(text[idx]);
+        const byte2: u8 = try base64Index(text[idx+1]);
+        const byte3: u8 = try base64Index(aux2);
+        const byte4: u8 = try base64Index(aux3);
+
+        // = only pads the end of a group
+        if (byte1 == 64 or byte2 == 64 or (byte3 == 64 and byte4 != 64)) return Error.DecodeError;
+
+        out[out_idx] = (byte1 << 2) | (byte2 >> 4);
+        out_idx += 1;
+
+        if (byte3 == 64) { padded.* = true; continue; }
+        out[out_idx] = (byte2 << 4) | (byte3 >> 2);
+        out_idx += 1;
+
+        if (byte4 == 64) { padded.* = true; continue; }
+        out[out_idx] = (byte3 << 6) | byte4;
+        out_idx += 1;
+    }
+
+    return out_idx;
+}
+
+// 64 characters to 48 bytes, false without writing anything if one of them is not in the alphabet
+fn decodeBlock(text: *const [DECODE_BLOCK]u8, out: *[ENCODE_BLOCK]u8) bool {
+
+    const chars: CharVector = text.*;
+
+    // same ranges as the encoder, anything outside them stays INVALID
+    var values = @select(u8, chars == splatChars('/'), splatChars(63), splatChars(INVALID));
+    values = @select(u8, chars == splatChars('+'), splatChars(62), values);
+    values = @select(u8, chars -% splatChars('0') < splatChars(10), chars +% splatChars(52 - '0'), values);
+    values = @select(u8, chars -% splatChars('a') < splatChars(26), chars -% splatChars('a' - 26), values);
+    values = @select(u8, chars -% splatChars('A') < splatChars(26), chars -% splatChars('A'), values);
+
+    if (@reduce(.Max, values) >= 64) return false;
+
+    // every byte is the rest of one character followed by the start of the next
+    const high: ByteVector = @shuffle(u8, values, undefined, DECODE_HIGH);
+    const low: ByteVector = @shuffle(u8, values, undefined, DECODE_LOW);
+    out.* = (high << DECODE_HIGH_SHIFTS) | (low >> DECODE_LOW_SHIFTS);
+
+    return true;
+}
+
+fn base64Index(char: u8) Error!u8 {
+
+    const value = DECODE_TABLE[char];
+    if (value == INVALID) return Error.NotBase64Character;
+
+    return value;
+}
+
+// same output as encode. every part is a whole number of vector blocks except the last,
+// so each thread writes its own stretch of out and no part gets padding but the last
+pub fn encodeParallel(pool: *std.Thread.Pool, text: []const u8, out: []u8) usize {
+
+    const parts = partCount(pool, text.len);
+    if (parts == 1) return encode(text, out);
+
+    var wait_group: std.Thread.WaitGroup = .{};
+    for (0..parts) |i| {
+        const start = partStart(text.len, ENCODE_BLOCK, parts, i);
+        const end = partStart(text.len, ENCODE_BLOCK, parts, i + 1);
+        pool.spawnWg(&wait_group, encodePart, .{ text[start..end], out[start / 3 * 4 ..] });
+    }
+    wait_group.wait();
+
+    return encodedLen(text.len);
+}
+
+// same output and errors as decode. padding may only end the last part, a part
+// before it that saw some means data followed the padding
+pub fn decodeParallel(pool: *std.Thread.Pool, text: []const u8, out: []u8, padded: *bool) Error!usize {
+
+    const parts = partCount(pool, text.len);
+    if (parts == 1) return decode(text, out, padded);
+    if (padded.*) return Error.DecodeError;
+
+    var results = [_]PartResult{.{}} ** MAX_PARTS;
+    var wait_group: std.Thread.WaitGroup = .{};
+    for (0..parts) |i| {
+        const start = partStart(text.len, DECODE_BLOCK, parts, i);
+        const end = partStart(text.len, DECODE_BLOCK, parts, i + 1);
+        pool.spawnWg(&wait_group, decodePart, .{ text[start..end], out[start / 4 * 3 ..], &results[i] });
+    }
+    wait_group.wait();
+
+    for (results[0..parts], 0..) |result, i| {
+        if (result.err) |err| return err;
+        if (result.padded and i + 1 < parts) return Error.DecodeError;
+    }
+
+    const last = parts - 1;
+    padded.* = results[last].padded;
+    return partStart(text.len, DECODE_BLOCK, parts, last) / 4 * 3 + results[last].len;
+}
+
+const PartResult = struct {
+    len: usize = 0,
+    padded: bool = false,
+    err: ?Error = null
+};
+
+fn encodePart(text: []const u8, out: []u8) void {
+    _ = encode(text, out);
+}
+
+fn decodePart(text: []const u8, out: []u8, result: *PartResult) void {
+    result.len = decode(text, out, &result.padded) catch |err| {
+        result.err = err;
+        return;
+    };
+}
+
+fn partCount(pool: *std.Thread.Pool, len: usize) usize {
+    return @max(1, @min(@min(pool.threads.len, MAX_PARTS), len / MIN_PART));
+}
+
+// parts split the whole blocks evenly, the last one also takes the tail
+fn partStart(len: usize, block: usize, parts: usize, part: usize) usize {
+    if (part == parts) return len;
+    return len / block * part / parts * block;
+}
+
+fn splatChars(value: u8) CharVector {
+    return @splat(value);
+}
+
+// shuffle mask picking offsets[i] out of every group of width lanes, from groups stride apart
+fn groupMask(comptime len: usize, comptime width: usize, comptime stride: i32, comptime offsets: [width]i32) @Vector(len, i32) {
+
+    var mask: [len]i32 = undefined;
+    for (0..len) |i| {
+        const group: i32 = @intCast(i / width);
+        mask[i] = group * stride + offsets[i % width];
+    }
+
+    return mask;
+}
+
+fn groupShifts(comptime T: type, comptime len: usize, comptime width: usize, comptime shifts: [width]T) @Vector(len, T) {
+
+    var result: [len]T = undefined;
+    for (0..len) |i| result[i] = shifts[i % width];
+
+    return result;
+}
+
+fn randomBytes(buf: []u8) void {
+    var prng = std.Random.DefaultPrng.init(buf.len);
+    prng.random().bytes(buf);
+}
+
+test "encode matches std.base64" {
+
+    var text: [300]u8 = undefined;
+    var out: [400]u8 = undefined;
+    var expected: [400]u8 = undefined;
+
+    for (0..text.len + 1) |len| {
+        randomBytes(text[0..len]);
+        const want = std.base64.standard.Encoder.encode(&expected, text[0..len]);
+        try std.testing.expectEqualStrings(want, out[0..encode(text[0..len], &out)]);
+        try std.testing.expectEqualStrings(want, out[0..encodeScalar(text[0..len], &out)]);
+    }
+}
+
+test "decode round trips every length" {
+
+    var text: [300]u8 = undefined;
+    var encoded: [400]u8 = undefined;
+    var decoded: [300]u8 = undefined;
+
+    for (0..text.len + 1) |len| {
+        randomBytes(text[0..len]);
+        const encoded_len = encode(text[0..len], &encoded);
+        try std.testing.expectEqual(encodedLen(len), encoded_len);
+
+        var padded = false;
+        const decoded_len = try decode(encoded[0..encoded_len], &decoded, &padded);
+        try std.testing.expectEqualSlices(u8, text[0..len], decoded[0..decoded_len]);
+        try std.testing.expectEqual(len % 3 != 0, padded);
+
+        // missing padding reads the same as present padding
+        padded = false;
+        const unpadded = std.mem.trimRight(u8, encoded[0..encoded_len], "=");
+        const unpadded_len = try decode(unpadded, &decoded, &padded);
+        try std.testing.expectEqualSlices(u8, text[0..len], decoded[0..unpadded_len]);
+    }
+}
+
+test "decode rejects bad input in both paths" {
+
+    var text: [100]u8 = undefined;
+    var encoded: [136]u8 = undefined;
+    var decoded: [102]u8 = undefined;
+    randomBytes(&text);
+    _ = encode(&text, &encoded);
+
+    // positions inside the first vector block and inside the scalar tail
+    for ([_]usize{ 10, 130 }) |pos| {
+        var bad = encoded;
+        var padded = false;
+        bad[pos] = '*';
+        try std.testing.expectError(Error.NotBase64Character, decode(&bad, &decoded, &padded));
+
+        bad = encoded;
+        padded = false;
+        bad[pos - pos % 4] = '=';
+        try std.testing.expectError(Error.DecodeError, decode(&bad, &decoded, &padded));
+    }
+
+    // a single character is not a group, and nothing may follow padding
+    var padded = false;
+    try std.testing.expectError(Error.DecodeError, decode("QUJD=", &decoded, &padded));
+    padded = false;
+    try std.testing.expectEqual(@as(usize, 1), try decode("QQ==", &decoded, &padded));
+    try std.testing.expectError(Error.DecodeError, decode("QUJD", &decoded, &padded));
+    padded = false;
+    try std.testing.expectError(Error.NotBase64Character, decode("QU\nD", &decoded, &padded));
+    padded = false;
+    try std.testing.expectEqual(@as(usize, 3), try decode("ab/+", &decoded, &padded));
+}
+
+test "parallel matches sequential" {
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = std.testing.allocator, .n_jobs = 4 });
+    defer pool.deinit();
+
+    const allocator = std.testing.allocator;
+    const len = 8 * MIN_PART + 8;
+
+    const text = try allocator.alloc(u8, len);
+    defer allocator.free(text);
+    const expected = try allocator.alloc(u8, encodedLen(len));
+    defer allocator.free(expected);
+    const encoded = try allocator.alloc(u8, encodedLen(len));
+    defer allocator.free(encoded);
+    const decoded = try allocator.alloc(u8, maxDecodedLen(encoded.len));
+    defer allocator.free(decoded);
+
+    randomBytes(text);
+    _ = encode(text, expected);
+    try std.testing.expectEqual(encodedLen(len), encodeParallel(&pool, text, encoded));
+    try std.testing.expectEqualSlices(u8, expected, encoded);
+
+    var padded = false;
+    const decoded_len = try decodeParallel(&pool, encoded, decoded, &padded);
+    try std.testing.expectEqualSlices(u8, text, decoded[0..decoded_len]);
+    try std.testing.expect(padded);
+
+    // an error in any part is reported, and so is padding that does not end the input
+    padded = false;
+    encoded[encoded.len / 2] = '*';
+    try std.testing.expectError(Error.NotBase64Character, decodeParallel(&pool, encoded, decoded, &padded));
+
+    padded = false;
+    @memcpy(encoded, expected);
+    encoded[encoded.len / 2 - encoded.len / 2 % 4 + 3] = '=';
+    try std.testing.expectError(Error.DecodeError, decodeParallel(&pool, encoded, decoded, &padded));
+}
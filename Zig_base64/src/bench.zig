@@ -0,0 +1,113 @@
+const std = @import("std");
+const base64 = @import("base64");
+
+// throughput of the scalar, vector and threaded paths over a range of input sizes.
+// rates are in decoded bytes, the same amount of data for both directions
+
+const BENCH_SIZES = [_]usize{ 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+
+// small inputs are repeated until every measurement has moved at least this much
+const BENCH_TOTAL = 256 * 1024 * 1024;
+
+const Mode = enum {
+    Scalar,
+    Vector,
+    Parallel
+};
+
+const Rates = struct {
+    encode: f64,
+    decode: f64
+};
+
+pub fn main() !void {
+
+    const allocator = std.heap.page_allocator;
+    const largest = BENCH_SIZES[BENCH_SIZES.len - 1];
+
+    const input = try allocator.alloc(u8, largest);
+    defer allocator.free(input);
+    const encoded = try allocator.alloc(u8, base64.encodedLen(largest));
+    defer allocator.free(encoded);
+    const decoded = try allocator.alloc(u8, largest);
+    defer allocator.free(decoded);
+
+    var prng = std.Random.DefaultPrng.init(0x5eed);
+    prng.random().bytes(input);
+
+    var buffered = std.io.bufferedWriter(std.io.getStdOut().writer());
+    const stdout = buffered.writer();
+
+    const cpus = std.Thread.getCpuCount() catch 1;
+    try stdout.print("{s:>10} {s:>8} {s:>12} {s:>12}\n", .{ "size KiB", "threads", "encode GB/s", "decode GB/s" });
+
+    for (BENCH_SIZES) |size| {
+        const text = input[0..size];
+        try report(stdout, size, "scalar", try measure(Mode.Scalar, null, text, encoded, decoded));
+
+        // powers of two up to the cpu count, and the cpu count itself
+        var threads: usize = 1;
+        while (true) : (threads = @min(threads * 2, cpus)) {
+            var label_buf: [16]u8 = undefined;
+            const label = try std.fmt.bufPrint(&label_buf, "{d}", .{threads});
+
+            if (threads == 1) {
+                try report(stdout, size, label, try measure(Mode.Vector, null, text, encoded, decoded));
+            } else {
+                var pool: std.Thread.Pool = undefined;
+                try pool.init(.{ .allocator = allocator, .n_jobs = threads });
+                defer pool.deinit();
+                try report(stdout, size, label, try measure(Mode.Parallel, &pool, text, encoded, decoded));
+            }
+
+            if (threads >= cpus) break;
+        }
+
+        try buffered.flush();
+    }
+}
+
+// encodes and then decodes text as often as BENCH_TOTAL asks for, and checks the round trip
+fn measure(mode: Mode, pool: ?*std.Thread.Pool, text: []const u8, encoded: []u8, decoded: []u8) !Rates {
+
+    const rounds = @max(1, BENCH_TOTAL / text.len);
+    var encoded_len: usize = 0;
+    var decoded_len: usize = 0;
+
+    var timer = try std.time.Timer.start();
+    for (0..rounds) |_| {
+        encoded_len = switch (mode) {
+            Mode.Scalar => base64.encodeScalar(text, encoded),
+            Mode.Vector => base64.encode(text, encoded),
+            Mode.Parallel => base64.encodeParallel(pool.?, text, encoded),
+        };
+    }
+    const encode_ns = timer.lap();
+
+    for (0..rounds) |_| {
+        var padded = false;
+        const chars = encoded[0..encoded_len];
+        decoded_len = switch (mode) {
+            Mode.Scalar => try base64.decodeScalar(chars, decoded, &padded),
+            Mode.Vector => try base64.decode(chars, decoded, &padded),
+            Mode.Parallel => try base64.decodeParallel(pool.?, chars, decoded, &padded),
+        };
+    }
+    const decode_ns = timer.read();
+
+    if (!std.mem.eql(u8, text, decoded[0..decoded_len])) return error.RoundTripMismatch;
+
+    return Rates{
+        .encode = rate(text.len * rounds, encode_ns),
+        .decode = rate(text.len * rounds, decode_ns),
+    };
+}
+
+fn rate(bytes: usize, ns: u64) f64 {
+    const seconds = @as(f64, @floatFromInt(@max(ns, 1))) / std.time.ns_per_s;
+    return @as(f64, @floatFromInt(bytes)) / seconds / 1e9;
+}
+
+fn report(writer: anytype, size: usize, threads: []const u8, rates: Rates) !void {
+    try writer.print("{d:>10} {s:>8} {d:>12.2} {d:>12.2}\n", .{ size / 1024, threads, rates.encode, rates.decode });
+}
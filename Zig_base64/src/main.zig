@@ -0,0 +1,215 @@
+const std = @import("std");
+const base64 = @import("base64");
+
+const EncodeDecodeError = error { 
+    EncodeError,
+    DecodeError,
+    UnknownAction,
+    NotBase64Character,
+    FileError,
+    Other
+};
+
+const Action = enum {
+    Encode,
+    Decode,
+    Unknown
+};
+
+const ERROR_ENCODE = "Error: encoding failed";
+const ERROR_DECODE = "Error: decoding failed";
+const ERROR_ACTION = "Error: unknown action";
+const ERROR_OTHERS = "Unknown error ocurred";
+const ERROR_BASE64 = "Error: Input is not a base64 encoded string";
+const ERROR_FILE = "Error: could not open input file";
+const ERROR_JOBS = "Error: -j takes a number of threads";
+
+// input is read in chunks of this size per thread, a multiple of both 3 and 4 so a full chunk holds whole groups
+const STREAM_CHUNK = 3 * 4 * 16 * 1024;
+
+// the chunk buffers, and with -j the pool every chunk is split over
+const Coder = struct {
+    pool: ?*std.Thread.Pool,
+    in_buf: []u8,
+    out_buf: []u8
+};
+
+pub fn main() !void {
+
+    // read and validate cli arguments
+    var args = std.process.args();
+    const cmd = args.next().?;
+
+    const action = args.next();
+    if (action == null) {
+        printUsage(cmd);
+        return;
+    }
+
+    const action_value: Action = readAction(action.?);
+    if (action_value == Action.Unknown) {
+        handleError(EncodeDecodeError.UnknownAction);
+    }
+
+    var data = args.next();
+    if (data == null) {
+        printUsage(cmd);
+        return;
+    }
+
+    // "-j n" runs n threads, 0 for one per cpu
+    var jobs: usize = 1;
+    if (std.mem.eql(u8, data.?, "-j")) {
+        const count = args.next() orelse {
+            printUsage(cmd);
+            return;
+        };
+        jobs = std.fmt.parseInt(usize, count, 10) catch {
+            std.debug.print("{s}\n", .{ERROR_JOBS});
+            std.process.exit(1);
+        };
+        if (jobs == 0) jobs = std.Thread.getCpuCount() catch 1;
+
+        data = args.next();
+        if (data == null) {
+            printUsage(cmd);
+            return;
+        }
+    }
+
+    const allocator = std.heap.page_allocator;
+
+    var pool: std.Thread.Pool = undefined;
+    if (jobs > 1) pool.init(.{ .allocator = allocator, .n_jobs = jobs }) catch |err| handleError(err);
+    defer if (jobs > 1) pool.deinit();
+
+    // decoding keeps up to 3 characters of an unfinished group in front of the next chunk
+    const chunk = STREAM_CHUNK * jobs;
+    const in_buf = allocator.alloc(u8, chunk + 3) catch |err| handleError(err);
+    defer allocator.free(in_buf);
+    const out_buf = allocator.alloc(u8, base64.encodedLen(chunk)) catch |err| handleError(err);
+    defer allocator.free(out_buf);
+
+    const coder = Coder{ .pool = if (jobs > 1) &pool else null, .in_buf = in_buf, .out_buf = out_buf };
+
+    var buffered = std.io.bufferedWriter(std.io.getStdOut().writer());
+    const stdout = buffered.writer();
+
+    // "-" streams stdin, "-f path" streams a file, anything else is the data itself
+    if (std.mem.eql(u8, data.?, "-")) {
+        b64Stream(action_value, &coder, std.io.getStdIn().reader(), stdout) catch |err| handleError(err);
+    } else if (std.mem.eql(u8, data.?, "-f")) {
+        const path = args.next();
+        if (path == null) {
+            printUsage(cmd);
+            return;
+        }
+
+        const file = std.fs.cwd().openFile(path.?, .{}) catch handleError(EncodeDecodeError.FileError);
+        defer file.close();
+        b64Stream(action_value, &coder, file.reader(), stdout) catch |err| handleError(err);
+    } else {
+        const input: []const u8 = data.?;
+        var text = std.io.fixedBufferStream(input);
+        b64Stream(action_value, &coder, text.reader(), stdout) catch |err| handleError(err);
+        if (action_value == Action.Decode) {
+            stdout.writeByte('\n') catch |err| handleError(err);
+        }
+    }
+
+    buffered.flush() catch |err| handleError(err);
+}
+
+fn readAction (action: []const u8) Action {
+
+    if (std.mem.eql(u8, action, "encode")) { return Action.Encode; }
+    else if (std.mem.eql(u8, action, "decode")) { return Action.Decode; }
+
+    return Action.Unknown;
+
+}
+
+fn b64Stream(action: Action, coder: *const Coder, reader: anytype, writer: anytype) !void {
+
+    switch (action) {
+        Action.Encode => {
+            try encodeStream(coder, reader, writer);
+            try writer.writeByte('\n');
+        },
+        Action.Decode => {
+            try decodeStream(coder, reader, writer);
+        },
+        Action.Unknown => {
+            return EncodeDecodeError.UnknownAction;
+        }
+    }
+}
+
+// memory use is the two chunk buffers, whatever the size of the input
+fn encodeStream(coder: *const Coder, reader: anytype, writer: anytype) !void {
+
+    const chunk = coder.in_buf.len - 3;
+
+    while (true) {
+        // readAll only comes back short at the end, so only the last chunk gets padding
+        const read_len = try reader.readAll(coder.in_buf[0..chunk]);
+        const text = coder.in_buf[0..read_len];
+        const out_len = if (coder.pool) |pool| base64.encodeParallel(pool, text, coder.out_buf) else base64.encode(text, coder.out_buf);
+        try writer.writeAll(coder.out_buf[0..out_len]);
+
+        if (read_len < chunk) break;
+    }
+}
+
+fn decodeStream(coder: *const Coder, reader: anytype, writer: anytype) !void {
+
+    const chunk = coder.in_buf.len - 3;
+    const in_buf = coder.in_buf;
+    var carry: usize = 0;
+    var padded = false;
+
+    while (true) {
+        const read_len = try reader.readAll(in_buf[carry..][0..chunk]);
+
+        // line breaks are dropped so wrapped input decodes as well
+        var len: usize = carry;
+        for (in_buf[carry .. carry + read_len]) |char| {
+            if (char == '\n' or char == '\r') continue;
+            in_buf[len] = char;
+            len += 1;
+        }
+
+        const last = read_len < chunk;
+        const whole = if (last) len else len - len % 4;
+        const text = in_buf[0..whole];
+        const out_len = if (coder.pool) |pool| try base64.decodeParallel(pool, text, coder.out_buf, &padded) else try base64.decode(text, coder.out_buf, &padded);
+        try writer.writeAll(coder.out_buf[0..out_len]);
+
+        if (last) break;
+
+        carry = len - whole;
+        std.mem.copyForwards(u8, in_buf[0..carry], in_buf[whole..len]);
+    }
+}
+
+fn handleError(err: anyerror) noreturn {
+
+    var msg: []const u8 = undefined;
+
+    switch(err) {
+        EncodeDecodeError.EncodeError => { msg = ERROR_ENCODE; },
+        EncodeDecodeError.DecodeError => { msg = ERROR_DECODE; },
+        EncodeDecodeError.UnknownAction => { msg = ERROR_ACTION; },
+        EncodeDecodeError.NotBase64Character => { msg = ERROR_BASE64; },
+        EncodeDecodeError.FileError => { msg = ERROR_FILE; },
+        EncodeDecodeError.Other => { msg = ERROR_OTHERS; },
+        else => { msg = ERROR_OTHERS; },
+    }
+
+    std.debug.print("{s}\n", .{msg});
+    std.process.exit(1);
+}
+
+fn printUsage(cmd: []const u8) void {
+    std.debug.print("Usage: {s} [encode/decode] [-j threads] [data | - | -f path]\n", .{cmd});
+}